@@ -0,0 +1,39 @@
+# Generates a C++ source that embeds resource files as constexpr byte arrays.
+# Run in script mode:
+#   cmake -DOUTPUT=<file.cc> -DRESOURCE_ROOT=<dir> -DRESOURCES=<a;b;...> -P EmbedResources.cmake
+# Resources are named by their path relative to RESOURCE_ROOT.
+
+# CMake regular expressions have no repetition counts
+set(lineOfBytes "")
+foreach(i RANGE 1 16)
+    string(APPEND lineOfBytes "0x[0-9a-f][0-9a-f],")
+endforeach()
+
+set(declarations "")
+set(entries "")
+set(index 0)
+foreach(resource IN LISTS RESOURCES)
+    file(RELATIVE_PATH name "${RESOURCE_ROOT}" "${resource}")
+    file(READ "${resource}" hex HEX)
+    string(LENGTH "${hex}" hexLength)
+    math(EXPR size "${hexLength} / 2")
+    # 16 bytes per line
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+    string(REGEX REPLACE "(${lineOfBytes})" "\\1\n  " bytes "${bytes}")
+    if(size EQUAL 0)
+        set(bytes "0x00,")
+    endif()
+    string(APPEND declarations "constexpr unsigned char kResource${index}[] = {\n  ${bytes}\n};\n\n")
+    string(APPEND entries "  { \"${name}\", kResource${index}, ${size}, fnv1a64(kResource${index}, ${size}) },\n")
+    math(EXPR index "${index} + 1")
+endforeach()
+
+set(content "// Generated by cmake/EmbedResources.cmake, do not edit\n#include \"embedded_resources.h\"\n\nnamespace {\n\n${declarations}constexpr EmbeddedResource kResources[] = {\n${entries}};\n\n} // namespace\n\nconst EmbeddedResource* embeddedResources(size_t& count) {\n  count = sizeof(kResources) / sizeof(kResources[0]);\n  return kResources;\n}\n")
+
+# Only touch the output when it changes, to avoid needless rebuilds
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" previous)
+endif()
+if(NOT "${previous}" STREQUAL "${content}")
+    file(WRITE "${OUTPUT}" "${content}")
+endif()
@@ -1,25 +1,46 @@
-struct VertexInput {
-    @location(0) position: vec2f,
-    @location(1) color: vec3f,
-};
+// VertexInput and InstanceInput are generated from the C++ vertex structs
+// (see vertex_layout.h) and prepended when the module is loaded. The color
+// is a vec3f or a vec4f depending on the vertex layout.
+
+// Specialized per pipeline variant (see pipeline_cache.h)
+override aspect_ratio: f32 = 1.3333333;
+override mesh_offset_x: f32 = 0.0;
+override mesh_offset_y: f32 = 0.0;
+override fragment_srgb: bool = false;  // Decode sRGB per fragment, for comparison
+override encode_srgb: bool = false;    // The target is UNORM, its writes do not encode
 
 struct VertexOutput {
     @builtin(position) position: vec4f,
-    @location(0) color: vec3f,
+    @location(0) color: vec4f,
 };
 
 @vertex
-fn vs_main(in: VertexInput) -> VertexOutput {
-    let ratio = 640.0 / 480.0;
-    let offset = vec2f(-0.6875, -0.463);
+fn vs_main(in: VertexInput, instance: InstanceInput) -> VertexOutput {
+    let offset = vec2f(mesh_offset_x, mesh_offset_y);
+    let position = (in.position + offset) * instance.scale + instance.offset;
     var out: VertexOutput;
-    out.position = vec4f(in.position.x + offset.x, (in.position.y + offset.y) * ratio, 0.0, 1.0);
-    out.color = in.color; // forward to the fragment shader
+    out.position = vec4f(position.x, position.y * aspect_ratio, instance.depth, 1.0);
+    out.color = vec4f(in.color.rgb, instance.alpha); // forward to the fragment shader
     return out;
 }
 
+// Vertex colors are already in the color space of the render target, unless
+// fragment_srgb is set: they are decoded to linear here, and encoded again
+// for a UNORM target. The branches are resolved when the pipeline is created.
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f {
-    let linear_color = pow(in.color, vec3f(2.2));
-    return vec4f(linear_color, 1.0);
-}
\ No newline at end of file
+    if (fragment_srgb) {
+        let linear = pow(in.color.rgb, vec3f(2.2));
+        if (encode_srgb) {
+            return vec4f(pow(linear, vec3f(1.0 / 2.2)), in.color.a);
+        }
+        return vec4f(linear, in.color.a);
+    }
+    return in.color;
+}
+
+// Overdraw analysis: every shaded fragment adds one to an additive float target
+@fragment
+fn fs_overdraw() -> @location(0) vec4f {
+    return vec4f(1.0, 0.0, 0.0, 0.0);
+}
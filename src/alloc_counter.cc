@@ -0,0 +1,134 @@
+#include "alloc_counter.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+namespace {
+
+// Plain thread_local data, usable from operator new before anything else is initialized
+thread_local AllocationCounts t_counts;
+
+} // namespace
+
+#ifdef WEBGPU_THINGY_COUNT_ALLOCATIONS
+
+namespace {
+
+void* countedAllocate(size_t size, size_t alignment, bool nothrow) {
+  if (size == 0) {
+    size = 1;
+  }
+  for (;;) {
+    void* block = nullptr;
+    if (alignment <= alignof(std::max_align_t)) {
+      block = std::malloc(size);
+    } else {
+      // aligned_alloc wants a multiple of the alignment
+      block = std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+    }
+    if (block) {
+      ++t_counts.allocations;
+      t_counts.bytes += size;
+      return block;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      if (nothrow) {
+        return nullptr;
+      }
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void countedFree(void* block) {
+  if (block) {
+    ++t_counts.frees;
+    std::free(block);
+  }
+}
+
+} // namespace
+
+void* operator new(size_t size) { return countedAllocate(size, 0, false); }
+void* operator new[](size_t size) { return countedAllocate(size, 0, false); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size, 0, true); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size, 0, true); }
+void* operator new(size_t size, std::align_val_t alignment) { return countedAllocate(size, static_cast<size_t>(alignment), false); }
+void* operator new[](size_t size, std::align_val_t alignment) { return countedAllocate(size, static_cast<size_t>(alignment), false); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return countedAllocate(size, static_cast<size_t>(alignment), true);
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return countedAllocate(size, static_cast<size_t>(alignment), true);
+}
+
+void operator delete(void* block) noexcept { countedFree(block); }
+void operator delete[](void* block) noexcept { countedFree(block); }
+void operator delete(void* block, size_t) noexcept { countedFree(block); }
+void operator delete[](void* block, size_t) noexcept { countedFree(block); }
+void operator delete(void* block, const std::nothrow_t&) noexcept { countedFree(block); }
+void operator delete[](void* block, const std::nothrow_t&) noexcept { countedFree(block); }
+void operator delete(void* block, std::align_val_t) noexcept { countedFree(block); }
+void operator delete[](void* block, std::align_val_t) noexcept { countedFree(block); }
+void operator delete(void* block, size_t, std::align_val_t) noexcept { countedFree(block); }
+void operator delete[](void* block, size_t, std::align_val_t) noexcept { countedFree(block); }
+void operator delete(void* block, std::align_val_t, const std::nothrow_t&) noexcept { countedFree(block); }
+void operator delete[](void* block, std::align_val_t, const std::nothrow_t&) noexcept { countedFree(block); }
+
+bool allocationCountingEnabled() {
+  return true;
+}
+
+#else
+
+bool allocationCountingEnabled() {
+  return false;
+}
+
+#endif
+
+AllocationCounts AllocationCounts::operator+(const AllocationCounts& other) const {
+  AllocationCounts sum;
+  sum.allocations = allocations + other.allocations;
+  sum.frees = frees + other.frees;
+  sum.bytes = bytes + other.bytes;
+  return sum;
+}
+
+AllocationCounts AllocationCounts::operator-(const AllocationCounts& other) const {
+  AllocationCounts difference;
+  difference.allocations = allocations - other.allocations;
+  difference.frees = frees - other.frees;
+  difference.bytes = bytes - other.bytes;
+  return difference;
+}
+
+AllocationCounts threadAllocationCounts() {
+  return t_counts;
+}
+
+void FrameAllocationStats::record(const AllocationCounts& frame) {
+  ++frames;
+  if (frame.allocations > 0) {
+    ++framesWithAllocations;
+  }
+  allocations += frame.allocations;
+  bytes += frame.bytes;
+  maxAllocations = std::max(maxAllocations, frame.allocations);
+}
+
+void printFrameAllocationStats(const FrameAllocationStats& stats) {
+  if (!allocationCountingEnabled()) {
+    std::cout << "Heap allocations: not counted, build with COUNT_ALLOCATIONS" << std::endl;
+    return;
+  }
+  double frames = static_cast<double>(std::max<size_t>(stats.frames, 1));
+  std::cout << std::fixed << std::setprecision(2)
+            << "Heap allocations: " << stats.frames << " frames, " << stats.framesWithAllocations << " allocating, avg "
+            << static_cast<double>(stats.allocations) / frames << " (" << static_cast<double>(stats.bytes) / frames
+            << " bytes) per frame, max " << stats.maxAllocations << std::defaultfloat << std::endl;
+}
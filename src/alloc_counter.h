@@ -0,0 +1,37 @@
+#ifndef WEBGPU_THINGY_SRC_ALLOC_COUNTER_H_
+#define WEBGPU_THINGY_SRC_ALLOC_COUNTER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Heap allocations made through the global operator new, per thread. Only
+// counted in builds with COUNT_ALLOCATIONS, which replace operator new and
+// delete; otherwise every count stays 0. The wgpu-native backend allocates
+// with malloc from Rust and is not counted, Dawn allocates from C++ and is.
+
+struct AllocationCounts {
+  uint64_t allocations = 0;
+  uint64_t frees = 0;
+  uint64_t bytes = 0;  // Requested by the allocations
+
+  AllocationCounts operator+(const AllocationCounts& other) const;
+  AllocationCounts operator-(const AllocationCounts& other) const;
+};
+
+bool allocationCountingEnabled();
+// Since the calling thread started
+AllocationCounts threadAllocationCounts();
+
+struct FrameAllocationStats {
+  size_t frames = 0;
+  size_t framesWithAllocations = 0;
+  uint64_t allocations = 0;
+  uint64_t bytes = 0;
+  uint64_t maxAllocations = 0;  // In a single frame
+
+  void record(const AllocationCounts& frame);
+};
+
+void printFrameAllocationStats(const FrameAllocationStats& stats);
+
+#endif //WEBGPU_THINGY_SRC_ALLOC_COUNTER_H_
@@ -0,0 +1,263 @@
+#include "asset_pack.h"
+#include "embedded_resources.h"
+#include "lz4_codec.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+uint64_t hashName(std::string_view name) {
+  return fnv1a64(reinterpret_cast<const unsigned char*>(name.data()), name.size());
+}
+
+} // namespace
+
+AssetPack::~AssetPack() {
+  close();
+}
+
+void AssetPack::close() {
+#ifndef _WIN32
+  if (m_mapped) {
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+  }
+#endif
+  m_fileData.clear();
+  m_data = nullptr;
+  m_size = 0;
+  m_mapped = false;
+  m_entries = nullptr;
+  m_entryCount = 0;
+  m_names = nullptr;
+  m_decompressed.clear();
+}
+
+bool AssetPack::open(const std::filesystem::path& path) {
+  close();
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Could not open asset pack " << path.string() << std::endl;
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    void* mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      m_data = static_cast<const uint8_t*>(mapping);
+      m_size = static_cast<size_t>(info.st_size);
+      m_mapped = true;
+    }
+  }
+  ::close(fd);
+#endif
+  if (!m_data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+      std::cerr << "Could not open asset pack " << path.string() << std::endl;
+      return false;
+    }
+    m_fileData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    m_data = m_fileData.data();
+    m_size = m_fileData.size();
+  }
+
+  // Validate everything the accessors rely on once, up front
+  AssetPackHeader header;
+  bool valid = m_size >= sizeof(header);
+  if (valid) {
+    std::memcpy(&header, m_data, sizeof(header));
+    valid = std::memcmp(header.magic, kAssetPackMagic, sizeof(header.magic)) == 0 && header.version == kAssetPackVersion
+         && header.indexOffset % alignof(AssetPackEntry) == 0
+         && header.indexOffset <= m_size && header.entryCount <= (m_size - header.indexOffset) / sizeof(AssetPackEntry)
+         && header.namesOffset <= m_size;
+  }
+  if (valid) {
+    m_entries = reinterpret_cast<const AssetPackEntry*>(m_data + header.indexOffset);
+    m_entryCount = header.entryCount;
+    m_names = reinterpret_cast<const char*>(m_data + header.namesOffset);
+    for (size_t i = 0; i < m_entryCount && valid; ++i) {
+      const AssetPackEntry& entry = m_entries[i];
+      valid = entry.offset <= m_size && entry.storedSize <= m_size - entry.offset
+           && uint64_t(entry.nameOffset) + entry.nameLength <= m_size - header.namesOffset
+           && (i == 0 || m_entries[i - 1].nameHash <= entry.nameHash);
+      if (entry.codec == static_cast<uint32_t>(AssetCodec::None)) {
+        valid = valid && entry.storedSize == entry.size;
+      } else if (entry.codec == static_cast<uint32_t>(AssetCodec::Lz4)) {
+        valid = valid && entry.chunkCount == (entry.size + kAssetPackChunkSize - 1) / kAssetPackChunkSize
+             && uint64_t(entry.chunkCount) * sizeof(uint32_t) <= entry.storedSize;
+      } else {
+        valid = false;
+      }
+    }
+  }
+  if (!valid) {
+    std::cerr << "Invalid asset pack " << path.string() << std::endl;
+    close();
+    return false;
+  }
+  m_decompressed.resize(m_entryCount);
+  return true;
+}
+
+std::string_view AssetPack::entryName(size_t index) const {
+  const AssetPackEntry& entry = m_entries[index];
+  return std::string_view(m_names + entry.nameOffset, entry.nameLength);
+}
+
+const AssetPackEntry* AssetPack::find(const std::string& name) const {
+  uint64_t hash = hashName(name);
+  const AssetPackEntry* end = m_entries + m_entryCount;
+  const AssetPackEntry* it = std::lower_bound(m_entries, end, hash, [](const AssetPackEntry& entry, uint64_t value) {
+    return entry.nameHash < value;
+  });
+  for (; it != end && it->nameHash == hash; ++it) {
+    if (entryName(static_cast<size_t>(it - m_entries)) == name) return it;
+  }
+  return nullptr;
+}
+
+bool AssetPack::decompress(const AssetPackEntry& entry, std::string& output) const {
+  const uint8_t* payload = m_data + entry.offset;
+  std::vector<uint32_t> chunkSizes(entry.chunkCount);
+  if (entry.chunkCount > 0) {
+    std::memcpy(chunkSizes.data(), payload, entry.chunkCount * sizeof(uint32_t));
+  }
+  std::vector<uint64_t> chunkOffsets(entry.chunkCount);
+  uint64_t offset = entry.chunkCount * sizeof(uint32_t);
+  for (uint32_t i = 0; i < entry.chunkCount; ++i) {
+    chunkOffsets[i] = offset;
+    offset += chunkSizes[i];
+  }
+  if (offset > entry.storedSize) {
+    return false;
+  }
+
+  output.resize(entry.size);
+  auto decompressChunk = [&](uint32_t i) {
+    size_t first = size_t(i) * kAssetPackChunkSize;
+    size_t size = std::min<size_t>(kAssetPackChunkSize, entry.size - first);
+    return lz4Decompress(payload + chunkOffsets[i], chunkSizes[i], reinterpret_cast<uint8_t*>(&output[first]), size);
+  };
+
+  // Chunks are independent, large entries are spread over threads
+  size_t threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), entry.chunkCount);
+  std::vector<char> chunkOk(entry.chunkCount, 0);
+  auto worker = [&](size_t thread) {
+    for (size_t i = thread; i < entry.chunkCount; i += threadCount) {
+      chunkOk[i] = decompressChunk(static_cast<uint32_t>(i));
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < threadCount; ++t) {
+    threads.emplace_back(worker, t);
+  }
+  worker(0);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  return std::all_of(chunkOk.begin(), chunkOk.end(), [](char ok) { return ok != 0; });
+}
+
+bool AssetPack::read(const std::string& name, std::string_view& contents) {
+  const AssetPackEntry* entry = find(name);
+  if (!entry) {
+    return false;
+  }
+  if (entry->codec == static_cast<uint32_t>(AssetCodec::None)) {
+    contents = std::string_view(reinterpret_cast<const char*>(m_data + entry->offset), entry->size);
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::unique_ptr<std::string>& decompressed = m_decompressed[entry - m_entries];
+  if (!decompressed) {
+    auto output = std::make_unique<std::string>();
+    if (!decompress(*entry, *output)) {
+      std::cerr << "Corrupted asset pack entry " << name << std::endl;
+      return false;
+    }
+    decompressed = std::move(output);
+  }
+  contents = *decompressed;
+  return true;
+}
+
+bool writeAssetPack(const std::filesystem::path& path, const std::vector<AssetPackInput>& inputs, bool compress) {
+  struct Pending {
+    AssetPackEntry entry;
+    std::string payload;
+  };
+  std::vector<Pending> pending;
+  std::string names;
+  for (const AssetPackInput& input : inputs) {
+    Pending item = {};
+    item.entry.nameHash = hashName(input.name);
+    item.entry.nameOffset = static_cast<uint32_t>(names.size());
+    item.entry.nameLength = static_cast<uint32_t>(input.name.size());
+    item.entry.size = input.contents.size();
+    names += input.name;
+
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(input.contents.data());
+    uint32_t chunkCount = static_cast<uint32_t>((input.contents.size() + kAssetPackChunkSize - 1) / kAssetPackChunkSize);
+    std::string compressed(chunkCount * sizeof(uint32_t), '\0');
+    std::vector<uint8_t> chunk(lz4CompressBound(kAssetPackChunkSize));
+    for (uint32_t i = 0; compress && i < chunkCount; ++i) {
+      size_t first = size_t(i) * kAssetPackChunkSize;
+      size_t size = std::min(kAssetPackChunkSize, input.contents.size() - first);
+      uint32_t chunkSize = static_cast<uint32_t>(lz4Compress(source + first, size, chunk.data(), chunk.size()));
+      std::memcpy(&compressed[i * sizeof(uint32_t)], &chunkSize, sizeof(chunkSize));
+      compressed.append(reinterpret_cast<const char*>(chunk.data()), chunkSize);
+    }
+
+    if (compress && compressed.size() < input.contents.size() - input.contents.size() / 8) {
+      item.entry.codec = static_cast<uint32_t>(AssetCodec::Lz4);
+      item.entry.chunkCount = chunkCount;
+      item.payload = std::move(compressed);
+    } else {
+      item.entry.codec = static_cast<uint32_t>(AssetCodec::None);
+      item.payload = input.contents;
+    }
+    item.entry.storedSize = item.payload.size();
+    pending.push_back(std::move(item));
+  }
+  std::sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b) {
+    return a.entry.nameHash < b.entry.nameHash;
+  });
+
+  AssetPackHeader header = {};
+  std::memcpy(header.magic, kAssetPackMagic, sizeof(header.magic));
+  header.version = kAssetPackVersion;
+  header.entryCount = static_cast<uint32_t>(pending.size());
+  header.indexOffset = sizeof(AssetPackHeader);
+  header.namesOffset = header.indexOffset + pending.size() * sizeof(AssetPackEntry);
+  uint64_t offset = header.namesOffset + names.size();
+  for (Pending& item : pending) {
+    item.entry.offset = offset;
+    offset += item.payload.size();
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    std::cerr << "Could not write asset pack " << path.string() << std::endl;
+    return false;
+  }
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const Pending& item : pending) {
+    file.write(reinterpret_cast<const char*>(&item.entry), sizeof(item.entry));
+  }
+  file.write(names.data(), names.size());
+  for (const Pending& item : pending) {
+    file.write(item.payload.data(), item.payload.size());
+  }
+  return static_cast<bool>(file);
+}
@@ -0,0 +1,103 @@
+#ifndef WEBGPU_THINGY_SRC_ASSET_PACK_H_
+#define WEBGPU_THINGY_SRC_ASSET_PACK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Single-file asset pack, all integers little endian:
+//
+//   AssetPackHeader
+//   AssetPackEntry[entryCount], sorted by name hash
+//   names, not terminated, referenced by the entries
+//   payloads
+//
+// A compressed payload starts with the compressed size of each chunk as a
+// uint32_t, followed by the chunks. Every chunk is an independent LZ4 block
+// of kAssetPackChunkSize bytes once decompressed (the last one may be
+// shorter), so large entries decompress on several threads.
+
+enum class AssetCodec : uint32_t {
+  None = 0,
+  Lz4 = 1,
+};
+
+constexpr char kAssetPackMagic[4] = { 'W', 'T', 'P', 'K' };
+constexpr uint32_t kAssetPackVersion = 1;
+constexpr size_t kAssetPackChunkSize = 256 * 1024;
+
+struct AssetPackHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t entryCount;
+  uint32_t reserved;
+  uint64_t indexOffset;
+  uint64_t namesOffset;
+};
+
+struct AssetPackEntry {
+  uint64_t nameHash;    // fnv1a64 of the name
+  uint64_t offset;      // Of the payload, from the start of the file
+  uint64_t storedSize;
+  uint64_t size;        // Once decompressed
+  uint32_t codec;       // AssetCodec
+  uint32_t chunkCount;
+  uint32_t nameOffset;  // From namesOffset
+  uint32_t nameLength;
+};
+
+static_assert(sizeof(AssetPackHeader) == 32, "AssetPackHeader is written as is");
+static_assert(sizeof(AssetPackEntry) == 48, "AssetPackEntry is written as is");
+
+// Read-only view of a pack file, mapped in memory. Uncompressed entries are
+// read in place; compressed ones are decompressed on first access and kept.
+class AssetPack {
+public:
+  AssetPack() = default;
+  ~AssetPack();
+  AssetPack(const AssetPack&) = delete;
+  AssetPack& operator=(const AssetPack&) = delete;
+
+  bool open(const std::filesystem::path& path);
+  bool isOpen() const { return m_data != nullptr; }
+
+  // The view stays valid as long as the pack. Safe to call from several threads.
+  bool read(const std::string& name, std::string_view& contents);
+  bool contains(const std::string& name) const { return find(name) != nullptr; }
+
+  size_t entryCount() const { return m_entryCount; }
+  std::string_view entryName(size_t index) const;
+  const AssetPackEntry& entry(size_t index) const { return m_entries[index]; }
+
+private:
+  const AssetPackEntry* find(const std::string& name) const;
+  bool decompress(const AssetPackEntry& entry, std::string& output) const;
+  void close();
+
+  const uint8_t* m_data = nullptr;
+  size_t m_size = 0;
+  bool m_mapped = false;
+  std::vector<uint8_t> m_fileData;  // Where memory mapping is not available
+  const AssetPackEntry* m_entries = nullptr;
+  size_t m_entryCount = 0;
+  const char* m_names = nullptr;
+
+  std::mutex m_mutex;
+  std::vector<std::unique_ptr<std::string>> m_decompressed;  // Per entry
+};
+
+struct AssetPackInput {
+  std::string name;
+  std::string contents;
+};
+
+// Writes a pack; entries are LZ4-compressed unless that saves less than
+// an eighth of their size, or `compress` is false
+bool writeAssetPack(const std::filesystem::path& path, const std::vector<AssetPackInput>& inputs, bool compress = true);
+
+#endif //WEBGPU_THINGY_SRC_ASSET_PACK_H_
@@ -0,0 +1,577 @@
+#include "async_io.h"
+#include "mesh_lod.h"
+#include "resources.h"
+#include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Blocking read of a whole file, used by the thread pool
+bool readWholeFile(const std::string& path, std::string& contents) {
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  bool ok = fstat(fd, &info) == 0;
+  contents.resize(ok ? static_cast<size_t>(info.st_size) : 0);
+  size_t offset = 0;
+  while (ok && offset < contents.size()) {
+    ssize_t count = pread(fd, &contents[offset], contents.size() - offset, static_cast<off_t>(offset));
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) {
+      // Error, or the file shrank since fstat
+      ok = count == 0;
+      contents.resize(offset);
+      break;
+    }
+    offset += static_cast<size_t>(count);
+  }
+  ::close(fd);
+  return ok;
+#else
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return !file.bad();
+#endif
+}
+
+#ifdef __linux__
+// No liburing, the three system calls are all there is to it
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned argCount) {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, argCount));
+}
+#endif
+
+} // namespace
+
+const char* asyncIoBackendName(AsyncIoBackend backend) {
+  switch (backend) {
+  case AsyncIoBackend::IoUring: return "io_uring";
+  case AsyncIoBackend::ThreadPool: return "thread pool";
+  }
+  return "unknown";
+}
+
+struct AsyncFileReader::Request {
+  std::string path;  // Read by the kernel while the open is queued
+  ReadCallback callback;
+  int fd = -1;
+  std::string contents;
+  size_t offset = 0;  // Bytes read so far
+};
+
+#ifdef __linux__
+// Submission and completion queues shared with the kernel. The submission
+// side is only touched under AsyncFileReader::m_mutex, the completion side
+// only by the completion thread.
+struct AsyncFileReader::Ring {
+  ~Ring() {
+    if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+    if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+    if (fd >= 0) ::close(fd);
+  }
+
+  bool map(const io_uring_params& params) {
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) return false;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      cqRing = sqRing;
+    } else {
+      cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cqRing == MAP_FAILED) return false;
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqeMapping = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqeMapping == MAP_FAILED) return false;
+    sqes = static_cast<io_uring_sqe*>(sqeMapping);
+
+    char* sq = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqEntries = params.sq_entries;
+    char* cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  bool supports(std::initializer_list<unsigned> opcodes) {
+    std::vector<uint8_t> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+    if (ioUringRegister(fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+      return false;  // Older than 5.6, which is also when OPENAT and READ appeared
+    }
+    return std::all_of(opcodes.begin(), opcodes.end(), [&](unsigned opcode) {
+      return opcode < probe->ops_len && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+    });
+  }
+
+  bool push(const io_uring_sqe& sqe) {
+    unsigned tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+      return false;
+    }
+    unsigned index = tail & sqMask;
+    sqes[index] = sqe;
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++unsubmitted;
+    return true;
+  }
+
+  void submit() {
+    while (unsubmitted > 0) {
+      int submitted = ioUringEnter(fd, unsubmitted, 0, 0);
+      if (submitted < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+        std::cerr << "io_uring_enter failed: " << std::strerror(errno) << std::endl;
+        return;
+      }
+      unsubmitted -= static_cast<unsigned>(submitted);
+    }
+  }
+
+  int fd = -1;
+  void* sqRing = MAP_FAILED;
+  void* cqRing = MAP_FAILED;
+  size_t sqRingSize = 0;
+  size_t cqRingSize = 0;
+  io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  size_t sqesSize = 0;
+  unsigned* sqHead = nullptr;
+  unsigned* sqTail = nullptr;
+  unsigned* sqArray = nullptr;
+  unsigned sqMask = 0;
+  unsigned sqEntries = 0;
+  unsigned* cqHead = nullptr;
+  unsigned* cqTail = nullptr;
+  unsigned cqMask = 0;
+  io_uring_cqe* cqes = nullptr;
+  unsigned unsubmitted = 0;
+};
+#else
+struct AsyncFileReader::Ring {};
+#endif
+
+AsyncFileReader::AsyncFileReader(unsigned queueDepth, AsyncIoBackend preferred) {
+  queueDepth = std::max(queueDepth, 2u);
+  if (preferred == AsyncIoBackend::IoUring && startIoUring(queueDepth)) {
+    return;
+  }
+  unsigned threadCount = std::min(std::max(2 * std::thread::hardware_concurrency(), 4u), queueDepth);
+  startThreadPool(threadCount);
+}
+
+AsyncFileReader::~AsyncFileReader() {
+  waitAll();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+#ifdef __linux__
+    if (m_ring) {
+      // Wakes the completion thread, user_data 0 is no request
+      io_uring_sqe sqe = {};
+      sqe.opcode = IORING_OP_NOP;
+      m_ring->push(sqe);
+      m_ring->submit();
+    }
+#endif
+  }
+  m_workAvailable.notify_all();
+  for (std::thread& thread : m_threads) {
+    thread.join();
+  }
+}
+
+bool AsyncFileReader::startIoUring(unsigned queueDepth) {
+#ifdef __linux__
+  auto ring = std::make_unique<Ring>();
+  io_uring_params params = {};
+  ring->fd = ioUringSetup(queueDepth, &params);
+  if (ring->fd < 0) {
+    // ENOSYS on old kernels, EPERM when disabled by sysctl or seccomp
+    std::cerr << "io_uring not available (" << std::strerror(errno) << "), reading files on a thread pool" << std::endl;
+    return false;
+  }
+  if (!ring->map(params) || !ring->supports({ IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_NOP })) {
+    std::cerr << "io_uring too old for asynchronous open, reading files on a thread pool" << std::endl;
+    return false;
+  }
+  m_ring = std::move(ring);
+  m_backend = AsyncIoBackend::IoUring;
+  m_threads.emplace_back(&AsyncFileReader::ioUringLoop, this);
+  return true;
+#else
+  (void)queueDepth;
+  return false;
+#endif
+}
+
+void AsyncFileReader::startThreadPool(unsigned threadCount) {
+  m_backend = AsyncIoBackend::ThreadPool;
+  for (unsigned i = 0; i < threadCount; ++i) {
+    m_threads.emplace_back(&AsyncFileReader::threadPoolLoop, this);
+  }
+}
+
+void AsyncFileReader::read(const fs::path& path, ReadCallback callback) {
+  auto request = std::make_unique<Request>();
+  request->path = path.string();
+  request->callback = std::move(callback);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_outstanding;
+    m_backlog.push_back(std::move(request));
+    if (m_backend == AsyncIoBackend::IoUring) {
+      submitBacklog();
+    }
+  }
+  m_workAvailable.notify_one();
+}
+
+void AsyncFileReader::waitAll() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_allDone.wait(lock, [this]() { return m_outstanding == 0; });
+}
+
+size_t AsyncFileReader::outstanding() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_outstanding;
+}
+
+void AsyncFileReader::submitBacklog() {
+#ifdef __linux__
+  // One slot stays free for the wake-up NOP of the destructor
+  while (!m_backlog.empty() && m_inFlight + 1 < m_ring->sqEntries) {
+    Request* request = m_backlog.front().get();
+    io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_OPENAT;
+    sqe.fd = AT_FDCWD;
+    sqe.addr = reinterpret_cast<uintptr_t>(request->path.c_str());
+    sqe.open_flags = O_RDONLY | O_CLOEXEC;
+    sqe.user_data = reinterpret_cast<uintptr_t>(request);
+    if (!m_ring->push(sqe)) break;
+    m_backlog.front().release();  // Owned by the kernel until its completion
+    m_backlog.pop_front();
+    ++m_inFlight;
+  }
+  m_ring->submit();
+#endif
+}
+
+void AsyncFileReader::ioUringLoop() {
+#ifdef __linux__
+  Ring& ring = *m_ring;
+  std::vector<io_uring_cqe> completions;
+  while (true) {
+    if (ioUringEnter(ring.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+      std::cerr << "io_uring_enter failed: " << std::strerror(errno) << std::endl;
+      return;
+    }
+    completions.clear();
+    {
+      // Also orders the requests after their submission, which went
+      // through the kernel where the memory model cannot see it
+      std::lock_guard<std::mutex> lock(m_mutex);
+      unsigned head = *ring.cqHead;
+      unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+      for (; head != tail; ++head) {
+        completions.push_back(ring.cqes[head & ring.cqMask]);
+      }
+      __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    for (const io_uring_cqe& cqe : completions) {
+      if (cqe.user_data == 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping) return;
+        continue;
+      }
+      std::unique_ptr<Request> request(reinterpret_cast<Request*>(static_cast<uintptr_t>(cqe.user_data)));
+      bool failed = cqe.res < 0;
+      bool done = failed;
+      if (!failed && request->fd < 0) {
+        // Opened, the size comes from the inode open just loaded
+        request->fd = cqe.res;
+        struct stat info;
+        failed = done = fstat(request->fd, &info) != 0;
+        request->contents.resize(failed ? 0 : static_cast<size_t>(info.st_size));
+        done = done || request->contents.empty();
+      } else if (!failed) {
+        if (cqe.res == 0) {
+          request->contents.resize(request->offset);  // The file shrank
+        }
+        request->offset += static_cast<size_t>(cqe.res);
+        done = request->offset >= request->contents.size();
+      }
+
+      if (done) {
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          --m_inFlight;
+          submitBacklog();
+        }
+        // Parsed here, on the completion thread, while the next reads run
+        finish(std::move(request), !failed);
+        continue;
+      }
+      // Short reads are resumed where they stopped
+      io_uring_sqe sqe = {};
+      sqe.opcode = IORING_OP_READ;
+      sqe.fd = request->fd;
+      sqe.addr = reinterpret_cast<uintptr_t>(&request->contents[request->offset]);
+      sqe.len = static_cast<uint32_t>(std::min<size_t>(request->contents.size() - request->offset, 1u << 30));
+      sqe.off = request->offset;
+      sqe.user_data = reinterpret_cast<uintptr_t>(request.release());
+      std::lock_guard<std::mutex> lock(m_mutex);
+      ring.push(sqe);  // Cannot be full, the request already held a slot
+      ring.submit();
+    }
+  }
+#endif
+}
+
+void AsyncFileReader::threadPoolLoop() {
+  while (true) {
+    std::unique_ptr<Request> request;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_workAvailable.wait(lock, [this]() { return m_stopping || !m_backlog.empty(); });
+      if (m_backlog.empty()) return;
+      request = std::move(m_backlog.front());
+      m_backlog.pop_front();
+    }
+    bool success = readWholeFile(request->path, request->contents);
+    finish(std::move(request), success);
+  }
+}
+
+void AsyncFileReader::finish(std::unique_ptr<Request> request, bool success) {
+#ifndef _WIN32
+  if (request->fd >= 0) {
+    ::close(request->fd);
+  }
+#endif
+  if (!success) {
+    request->contents.clear();
+  }
+  request->callback(success, request->contents);
+  request.reset();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (--m_outstanding == 0) {
+    m_allDone.notify_all();
+  }
+}
+
+namespace {
+
+std::string formatGeometry(const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indexData) {
+  std::ostringstream out;
+  out << "[points]\n";
+  for (const Vertex& vertex : vertices) {
+    out << vertex.position[0] << " " << vertex.position[1] << " "
+        << vertex.color[0] << " " << vertex.color[1] << " " << vertex.color[2] << "\n";
+  }
+  out << "[indices]\n";
+  for (size_t i = 0; i + 2 < indexData.size(); i += 3) {
+    out << indexData[i] << " " << indexData[i + 1] << " " << indexData[i + 2] << "\n";
+  }
+  return out.str();
+}
+
+// Written through to disk, so that the pages are clean and can be evicted
+bool writeFileDurably(const fs::path& path, const std::string& contents) {
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = ::write(fd, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size()) && fsync(fd) == 0;
+  ::close(fd);
+  return ok;
+#else
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(contents.data(), contents.size());
+  return static_cast<bool>(file);
+#endif
+}
+
+// Evicts the files from the page cache without needing root for
+// /proc/sys/vm/drop_caches. Returns the fraction of pages still resident.
+double dropFromPageCache(const std::vector<fs::path>& files) {
+#ifdef __linux__
+  const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t pages = 0;
+  size_t resident = 0;
+  for (const fs::path& path : files) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      size_t size = static_cast<size_t>(info.st_size);
+      void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapping != MAP_FAILED) {
+        std::vector<unsigned char> residency((size + pageSize - 1) / pageSize);
+        if (mincore(mapping, size, residency.data()) == 0) {
+          pages += residency.size();
+          resident += static_cast<size_t>(std::count_if(residency.begin(), residency.end(), [](unsigned char page) { return (page & 1) != 0; }));
+        }
+        munmap(mapping, size);
+      }
+    }
+    ::close(fd);
+  }
+  return pages > 0 ? static_cast<double>(resident) / static_cast<double>(pages) : 0.0;
+#else
+  (void)files;
+  return 1.0;
+#endif
+}
+
+} // namespace
+
+void benchmarkAsyncIo(size_t fileCount) {
+  using Clock = std::chrono::steady_clock;
+
+  // Heavier copies of the embedded mesh, so that each file spans a few pages
+  const EmbeddedResource* resource = findEmbeddedResource("webgpu.txt");
+  std::vector<Vertex> vertices;
+  std::vector<uint16_t> indexData;
+  if (!resource || !parseGeometry(std::string(reinterpret_cast<const char*>(resource->data), resource->size), vertices, indexData)) {
+    std::cerr << "Could not load the embedded geometry" << std::endl;
+    return;
+  }
+  subdivideGeometry(vertices, indexData, 3);
+  const std::string contents = formatGeometry(vertices, indexData);
+
+  fs::path directory = fs::temp_directory_path() / "webgpu-thingy-io-bench";
+  std::error_code error;
+  fs::create_directories(directory, error);
+  std::vector<fs::path> files;
+  for (size_t i = 0; i < fileCount; ++i) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "geometry-%05zu.txt", i);
+    fs::path path = directory / name;
+    if (fs::file_size(path, error) != contents.size() && !writeFileDurably(path, contents)) {
+      std::cerr << "Could not write " << path.string() << std::endl;
+      return;
+    }
+    files.push_back(path);
+  }
+  const double totalMb = static_cast<double>(contents.size() * fileCount) / (1024.0 * 1024.0);
+  std::cout << "Loading " << fileCount << " geometry files of " << contents.size() / 1024 << " KiB from "
+            << directory.string() << std::endl;
+
+  // Read alone shows the I/O, read + parse how much of it parsing hides
+  bool parseFiles = false;
+  std::atomic<size_t> loadedBytes{ 0 };
+  std::atomic<size_t> loadedVertices{ 0 };
+  std::atomic<size_t> failures{ 0 };
+  auto consume = [&](bool success, std::string& source) {
+    std::vector<Vertex> fileVertices;
+    std::vector<uint16_t> fileIndices;
+    if (!success || (parseFiles && !parseGeometry(source, fileVertices, fileIndices))) {
+      ++failures;
+      return;
+    }
+    loadedBytes += source.size();
+    loadedVertices += fileVertices.size();
+  };
+
+  auto sequential = [&]() {
+    for (const fs::path& path : files) {
+      std::string source;
+      consume(loadShaderSource(path, source), source);
+    }
+  };
+  auto asynchronous = [&](AsyncIoBackend backend) {
+    return [&, backend]() {
+      AsyncFileReader reader(64, backend);
+      for (const fs::path& path : files) {
+        reader.read(path, consume);
+      }
+      reader.waitAll();
+    };
+  };
+
+  auto run = [&](const std::string& label, const std::function<void()>& load) {
+    double resident = dropFromPageCache(files);
+    double ms[2];
+    for (int pass = 0; pass < 2; ++pass) {
+      loadedBytes = 0;
+      loadedVertices = 0;
+      auto start = Clock::now();
+      load();
+      ms[pass] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+    std::cout << std::fixed << std::setprecision(2) << std::left << std::setw(26) << label << std::right
+              << " cold: " << std::setw(8) << ms[0] << " ms (" << std::setw(7) << totalMb * 1000.0 / ms[0] << " MB/s, "
+              << std::setprecision(0) << resident * 100.0 << "% cached before)"
+              << std::setprecision(2) << "  warm: " << std::setw(8) << ms[1] << " ms (" << std::setw(7) << totalMb * 1000.0 / ms[1] << " MB/s)"
+              << std::defaultfloat << std::endl;
+    size_t expectedVertices = parseFiles ? vertices.size() * fileCount : 0;
+    if (loadedBytes != contents.size() * fileCount || loadedVertices != expectedVertices) {
+      std::cerr << label << " loaded " << loadedBytes << " bytes and " << loadedVertices << " vertices instead of "
+                << contents.size() * fileCount << " and " << expectedVertices << std::endl;
+    }
+  };
+
+  bool ioUring = AsyncFileReader(2).backend() == AsyncIoBackend::IoUring;
+  for (bool parse : { false, true }) {
+    parseFiles = parse;
+    std::string suffix = parse ? ", read + parse" : ", read";
+    run("ifstream" + suffix, sequential);
+    run(asyncIoBackendName(AsyncIoBackend::ThreadPool) + suffix, asynchronous(AsyncIoBackend::ThreadPool));
+    if (ioUring) {
+      run(asyncIoBackendName(AsyncIoBackend::IoUring) + suffix, asynchronous(AsyncIoBackend::IoUring));
+    }
+  }
+  if (failures > 0) {
+    std::cerr << failures << " files could not be loaded" << std::endl;
+  }
+}
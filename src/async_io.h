@@ -0,0 +1,77 @@
+#ifndef WEBGPU_THINGY_SRC_ASYNC_IO_H_
+#define WEBGPU_THINGY_SRC_ASYNC_IO_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class AsyncIoBackend {
+  IoUring,     // Linux 5.6+, every open and read is queued to the kernel
+  ThreadPool,  // Blocking open/pread on worker threads, everywhere else
+};
+
+const char* asyncIoBackendName(AsyncIoBackend backend);
+
+// Receives the whole file, or success == false if it could not be read.
+// The contents may be moved from.
+using ReadCallback = std::function<void(bool success, std::string& contents)>;
+
+// Reads whole files with many requests in flight. Callbacks run on the
+// reader's threads as soon as their file is complete, so parsing overlaps
+// with the remaining reads and the submitting thread never waits on disk.
+// Callbacks must not call back into the reader.
+class AsyncFileReader {
+public:
+  // `queueDepth` bounds the requests in flight, the others wait in a backlog
+  explicit AsyncFileReader(unsigned queueDepth = 64, AsyncIoBackend preferred = AsyncIoBackend::IoUring);
+  ~AsyncFileReader();
+  AsyncFileReader(const AsyncFileReader&) = delete;
+  AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+  // Falls back to ThreadPool when io_uring is not available
+  AsyncIoBackend backend() const { return m_backend; }
+
+  // Safe to call from several threads
+  void read(const std::filesystem::path& path, ReadCallback callback);
+  // Blocks until every read issued so far has run its callback
+  void waitAll();
+  // Reads issued whose callback has not returned yet
+  size_t outstanding();
+
+private:
+  struct Request;
+  struct Ring;
+
+  bool startIoUring(unsigned queueDepth);
+  void startThreadPool(unsigned threadCount);
+  void ioUringLoop();
+  void threadPoolLoop();
+  // Queues as many backlog requests as the ring has room for; m_mutex held
+  void submitBacklog();
+  void finish(std::unique_ptr<Request> request, bool success);
+
+  AsyncIoBackend m_backend = AsyncIoBackend::ThreadPool;
+  std::unique_ptr<Ring> m_ring;
+  std::vector<std::thread> m_threads;
+
+  std::mutex m_mutex;
+  std::condition_variable m_workAvailable;
+  std::condition_variable m_allDone;
+  std::deque<std::unique_ptr<Request>> m_backlog;
+  size_t m_inFlight = 0;     // Requests owned by the kernel
+  size_t m_outstanding = 0;  // Issued requests whose callback has not returned
+  bool m_stopping = false;
+};
+
+// Cold and warm load of `fileCount` geometry files, parsed as they arrive,
+// with each backend and with sequential std::ifstream reads for reference
+void benchmarkAsyncIo(size_t fileCount);
+
+#endif //WEBGPU_THINGY_SRC_ASYNC_IO_H_
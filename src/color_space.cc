@@ -0,0 +1,181 @@
+#include "color_space.h"
+#include "color_space_simd.h"
+#include "vertex.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COLOR_SPACE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define COLOR_SPACE_NEON
+#endif
+
+#ifdef COLOR_SPACE_AVX2
+// Defined in color_space_avx2.cc
+size_t srgbToLinearAvx2(float* values, size_t count);
+#endif
+
+namespace {
+
+#if defined(COLOR_SPACE_SSE2)
+struct Sse2 {
+  using F = __m128;
+  using I = __m128i;
+  static constexpr size_t kWidth = 4;
+  static F load(const float* p) { return _mm_loadu_ps(p); }
+  static void store(float* p, F v) { _mm_storeu_ps(p, v); }
+  static F set1(float v) { return _mm_set1_ps(v); }
+  static I setInt(int v) { return _mm_set1_epi32(v); }
+  static F add(F a, F b) { return _mm_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm_div_ps(a, b); }
+  static F min(F a, F b) { return _mm_min_ps(a, b); }
+  static F max(F a, F b) { return _mm_max_ps(a, b); }
+  static F lessEqual(F a, F b) { return _mm_cmple_ps(a, b); }
+  static F greater(F a, F b) { return _mm_cmpgt_ps(a, b); }
+  static F select(F mask, F a, F b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+  static I asInt(F v) { return _mm_castps_si128(v); }
+  static F asFloat(I v) { return _mm_castsi128_ps(v); }
+  static F toFloat(I v) { return _mm_cvtepi32_ps(v); }
+  static I roundToInt(F v) { return _mm_cvtps_epi32(v); }
+  static I andInt(I a, I b) { return _mm_and_si128(a, b); }
+  static I orInt(I a, I b) { return _mm_or_si128(a, b); }
+  static I addInt(I a, I b) { return _mm_add_epi32(a, b); }
+  static I subInt(I a, I b) { return _mm_sub_epi32(a, b); }
+  static I shiftRight23(I v) { return _mm_srli_epi32(v, 23); }
+  static I shiftLeft23(I v) { return _mm_slli_epi32(v, 23); }
+};
+#elif defined(COLOR_SPACE_NEON)
+struct Neon {
+  using F = float32x4_t;
+  using I = int32x4_t;
+  static constexpr size_t kWidth = 4;
+  static F load(const float* p) { return vld1q_f32(p); }
+  static void store(float* p, F v) { vst1q_f32(p, v); }
+  static F set1(float v) { return vdupq_n_f32(v); }
+  static I setInt(int v) { return vdupq_n_s32(v); }
+  static F add(F a, F b) { return vaddq_f32(a, b); }
+  static F sub(F a, F b) { return vsubq_f32(a, b); }
+  static F mul(F a, F b) { return vmulq_f32(a, b); }
+  static F div(F a, F b) { return vdivq_f32(a, b); }
+  static F min(F a, F b) { return vminq_f32(a, b); }
+  static F max(F a, F b) { return vmaxq_f32(a, b); }
+  static F lessEqual(F a, F b) { return vreinterpretq_f32_u32(vcleq_f32(a, b)); }
+  static F greater(F a, F b) { return vreinterpretq_f32_u32(vcgtq_f32(a, b)); }
+  static F select(F mask, F a, F b) { return vbslq_f32(vreinterpretq_u32_f32(mask), a, b); }
+  static I asInt(F v) { return vreinterpretq_s32_f32(v); }
+  static F asFloat(I v) { return vreinterpretq_f32_s32(v); }
+  static F toFloat(I v) { return vcvtq_f32_s32(v); }
+  static I roundToInt(F v) { return vcvtnq_s32_f32(v); }
+  static I andInt(I a, I b) { return vandq_s32(a, b); }
+  static I orInt(I a, I b) { return vorrq_s32(a, b); }
+  static I addInt(I a, I b) { return vaddq_s32(a, b); }
+  static I subInt(I a, I b) { return vsubq_s32(a, b); }
+  static I shiftRight23(I v) { return vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(v), 23)); }
+  static I shiftLeft23(I v) { return vshlq_n_s32(v, 23); }
+};
+#endif
+
+float srgbToLinearValue(float c) {
+  c = std::min(std::max(c, 0.0f), 1.0f);
+  return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+#ifdef COLOR_SPACE_AVX2
+bool cpuHasAvx2() {
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  return hasAvx2;
+}
+#endif
+
+} // namespace
+
+void srgbToLinearScalar(float* values, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    values[i] = srgbToLinearValue(values[i]);
+  }
+}
+
+void srgbToLinear(float* values, size_t count) {
+  size_t done = 0;
+#ifdef COLOR_SPACE_AVX2
+  if (cpuHasAvx2()) {
+    done = srgbToLinearAvx2(values, count);
+  }
+#endif
+#if defined(COLOR_SPACE_SSE2)
+  done += srgb_simd::srgbToLinearBlocks<Sse2>(values + done, count - done);
+#elif defined(COLOR_SPACE_NEON)
+  done += srgb_simd::srgbToLinearBlocks<Neon>(values + done, count - done);
+#endif
+  srgbToLinearScalar(values + done, count - done);
+}
+
+const char* srgbToLinearImplementation() {
+#ifdef COLOR_SPACE_AVX2
+  if (cpuHasAvx2()) return "AVX2";
+#endif
+#if defined(COLOR_SPACE_SSE2)
+  return "SSE2";
+#elif defined(COLOR_SPACE_NEON)
+  return "NEON";
+#else
+  return "scalar";
+#endif
+}
+
+void convertVertexColorsToLinear(std::vector<Vertex>& vertices) {
+  // Gather the colors into a contiguous block so the kernel runs on full vectors
+  constexpr size_t kBatchVertices = 256;
+  float colors[kBatchVertices * 3];
+  const size_t vertexCount = vertices.size();
+  for (size_t first = 0; first < vertexCount; first += kBatchVertices) {
+    size_t batch = std::min(kBatchVertices, vertexCount - first);
+    for (size_t v = 0; v < batch; ++v) {
+      const float* color = vertices[first + v].color;
+      std::copy(color, color + 3, &colors[v * 3]);
+    }
+    srgbToLinear(colors, batch * 3);
+    for (size_t v = 0; v < batch; ++v) {
+      std::copy(&colors[v * 3], &colors[v * 3] + 3, vertices[first + v].color);
+    }
+  }
+}
+
+void benchmarkSrgbToLinear(size_t count) {
+  std::vector<float> input(count);
+  for (size_t i = 0; i < count; ++i) {
+    input[i] = static_cast<float>(i % 4096) / 4095.0f;
+  }
+
+  auto run = [&](const char* label, void (*kernel)(float*, size_t), std::vector<float>& output) {
+    using Clock = std::chrono::steady_clock;
+    double bestMs = 1e30;
+    for (int repeat = 0; repeat < 5; ++repeat) {
+      output = input;
+      auto start = Clock::now();
+      kernel(output.data(), output.size());
+      bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    std::cout << std::fixed << std::setprecision(3) << label << ": " << bestMs << " ms, "
+              << bestMs * 1e6 / static_cast<double>(count) << " ns/value" << std::defaultfloat << std::endl;
+    return bestMs;
+  };
+
+  std::vector<float> vectorized, scalar;
+  std::cout << "sRGB to linear over " << count << " values" << std::endl;
+  double vectorizedMs = run(srgbToLinearImplementation(), srgbToLinear, vectorized);
+  double scalarMs = run("scalar", srgbToLinearScalar, scalar);
+
+  float maxError = 0.0f;
+  for (size_t i = 0; i < count; ++i) {
+    maxError = std::max(maxError, std::abs(vectorized[i] - scalar[i]));
+  }
+  std::cout << "Speedup: " << scalarMs / vectorizedMs << "x, max abs difference: " << maxError << std::endl;
+}
@@ -0,0 +1,25 @@
+#ifndef WEBGPU_THINGY_SRC_COLOR_SPACE_H_
+#define WEBGPU_THINGY_SRC_COLOR_SPACE_H_
+
+#include <cstddef>
+#include <vector>
+
+struct Vertex;
+
+// Exact sRGB transfer function (IEC 61966-2-1), applied in place. Inputs are
+// clamped to [0, 1]. Uses the widest SIMD instruction set available at run
+// time (AVX2, SSE2 or NEON) and a scalar loop for the tail.
+void srgbToLinear(float* values, size_t count);
+// Reference implementation with std::pow
+void srgbToLinearScalar(float* values, size_t count);
+// Name of the implementation srgbToLinear() dispatches to
+const char* srgbToLinearImplementation();
+
+// Converts the color of every vertex
+void convertVertexColorsToLinear(std::vector<Vertex>& vertices);
+
+// Times the SIMD and scalar kernels over `count` values and reports their
+// throughput and largest difference
+void benchmarkSrgbToLinear(size_t count);
+
+#endif //WEBGPU_THINGY_SRC_COLOR_SPACE_H_
@@ -0,0 +1,40 @@
+// Compiled with AVX2 enabled; only called after a run time CPU check.
+#include "color_space_simd.h"
+#include <immintrin.h>
+
+namespace {
+
+struct Avx2 {
+  using F = __m256;
+  using I = __m256i;
+  static constexpr size_t kWidth = 8;
+  static F load(const float* p) { return _mm256_loadu_ps(p); }
+  static void store(float* p, F v) { _mm256_storeu_ps(p, v); }
+  static F set1(float v) { return _mm256_set1_ps(v); }
+  static I setInt(int v) { return _mm256_set1_epi32(v); }
+  static F add(F a, F b) { return _mm256_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm256_div_ps(a, b); }
+  static F min(F a, F b) { return _mm256_min_ps(a, b); }
+  static F max(F a, F b) { return _mm256_max_ps(a, b); }
+  static F lessEqual(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+  static F greater(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static F select(F mask, F a, F b) { return _mm256_blendv_ps(b, a, mask); }
+  static I asInt(F v) { return _mm256_castps_si256(v); }
+  static F asFloat(I v) { return _mm256_castsi256_ps(v); }
+  static F toFloat(I v) { return _mm256_cvtepi32_ps(v); }
+  static I roundToInt(F v) { return _mm256_cvtps_epi32(v); }
+  static I andInt(I a, I b) { return _mm256_and_si256(a, b); }
+  static I orInt(I a, I b) { return _mm256_or_si256(a, b); }
+  static I addInt(I a, I b) { return _mm256_add_epi32(a, b); }
+  static I subInt(I a, I b) { return _mm256_sub_epi32(a, b); }
+  static I shiftRight23(I v) { return _mm256_srli_epi32(v, 23); }
+  static I shiftLeft23(I v) { return _mm256_slli_epi32(v, 23); }
+};
+
+} // namespace
+
+size_t srgbToLinearAvx2(float* values, size_t count) {
+  return srgb_simd::srgbToLinearBlocks<Avx2>(values, count);
+}
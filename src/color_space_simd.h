@@ -0,0 +1,84 @@
+#ifndef WEBGPU_THINGY_SRC_COLOR_SPACE_SIMD_H_
+#define WEBGPU_THINGY_SRC_COLOR_SPACE_SIMD_H_
+
+// Instruction set independent sRGB kernel, shared by the translation units
+// that are compiled for each instruction set. `S` wraps one vector type:
+//   S::F / S::I       float and int32 vectors of S::kWidth lanes
+//   load, store, set1, setInt, add, sub, mul, div, min, max
+//   lessEqual, greater (float masks), select(mask, a, b)
+//   asInt, asFloat (bit casts), toFloat, roundToInt
+//   andInt, orInt, addInt, subInt, shiftRight23, shiftLeft23
+
+#include <cstddef>
+
+namespace srgb_simd {
+
+// log2 of normal positive numbers: split off the exponent, bring the
+// mantissa to [sqrt(1/2), sqrt(2)) and evaluate 2 atanh(t) / ln 2 with
+// t = (m - 1) / (m + 1), |t| < 0.172.
+template <class S>
+inline typename S::F log2(typename S::F x) {
+  using F = typename S::F;
+  using I = typename S::I;
+  const F one = S::set1(1.0f);
+  I bits = S::asInt(x);
+  I exponent = S::subInt(S::shiftRight23(bits), S::setInt(127));
+  F mantissa = S::asFloat(S::orInt(S::andInt(bits, S::setInt(0x007FFFFF)), S::setInt(0x3F800000)));
+  F big = S::greater(mantissa, S::set1(1.41421356f));
+  mantissa = S::select(big, S::mul(mantissa, S::set1(0.5f)), mantissa);
+  F e = S::add(S::toFloat(exponent), S::select(big, one, S::set1(0.0f)));
+
+  F t = S::div(S::sub(mantissa, one), S::add(mantissa, one));
+  F t2 = S::mul(t, t);
+  F p = S::set1(1.0f / 9.0f);
+  p = S::add(S::mul(p, t2), S::set1(1.0f / 7.0f));
+  p = S::add(S::mul(p, t2), S::set1(1.0f / 5.0f));
+  p = S::add(S::mul(p, t2), S::set1(1.0f / 3.0f));
+  p = S::add(S::mul(p, t2), one);
+  return S::add(e, S::mul(S::mul(t, p), S::set1(2.88539008f))); // 2 / ln 2
+}
+
+// 2^y for y in the normal range: 2^round(y) from the exponent bits times a
+// degree 7 Taylor expansion of e^(f ln 2) for the fraction f in [-0.5, 0.5].
+template <class S>
+inline typename S::F exp2(typename S::F y) {
+  using F = typename S::F;
+  using I = typename S::I;
+  I n = S::roundToInt(y);
+  F z = S::mul(S::sub(y, S::toFloat(n)), S::set1(0.693147181f));
+  F p = S::set1(1.0f / 5040.0f);
+  p = S::add(S::mul(p, z), S::set1(1.0f / 720.0f));
+  p = S::add(S::mul(p, z), S::set1(1.0f / 120.0f));
+  p = S::add(S::mul(p, z), S::set1(1.0f / 24.0f));
+  p = S::add(S::mul(p, z), S::set1(1.0f / 6.0f));
+  p = S::add(S::mul(p, z), S::set1(0.5f));
+  p = S::add(S::mul(p, z), S::set1(1.0f));
+  p = S::add(S::mul(p, z), S::set1(1.0f));
+  F scale = S::asFloat(S::shiftLeft23(S::addInt(n, S::setInt(127))));
+  return S::mul(p, scale);
+}
+
+template <class S>
+inline typename S::F srgbToLinear(typename S::F c) {
+  using F = typename S::F;
+  c = S::min(S::max(c, S::set1(0.0f)), S::set1(1.0f));
+  F linear = S::mul(c, S::set1(1.0f / 12.92f));
+  // The curved segment only matters above the threshold, where the base is >= 0.09
+  F base = S::max(S::mul(S::add(c, S::set1(0.055f)), S::set1(1.0f / 1.055f)), S::set1(0.05f));
+  F curve = exp2<S>(S::mul(log2<S>(base), S::set1(2.4f)));
+  return S::select(S::lessEqual(c, S::set1(0.04045f)), linear, curve);
+}
+
+// Converts whole vectors and returns how many values were processed
+template <class S>
+inline size_t srgbToLinearBlocks(float* values, size_t count) {
+  size_t i = 0;
+  for (; i + S::kWidth <= count; i += S::kWidth) {
+    S::store(values + i, srgbToLinear<S>(S::load(values + i)));
+  }
+  return i;
+}
+
+} // namespace srgb_simd
+
+#endif //WEBGPU_THINGY_SRC_COLOR_SPACE_SIMD_H_
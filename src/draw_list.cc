@@ -0,0 +1,461 @@
+#include "draw_list.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include "frame_arena.h"
+#include "job_system.h"
+
+namespace {
+
+constexpr int kRadixBits = 8;
+constexpr size_t kRadixBuckets = size_t(1) << kRadixBits;
+// Below this many keys the cost of starting threads outweighs the sort itself
+constexpr size_t kParallelSortThreshold = 64 * 1024;
+constexpr size_t kMinKeysPerThread = 16 * 1024;
+// Smaller bundles cost more to record and execute than they save
+constexpr size_t kMinDrawsPerBundle = 256;
+
+class Barrier {
+public:
+  explicit Barrier(unsigned count) : m_count(count) {}
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    unsigned generation = m_generation;
+    if (++m_waiting == m_count) {
+      m_waiting = 0;
+      ++m_generation;
+      m_condition.notify_all();
+      return;
+    }
+    m_condition.wait(lock, [&] { return generation != m_generation; });
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  unsigned m_count;
+  unsigned m_waiting = 0;
+  unsigned m_generation = 0;
+};
+
+} // namespace
+
+uint64_t makeSortKey(uint32_t pass, uint32_t pipelineId, uint32_t bindGroupId, uint32_t bufferId, uint32_t depth) {
+  auto field = [](uint32_t value, int bits) {
+    assert(value < (uint64_t(1) << bits));
+    return uint64_t(value) & ((uint64_t(1) << bits) - 1);
+  };
+  uint64_t key = field(pass, kSortKeyPassBits);
+  key = (key << kSortKeyPipelineBits) | field(pipelineId, kSortKeyPipelineBits);
+  key = (key << kSortKeyBindGroupBits) | field(bindGroupId, kSortKeyBindGroupBits);
+  key = (key << kSortKeyBufferBits) | field(bufferId, kSortKeyBufferBits);
+  key = (key << kSortKeyDepthBits) | field(depth, kSortKeyDepthBits);
+  return key;
+}
+
+uint32_t quantizeSortDepth(float depth) {
+  constexpr uint32_t maxDepth = (uint32_t(1) << kSortKeyDepthBits) - 1;
+  float clamped = std::min(std::max(depth, 0.0f), 1.0f);
+  return static_cast<uint32_t>(clamped * static_cast<float>(maxDepth));
+}
+
+void radixSortKeys(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, unsigned threadCount, FrameArena* arena) {
+  assert(keys.size() == values.size());
+  const size_t count = keys.size();
+  if (count < 2) {
+    return;
+  }
+
+  // Digits that are the same in every key do not need a pass
+  uint64_t anyBits = 0;
+  uint64_t allBits = ~uint64_t(0);
+  for (uint64_t key : keys) {
+    anyBits |= key;
+    allBits &= key;
+  }
+  const uint64_t varyingBits = anyBits ^ allBits;
+  int shifts[64 / kRadixBits];
+  int shiftCount = 0;
+  for (int shift = 0; shift < 64; shift += kRadixBits) {
+    if ((varyingBits >> shift) & (kRadixBuckets - 1)) {
+      shifts[shiftCount++] = shift;
+    }
+  }
+  if (shiftCount == 0) {
+    return;
+  }
+
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (count < kParallelSortThreshold) {
+    threadCount = 1;
+  }
+  threadCount = static_cast<unsigned>(std::min<size_t>(threadCount, count / kMinKeysPerThread + 1));
+
+  // Scratch memory from the arena when there is one, the heap otherwise
+  std::vector<uint64_t> keysStorage;
+  std::vector<uint32_t> valuesStorage;
+  std::vector<size_t> offsetsStorage;
+  uint64_t* keysScratch = nullptr;
+  uint32_t* valuesScratch = nullptr;
+  // One row of bucket counters per thread, turned into scatter offsets in place
+  size_t* offsets = nullptr;
+  if (arena) {
+    keysScratch = arena->allocate<uint64_t>(count);
+    valuesScratch = arena->allocate<uint32_t>(count);
+    offsets = arena->allocate<size_t>(threadCount * kRadixBuckets);
+  } else {
+    keysStorage.resize(count);
+    valuesStorage.resize(count);
+    offsetsStorage.resize(threadCount * kRadixBuckets);
+    keysScratch = keysStorage.data();
+    valuesScratch = valuesStorage.data();
+    offsets = offsetsStorage.data();
+  }
+  Barrier barrier(threadCount);
+
+  auto worker = [&](unsigned thread) {
+    const size_t begin = count * thread / threadCount;
+    const size_t end = count * (thread + 1) / threadCount;
+    uint64_t* srcKeys = keys.data();
+    uint32_t* srcValues = values.data();
+    uint64_t* dstKeys = keysScratch;
+    uint32_t* dstValues = valuesScratch;
+    size_t* row = &offsets[thread * kRadixBuckets];
+
+    for (int pass = 0; pass < shiftCount; ++pass) {
+      const int shift = shifts[pass];
+      std::fill(row, row + kRadixBuckets, 0);
+      for (size_t i = begin; i < end; ++i) {
+        ++row[(srcKeys[i] >> shift) & (kRadixBuckets - 1)];
+      }
+      barrier.wait();
+
+      // Bucket-major, thread-minor prefix sum keeps the sort stable
+      if (thread == 0) {
+        size_t sum = 0;
+        for (size_t bucket = 0; bucket < kRadixBuckets; ++bucket) {
+          for (unsigned t = 0; t < threadCount; ++t) {
+            size_t bucketCount = offsets[t * kRadixBuckets + bucket];
+            offsets[t * kRadixBuckets + bucket] = sum;
+            sum += bucketCount;
+          }
+        }
+      }
+      barrier.wait();
+
+      for (size_t i = begin; i < end; ++i) {
+        size_t destination = row[(srcKeys[i] >> shift) & (kRadixBuckets - 1)]++;
+        dstKeys[destination] = srcKeys[i];
+        dstValues[destination] = srcValues[i];
+      }
+      barrier.wait();
+
+      std::swap(srcKeys, dstKeys);
+      std::swap(srcValues, dstValues);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned thread = 1; thread < threadCount; ++thread) {
+    threads.emplace_back(worker, thread);
+  }
+  worker(0);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  // After an odd number of passes the sorted data lives in the scratch buffers
+  if (shiftCount % 2 == 1) {
+    if (arena) {
+      std::copy(keysScratch, keysScratch + count, keys.data());
+      std::copy(valuesScratch, valuesScratch + count, values.data());
+    } else {
+      keys.swap(keysStorage);
+      values.swap(valuesStorage);
+    }
+  }
+}
+
+DrawListStats& DrawListStats::operator+=(const DrawListStats& other) {
+  draws += other.draws;
+  pipelineChanges += other.pipelineChanges;
+  bindGroupChanges += other.bindGroupChanges;
+  vertexBufferChanges += other.vertexBufferChanges;
+  indexBufferChanges += other.indexBufferChanges;
+  redundantChangesSkipped += other.redundantChangesSkipped;
+  return *this;
+}
+
+void DrawList::clear() {
+  m_commands.clear();
+  m_keys.clear();
+  m_order.clear();
+}
+
+void DrawList::add(const DrawCommand& command) {
+  m_commands.push_back(command);
+}
+
+void DrawList::sort(unsigned threadCount, FrameArena* arena) {
+  m_keys.resize(m_commands.size());
+  m_order.resize(m_commands.size());
+  for (size_t i = 0; i < m_commands.size(); ++i) {
+    m_keys[i] = m_commands[i].sortKey;
+  }
+  std::iota(m_order.begin(), m_order.end(), 0);
+  radixSortKeys(m_keys, m_order, threadCount, arena);
+}
+
+DrawListStats DrawList::encode(wgpu::RenderPassEncoder renderPass) const {
+  assert(m_order.size() == m_commands.size() && "DrawList::sort() must be called before encode()");
+  return encodeRange(renderPass, 0, m_order.size());
+}
+
+DrawListStats DrawList::encodeParallel(wgpu::RenderPassEncoder renderPass, wgpu::Device device, const RenderBundleFormat& format,
+                                       JobSystem& jobs, FrameArena* arena, size_t drawsPerBundle) const {
+  assert(m_order.size() == m_commands.size() && "DrawList::sort() must be called before encode()");
+  if (m_order.empty()) {
+    return {};
+  }
+  if (drawsPerBundle == 0) {
+    size_t threadCount = jobs.workerCount() + 1;
+    drawsPerBundle = std::max(kMinDrawsPerBundle, (m_order.size() + threadCount - 1) / threadCount);
+  }
+  const size_t bundleCount = (m_order.size() + drawsPerBundle - 1) / drawsPerBundle;
+
+  // Bundles are executed in draw list order whichever thread recorded them
+  std::vector<WGPURenderBundle> bundlesStorage;
+  std::vector<DrawListStats> bundleStatsStorage;
+  WGPURenderBundle* bundles = nullptr;
+  DrawListStats* bundleStats = nullptr;
+  if (arena) {
+    bundles = arena->allocate<WGPURenderBundle>(bundleCount);
+    bundleStats = arena->allocate<DrawListStats>(bundleCount);
+  } else {
+    bundlesStorage.resize(bundleCount);
+    bundleStatsStorage.resize(bundleCount);
+    bundles = bundlesStorage.data();
+    bundleStats = bundleStatsStorage.data();
+  }
+  jobs.parallelFor(0, bundleCount, 1, [&](size_t begin, size_t end) {
+    for (size_t bundle = begin; bundle < end; ++bundle) {
+      wgpu::RenderBundleEncoderDescriptor encoderDesc = wgpu::Default;
+      encoderDesc.label = "Draw list bundle";
+      WGPUTextureFormat colorFormat = format.colorFormat;
+      encoderDesc.colorFormatsCount = 1;
+      encoderDesc.colorFormats = &colorFormat;
+      encoderDesc.depthStencilFormat = format.depthFormat;
+      encoderDesc.sampleCount = format.sampleCount;
+      encoderDesc.depthReadOnly = false;
+      encoderDesc.stencilReadOnly = true;  // Matches the render pass
+      wgpu::RenderBundleEncoder encoder = device.createRenderBundleEncoder(encoderDesc);
+      size_t first = bundle * drawsPerBundle;
+      bundleStats[bundle] = encodeRange(encoder, first, std::min(first + drawsPerBundle, m_order.size()));
+      wgpu::RenderBundleDescriptor bundleDesc = wgpu::Default;
+      bundleDesc.label = "Draw list bundle";
+      bundles[bundle] = encoder.finish(bundleDesc);
+      encoder.release();
+    }
+  });
+
+  renderPass.executeBundles(bundleCount, bundles);
+  DrawListStats stats;
+  for (size_t bundle = 0; bundle < bundleCount; ++bundle) {
+    stats += bundleStats[bundle];
+    wgpu::RenderBundle(bundles[bundle]).release();
+  }
+  return stats;
+}
+
+template <typename Encoder>
+DrawListStats DrawList::encodeRange(Encoder& encoder, size_t begin, size_t end) const {
+  DrawListStats stats;
+  WGPURenderPipeline currentPipeline = nullptr;
+  WGPUBindGroup currentBindGroup = nullptr;
+  WGPUBuffer currentVertexBuffer = nullptr;
+  uint64_t currentVertexBufferSize = 0;
+  WGPUBuffer currentInstanceBuffer = nullptr;
+  uint64_t currentInstanceBufferSize = 0;
+  WGPUBuffer currentIndexBuffer = nullptr;
+  uint64_t currentIndexBufferSize = 0;
+  wgpu::IndexFormat currentIndexFormat = wgpu::IndexFormat::Undefined;
+
+  for (size_t position = begin; position < end; ++position) {
+    const DrawCommand& command = m_commands[m_order[position]];
+
+    WGPURenderPipeline pipeline = command.pipeline;
+    if (pipeline != currentPipeline) {
+      encoder.setPipeline(command.pipeline);
+      currentPipeline = pipeline;
+      ++stats.pipelineChanges;
+    } else {
+      ++stats.redundantChangesSkipped;
+    }
+
+    WGPUBindGroup bindGroup = command.bindGroup;
+    if (bindGroup) {
+      if (bindGroup != currentBindGroup) {
+        encoder.setBindGroup(0, command.bindGroup, 0, nullptr);
+        currentBindGroup = bindGroup;
+        ++stats.bindGroupChanges;
+      } else {
+        ++stats.redundantChangesSkipped;
+      }
+    }
+
+    WGPUBuffer vertexBuffer = command.vertexBuffer;
+    if (vertexBuffer != currentVertexBuffer || command.vertexBufferSize != currentVertexBufferSize) {
+      encoder.setVertexBuffer(0, command.vertexBuffer, 0, command.vertexBufferSize);
+      currentVertexBuffer = vertexBuffer;
+      currentVertexBufferSize = command.vertexBufferSize;
+      ++stats.vertexBufferChanges;
+    } else {
+      ++stats.redundantChangesSkipped;
+    }
+
+    WGPUBuffer instanceBuffer = command.instanceBuffer;
+    if (instanceBuffer) {
+      if (instanceBuffer != currentInstanceBuffer || command.instanceBufferSize != currentInstanceBufferSize) {
+        encoder.setVertexBuffer(1, command.instanceBuffer, 0, command.instanceBufferSize);
+        currentInstanceBuffer = instanceBuffer;
+        currentInstanceBufferSize = command.instanceBufferSize;
+        ++stats.vertexBufferChanges;
+      } else {
+        ++stats.redundantChangesSkipped;
+      }
+    }
+
+    WGPUBuffer indexBuffer = command.indexBuffer;
+    if (indexBuffer != currentIndexBuffer || command.indexBufferSize != currentIndexBufferSize || command.indexFormat != currentIndexFormat) {
+      encoder.setIndexBuffer(command.indexBuffer, command.indexFormat, 0, command.indexBufferSize);
+      currentIndexBuffer = indexBuffer;
+      currentIndexBufferSize = command.indexBufferSize;
+      currentIndexFormat = command.indexFormat;
+      ++stats.indexBufferChanges;
+    } else {
+      ++stats.redundantChangesSkipped;
+    }
+
+    encoder.drawIndexed(command.indexCount, command.instanceCount, command.firstIndex, command.baseVertex, command.firstInstance);
+    ++stats.draws;
+  }
+  return stats;
+}
+
+void benchmarkDrawListEncoding(wgpu::Device device, const DrawCommand& draw, uint32_t instanceCount, const RenderBundleFormat& format,
+                               wgpu::TextureView depthView, size_t drawCount, unsigned maxThreads) {
+  using Clock = std::chrono::steady_clock;
+
+  // One draw per instance, cycling through the instances
+  DrawList drawList;
+  for (size_t i = 0; i < drawCount; ++i) {
+    DrawCommand command = draw;
+    command.firstInstance = static_cast<uint32_t>(i % std::max(1u, instanceCount));
+    command.instanceCount = 1;
+    command.sortKey = makeSortKey(0, 0, 0, 0, quantizeSortDepth(static_cast<float>(i) / static_cast<float>(drawCount)));
+    drawList.add(command);
+  }
+  drawList.sort();
+
+  // Encoding only needs a target of the right format, not of the right size
+  wgpu::TextureDescriptor textureDesc;
+  textureDesc.label = "Encoding benchmark target";
+  textureDesc.dimension = wgpu::TextureDimension::_2D;
+  textureDesc.format = format.colorFormat;
+  textureDesc.mipLevelCount = 1;
+  textureDesc.sampleCount = format.sampleCount;
+  textureDesc.size = { 16, 16, 1 };
+  textureDesc.usage = wgpu::TextureUsage::RenderAttachment;
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  wgpu::Texture colorTexture = device.createTexture(textureDesc);
+  wgpu::TextureView colorView = colorTexture.createView();
+
+  // Milliseconds from creating the command encoder to finishing it, best of a few runs
+  auto timeEncoding = [&](JobSystem* jobs) {
+    double bestMs = 0.0;
+    for (int run = 0; run <= 5; ++run) {
+      auto start = Clock::now();
+      wgpu::CommandEncoderDescriptor encoderDesc = wgpu::Default;
+      encoderDesc.label = "Encoding benchmark";
+      wgpu::CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+
+      wgpu::RenderPassColorAttachment colorAttachment = wgpu::Default;
+      colorAttachment.view = colorView;
+      colorAttachment.resolveTarget = nullptr;
+      colorAttachment.loadOp = wgpu::LoadOp::Clear;
+      colorAttachment.storeOp = wgpu::StoreOp::Store;
+      colorAttachment.clearValue = wgpu::Color{ 0.0, 0.0, 0.0, 1.0 };
+
+      wgpu::RenderPassDepthStencilAttachment depthStencilAttachment = wgpu::Default;
+      depthStencilAttachment.view = depthView;
+      depthStencilAttachment.depthClearValue = 1.0f;
+      depthStencilAttachment.depthLoadOp = wgpu::LoadOp::Clear;
+      depthStencilAttachment.depthStoreOp = wgpu::StoreOp::Store;
+      depthStencilAttachment.depthReadOnly = false;
+      depthStencilAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+      depthStencilAttachment.stencilLoadOp = wgpu::LoadOp::Clear;
+      depthStencilAttachment.stencilStoreOp = wgpu::StoreOp::Store;
+#else
+      depthStencilAttachment.stencilLoadOp = wgpu::LoadOp::Undefined;
+      depthStencilAttachment.stencilStoreOp = wgpu::StoreOp::Undefined;
+#endif
+      depthStencilAttachment.stencilReadOnly = true;
+
+      wgpu::RenderPassDescriptor renderPassDesc = wgpu::Default;
+      renderPassDesc.colorAttachmentCount = 1;
+      renderPassDesc.colorAttachments = &colorAttachment;
+      renderPassDesc.depthStencilAttachment = depthView ? &depthStencilAttachment : nullptr;
+      renderPassDesc.timestampWriteCount = 0;
+      renderPassDesc.timestampWrites = nullptr;
+      wgpu::RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+      if (jobs) {
+        drawList.encodeParallel(renderPass, device, format, *jobs);
+      } else {
+        drawList.encode(renderPass);
+      }
+      renderPass.end();
+      renderPass.release();
+      wgpu::CommandBufferDescriptor commandDesc = wgpu::Default;
+      wgpu::CommandBuffer command = encoder.finish(commandDesc);
+      encoder.release();
+      double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+      // Never submitted
+      command.release();
+      // The first run warms up
+      if (run == 1 || (run > 1 && ms < bestMs)) {
+        bestMs = ms;
+      }
+    }
+    return bestMs;
+  };
+
+  double directMs = timeEncoding(nullptr);
+  std::cout << "Encoding " << drawCount << " draws, best of 5 runs" << std::endl;
+  std::cout << std::fixed << std::setprecision(3) << "  render pass, 1 thread: " << directMs << " ms" << std::endl;
+  std::vector<unsigned> threadCounts;
+  for (unsigned threads = 1; threads < maxThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(std::max(1u, maxThreads));
+  for (unsigned threads : threadCounts) {
+    JobSystem jobs(threads - 1);
+    double bundleMs = timeEncoding(&jobs);
+    std::cout << "  bundles, " << std::setw(2) << threads << " threads: " << bundleMs << " ms (" << directMs / bundleMs << "x)" << std::endl;
+  }
+  std::cout << std::defaultfloat;
+
+  colorView.release();
+  colorTexture.destroy();
+  colorTexture.release();
+}
@@ -0,0 +1,106 @@
+#ifndef WEBGPU_THINGY_SRC_DRAW_LIST_H_
+#define WEBGPU_THINGY_SRC_DRAW_LIST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+class FrameArena;
+class JobSystem;
+
+// 64-bit draw sort key, most significant field first:
+//   pass (4) | pipeline (12) | bind group (12) | buffer (12) | depth (24)
+// Sorting by this key groups draws by pass, then by the most expensive state
+// to switch, and finally orders them by depth inside a group.
+constexpr int kSortKeyPassBits = 4;
+constexpr int kSortKeyPipelineBits = 12;
+constexpr int kSortKeyBindGroupBits = 12;
+constexpr int kSortKeyBufferBits = 12;
+constexpr int kSortKeyDepthBits = 24;
+
+uint64_t makeSortKey(uint32_t pass, uint32_t pipelineId, uint32_t bindGroupId, uint32_t bufferId, uint32_t depth);
+// Quantizes a normalized depth in [0, 1] to the key's depth field
+uint32_t quantizeSortDepth(float depth);
+
+// Sorts keys in ascending order with an LSD radix sort (8 bits per pass),
+// permuting `values` along with them. Large inputs are split across threads.
+// Scratch memory comes from `arena` when given.
+void radixSortKeys(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, unsigned threadCount = 0,
+                   FrameArena* arena = nullptr);
+
+struct DrawCommand {
+  uint64_t sortKey = 0;
+  wgpu::RenderPipeline pipeline = nullptr;
+  wgpu::BindGroup bindGroup = nullptr; // Optional, bound at group 0
+  wgpu::Buffer vertexBuffer = nullptr;
+  uint64_t vertexBufferSize = 0;
+  wgpu::Buffer instanceBuffer = nullptr; // Optional, bound at vertex slot 1
+  uint64_t instanceBufferSize = 0;
+  wgpu::Buffer indexBuffer = nullptr;
+  uint64_t indexBufferSize = 0;
+  wgpu::IndexFormat indexFormat = wgpu::IndexFormat::Uint16;
+  uint32_t indexCount = 0;
+  uint32_t firstIndex = 0;
+  int32_t baseVertex = 0;
+  uint32_t instanceCount = 1;
+  uint32_t firstInstance = 0;
+};
+
+struct DrawListStats {
+  size_t draws = 0;
+  size_t pipelineChanges = 0;
+  size_t bindGroupChanges = 0;
+  size_t vertexBufferChanges = 0;
+  size_t indexBufferChanges = 0;
+  // State setting calls that were skipped because the state was already bound
+  size_t redundantChangesSkipped = 0;
+
+  DrawListStats& operator+=(const DrawListStats& other);
+};
+
+// Attachments of the render pass that bundles are recorded for
+struct RenderBundleFormat {
+  wgpu::TextureFormat colorFormat = wgpu::TextureFormat::Undefined;
+  wgpu::TextureFormat depthFormat = wgpu::TextureFormat::Undefined;  // Undefined without depth
+  uint32_t sampleCount = 1;
+};
+
+class DrawList {
+public:
+  void clear();
+  void add(const DrawCommand& command);
+  size_t size() const { return m_commands.size(); }
+  // The command encode() records at `index`, once sorted
+  const DrawCommand& sorted(size_t index) const { return m_commands[m_order[index]]; }
+
+  // Orders the commands by sort key. Must be called before encode().
+  void sort(unsigned threadCount = 0, FrameArena* arena = nullptr);
+  // Records every command into the render pass, skipping state that is already bound
+  DrawListStats encode(wgpu::RenderPassEncoder renderPass) const;
+  // Same as encode(), but consecutive ranges of commands are recorded into
+  // render bundles on the job system's threads and then executed in order.
+  // State is not carried from one bundle to the next, so each one starts by
+  // binding everything. A drawsPerBundle of 0 records one bundle per thread.
+  // The per-bundle arrays come from `arena` when given.
+  DrawListStats encodeParallel(wgpu::RenderPassEncoder renderPass, wgpu::Device device, const RenderBundleFormat& format,
+                               JobSystem& jobs, FrameArena* arena = nullptr, size_t drawsPerBundle = 0) const;
+
+private:
+  // Records the sorted commands [begin, end) into a render pass or bundle encoder
+  template <typename Encoder>
+  DrawListStats encodeRange(Encoder& encoder, size_t begin, size_t end) const;
+
+  std::vector<DrawCommand> m_commands;
+  std::vector<uint64_t> m_keys;
+  std::vector<uint32_t> m_order;
+};
+
+// Times encoding `drawCount` draws of `draw`, one per instance, into a render
+// pass directly and through render bundles recorded by 1 to `maxThreads`
+// threads. The color target is created for `format`, `depthView` must match
+// its depth format.
+void benchmarkDrawListEncoding(wgpu::Device device, const DrawCommand& draw, uint32_t instanceCount, const RenderBundleFormat& format,
+                               wgpu::TextureView depthView, size_t drawCount, unsigned maxThreads);
+
+#endif //WEBGPU_THINGY_SRC_DRAW_LIST_H_
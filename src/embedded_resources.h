@@ -0,0 +1,26 @@
+#ifndef WEBGPU_THINGY_SRC_EMBEDDED_RESOURCES_H_
+#define WEBGPU_THINGY_SRC_EMBEDDED_RESOURCES_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// A file of resources/ compiled into the executable by cmake/EmbedResources.cmake
+struct EmbeddedResource {
+  const char* name;  // Path relative to resources/
+  const unsigned char* data;
+  size_t size;
+  uint64_t hash;     // fnv1a64 of the contents, computed at compile time
+};
+
+constexpr uint64_t fnv1a64(const unsigned char* data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Defined in the generated embedded_resources.cc
+const EmbeddedResource* embeddedResources(size_t& count);
+
+#endif //WEBGPU_THINGY_SRC_EMBEDDED_RESOURCES_H_
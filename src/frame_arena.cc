@@ -0,0 +1,51 @@
+#include "frame_arena.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+size_t alignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+FrameArena::FrameArena(size_t capacity) : m_capacity(alignUp(std::max<size_t>(capacity, 64), 64)) {
+  m_block = static_cast<uint8_t*>(::operator new(m_capacity, std::align_val_t(64)));
+}
+
+FrameArena::~FrameArena() {
+  reset();
+  ::operator delete(m_block, std::align_val_t(64));
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment) {
+  size = std::max<size_t>(size, 1);
+  size_t offset = alignUp(m_used, alignment);
+  m_frameBytes += size + (offset - m_used);
+  if (alignment <= 64 && offset + size <= m_capacity) {
+    m_used = offset + size;
+    return m_block + offset;
+  }
+  ++m_overflows;
+  alignment = std::max(alignment, alignof(std::max_align_t));
+  void* block = ::operator new(size, std::align_val_t(alignment));
+  m_overflowBlocks.push_back({ block, alignment });
+  return block;
+}
+
+void FrameArena::reset() {
+  m_peak = std::max(m_peak, m_frameBytes);
+  for (const OverflowBlock& overflow : m_overflowBlocks) {
+    ::operator delete(overflow.block, std::align_val_t(overflow.alignment));
+  }
+  if (!m_overflowBlocks.empty()) {
+    // Room for the whole of the largest frame, with some headroom
+    ::operator delete(m_block, std::align_val_t(64));
+    m_capacity = alignUp(m_peak + m_peak / 4, 64);
+    m_block = static_cast<uint8_t*>(::operator new(m_capacity, std::align_val_t(64)));
+    m_overflowBlocks.clear();
+  }
+  m_used = 0;
+  m_frameBytes = 0;
+}
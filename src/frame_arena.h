@@ -0,0 +1,58 @@
+#ifndef WEBGPU_THINGY_SRC_FRAME_ARENA_H_
+#define WEBGPU_THINGY_SRC_FRAME_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Linear allocator for CPU data that only lives until the end of the frame:
+// an allocation bumps an offset into one block and reset() frees everything
+// at once. Requests that do not fit go to the heap; the next reset() grows
+// the block to the frame's peak, so steady-state frames stop touching the
+// heap. Not thread safe, allocate from the thread that owns the frame.
+class FrameArena {
+public:
+  explicit FrameArena(size_t capacity = size_t(1) << 20);
+  ~FrameArena();
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+  // Default-initialized: trivial types are left uninitialized. Destructors
+  // never run, so T must be trivially destructible.
+  template <typename T>
+  T* allocate(size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>, "FrameArena never runs destructors");
+    T* items = static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    for (size_t i = 0; i < count; ++i) {
+      new (items + i) T;
+    }
+    return items;
+  }
+
+  // Ends the frame; every pointer handed out becomes invalid
+  void reset();
+
+  size_t capacity() const { return m_capacity; }
+  size_t used() const { return m_used; }
+  size_t peak() const { return m_peak; }              // Largest frame so far, heap overflow included
+  uint64_t overflows() const { return m_overflows; }  // Allocations that went to the heap
+
+private:
+  struct OverflowBlock {
+    void* block;
+    size_t alignment;
+  };
+
+  uint8_t* m_block = nullptr;
+  size_t m_capacity = 0;
+  size_t m_used = 0;
+  size_t m_frameBytes = 0;  // This frame's allocations, including overflow
+  size_t m_peak = 0;
+  uint64_t m_overflows = 0;
+  std::vector<OverflowBlock> m_overflowBlocks;
+};
+
+#endif //WEBGPU_THINGY_SRC_FRAME_ARENA_H_
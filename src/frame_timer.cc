@@ -0,0 +1,84 @@
+#include "frame_timer.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+FrameTimer::FrameTimer(size_t window)
+  : m_window(std::max<size_t>(window, 1))
+{
+}
+
+void FrameTimer::tick() {
+  auto now = std::chrono::steady_clock::now();
+  if (m_started) {
+    record(std::chrono::duration<double, std::milli>(now - m_last).count());
+  }
+  m_last = now;
+  m_started = true;
+}
+
+void FrameTimer::record(double ms) {
+  m_window[m_next] = ms;
+  m_next = m_next + 1 < m_window.size() ? m_next + 1 : 0;
+  m_stored = std::min(m_stored + 1, m_window.size());
+  ++m_count;
+  const double delta = ms - m_mean;
+  m_mean += delta / static_cast<double>(m_count);
+  m_squares += delta * (ms - m_mean);
+  m_min = m_count == 1 ? ms : std::min(m_min, ms);
+  m_max = m_count == 1 ? ms : std::max(m_max, ms);
+}
+
+void FrameTimer::reserve(size_t frames) {
+  if (frames <= m_window.size()) {
+    return;
+  }
+  // Oldest sample first, then the ring grows past the newest
+  if (m_stored == m_window.size()) {
+    std::rotate(m_window.begin(), m_window.begin() + static_cast<std::ptrdiff_t>(m_next), m_window.end());
+    m_next = m_window.size();
+  }
+  m_window.resize(frames);
+}
+
+void FrameTimer::reset() {
+  m_next = 0;
+  m_stored = 0;
+  m_count = 0;
+  m_mean = 0.0;
+  m_squares = 0.0;
+  m_started = false;
+}
+
+FrameTimeStats FrameTimer::stats() const {
+  FrameTimeStats stats;
+  stats.frames = m_count;
+  if (m_count == 0) {
+    return stats;
+  }
+  std::vector<double> sorted(m_window.begin(), m_window.begin() + static_cast<std::ptrdiff_t>(m_stored));
+  std::sort(sorted.begin(), sorted.end());
+  stats.averageMs = m_mean;
+  stats.minMs = m_min;
+  stats.medianMs = sorted[sorted.size() / 2];
+  stats.p99Ms = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+  stats.maxMs = m_max;
+  stats.stdDevMs = std::sqrt(m_squares / static_cast<double>(m_count));
+  return stats;
+}
+
+void printFrameTimeStats(const char* label, const FrameTimeStats& stats) {
+  std::cout << std::fixed << std::setprecision(3)
+            << label << ": " << stats.frames << " frames, avg " << stats.averageMs
+            << " ms (" << (stats.averageMs > 0.0 ? 1000.0 / stats.averageMs : 0.0) << " fps), min " << stats.minMs
+            << " ms, median " << stats.medianMs << " ms, p99 " << stats.p99Ms
+            << " ms, max " << stats.maxMs << " ms, stddev " << stats.stdDevMs << " ms" << std::defaultfloat << std::endl;
+}
+
+void printLatencyStats(const char* label, const FrameTimeStats& stats) {
+  std::cout << std::fixed << std::setprecision(3)
+            << label << ": " << stats.frames << " samples, avg " << stats.averageMs << " ms, min " << stats.minMs
+            << " ms, median " << stats.medianMs << " ms, p99 " << stats.p99Ms
+            << " ms, max " << stats.maxMs << " ms, stddev " << stats.stdDevMs << " ms" << std::defaultfloat << std::endl;
+}
@@ -0,0 +1,55 @@
+#ifndef WEBGPU_THINGY_SRC_FRAME_TIMER_H_
+#define WEBGPU_THINGY_SRC_FRAME_TIMER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+struct FrameTimeStats {
+  size_t frames = 0;
+  double averageMs = 0.0;
+  double minMs = 0.0;
+  double medianMs = 0.0;
+  double p99Ms = 0.0;
+  double maxMs = 0.0;
+  double stdDevMs = 0.0;
+};
+
+// Samples a FrameTimer keeps for its percentiles by default
+constexpr size_t kFrameTimerWindow = 8192;
+
+// Records the wall clock time between consecutive tick() calls, or
+// durations measured elsewhere with record(). The count, average, minimum,
+// maximum and deviation cover every sample; the median and p99 cover the
+// latest ones, kept in a ring allocated up front so that recording never
+// allocates and long runs stay within a fixed size.
+class FrameTimer {
+public:
+  explicit FrameTimer(size_t window = kFrameTimerWindow);
+
+  void tick();
+  void record(double ms);
+  // Keeps at least `frames` samples, e.g. every frame of a benchmark
+  void reserve(size_t frames);
+  void reset();
+  size_t frameCount() const { return m_count; }
+  FrameTimeStats stats() const;
+
+private:
+  std::chrono::steady_clock::time_point m_last;
+  bool m_started = false;
+  std::vector<double> m_window;  // Ring of the latest samples
+  size_t m_next = 0;             // Where the next sample goes
+  size_t m_stored = 0;           // Samples in the ring
+  size_t m_count = 0;            // Of every sample recorded
+  double m_mean = 0.0;           // Running, with m_squares as in Welford's algorithm
+  double m_squares = 0.0;
+  double m_min = 0.0;
+  double m_max = 0.0;
+};
+
+void printFrameTimeStats(const char* label, const FrameTimeStats& stats);
+// For recorded durations that are not frame intervals
+void printLatencyStats(const char* label, const FrameTimeStats& stats);
+
+#endif //WEBGPU_THINGY_SRC_FRAME_TIMER_H_
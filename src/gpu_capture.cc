@@ -0,0 +1,448 @@
+#include "gpu_capture.h"
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include "draw_list.h"
+#include "lz4_codec.h"
+
+namespace {
+
+void putConstants(CaptureWriter& writer, const WGPUConstantEntry* constants, size_t count) {
+  writer.put<uint32_t>(static_cast<uint32_t>(count));
+  for (size_t i = 0; i < count; ++i) {
+    writer.putString(constants[i].key);
+    writer.put<double>(constants[i].value);
+  }
+}
+
+void putBlend(CaptureWriter& writer, const wgpu::BlendComponent& component) {
+  writer.put<uint32_t>(component.operation);
+  writer.put<uint32_t>(component.srcFactor);
+  writer.put<uint32_t>(component.dstFactor);
+}
+
+void putStencilFace(CaptureWriter& writer, const wgpu::StencilFaceState& face) {
+  writer.put<uint32_t>(face.compare);
+  writer.put<uint32_t>(face.failOp);
+  writer.put<uint32_t>(face.depthFailOp);
+  writer.put<uint32_t>(face.passOp);
+}
+
+} // namespace
+
+void CaptureWriter::putString(std::string_view text) {
+  put<uint32_t>(static_cast<uint32_t>(text.size()));
+  putBytes(text.data(), text.size());
+}
+
+void CaptureWriter::putBytes(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  m_data.insert(m_data.end(), bytes, bytes + size);
+}
+
+std::string_view CaptureParser::getString() {
+  const uint32_t size = get<uint32_t>();
+  if (static_cast<size_t>(m_end - m_data) < size) {
+    m_ok = false;
+    m_data = m_end;
+    return {};
+  }
+  std::string_view text(reinterpret_cast<const char*>(m_data), size);
+  m_data += size;
+  return text;
+}
+
+const uint8_t* CaptureParser::getBytes(uint64_t& size) {
+  size = get<uint64_t>();
+  if (static_cast<uint64_t>(m_end - m_data) < size) {
+    m_ok = false;
+    m_data = m_end;
+    size = 0;
+    return nullptr;
+  }
+  const uint8_t* bytes = m_data;
+  m_data += size;
+  return bytes;
+}
+
+GpuCapture::GpuCapture(const std::filesystem::path& path)
+  : m_file(path, std::ios::binary | std::ios::trunc)
+  , m_lastFrame(Clock::now())
+{
+  if (!m_file) {
+    std::cerr << "Could not create capture file " << path.string() << std::endl;
+    return;
+  }
+  m_file.write(kCaptureMagic, sizeof(kCaptureMagic));
+  m_file.write(reinterpret_cast<const char*>(&kCaptureVersion), sizeof(kCaptureVersion));
+  m_stats.bytesWritten = sizeof(kCaptureMagic) + sizeof(kCaptureVersion);
+}
+
+GpuCapture::~GpuCapture() {
+  m_file.flush();
+}
+
+void GpuCapture::createBuffer(wgpu::Buffer buffer, const wgpu::BufferDescriptor& descriptor) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(addObject(buffer));
+  writer.put<uint32_t>(static_cast<uint32_t>(descriptor.usage));
+  writer.put<uint64_t>(descriptor.size);
+  writer.putString(descriptor.label ? descriptor.label : "");
+  writeRecord(CaptureCommand::CreateBuffer);
+}
+
+void GpuCapture::destroyBuffer(wgpu::Buffer buffer) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(objectId(buffer));
+  removeObject(buffer);
+  writeRecord(CaptureCommand::DestroyBuffer);
+}
+
+void GpuCapture::writeBuffer(wgpu::Buffer buffer, uint64_t offset, const void* data, size_t size) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(objectId(buffer));
+  writer.put<uint64_t>(offset);
+  writer.put<uint64_t>(size);
+  writer.putBytes(data, size);
+  writeRecord(CaptureCommand::WriteBuffer);
+}
+
+void GpuCapture::copyBuffer(wgpu::Buffer source, uint64_t sourceOffset, wgpu::Buffer destination, uint64_t destinationOffset,
+                            uint64_t size) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(objectId(source));
+  writer.put<uint64_t>(sourceOffset);
+  writer.put<uint32_t>(objectId(destination));
+  writer.put<uint64_t>(destinationOffset);
+  writer.put<uint64_t>(size);
+  writeRecord(CaptureCommand::CopyBuffer);
+}
+
+void GpuCapture::createTexture(wgpu::Texture texture, const wgpu::TextureDescriptor& descriptor) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(addObject(texture));
+  writer.put<uint32_t>(static_cast<uint32_t>(descriptor.usage));
+  writer.put<uint32_t>(descriptor.dimension);
+  writer.put<uint32_t>(descriptor.size.width);
+  writer.put<uint32_t>(descriptor.size.height);
+  writer.put<uint32_t>(descriptor.size.depthOrArrayLayers);
+  writer.put<uint32_t>(descriptor.format);
+  writer.put<uint32_t>(descriptor.mipLevelCount);
+  writer.put<uint32_t>(descriptor.sampleCount);
+  writer.putString(descriptor.label ? descriptor.label : "");
+  writeRecord(CaptureCommand::CreateTexture);
+}
+
+void GpuCapture::destroyTexture(wgpu::Texture texture) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(objectId(texture));
+  removeObject(texture);
+  writeRecord(CaptureCommand::DestroyTexture);
+}
+
+void GpuCapture::createTextureView(wgpu::TextureView view, wgpu::Texture texture, const wgpu::TextureViewDescriptor& descriptor) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(addObject(view));
+  writer.put<uint32_t>(objectId(texture));
+  writer.put<uint32_t>(descriptor.format);
+  writer.put<uint32_t>(descriptor.dimension);
+  writer.put<uint32_t>(descriptor.aspect);
+  writer.put<uint32_t>(descriptor.baseMipLevel);
+  writer.put<uint32_t>(descriptor.mipLevelCount);
+  writer.put<uint32_t>(descriptor.baseArrayLayer);
+  writer.put<uint32_t>(descriptor.arrayLayerCount);
+  writeRecord(CaptureCommand::CreateTextureView);
+}
+
+void GpuCapture::createShaderModule(wgpu::ShaderModule module, const std::string& source) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(addObject(module));
+  writer.putString(source);
+  writeRecord(CaptureCommand::CreateShaderModule);
+}
+
+void GpuCapture::createPipelineLayout(wgpu::PipelineLayout layout, const wgpu::PipelineLayoutDescriptor& descriptor) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (descriptor.bindGroupLayoutCount > 0) {
+    std::cerr << "Capture: bind group layouts are not captured, replay uses an empty pipeline layout" << std::endl;
+  }
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(addObject(layout));
+  writeRecord(CaptureCommand::CreatePipelineLayout);
+}
+
+void GpuCapture::createRenderPipeline(wgpu::RenderPipeline pipeline, const wgpu::RenderPipelineDescriptor& descriptor) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(addObject(pipeline));
+  writer.put<uint32_t>(objectId(descriptor.layout));
+
+  const wgpu::VertexState& vertex = descriptor.vertex;
+  writer.put<uint32_t>(objectId(vertex.module));
+  writer.putString(vertex.entryPoint ? vertex.entryPoint : "");
+  putConstants(writer, vertex.constants, vertex.constantCount);
+  writer.put<uint32_t>(static_cast<uint32_t>(vertex.bufferCount));
+  for (size_t i = 0; i < vertex.bufferCount; ++i) {
+    const wgpu::VertexBufferLayout& layout = vertex.buffers[i];
+    writer.put<uint64_t>(layout.arrayStride);
+    writer.put<uint32_t>(layout.stepMode);
+    writer.put<uint32_t>(static_cast<uint32_t>(layout.attributeCount));
+    for (size_t j = 0; j < layout.attributeCount; ++j) {
+      writer.put<uint32_t>(layout.attributes[j].format);
+      writer.put<uint64_t>(layout.attributes[j].offset);
+      writer.put<uint32_t>(layout.attributes[j].shaderLocation);
+    }
+  }
+
+  writer.put<uint32_t>(descriptor.primitive.topology);
+  writer.put<uint32_t>(descriptor.primitive.stripIndexFormat);
+  writer.put<uint32_t>(descriptor.primitive.frontFace);
+  writer.put<uint32_t>(descriptor.primitive.cullMode);
+
+  writer.put<uint8_t>(descriptor.depthStencil != nullptr);
+  if (const wgpu::DepthStencilState* depth = descriptor.depthStencil) {
+    writer.put<uint32_t>(depth->format);
+    writer.put<uint8_t>(depth->depthWriteEnabled);
+    writer.put<uint32_t>(depth->depthCompare);
+    putStencilFace(writer, depth->stencilFront);
+    putStencilFace(writer, depth->stencilBack);
+    writer.put<uint32_t>(depth->stencilReadMask);
+    writer.put<uint32_t>(depth->stencilWriteMask);
+    writer.put<int32_t>(depth->depthBias);
+    writer.put<float>(depth->depthBiasSlopeScale);
+    writer.put<float>(depth->depthBiasClamp);
+  }
+
+  writer.put<uint32_t>(descriptor.multisample.count);
+  writer.put<uint32_t>(descriptor.multisample.mask);
+  writer.put<uint8_t>(descriptor.multisample.alphaToCoverageEnabled);
+
+  writer.put<uint8_t>(descriptor.fragment != nullptr);
+  if (const wgpu::FragmentState* fragment = descriptor.fragment) {
+    writer.put<uint32_t>(objectId(fragment->module));
+    writer.putString(fragment->entryPoint ? fragment->entryPoint : "");
+    putConstants(writer, fragment->constants, fragment->constantCount);
+    writer.put<uint32_t>(static_cast<uint32_t>(fragment->targetCount));
+    for (size_t i = 0; i < fragment->targetCount; ++i) {
+      const wgpu::ColorTargetState& target = fragment->targets[i];
+      writer.put<uint32_t>(target.format);
+      writer.put<uint8_t>(target.blend != nullptr);
+      if (target.blend) {
+        putBlend(writer, target.blend->color);
+        putBlend(writer, target.blend->alpha);
+      }
+      writer.put<uint32_t>(static_cast<uint32_t>(target.writeMask));
+    }
+  }
+  writeRecord(CaptureCommand::CreateRenderPipeline);
+}
+
+void GpuCapture::renderPass(const wgpu::RenderPassDescriptor& descriptor, wgpu::TextureFormat colorFormat, uint32_t width,
+                            uint32_t height, const DrawList& drawList) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CaptureWriter writer(m_payload);
+  writer.put<uint32_t>(colorFormat);
+  writer.put<uint32_t>(width);
+  writer.put<uint32_t>(height);
+  const wgpu::RenderPassColorAttachment& color = descriptor.colorAttachments[0];
+  writer.put<uint32_t>(color.loadOp);
+  writer.put<uint32_t>(color.storeOp);
+  writer.put<double>(color.clearValue.r);
+  writer.put<double>(color.clearValue.g);
+  writer.put<double>(color.clearValue.b);
+  writer.put<double>(color.clearValue.a);
+
+  const wgpu::RenderPassDepthStencilAttachment* depth = descriptor.depthStencilAttachment;
+  writer.put<uint32_t>(depth ? objectId(depth->view) : 0);
+  if (depth) {
+    writer.put<uint32_t>(depth->depthLoadOp);
+    writer.put<uint32_t>(depth->depthStoreOp);
+    writer.put<float>(depth->depthClearValue);
+    writer.put<uint8_t>(depth->depthReadOnly);
+    writer.put<uint32_t>(depth->stencilLoadOp);
+    writer.put<uint32_t>(depth->stencilStoreOp);
+    writer.put<uint32_t>(depth->stencilClearValue);
+    writer.put<uint8_t>(depth->stencilReadOnly);
+  }
+
+  writer.put<uint32_t>(static_cast<uint32_t>(drawList.size()));
+  for (size_t i = 0; i < drawList.size(); ++i) {
+    const DrawCommand& draw = drawList.sorted(i);
+    if (draw.bindGroup) {
+      // Bind groups are not captured; the app does not use any
+      ++m_stats.untrackedHandles;
+    }
+    writer.put<uint32_t>(objectId(draw.pipeline));
+    writer.put<uint32_t>(objectId(draw.vertexBuffer));
+    writer.put<uint64_t>(draw.vertexBufferSize);
+    writer.put<uint32_t>(objectId(draw.instanceBuffer));
+    writer.put<uint64_t>(draw.instanceBufferSize);
+    writer.put<uint32_t>(objectId(draw.indexBuffer));
+    writer.put<uint64_t>(draw.indexBufferSize);
+    writer.put<uint32_t>(draw.indexFormat);
+    writer.put<uint32_t>(draw.indexCount);
+    writer.put<uint32_t>(draw.firstIndex);
+    writer.put<int32_t>(draw.baseVertex);
+    writer.put<uint32_t>(draw.instanceCount);
+    writer.put<uint32_t>(draw.firstInstance);
+  }
+  writeRecord(CaptureCommand::RenderPass);
+}
+
+void GpuCapture::endFrame() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const Clock::time_point now = Clock::now();
+  CaptureWriter writer(m_payload);
+  writer.put<uint64_t>(m_stats.frames);
+  writer.put<double>(std::chrono::duration<double, std::milli>(now - m_lastFrame).count());
+  m_lastFrame = now;
+  ++m_stats.frames;
+  writeRecord(CaptureCommand::EndFrame);
+}
+
+GpuCaptureStats GpuCapture::stats() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+uint32_t GpuCapture::addObject(const void* handle) {
+  if (m_nextId > kCaptureMaxObjects) {
+    if (isOpen()) {
+      std::cerr << "Capture stopped after " << kCaptureMaxObjects << " objects" << std::endl;
+      m_file.close();
+    }
+    return 0;
+  }
+  const uint32_t id = m_nextId++;
+  m_objects[handle] = id;
+  return id;
+}
+
+uint32_t GpuCapture::objectId(const void* handle) {
+  if (!handle) {
+    return 0;
+  }
+  auto it = m_objects.find(handle);
+  if (it == m_objects.end()) {
+    ++m_stats.untrackedHandles;
+    return 0;
+  }
+  return it->second;
+}
+
+void GpuCapture::removeObject(const void* handle) {
+  m_objects.erase(handle);
+}
+
+void GpuCapture::writeRecord(CaptureCommand command) {
+  if (!isOpen()) {
+    m_payload.clear();
+    return;
+  }
+  uint8_t tag = static_cast<uint8_t>(command);
+  const uint8_t* payload = m_payload.data();
+  uint32_t payloadSize = static_cast<uint32_t>(m_payload.size());
+  if (m_payload.size() > kCaptureCompressThreshold) {
+    // Uncompressed size first, then the LZ4 block
+    const uint32_t rawSize = static_cast<uint32_t>(m_payload.size());
+    m_compressed.resize(sizeof(rawSize) + lz4CompressBound(m_payload.size()));
+    std::memcpy(m_compressed.data(), &rawSize, sizeof(rawSize));
+    size_t compressedSize = lz4Compress(m_payload.data(), m_payload.size(), m_compressed.data() + sizeof(rawSize),
+                                        m_compressed.size() - sizeof(rawSize));
+    if (compressedSize > 0 && compressedSize + sizeof(rawSize) < m_payload.size()) {
+      tag |= kCaptureCompressed;
+      payload = m_compressed.data();
+      payloadSize = static_cast<uint32_t>(compressedSize + sizeof(rawSize));
+    }
+  }
+  m_file.put(static_cast<char>(tag));
+  m_file.write(reinterpret_cast<const char*>(&payloadSize), sizeof(payloadSize));
+  m_file.write(reinterpret_cast<const char*>(payload), payloadSize);
+  ++m_stats.records;
+  m_stats.bytesCaptured += m_payload.size() + 1 + sizeof(payloadSize);
+  m_stats.bytesWritten += payloadSize + 1 + sizeof(payloadSize);
+  m_payload.clear();
+}
+
+bool CaptureReader::open(const std::filesystem::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    std::cerr << "Could not open capture " << path.string() << std::endl;
+    return false;
+  }
+  m_data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  uint32_t version = 0;
+  if (m_data.size() < sizeof(kCaptureMagic) + sizeof(version) || std::memcmp(m_data.data(), kCaptureMagic, sizeof(kCaptureMagic)) != 0) {
+    std::cerr << path.string() << " is not a capture" << std::endl;
+    return false;
+  }
+  std::memcpy(&version, m_data.data() + sizeof(kCaptureMagic), sizeof(version));
+  if (version != kCaptureVersion) {
+    std::cerr << path.string() << " is a version " << version << " capture, expected " << kCaptureVersion << std::endl;
+    return false;
+  }
+  m_offset = sizeof(kCaptureMagic) + sizeof(version);
+  m_failed = false;
+  return true;
+}
+
+bool CaptureReader::next(CaptureCommand& command, CaptureParser& payload) {
+  uint32_t payloadSize = 0;
+  if (m_offset == m_data.size()) {
+    return false;
+  }
+  if (m_data.size() - m_offset < 1 + sizeof(payloadSize)) {
+    m_failed = true;
+    return false;
+  }
+  const uint8_t tag = m_data[m_offset];
+  std::memcpy(&payloadSize, m_data.data() + m_offset + 1, sizeof(payloadSize));
+  m_offset += 1 + sizeof(payloadSize);
+  if (m_data.size() - m_offset < payloadSize) {
+    m_failed = true;
+    return false;
+  }
+  const uint8_t* data = m_data.data() + m_offset;
+  m_offset += payloadSize;
+  command = static_cast<CaptureCommand>(tag & ~kCaptureCompressed);
+  if (!(tag & kCaptureCompressed)) {
+    payload = CaptureParser(data, payloadSize);
+    return true;
+  }
+  uint32_t rawSize = 0;
+  if (payloadSize < sizeof(rawSize)) {
+    m_failed = true;
+    return false;
+  }
+  std::memcpy(&rawSize, data, sizeof(rawSize));
+  // LZ4 expands a block by at most 255 times
+  if (rawSize / 255 > payloadSize) {
+    m_failed = true;
+    return false;
+  }
+  m_decompressed.resize(rawSize);
+  if (!lz4Decompress(data + sizeof(rawSize), payloadSize - sizeof(rawSize), m_decompressed.data(), rawSize)) {
+    m_failed = true;
+    return false;
+  }
+  payload = CaptureParser(m_decompressed.data(), m_decompressed.size());
+  return true;
+}
+
+void printGpuCaptureStats(const GpuCaptureStats& stats) {
+  const double ratio = stats.bytesWritten > 0 ? static_cast<double>(stats.bytesCaptured) / static_cast<double>(stats.bytesWritten) : 0.0;
+  std::cout << std::fixed << std::setprecision(2) << "Capture: " << stats.frames << " frames, " << stats.records << " records, "
+            << stats.bytesWritten << " bytes (" << ratio << "x compressed)";
+  if (stats.untrackedHandles > 0) {
+    std::cout << ", " << stats.untrackedHandles << " references to objects created outside the capture";
+  }
+  std::cout << std::defaultfloat << std::endl;
+}
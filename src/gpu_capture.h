@@ -0,0 +1,200 @@
+#ifndef WEBGPU_THINGY_SRC_GPU_CAPTURE_H_
+#define WEBGPU_THINGY_SRC_GPU_CAPTURE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+class DrawList;
+
+// Capture of the WebGPU calls that make up the app's frames, for replay by
+// capture-replay (tools/capture_replay.cc). A capture file starts with
+// kCaptureMagic and kCaptureVersion, followed by records: a CaptureCommand
+// byte, the payload size as a uint32 and the payload. Fields are
+// little-endian, strings are prefixed with their uint32 size. Payloads
+// larger than kCaptureCompressThreshold are LZ4 compressed: the command has
+// kCaptureCompressed set and the payload starts with its uncompressed size.
+//
+// Objects are numbered in creation order, 0 is none, up to
+// kCaptureMaxObjects: replay rejects larger ids and recording stops there.
+// Passes are recorded as their attachments and the sorted commands of the draw list, not as
+// individual encoder calls, and target the swap chain image, which replay
+// replaces with a texture of the same format and size.
+
+constexpr char kCaptureMagic[4] = { 'W', 'G', 'C', 'P' };
+constexpr uint32_t kCaptureVersion = 1;
+constexpr uint8_t kCaptureCompressed = 0x80;
+constexpr size_t kCaptureCompressThreshold = 256;
+constexpr uint32_t kCaptureMaxObjects = 1u << 20;
+
+enum class CaptureCommand : uint8_t {
+  CreateBuffer = 1,      // id, usage, size u64, label
+  DestroyBuffer,         // id
+  WriteBuffer,           // id, offset u64, data (size u64 then bytes)
+  CopyBuffer,            // source, source offset u64, destination, destination offset u64, size u64; submitted at once
+  CreateTexture,         // id, usage, dimension, width, height, depth or layers, format, mips, samples, label
+  DestroyTexture,        // id
+  CreateTextureView,     // id, texture, format, dimension, aspect, base mip, mips, base layer, layers
+  CreateShaderModule,    // id, WGSL source
+  CreatePipelineLayout,  // id; the app binds no groups
+  CreateRenderPipeline,  // id, then the descriptor, see GpuCapture::createRenderPipeline
+  RenderPass,            // color target and depth attachment, then the draws
+  EndFrame,              // frame index, captured frame time in ms (f64)
+};
+
+// Builds a record payload
+class CaptureWriter {
+public:
+  explicit CaptureWriter(std::vector<uint8_t>& data) : m_data(data) {}
+
+  template <typename T>
+  void put(T value) {
+    static_assert(std::is_arithmetic_v<T>, "Only numbers are written as is");
+    const size_t offset = m_data.size();
+    m_data.resize(offset + sizeof(T));
+    std::memcpy(m_data.data() + offset, &value, sizeof(T));
+  }
+  void putString(std::string_view text);
+  void putBytes(const void* data, size_t size);
+
+private:
+  std::vector<uint8_t>& m_data;
+};
+
+// Reads a record payload. Reading past the end returns zeros and clears ok().
+class CaptureParser {
+public:
+  CaptureParser() = default;
+  CaptureParser(const uint8_t* data, size_t size) : m_data(data), m_end(data + size) {}
+
+  template <typename T>
+  T get() {
+    static_assert(std::is_arithmetic_v<T>, "Only numbers are read as is");
+    T value{};
+    if (static_cast<size_t>(m_end - m_data) < sizeof(T)) {
+      m_ok = false;
+      m_data = m_end;
+      return value;
+    }
+    std::memcpy(&value, m_data, sizeof(T));
+    m_data += sizeof(T);
+    return value;
+  }
+  // An object id, 0 and a failed parse past kCaptureMaxObjects
+  uint32_t getId() {
+    const uint32_t id = get<uint32_t>();
+    if (id > kCaptureMaxObjects) {
+      m_ok = false;
+      return 0;
+    }
+    return id;
+  }
+  // A count of elements that follow, each of at least `elementSize` bytes,
+  // 0 and a failed parse when the rest of the payload cannot hold them
+  uint32_t getCount(size_t elementSize) {
+    const uint32_t count = get<uint32_t>();
+    if (count > static_cast<size_t>(m_end - m_data) / elementSize) {
+      m_ok = false;
+      m_data = m_end;
+      return 0;
+    }
+    return count;
+  }
+  // Views into the payload, valid until the next record is read
+  std::string_view getString();
+  const uint8_t* getBytes(uint64_t& size);
+
+  bool ok() const { return m_ok; }
+
+private:
+  const uint8_t* m_data = nullptr;
+  const uint8_t* m_end = nullptr;
+  bool m_ok = true;
+};
+
+struct GpuCaptureStats {
+  uint64_t records = 0;
+  uint64_t frames = 0;
+  uint64_t bytesWritten = 0;  // To the file, compressed
+  uint64_t bytesCaptured = 0;  // Before compression
+  uint64_t untrackedHandles = 0;  // Referenced objects created outside the capture
+};
+
+// Records the calls passed to it. Every method is a no-op once the file
+// failed. Safe to call from several threads.
+class GpuCapture {
+public:
+  explicit GpuCapture(const std::filesystem::path& path);
+  ~GpuCapture();
+  GpuCapture(const GpuCapture&) = delete;
+  GpuCapture& operator=(const GpuCapture&) = delete;
+
+  bool isOpen() const { return m_file.is_open() && m_file.good(); }
+
+  void createBuffer(wgpu::Buffer buffer, const wgpu::BufferDescriptor& descriptor);
+  void destroyBuffer(wgpu::Buffer buffer);
+  void writeBuffer(wgpu::Buffer buffer, uint64_t offset, const void* data, size_t size);
+  void copyBuffer(wgpu::Buffer source, uint64_t sourceOffset, wgpu::Buffer destination, uint64_t destinationOffset, uint64_t size);
+  void createTexture(wgpu::Texture texture, const wgpu::TextureDescriptor& descriptor);
+  void destroyTexture(wgpu::Texture texture);
+  void createTextureView(wgpu::TextureView view, wgpu::Texture texture, const wgpu::TextureViewDescriptor& descriptor);
+  void createShaderModule(wgpu::ShaderModule module, const std::string& source);
+  void createPipelineLayout(wgpu::PipelineLayout layout, const wgpu::PipelineLayoutDescriptor& descriptor);
+  void createRenderPipeline(wgpu::RenderPipeline pipeline, const wgpu::RenderPipelineDescriptor& descriptor);
+  // The color attachment is the swap chain image, of `colorFormat` and the given size.
+  // `drawList` must be sorted.
+  void renderPass(const wgpu::RenderPassDescriptor& descriptor, wgpu::TextureFormat colorFormat, uint32_t width, uint32_t height,
+                  const DrawList& drawList);
+  void endFrame();
+
+  GpuCaptureStats stats() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  uint32_t addObject(const void* handle);
+  // 0 for null handles and objects the capture did not see created; m_mutex held
+  uint32_t objectId(const void* handle);
+  void removeObject(const void* handle);
+  // Writes m_payload as a record; m_mutex held
+  void writeRecord(CaptureCommand command);
+
+  mutable std::mutex m_mutex;
+  std::ofstream m_file;
+  std::unordered_map<const void*, uint32_t> m_objects;
+  uint32_t m_nextId = 1;
+  std::vector<uint8_t> m_payload;
+  std::vector<uint8_t> m_compressed;
+  Clock::time_point m_lastFrame;
+  GpuCaptureStats m_stats;
+};
+
+// Reads the records of a capture file, loaded whole into memory
+class CaptureReader {
+public:
+  // Returns false if the file cannot be read or is not a capture of this version
+  bool open(const std::filesystem::path& path);
+  // Returns false at the end of the file or on a malformed record
+  bool next(CaptureCommand& command, CaptureParser& payload);
+  bool failed() const { return m_failed; }
+
+private:
+  std::vector<uint8_t> m_data;
+  size_t m_offset = 0;
+  std::vector<uint8_t> m_decompressed;
+  bool m_failed = false;
+};
+
+void printGpuCaptureStats(const GpuCaptureStats& stats);
+
+#endif //WEBGPU_THINGY_SRC_GPU_CAPTURE_H_
@@ -0,0 +1,124 @@
+#include "gpu_pass_timer.h"
+#include <algorithm>
+#include <cstring>
+#include "gpu_resources.h"
+#include "trace.h"
+#include "utils.h"
+
+GpuPassTimer::GpuPassTimer(wgpu::Device device, wgpu::Queue queue, GpuResources& resources)
+  : m_device(device)
+  , m_queue(queue)
+  , m_resources(resources)
+{
+  if (!m_device.hasFeature(wgpu::FeatureName::TimestampQuery)) {
+    return;
+  }
+  wgpu::QuerySetDescriptor querySetDesc;
+  querySetDesc.label = "Pass timestamps";
+  querySetDesc.type = wgpu::QueryType::Timestamp;
+  querySetDesc.count = 2 * kSlots;
+  querySetDesc.pipelineStatistics = nullptr;
+  querySetDesc.pipelineStatisticsCount = 0;
+  m_querySet = m_resources.createQuerySet(querySetDesc);
+
+  wgpu::BufferDescriptor bufferDesc;
+  bufferDesc.label = "Pass timestamp resolve";
+  bufferDesc.size = kResolveAlignment * kSlots;
+  bufferDesc.usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc;
+  bufferDesc.mappedAtCreation = false;
+  m_resolveBuffer = m_resources.createBuffer(bufferDesc);
+  bufferDesc.label = "Pass timestamp readback";
+  bufferDesc.size = 2 * sizeof(uint64_t);
+  bufferDesc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+  for (Slot& slot : m_slots) {
+    slot.readback = m_resources.createBuffer(bufferDesc);
+  }
+}
+
+GpuPassTimer::~GpuPassTimer() {
+  // The callbacks of pending readbacks must run before they are freed
+  auto mapping = [this]() {
+    return std::any_of(m_slots.begin(), m_slots.end(), [](const Slot& slot) { return slot.state == SlotState::Mapping; });
+  };
+  while (mapping()) {
+    pollDevice(m_device, m_queue);
+  }
+  for (Slot& slot : m_slots) {
+    m_resources.destroy(slot.readback);
+  }
+  m_resources.destroy(m_resolveBuffer);
+  m_resources.destroy(m_querySet);
+}
+
+void GpuPassTimer::beginPass(wgpu::RenderPassDescriptor& descriptor, const char* name) {
+  m_current = kSlots;
+  if (!available() || m_slots[m_next].state != SlotState::Free) {
+    return;
+  }
+  m_current = m_next;
+  Slot& slot = m_slots[m_current];
+  slot.state = SlotState::Encoded;
+  slot.name = name;
+  const uint32_t first = static_cast<uint32_t>(2 * m_current);
+  m_writes[0] = WGPURenderPassTimestampWrite{ m_querySet, first, WGPURenderPassTimestampLocation_Beginning };
+  m_writes[1] = WGPURenderPassTimestampWrite{ m_querySet, first + 1, WGPURenderPassTimestampLocation_End };
+  descriptor.timestampWriteCount = m_writes.size();
+  descriptor.timestampWrites = m_writes.data();
+}
+
+void GpuPassTimer::resolve(wgpu::CommandEncoder encoder) {
+  if (m_current == kSlots) {
+    return;
+  }
+  Slot& slot = m_slots[m_current];
+  encoder.resolveQuerySet(m_querySet, static_cast<uint32_t>(2 * m_current), 2, m_resolveBuffer, kResolveAlignment * m_current);
+  encoder.copyBufferToBuffer(m_resolveBuffer, kResolveAlignment * m_current, slot.readback, 0, 2 * sizeof(uint64_t));
+  slot.state = SlotState::Resolved;
+}
+
+void GpuPassTimer::submitted() {
+  if (m_current == kSlots || m_slots[m_current].state != SlotState::Resolved) {
+    m_current = kSlots;
+    return;
+  }
+  const size_t index = m_current;
+  Slot& slot = m_slots[index];
+  slot.submitNs = traceNow();
+  slot.state = SlotState::Mapping;
+  slot.mapCallback = slot.readback.mapAsync(wgpu::MapMode::Read, 0, 2 * sizeof(uint64_t), [this, index](wgpu::BufferMapAsyncStatus status) {
+    mapped(index, status == wgpu::BufferMapAsyncStatus::Success);
+  });
+  m_next = (m_current + 1) % kSlots;
+  m_current = kSlots;
+}
+
+size_t GpuPassTimer::pendingReadbacks() const {
+  return std::count_if(m_slots.begin(), m_slots.end(), [](const Slot& slot) { return slot.state == SlotState::Mapping; });
+}
+
+void GpuPassTimer::mapped(size_t index, bool success) {
+  const int64_t doneNs = traceNow();
+  Slot& slot = m_slots[index];
+  slot.state = SlotState::Free;
+  if (!success) {
+    return;
+  }
+  uint64_t timestamps[2];
+  std::memcpy(timestamps, slot.readback.getConstMappedRange(0, sizeof(timestamps)), sizeof(timestamps));
+  slot.readback.unmap();
+  if (timestamps[1] <= timestamps[0]) {
+    return;
+  }
+  m_lastPassMs = static_cast<double>(timestamps[1] - timestamps[0]) / 1e6;
+  // The pass started after the submit and ended before the readback
+  // completed. The smallest offset seen so far that still fits both is the
+  // tightest bound, and keeps the placement stable from frame to frame.
+  const int64_t begin = static_cast<int64_t>(timestamps[0]);
+  const int64_t end = static_cast<int64_t>(timestamps[1]);
+  const int64_t earliest = slot.submitNs - begin;
+  const int64_t latest = doneNs - end;
+  m_offsetNs = m_synced ? std::min(m_offsetNs, latest) : latest;
+  m_offsetNs = std::max(m_offsetNs, earliest);
+  m_synced = true;
+  traceGpuZone(slot.name, begin + m_offsetNs, end + m_offsetNs);
+}
@@ -0,0 +1,70 @@
+#ifndef WEBGPU_THINGY_SRC_GPU_PASS_TIMER_H_
+#define WEBGPU_THINGY_SRC_GPU_PASS_TIMER_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <webgpu/webgpu.hpp>
+
+class GpuResources;
+
+// Times render passes with timestamp queries, when the device has the
+// TimestampQuery feature, and adds them to the trace (see trace.h) on its
+// GPU track while tracing. The timestamps are read back without waiting, a frame or two
+// later, and shifted onto the CPU timeline so that each pass lies between
+// the submit of its frame and the completion of its readback: durations are
+// the GPU's, start times only as precise as that window. Timestamps are
+// taken to be in nanoseconds.
+class GpuPassTimer {
+public:
+  GpuPassTimer(wgpu::Device device, wgpu::Queue queue, GpuResources& resources);
+  ~GpuPassTimer();
+  GpuPassTimer(const GpuPassTimer&) = delete;
+  GpuPassTimer& operator=(const GpuPassTimer&) = delete;
+
+  // Whether the device writes timestamps
+  bool available() const { return m_querySet != nullptr; }
+
+  // Adds the timestamp writes of a pass named `name` to `descriptor`, unless
+  // every readback is still in flight
+  void beginPass(wgpu::RenderPassDescriptor& descriptor, const char* name);
+  // After the pass ended, before the encoder is finished
+  void resolve(wgpu::CommandEncoder encoder);
+  // After the submit, starts reading the timestamps back
+  void submitted();
+  // Readbacks whose mapAsync has not called back, about the frames still on the GPU
+  size_t pendingReadbacks() const;
+  // GPU time of the latest pass read back, negative before the first
+  double lastPassMs() const { return m_lastPassMs; }
+
+private:
+  static constexpr size_t kSlots = 4;
+  static constexpr uint64_t kResolveAlignment = 256;  // Of resolveQuerySet's destination offset
+  enum class SlotState : uint8_t { Free, Encoded, Resolved, Mapping };
+
+  struct Slot {
+    wgpu::Buffer readback = nullptr;
+    SlotState state = SlotState::Free;
+    const char* name = nullptr;
+    int64_t submitNs = 0;
+    std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+  };
+
+  void mapped(size_t slot, bool success);
+
+  wgpu::Device m_device;
+  wgpu::Queue m_queue;
+  GpuResources& m_resources;
+  wgpu::QuerySet m_querySet = nullptr;
+  wgpu::Buffer m_resolveBuffer = nullptr;
+  std::array<Slot, kSlots> m_slots;
+  std::array<WGPURenderPassTimestampWrite, 2> m_writes = {};
+  size_t m_current = kSlots;  // Slot of the pass being encoded, kSlots for none
+  size_t m_next = 0;
+  bool m_synced = false;
+  int64_t m_offsetNs = 0;  // From GPU timestamps to traceNow()
+  double m_lastPassMs = -1.0;
+};
+
+#endif //WEBGPU_THINGY_SRC_GPU_PASS_TIMER_H_
@@ -0,0 +1,283 @@
+#include "gpu_resources.h"
+#include <algorithm>
+#include <charconv>
+#include <iomanip>
+#include <iostream>
+#include "gpu_capture.h"
+#include "log.h"
+
+namespace {
+
+GpuResourceCategory bufferCategory(uint32_t usage) {
+  if (usage & WGPUBufferUsage_Index) return GpuResourceCategory::IndexBuffer;
+  if (usage & WGPUBufferUsage_Vertex) return GpuResourceCategory::VertexBuffer;
+  if (usage & WGPUBufferUsage_Uniform) return GpuResourceCategory::UniformBuffer;
+  if (usage & WGPUBufferUsage_Storage) return GpuResourceCategory::StorageBuffer;
+  if (usage & WGPUBufferUsage_QueryResolve) return GpuResourceCategory::QueryBuffer;
+  if (usage & (WGPUBufferUsage_MapRead | WGPUBufferUsage_MapWrite)) return GpuResourceCategory::StagingBuffer;
+  return GpuResourceCategory::OtherBuffer;
+}
+
+bool isDepthFormat(wgpu::TextureFormat format) {
+  return format == wgpu::TextureFormat::Depth16Unorm || format == wgpu::TextureFormat::Depth24Plus ||
+         format == wgpu::TextureFormat::Depth24PlusStencil8 || format == wgpu::TextureFormat::Depth32Float;
+}
+
+// Formats the app uses; others are assumed to take 4 bytes per texel
+uint32_t bytesPerTexel(wgpu::TextureFormat format) {
+  switch (format) {
+  case wgpu::TextureFormat::R8Unorm:
+    return 1;
+  case wgpu::TextureFormat::R16Float:
+  case wgpu::TextureFormat::R16Uint:
+  case wgpu::TextureFormat::Depth16Unorm:
+    return 2;
+  case wgpu::TextureFormat::RGBA16Float:
+  case wgpu::TextureFormat::RG32Float:
+    return 8;
+  case wgpu::TextureFormat::RGBA32Float:
+    return 16;
+  default:
+    return 4;
+  }
+}
+
+double toMiB(uint64_t bytes) {
+  return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+} // namespace
+
+const char* gpuResourceCategoryName(GpuResourceCategory category) {
+  switch (category) {
+  case GpuResourceCategory::VertexBuffer: return "vertex buffers";
+  case GpuResourceCategory::IndexBuffer: return "index buffers";
+  case GpuResourceCategory::UniformBuffer: return "uniform buffers";
+  case GpuResourceCategory::StorageBuffer: return "storage buffers";
+  case GpuResourceCategory::StagingBuffer: return "staging buffers";
+  case GpuResourceCategory::QueryBuffer: return "query buffers";
+  case GpuResourceCategory::OtherBuffer: return "other buffers";
+  case GpuResourceCategory::RenderTarget: return "render targets";
+  case GpuResourceCategory::DepthTarget: return "depth targets";
+  case GpuResourceCategory::Texture: return "textures";
+  case GpuResourceCategory::QuerySet: return "query sets";
+  case GpuResourceCategory::PipelineLayout: return "pipeline layouts";
+  case GpuResourceCategory::Count: break;
+  }
+  return "unknown";
+}
+
+uint64_t textureSizeInBytes(const wgpu::TextureDescriptor& descriptor) {
+  uint64_t texel = bytesPerTexel(descriptor.format);
+  uint64_t width = descriptor.size.width;
+  uint64_t height = descriptor.size.height;
+  uint64_t depth = descriptor.size.depthOrArrayLayers;
+  const bool volume = descriptor.dimension == wgpu::TextureDimension::_3D;
+  uint64_t bytes = 0;
+  for (uint32_t level = 0; level < std::max(descriptor.mipLevelCount, 1u); ++level) {
+    bytes += width * height * std::max<uint64_t>(depth, 1) * texel;
+    width = std::max<uint64_t>(width / 2, 1);
+    height = std::max<uint64_t>(height / 2, 1);
+    if (volume) {
+      depth = std::max<uint64_t>(depth / 2, 1);
+    }
+  }
+  return bytes * std::max(descriptor.sampleCount, 1u);
+}
+
+GpuResources::GpuResources(wgpu::Device device, GpuCapture* capture) : m_device(device), m_capture(capture) {}
+
+wgpu::Buffer GpuResources::createBuffer(const wgpu::BufferDescriptor& descriptor, GpuResourceSite site) {
+  wgpu::Buffer buffer = m_device.createBuffer(descriptor);
+  if (buffer) {
+    track(buffer, bufferCategory(descriptor.usage), descriptor.size, descriptor.usage, descriptor.label, site);
+    if (m_capture) {
+      m_capture->createBuffer(buffer, descriptor);
+    }
+  }
+  return buffer;
+}
+
+wgpu::Texture GpuResources::createTexture(const wgpu::TextureDescriptor& descriptor, GpuResourceSite site) {
+  wgpu::Texture texture = m_device.createTexture(descriptor);
+  if (texture) {
+    GpuResourceCategory category = GpuResourceCategory::Texture;
+    if (isDepthFormat(descriptor.format)) {
+      category = GpuResourceCategory::DepthTarget;
+    } else if (descriptor.usage & WGPUTextureUsage_RenderAttachment) {
+      category = GpuResourceCategory::RenderTarget;
+    }
+    track(texture, category, textureSizeInBytes(descriptor), descriptor.usage, descriptor.label, site);
+    if (m_capture) {
+      m_capture->createTexture(texture, descriptor);
+    }
+  }
+  return texture;
+}
+
+wgpu::QuerySet GpuResources::createQuerySet(const wgpu::QuerySetDescriptor& descriptor, GpuResourceSite site) {
+  wgpu::QuerySet querySet = m_device.createQuerySet(descriptor);
+  if (querySet) {
+    // One 64-bit result per query
+    track(querySet, GpuResourceCategory::QuerySet, uint64_t(descriptor.count) * sizeof(uint64_t), 0, descriptor.label, site);
+  }
+  return querySet;
+}
+
+wgpu::PipelineLayout GpuResources::createPipelineLayout(const wgpu::PipelineLayoutDescriptor& descriptor, GpuResourceSite site) {
+  wgpu::PipelineLayout layout = m_device.createPipelineLayout(descriptor);
+  if (layout) {
+    track(layout, GpuResourceCategory::PipelineLayout, 0, 0, descriptor.label, site);
+    if (m_capture) {
+      m_capture->createPipelineLayout(layout, descriptor);
+    }
+  }
+  return layout;
+}
+
+void GpuResources::destroy(wgpu::Buffer& buffer) {
+  if (!buffer) {
+    return;
+  }
+  untrack(buffer);
+  if (m_capture) {
+    m_capture->destroyBuffer(buffer);
+  }
+  buffer.destroy();
+  buffer.release();
+  buffer = nullptr;
+}
+
+void GpuResources::destroy(wgpu::Texture& texture) {
+  if (!texture) {
+    return;
+  }
+  untrack(texture);
+  if (m_capture) {
+    m_capture->destroyTexture(texture);
+  }
+  texture.destroy();
+  texture.release();
+  texture = nullptr;
+}
+
+void GpuResources::destroy(wgpu::QuerySet& querySet) {
+  if (!querySet) {
+    return;
+  }
+  untrack(querySet);
+  querySet.destroy();
+  querySet.release();
+  querySet = nullptr;
+}
+
+void GpuResources::release(wgpu::PipelineLayout& layout) {
+  if (!layout) {
+    return;
+  }
+  untrack(layout);
+  layout.release();
+  layout = nullptr;
+}
+
+void GpuResources::setBudget(uint64_t bytes, GpuBudgetMode mode) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_report.budgetBytes = bytes;
+  m_budgetMode = mode;
+}
+
+bool GpuResources::overBudget() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_overBudget;
+}
+
+GpuResourceReport GpuResources::report() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_report;
+}
+
+size_t GpuResources::reportLeaks() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  // Every leak is listed, a rate limited site would drop all after the first
+  // burst, and the ring is drained on the way so that none is dropped there
+  size_t listed = 0;
+  for (const auto& [handle, record] : m_records) {
+    if (++listed % (kLogCapacity / 2) == 0) {
+      flushLog();
+    }
+    char usage[8];
+    auto result = std::to_chars(usage, usage + sizeof(usage), record.usage, 16);
+    LOG_WARNING_ALWAYS << "Leaked " << gpuResourceCategoryName(record.category) << " resource "
+                       << (record.label.empty() ? "(unlabeled)" : record.label.c_str()) << ", " << record.bytes
+                       << " bytes, usage 0x" << std::string_view(usage, static_cast<size_t>(result.ptr - usage))
+                       << ", created at " << record.site.file << ":" << record.site.line;
+  }
+  return m_records.size();
+}
+
+void GpuResources::track(const void* handle, GpuResourceCategory category, uint64_t bytes, uint32_t usage, const char* label,
+                         GpuResourceSite site) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_records[handle] = Record{ category, bytes, usage, label ? label : "", site };
+  auto add = [&](GpuResourceTotals& totals) {
+    totals.bytes += bytes;
+    totals.peakBytes = std::max(totals.peakBytes, totals.bytes);
+    ++totals.count;
+    totals.peakCount = std::max(totals.peakCount, totals.count);
+  };
+  add(m_report.categories[static_cast<size_t>(category)]);
+  add(m_report.total);
+  ++m_report.created;
+
+  const uint64_t budget = m_report.budgetBytes;
+  if (budget > 0 && m_report.total.bytes > budget && !m_overBudget) {
+    m_overBudget = true;
+    ++m_report.budgetExceeded;
+    if (m_budgetMode == GpuBudgetMode::Fail) {
+      LOG_ERROR << "GPU memory budget exceeded: " << toMiB(m_report.total.bytes) << " MiB of " << toMiB(budget)
+                << " MiB after " << (label ? label : "an unlabeled resource") << " at " << site.file << ":" << site.line;
+    } else {
+      LOG_WARNING << "GPU memory budget exceeded: " << toMiB(m_report.total.bytes) << " MiB of " << toMiB(budget)
+                  << " MiB after " << (label ? label : "an unlabeled resource") << " at " << site.file << ":" << site.line;
+    }
+  }
+}
+
+void GpuResources::untrack(const void* handle) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_records.find(handle);
+  if (it == m_records.end()) {
+    LOG_WARNING << "Destroying a GPU resource the registry did not create: " << handle;
+    return;
+  }
+  GpuResourceTotals& category = m_report.categories[static_cast<size_t>(it->second.category)];
+  category.bytes -= it->second.bytes;
+  --category.count;
+  m_report.total.bytes -= it->second.bytes;
+  --m_report.total.count;
+  ++m_report.destroyed;
+  m_records.erase(it);
+  // Warn mode warns again on the next crossing; fail mode stays failed
+  if (m_budgetMode == GpuBudgetMode::Warn && m_report.total.bytes <= m_report.budgetBytes) {
+    m_overBudget = false;
+  }
+}
+
+void printGpuResourceReport(const GpuResourceReport& report) {
+  std::cout << std::fixed << std::setprecision(2) << "GPU memory: " << toMiB(report.total.bytes) << " MiB live in "
+            << report.total.count << " resources, peak " << toMiB(report.total.peakBytes) << " MiB, " << report.created
+            << " created / " << report.destroyed << " destroyed" << std::endl;
+  for (size_t i = 0; i < report.categories.size(); ++i) {
+    const GpuResourceTotals& totals = report.categories[i];
+    if (totals.peakCount == 0) {
+      continue;
+    }
+    std::cout << "  " << std::left << std::setw(18) << gpuResourceCategoryName(static_cast<GpuResourceCategory>(i))
+              << std::right << std::setw(10) << toMiB(totals.bytes) << " MiB live (" << totals.count << "), peak "
+              << toMiB(totals.peakBytes) << " MiB (" << totals.peakCount << ")" << std::endl;
+  }
+  if (report.budgetBytes > 0) {
+    std::cout << "  budget " << toMiB(report.budgetBytes) << " MiB, exceeded " << report.budgetExceeded << " times" << std::endl;
+  }
+  std::cout << std::defaultfloat;
+}
@@ -0,0 +1,132 @@
+#ifndef WEBGPU_THINGY_SRC_GPU_RESOURCES_H_
+#define WEBGPU_THINGY_SRC_GPU_RESOURCES_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <webgpu/webgpu.hpp>
+
+class GpuCapture;
+
+// Accounting of the GPU memory the app allocates. Buffers, textures, query
+// sets and pipeline layouts are created and destroyed through the registry,
+// which records their size, usage, label and creation site, keeps live
+// totals and high-water marks per category, enforces an optional budget and
+// lists what was never destroyed. Sizes are what the app asked for: drivers
+// add alignment and metadata, and the swap chain images are not included.
+
+enum class GpuResourceCategory : uint8_t {
+  VertexBuffer,
+  IndexBuffer,
+  UniformBuffer,
+  StorageBuffer,
+  StagingBuffer,  // Mappable, for uploads and readbacks
+  QueryBuffer,
+  OtherBuffer,
+  RenderTarget,
+  DepthTarget,
+  Texture,
+  QuerySet,
+  PipelineLayout,  // No memory of its own, tracked for leaks
+  Count,
+};
+
+const char* gpuResourceCategoryName(GpuResourceCategory category);
+
+// Where a resource was created, filled in by default arguments at the call site
+struct GpuResourceSite {
+  const char* file = "";
+  int line = 0;
+
+  static GpuResourceSite current(const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+    return { file, line };
+  }
+};
+
+enum class GpuBudgetMode : uint8_t {
+  Warn,  // Log a warning each time the total crosses the budget
+  Fail,  // Log an error and report overBudget() until shutdown
+};
+
+struct GpuResourceTotals {
+  uint64_t bytes = 0;
+  uint64_t peakBytes = 0;
+  uint32_t count = 0;
+  uint32_t peakCount = 0;
+};
+
+struct GpuResourceReport {
+  std::array<GpuResourceTotals, static_cast<size_t>(GpuResourceCategory::Count)> categories;
+  GpuResourceTotals total;
+  uint64_t created = 0;
+  uint64_t destroyed = 0;
+  uint64_t budgetBytes = 0;  // 0 without a budget
+  uint32_t budgetExceeded = 0;  // Times the total went over the budget
+};
+
+class GpuResources {
+public:
+  // With `capture`, buffer, texture and pipeline layout creation and
+  // destruction are recorded to it
+  explicit GpuResources(wgpu::Device device, GpuCapture* capture = nullptr);
+  GpuResources(const GpuResources&) = delete;
+  GpuResources& operator=(const GpuResources&) = delete;
+
+  // Same as the wgpu::Device methods. Return nullptr without creating
+  // anything if the device returned nullptr.
+  wgpu::Buffer createBuffer(const wgpu::BufferDescriptor& descriptor, GpuResourceSite site = GpuResourceSite::current());
+  wgpu::Texture createTexture(const wgpu::TextureDescriptor& descriptor, GpuResourceSite site = GpuResourceSite::current());
+  wgpu::QuerySet createQuerySet(const wgpu::QuerySetDescriptor& descriptor, GpuResourceSite site = GpuResourceSite::current());
+  wgpu::PipelineLayout createPipelineLayout(const wgpu::PipelineLayoutDescriptor& descriptor,
+                                            GpuResourceSite site = GpuResourceSite::current());
+
+  // Destroy and release the resource, then set the handle to nullptr. Null
+  // handles are ignored.
+  void destroy(wgpu::Buffer& buffer);
+  void destroy(wgpu::Texture& texture);
+  void destroy(wgpu::QuerySet& querySet);
+  void release(wgpu::PipelineLayout& layout);
+
+  // For the writes to the buffers, which the registry does not see
+  GpuCapture* capture() const { return m_capture; }
+
+  // 0 disables the budget
+  void setBudget(uint64_t bytes, GpuBudgetMode mode);
+  bool overBudget() const;
+
+  GpuResourceReport report() const;
+  // Logs every resource still alive with its label and creation site, and
+  // returns how many there are. Call at shutdown, once everything was destroyed.
+  size_t reportLeaks() const;
+
+private:
+  struct Record {
+    GpuResourceCategory category;
+    uint64_t bytes;
+    uint32_t usage;
+    std::string label;
+    GpuResourceSite site;
+  };
+
+  void track(const void* handle, GpuResourceCategory category, uint64_t bytes, uint32_t usage, const char* label,
+             GpuResourceSite site);
+  void untrack(const void* handle);
+
+  wgpu::Device m_device;
+  GpuCapture* m_capture;
+  mutable std::mutex m_mutex;  // Resources are created from the main and render threads
+  std::unordered_map<const void*, Record> m_records;
+  GpuResourceReport m_report;
+  GpuBudgetMode m_budgetMode = GpuBudgetMode::Warn;
+  bool m_overBudget = false;
+};
+
+// Bytes of a texture with all its mip levels, layers and samples
+uint64_t textureSizeInBytes(const wgpu::TextureDescriptor& descriptor);
+
+void printGpuResourceReport(const GpuResourceReport& report);
+
+#endif //WEBGPU_THINGY_SRC_GPU_RESOURCES_H_
@@ -0,0 +1,263 @@
+#include "hitch_detector.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <utility>
+#include "log.h"
+
+namespace {
+
+double nsToMs(int64_t ns) {
+  return static_cast<double>(ns) / 1e6;
+}
+
+// One past the highest sequence in the headers of the snapshots a previous
+// run left in `directory`, so that a new run overwrites the oldest of them
+uint64_t nextSnapshotSequence(const std::filesystem::path& directory) {
+  uint64_t next = 0;
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+    const std::string name = entry.path().filename().string();
+    if (name.rfind("hitch-", 0) != 0 || entry.path().extension() != ".txt") {
+      continue;
+    }
+    std::ifstream file(entry.path());
+    std::string word;
+    unsigned long long sequence = 0;
+    if (file >> word >> sequence && word == "Hitch") {
+      next = std::max<uint64_t>(next, sequence + 1);
+    }
+  }
+  return next;
+}
+
+} // namespace
+
+const char* framePhaseName(FramePhase phase) {
+  switch (phase) {
+  case FramePhase::Update: return "update";
+  case FramePhase::Acquire: return "acquire";
+  case FramePhase::Encode: return "encode";
+  case FramePhase::Submit: return "submit";
+  case FramePhase::Present: return "present";
+  case FramePhase::Count: break;
+  }
+  return "unknown";
+}
+
+HitchDetector::HitchDetector(const HitchDetectorSettings& settings)
+  : m_settings(settings)
+  , m_windowMs(std::max<size_t>(settings.windowFrames, 1), 0.0)
+  , m_scratchMs(m_windowMs.size(), 0.0)
+{
+  m_settings.maxSnapshots = std::max<size_t>(m_settings.maxSnapshots, 1);
+  for (Snapshot* snapshot : { &m_capture, &m_pending, &m_writing }) {
+    snapshot->zones.resize(kMaxZones);
+  }
+  std::error_code error;
+  std::filesystem::create_directories(m_settings.directory, error);
+  if (error) {
+    LOG_ERROR << "Could not create hitch snapshot directory " << m_settings.directory.string() << ": " << error.message();
+  }
+  m_snapshotSequence = nextSnapshotSequence(m_settings.directory);
+  m_writer = std::thread([this]() { writerLoop(); });
+}
+
+HitchDetector::~HitchDetector() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  m_writer.join();
+}
+
+void HitchDetector::beginFrame(uint64_t frameIndex) {
+  m_frameIndex = frameIndex;
+  m_frameStartNs = traceNow();
+  m_phaseStartNs = m_frameStartNs;
+  m_phaseMs.fill(0.0);
+}
+
+void HitchDetector::endPhase(FramePhase phase) {
+  const int64_t now = traceNow();
+  m_phaseMs[static_cast<size_t>(phase)] += nsToMs(now - m_phaseStartNs);
+  m_phaseStartNs = now;
+}
+
+void HitchDetector::note(const char* what, uint64_t bytes) {
+  m_events[m_eventCount % kMaxEvents] = Event{ m_frameIndex, traceNow(), what, bytes };
+  ++m_eventCount;
+}
+
+bool HitchDetector::endFrame(const AllocationCounts& allocations) {
+  const double frameMs = nsToMs(traceNow() - m_frameStartNs);
+  ++m_framesSeen;
+  // The median is compared against before the frame joins the window
+  const bool detecting = m_framesSeen > m_settings.warmupFrames && m_medianMs > 0.0;
+  const bool hitch = detecting && frameMs > m_settings.medianMultiple * m_medianMs;
+
+  m_windowMs[m_windowNext] = frameMs;
+  m_windowNext = (m_windowNext + 1) % m_windowMs.size();
+  m_windowCount = std::min(m_windowCount + 1, m_windowMs.size());
+  if (m_framesSeen % kMedianRefreshFrames == 0 || m_medianMs == 0.0) {
+    std::copy(m_windowMs.begin(), m_windowMs.begin() + static_cast<std::ptrdiff_t>(m_windowCount), m_scratchMs.begin());
+    auto middle = m_scratchMs.begin() + static_cast<std::ptrdiff_t>(m_windowCount / 2);
+    std::nth_element(m_scratchMs.begin(), middle, m_scratchMs.begin() + static_cast<std::ptrdiff_t>(m_windowCount));
+    m_medianMs = *middle;
+  }
+  if (!hitch) {
+    return false;
+  }
+
+  ++m_hitches;
+  if (m_snapshotTaken && m_frameIndex - m_lastSnapshotFrame < m_settings.cooldownFrames) {
+    ++m_snapshotsSkipped;
+    return true;
+  }
+  capture(m_capture, frameMs, allocations);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_hasPending) {
+      ++m_snapshotsSkipped;
+      return true;
+    }
+    std::swap(m_capture, m_pending);
+    m_hasPending = true;
+  }
+  m_wake.notify_one();
+  ++m_snapshotSequence;
+  m_snapshotTaken = true;
+  m_lastSnapshotFrame = m_frameIndex;
+  return true;
+}
+
+void HitchDetector::capture(Snapshot& snapshot, double frameMs, const AllocationCounts& allocations) {
+  snapshot.sequence = m_snapshotSequence;
+  snapshot.frame = m_frameIndex;
+  snapshot.unixSeconds = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+  snapshot.frameMs = frameMs;
+  snapshot.medianMs = m_medianMs;
+  snapshot.windowFrames = m_windowCount;
+  snapshot.frameStartNs = m_frameStartNs;
+  snapshot.phaseMs = m_phaseMs;
+  snapshot.allocations = allocations;
+  snapshot.pending = m_pendingWorkSampler ? m_pendingWorkSampler() : PendingWork{};
+  snapshot.eventCount = 0;
+  const uint64_t firstEvent = m_eventCount > kMaxEvents ? m_eventCount - kMaxEvents : 0;
+  for (uint64_t i = firstEvent; i < m_eventCount; ++i) {
+    const Event& event = m_events[i % kMaxEvents];
+    if (event.frame + kEventFrames >= m_frameIndex) {
+      snapshot.events[snapshot.eventCount++] = event;
+    }
+  }
+  snapshot.zoneCount = recentTraceZones(m_frameStartNs, snapshot.zones.data(), snapshot.zones.size());
+}
+
+void HitchDetector::writerLoop() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_wake.wait(lock, [this]() { return m_hasPending || m_stop; });
+    if (!m_hasPending) {
+      return;
+    }
+    std::swap(m_pending, m_writing);
+    m_hasPending = false;
+    lock.unlock();
+    const bool written = write(m_writing);
+    lock.lock();
+    if (written) {
+      ++m_snapshotsWritten;
+    }
+  }
+}
+
+bool HitchDetector::write(const Snapshot& snapshot) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "hitch-%02zu.txt", static_cast<size_t>(snapshot.sequence % m_settings.maxSnapshots));
+  const std::filesystem::path path = m_settings.directory / name;
+  std::ofstream file(path, std::ios::trunc);
+  file << std::fixed << std::setprecision(3);
+  file << "Hitch " << snapshot.sequence << " at frame " << snapshot.frame << ", Unix time " << snapshot.unixSeconds << "\n";
+  file << "Frame: " << snapshot.frameMs << " ms, " << snapshot.frameMs / snapshot.medianMs << "x the median of "
+       << snapshot.medianMs << " ms over " << snapshot.windowFrames << " frames\n";
+
+  file << "\nPhases:\n";
+  for (size_t i = 0; i < snapshot.phaseMs.size(); ++i) {
+    file << "  " << std::left << std::setw(10) << framePhaseName(static_cast<FramePhase>(i)) << std::right << std::setw(10)
+         << snapshot.phaseMs[i] << " ms\n";
+  }
+
+  file << "\nAllocations: ";
+  if (allocationCountingEnabled()) {
+    file << snapshot.allocations.allocations << " (" << snapshot.allocations.bytes << " bytes), " << snapshot.allocations.frees
+         << " frees on the rendering thread\n";
+  } else {
+    file << "not counted, build with COUNT_ALLOCATIONS\n";
+  }
+  file << "Pending: " << snapshot.pending.gpuReadbacks << " GPU readbacks, " << snapshot.pending.meshStreamIns
+       << " mesh stream-ins, " << snapshot.pending.fileReads << " file reads\n";
+
+  file << "\nEvents of the last " << kEventFrames << " frames:\n";
+  if (snapshot.eventCount == 0) {
+    file << "  none\n";
+  }
+  for (size_t i = 0; i < snapshot.eventCount; ++i) {
+    const Event& event = snapshot.events[i];
+    file << "  frame " << event.frame << " (" << nsToMs(event.timeNs - snapshot.frameStartNs) << " ms)  " << event.what;
+    if (event.bytes > 0) {
+      file << ", " << event.bytes << " bytes";
+    }
+    file << "\n";
+  }
+
+  file << "\nTrace zones of the frame (rendering thread, start and duration in ms):\n";
+  if (!kTracingBuilt) {
+    file << "  none, build with TRACING\n";
+  } else if (snapshot.zoneCount == 0) {
+    file << "  none, tracing is not started\n";
+  }
+  std::vector<const TraceEvent*> zones;
+  for (size_t i = 0; i < snapshot.zoneCount; ++i) {
+    zones.push_back(&snapshot.zones[i]);
+  }
+  // Recorded as they end, listed as they start with the outer ones first
+  std::sort(zones.begin(), zones.end(), [](const TraceEvent* a, const TraceEvent* b) {
+    return a->beginNs != b->beginNs ? a->beginNs < b->beginNs : a->endNs > b->endNs;
+  });
+  std::vector<int64_t> open;
+  for (const TraceEvent* zone : zones) {
+    while (!open.empty() && open.back() <= zone->beginNs) {
+      open.pop_back();
+    }
+    file << "  " << std::setw(10) << nsToMs(zone->beginNs - snapshot.frameStartNs) << std::setw(10)
+         << nsToMs(zone->endNs - zone->beginNs) << "  " << std::string(2 * open.size(), ' ') << zone->name << "\n";
+    open.push_back(zone->endNs);
+  }
+
+  if (!file) {
+    LOG_ERROR << "Could not write hitch snapshot " << path.string();
+    return false;
+  }
+  return true;
+}
+
+HitchStats HitchDetector::stats() const {
+  HitchStats stats;
+  stats.frames = m_framesSeen;
+  stats.hitches = m_hitches;
+  stats.snapshotsSkipped = m_snapshotsSkipped;
+  stats.medianMs = m_medianMs;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  stats.snapshotsWritten = m_snapshotsWritten;
+  return stats;
+}
+
+void printHitchStats(const HitchStats& stats) {
+  std::cout << std::fixed << std::setprecision(2) << "Hitches: " << stats.hitches << " in " << stats.frames
+            << " frames (median " << stats.medianMs << " ms), " << stats.snapshotsWritten << " snapshots written, "
+            << stats.snapshotsSkipped << " skipped" << std::defaultfloat << std::endl;
+}
@@ -0,0 +1,155 @@
+#ifndef WEBGPU_THINGY_SRC_HITCH_DETECTOR_H_
+#define WEBGPU_THINGY_SRC_HITCH_DETECTOR_H_
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "alloc_counter.h"
+#include "trace.h"
+
+// Phases of a frame, in order, each ending where the next starts
+enum class FramePhase : uint8_t {
+  Update,   // Reloads, feed, instances, mesh residency
+  Acquire,  // Of the swap chain image
+  Encode,
+  Submit,
+  Present,
+  Count,
+};
+
+const char* framePhaseName(FramePhase phase);
+
+// Asynchronous work still outstanding when a snapshot is taken
+struct PendingWork {
+  size_t gpuReadbacks = 0;  // mapAsync calls not called back, one per frame on the GPU while passes are timed
+  size_t meshStreamIns = 0;
+  size_t fileReads = 0;
+};
+
+struct HitchDetectorSettings {
+  double medianMultiple = 3.0;  // Frames longer than this many medians are hitches
+  size_t windowFrames = 240;    // Of the rolling frame time distribution
+  size_t warmupFrames = 60;     // Before the first detection
+  size_t cooldownFrames = 60;   // Between snapshots, so that a burst of hitches does not rotate the ring
+  std::filesystem::path directory;
+  size_t maxSnapshots = 16;     // Files in the ring, the oldest is overwritten, also across runs
+};
+
+struct HitchStats {
+  uint64_t frames = 0;
+  uint64_t hitches = 0;
+  uint64_t snapshotsWritten = 0;
+  uint64_t snapshotsSkipped = 0;  // In the cooldown, or while the previous one was being written
+  double medianMs = 0.0;
+};
+
+// Keeps a rolling distribution of frame times, and when a frame takes more
+// than a multiple of the median, writes a snapshot of it to a ring of files:
+// the time of each phase, the trace zones of the frame, its heap
+// allocations, the outstanding asynchronous work and the reload and upload
+// events of the last frames. Trace zones need tracing to be started, best
+// with TraceBufferMode::KeepLatest.
+//
+// All calls come from the rendering thread. Frames that are not hitches
+// neither lock nor allocate; a snapshot is copied into preallocated storage
+// and written by a thread of the detector.
+class HitchDetector {
+public:
+  explicit HitchDetector(const HitchDetectorSettings& settings);
+  ~HitchDetector();
+  HitchDetector(const HitchDetector&) = delete;
+  HitchDetector& operator=(const HitchDetector&) = delete;
+
+  // Called for each snapshot
+  void setPendingWorkSampler(std::function<PendingWork()> sampler) { m_pendingWorkSampler = std::move(sampler); }
+
+  void beginFrame(uint64_t frameIndex);
+  // Ends `phase` now; phases that are skipped take no time
+  void endPhase(FramePhase phase);
+  // Records a reload, an upload or another event that may explain a hitch.
+  // `what` is kept as a pointer, a string literal.
+  void note(const char* what, uint64_t bytes = 0);
+  // Returns whether the frame was a hitch
+  bool endFrame(const AllocationCounts& allocations);
+
+  HitchStats stats() const;
+
+private:
+  static constexpr size_t kMaxEvents = 32;
+  static constexpr size_t kMaxZones = 512;
+  static constexpr uint64_t kEventFrames = 120;  // Events older than this are left out of a snapshot
+  static constexpr uint64_t kMedianRefreshFrames = 16;
+
+  struct Event {
+    uint64_t frame = 0;
+    int64_t timeNs = 0;
+    const char* what = nullptr;
+    uint64_t bytes = 0;
+  };
+
+  struct Snapshot {
+    uint64_t sequence = 0;
+    uint64_t frame = 0;
+    double unixSeconds = 0.0;
+    double frameMs = 0.0;
+    double medianMs = 0.0;
+    size_t windowFrames = 0;
+    int64_t frameStartNs = 0;
+    std::array<double, static_cast<size_t>(FramePhase::Count)> phaseMs = {};
+    AllocationCounts allocations;
+    PendingWork pending;
+    std::array<Event, kMaxEvents> events = {};
+    size_t eventCount = 0;
+    std::vector<TraceEvent> zones;
+    size_t zoneCount = 0;
+  };
+
+  void capture(Snapshot& snapshot, double frameMs, const AllocationCounts& allocations);
+  void writerLoop();
+  bool write(const Snapshot& snapshot);
+
+  HitchDetectorSettings m_settings;
+  std::function<PendingWork()> m_pendingWorkSampler;
+
+  // Rendering thread
+  std::vector<double> m_windowMs;
+  std::vector<double> m_scratchMs;  // For nth_element
+  size_t m_windowCount = 0;
+  size_t m_windowNext = 0;
+  double m_medianMs = 0.0;
+  uint64_t m_frameIndex = 0;
+  uint64_t m_framesSeen = 0;
+  uint64_t m_lastSnapshotFrame = 0;
+  bool m_snapshotTaken = false;
+  int64_t m_frameStartNs = 0;
+  int64_t m_phaseStartNs = 0;
+  std::array<double, static_cast<size_t>(FramePhase::Count)> m_phaseMs = {};
+  std::array<Event, kMaxEvents> m_events = {};
+  uint64_t m_eventCount = 0;
+  uint64_t m_hitches = 0;
+  uint64_t m_snapshotsSkipped = 0;
+  uint64_t m_snapshotSequence = 0;  // Of the next one handed to the writer
+  Snapshot m_capture;
+
+  // Shared with the writer
+  mutable std::mutex m_mutex;
+  std::condition_variable m_wake;
+  Snapshot m_pending;
+  bool m_hasPending = false;
+  bool m_stop = false;
+  uint64_t m_snapshotsWritten = 0;
+
+  Snapshot m_writing;  // Writer thread
+  std::thread m_writer;
+};
+
+void printHitchStats(const HitchStats& stats);
+
+#endif //WEBGPU_THINGY_SRC_HITCH_DETECTOR_H_
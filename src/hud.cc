@@ -0,0 +1,534 @@
+#include "hud.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "gpu_resources.h"
+#include "log.h"
+#include "utils.h"
+
+#define NK_INCLUDE_FIXED_TYPES
+#define NK_INCLUDE_DEFAULT_ALLOCATOR
+#define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
+#define NK_INCLUDE_FONT_BAKING
+#define NK_INCLUDE_DEFAULT_FONT
+#define NK_IMPLEMENTATION
+#include <nuklear.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// What nk_convert writes, see kVertexLayout
+struct HudVertex {
+  float position[2];
+  float uv[2];
+  uint8_t color[4];
+};
+
+const struct nk_draw_vertex_layout_element kVertexLayout[] = {
+  { NK_VERTEX_POSITION, NK_FORMAT_FLOAT, offsetof(HudVertex, position) },
+  { NK_VERTEX_TEXCOORD, NK_FORMAT_FLOAT, offsetof(HudVertex, uv) },
+  { NK_VERTEX_COLOR, NK_FORMAT_R8G8B8A8, offsetof(HudVertex, color) },
+  { NK_VERTEX_LAYOUT_END },
+};
+
+struct HudUniforms {
+  float screenSize[2];
+  float decodeSrgb;  // 1 on an sRGB target, whose writes encode the colors nuklear gives encoded
+  float padding;
+};
+
+const char* kHudShader = R"(
+struct Uniforms {
+  screen_size: vec2f,
+  decode_srgb: f32,
+};
+
+struct VertexOutput {
+  @builtin(position) position: vec4f,
+  @location(0) uv: vec2f,
+  @location(1) color: vec4f,
+};
+
+@group(0) @binding(0) var<uniform> uniforms: Uniforms;
+@group(0) @binding(1) var font_atlas: texture_2d<f32>;
+@group(0) @binding(2) var font_sampler: sampler;
+
+fn srgb_to_linear(c: vec3f) -> vec3f {
+  return select(pow((c + 0.055) / 1.055, vec3f(2.4)), c / 12.92, c <= vec3f(0.04045));
+}
+
+@vertex
+fn vs_main(@location(0) position: vec2f, @location(1) uv: vec2f, @location(2) color: vec4f) -> VertexOutput {
+  var out: VertexOutput;
+  let ndc = position / uniforms.screen_size * 2.0 - 1.0;
+  out.position = vec4f(ndc.x, -ndc.y, 0.0, 1.0);
+  out.uv = uv;
+  out.color = color;
+  if (uniforms.decode_srgb > 0.5) {
+    out.color = vec4f(srgb_to_linear(color.rgb), color.a);
+  }
+  return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+  return in.color * textureSample(font_atlas, font_sampler, in.uv);
+}
+)";
+
+constexpr float kFontHeight = 13.0f;
+constexpr float kWindowWidth = 320.0f;
+constexpr float kWindowHeight = 300.0f;
+constexpr float kMinGraphMs = 20.0f;  // The graphs scale up from this
+constexpr size_t kContextMemory = 256 * 1024;  // Of nuklear's windows and command buffer
+constexpr size_t kCommandMemory = 64 * 1024;   // Of the converted draw commands
+
+double toMiB(uint64_t bytes) {
+  return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+uint64_t alignTo4(uint64_t size) {
+  return (size + 3) & ~uint64_t(3);
+}
+
+} // namespace
+
+struct PerformanceHud::Nuklear {
+  nk_context context;
+  nk_font_atlas atlas;
+  nk_draw_null_texture whitePixel;
+  nk_convert_config config;
+  std::vector<uint8_t> contextMemory;
+  std::vector<uint8_t> commandMemory;
+  std::vector<uint8_t> vertexMemory;
+  std::vector<uint8_t> indexMemory;
+  nk_buffer commands;
+  nk_buffer vertices;
+  nk_buffer indices;
+  bool initialized = false;
+};
+
+PerformanceHud::PerformanceHud(wgpu::Device device, wgpu::Queue queue, GpuResources& resources,
+                               const PerformanceHudSettings& settings)
+  : m_device(device)
+  , m_queue(queue)
+  , m_resources(resources)
+  , m_settings(settings)
+  , m_nuklear(std::make_unique<Nuklear>())
+{
+  m_settings.maxVertices = std::min<size_t>(m_settings.maxVertices, 65536);
+  m_draws.reserve(64);
+  createFontAtlas();
+  if (!m_nuklear->initialized) {
+    return;
+  }
+
+  // One region per frame in flight, so that a frame never overwrites
+  // geometry the GPU may still be drawing
+  m_vertexRegionBytes = alignTo4(m_settings.maxVertices * sizeof(HudVertex));
+  m_indexRegionBytes = alignTo4(m_settings.maxIndices * sizeof(nk_draw_index));
+  wgpu::BufferDescriptor bufferDesc;
+  bufferDesc.label = "HUD vertices";
+  bufferDesc.size = m_vertexRegionBytes * kFramesInFlight;
+  bufferDesc.usage = wgpu::BufferUsage::Vertex | wgpu::BufferUsage::CopyDst;
+  bufferDesc.mappedAtCreation = false;
+  m_vertexBuffer = m_resources.createBuffer(bufferDesc);
+  bufferDesc.label = "HUD indices";
+  bufferDesc.size = m_indexRegionBytes * kFramesInFlight;
+  bufferDesc.usage = wgpu::BufferUsage::Index | wgpu::BufferUsage::CopyDst;
+  m_indexBuffer = m_resources.createBuffer(bufferDesc);
+  bufferDesc.label = "HUD uniforms";
+  bufferDesc.size = sizeof(HudUniforms);
+  bufferDesc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
+  m_uniformBuffer = m_resources.createBuffer(bufferDesc);
+  m_nuklear->vertexMemory.resize(m_vertexRegionBytes);
+  m_nuklear->indexMemory.resize(m_indexRegionBytes);
+  nk_buffer_init_fixed(&m_nuklear->vertices, m_nuklear->vertexMemory.data(), m_nuklear->vertexMemory.size());
+  nk_buffer_init_fixed(&m_nuklear->indices, m_nuklear->indexMemory.data(), m_nuklear->indexMemory.size());
+  if (!m_vertexBuffer || !m_indexBuffer || !m_uniformBuffer) {
+    LOG_ERROR << "Could not create the HUD buffers";
+    return;
+  }
+
+  HudUniforms uniforms = {};
+  uniforms.screenSize[0] = static_cast<float>(m_settings.width);
+  uniforms.screenSize[1] = static_cast<float>(m_settings.height);
+  uniforms.decodeSrgb = isSrgbFormat(m_settings.colorFormat) ? 1.0f : 0.0f;
+  m_queue.writeBuffer(m_uniformBuffer, 0, &uniforms, sizeof(uniforms));
+  createPipeline();
+}
+
+PerformanceHud::~PerformanceHud() {
+  if (m_pipeline) {
+    m_pipeline.release();
+  }
+  if (m_bindGroup) {
+    m_bindGroup.release();
+  }
+  if (m_bindGroupLayout) {
+    m_bindGroupLayout.release();
+  }
+  m_resources.release(m_pipelineLayout);
+  if (m_sampler) {
+    m_sampler.release();
+  }
+  if (m_fontView) {
+    m_fontView.release();
+  }
+  m_resources.destroy(m_fontTexture);
+  m_resources.destroy(m_uniformBuffer);
+  m_resources.destroy(m_vertexBuffer);
+  m_resources.destroy(m_indexBuffer);
+  if (m_nuklear->initialized) {
+    nk_free(&m_nuklear->context);
+    nk_font_atlas_clear(&m_nuklear->atlas);
+  }
+}
+
+void PerformanceHud::createFontAtlas() {
+  Nuklear& nk = *m_nuklear;
+  nk_font_atlas_init_default(&nk.atlas);
+  nk_font_atlas_begin(&nk.atlas);
+  struct nk_font* font = nk_font_atlas_add_default(&nk.atlas, kFontHeight, nullptr);
+  int width = 0;
+  int height = 0;
+  const void* pixels = nk_font_atlas_bake(&nk.atlas, &width, &height, NK_FONT_ATLAS_RGBA32);
+  if (!font || !pixels) {
+    LOG_ERROR << "Could not bake the HUD font";
+    nk_font_atlas_clear(&nk.atlas);
+    return;
+  }
+
+  wgpu::TextureDescriptor textureDesc;
+  textureDesc.label = "HUD font atlas";
+  textureDesc.dimension = wgpu::TextureDimension::_2D;
+  textureDesc.format = wgpu::TextureFormat::RGBA8Unorm;
+  textureDesc.mipLevelCount = 1;
+  textureDesc.sampleCount = 1;
+  textureDesc.size = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1 };
+  textureDesc.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst;
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  m_fontTexture = m_resources.createTexture(textureDesc);
+  if (m_fontTexture) {
+    wgpu::ImageCopyTexture destination;
+    destination.texture = m_fontTexture;
+    destination.mipLevel = 0;
+    destination.origin = { 0, 0, 0 };
+    destination.aspect = wgpu::TextureAspect::All;
+    wgpu::TextureDataLayout source;
+    source.offset = 0;
+    source.bytesPerRow = 4 * textureDesc.size.width;
+    source.rowsPerImage = textureDesc.size.height;
+    m_queue.writeTexture(destination, pixels, size_t(source.bytesPerRow) * textureDesc.size.height, source, textureDesc.size);
+    m_fontView = m_fontTexture.createView();
+  }
+  // Untextured shapes sample the white pixel the atlas was baked with
+  nk_font_atlas_end(&nk.atlas, nk_handle_id(0), &nk.whitePixel);
+  nk_font_atlas_cleanup(&nk.atlas);
+
+  nk.contextMemory.resize(kContextMemory);
+  nk.commandMemory.resize(kCommandMemory);
+  nk_init_fixed(&nk.context, nk.contextMemory.data(), nk.contextMemory.size(), &font->handle);
+  nk_buffer_init_fixed(&nk.commands, nk.commandMemory.data(), nk.commandMemory.size());
+
+  std::memset(&nk.config, 0, sizeof(nk.config));
+  nk.config.vertex_layout = kVertexLayout;
+  nk.config.vertex_size = sizeof(HudVertex);
+  nk.config.vertex_alignment = alignof(HudVertex);
+  nk.config.null = nk.whitePixel;
+  nk.config.circle_segment_count = 12;
+  nk.config.curve_segment_count = 12;
+  nk.config.arc_segment_count = 12;
+  nk.config.global_alpha = 1.0f;
+  nk.config.shape_AA = NK_ANTI_ALIASING_ON;
+  nk.config.line_AA = NK_ANTI_ALIASING_ON;
+  nk.initialized = true;
+}
+
+void PerformanceHud::createPipeline() {
+  if (!m_fontView) {
+    return;
+  }
+  wgpu::SamplerDescriptor samplerDesc;
+  samplerDesc.label = "HUD sampler";
+  samplerDesc.addressModeU = wgpu::AddressMode::ClampToEdge;
+  samplerDesc.addressModeV = wgpu::AddressMode::ClampToEdge;
+  samplerDesc.addressModeW = wgpu::AddressMode::ClampToEdge;
+  samplerDesc.magFilter = wgpu::FilterMode::Linear;
+  samplerDesc.minFilter = wgpu::FilterMode::Linear;
+  samplerDesc.mipmapFilter = wgpu::MipmapFilterMode::Nearest;
+  samplerDesc.lodMinClamp = 0.0f;
+  samplerDesc.lodMaxClamp = 1.0f;
+  samplerDesc.compare = wgpu::CompareFunction::Undefined;
+  samplerDesc.maxAnisotropy = 1;
+  m_sampler = m_device.createSampler(samplerDesc);
+
+  std::array<wgpu::BindGroupLayoutEntry, 3> layoutEntries;
+  for (wgpu::BindGroupLayoutEntry& entry : layoutEntries) {
+    entry = wgpu::Default;
+  }
+  layoutEntries[0].binding = 0;
+  layoutEntries[0].visibility = wgpu::ShaderStage::Vertex;
+  layoutEntries[0].buffer.type = wgpu::BufferBindingType::Uniform;
+  layoutEntries[0].buffer.minBindingSize = sizeof(HudUniforms);
+  layoutEntries[1].binding = 1;
+  layoutEntries[1].visibility = wgpu::ShaderStage::Fragment;
+  layoutEntries[1].texture.sampleType = wgpu::TextureSampleType::Float;
+  layoutEntries[1].texture.viewDimension = wgpu::TextureViewDimension::_2D;
+  layoutEntries[2].binding = 2;
+  layoutEntries[2].visibility = wgpu::ShaderStage::Fragment;
+  layoutEntries[2].sampler.type = wgpu::SamplerBindingType::Filtering;
+  wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc;
+  bindGroupLayoutDesc.label = "HUD bind group layout";
+  bindGroupLayoutDesc.entryCount = layoutEntries.size();
+  bindGroupLayoutDesc.entries = layoutEntries.data();
+  m_bindGroupLayout = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+
+  std::array<wgpu::BindGroupEntry, 3> entries;
+  for (wgpu::BindGroupEntry& entry : entries) {
+    entry = wgpu::Default;
+  }
+  entries[0].binding = 0;
+  entries[0].buffer = m_uniformBuffer;
+  entries[0].offset = 0;
+  entries[0].size = sizeof(HudUniforms);
+  entries[1].binding = 1;
+  entries[1].textureView = m_fontView;
+  entries[2].binding = 2;
+  entries[2].sampler = m_sampler;
+  wgpu::BindGroupDescriptor bindGroupDesc;
+  bindGroupDesc.label = "HUD bind group";
+  bindGroupDesc.layout = m_bindGroupLayout;
+  bindGroupDesc.entryCount = entries.size();
+  bindGroupDesc.entries = entries.data();
+  m_bindGroup = m_device.createBindGroup(bindGroupDesc);
+
+  wgpu::PipelineLayoutDescriptor layoutDesc;
+  layoutDesc.label = "HUD pipeline layout";
+  layoutDesc.bindGroupLayoutCount = 1;
+  layoutDesc.bindGroupLayouts = reinterpret_cast<const WGPUBindGroupLayout*>(&m_bindGroupLayout);
+  m_pipelineLayout = m_resources.createPipelineLayout(layoutDesc);
+
+  wgpu::ShaderModule shaderModule = createShaderModule(m_device, kHudShader);
+  std::array<wgpu::VertexAttribute, 3> attributes;
+  attributes[0].shaderLocation = 0;
+  attributes[0].format = wgpu::VertexFormat::Float32x2;
+  attributes[0].offset = offsetof(HudVertex, position);
+  attributes[1].shaderLocation = 1;
+  attributes[1].format = wgpu::VertexFormat::Float32x2;
+  attributes[1].offset = offsetof(HudVertex, uv);
+  attributes[2].shaderLocation = 2;
+  attributes[2].format = wgpu::VertexFormat::Unorm8x4;
+  attributes[2].offset = offsetof(HudVertex, color);
+  wgpu::VertexBufferLayout vertexLayout;
+  vertexLayout.arrayStride = sizeof(HudVertex);
+  vertexLayout.stepMode = wgpu::VertexStepMode::Vertex;
+  vertexLayout.attributeCount = attributes.size();
+  vertexLayout.attributes = attributes.data();
+
+  wgpu::RenderPipelineDescriptor pipelineDesc = wgpu::Default;
+  pipelineDesc.label = "HUD pipeline";
+  pipelineDesc.layout = m_pipelineLayout;
+  pipelineDesc.vertex.module = shaderModule;
+  pipelineDesc.vertex.entryPoint = "vs_main";
+  pipelineDesc.vertex.constantCount = 0;
+  pipelineDesc.vertex.constants = nullptr;
+  pipelineDesc.vertex.bufferCount = 1;
+  pipelineDesc.vertex.buffers = &vertexLayout;
+  pipelineDesc.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+  pipelineDesc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+  pipelineDesc.primitive.frontFace = wgpu::FrontFace::CCW;
+  pipelineDesc.primitive.cullMode = wgpu::CullMode::None;
+
+  wgpu::BlendState blendState;
+  blendState.color.srcFactor = wgpu::BlendFactor::SrcAlpha;
+  blendState.color.dstFactor = wgpu::BlendFactor::OneMinusSrcAlpha;
+  blendState.color.operation = wgpu::BlendOperation::Add;
+  blendState.alpha.srcFactor = wgpu::BlendFactor::Zero;
+  blendState.alpha.dstFactor = wgpu::BlendFactor::One;
+  blendState.alpha.operation = wgpu::BlendOperation::Add;
+  wgpu::ColorTargetState colorTarget;
+  colorTarget.format = m_settings.colorFormat;
+  colorTarget.blend = &blendState;
+  colorTarget.writeMask = wgpu::ColorWriteMask::All;
+  wgpu::FragmentState fragmentState = wgpu::Default;
+  fragmentState.module = shaderModule;
+  fragmentState.entryPoint = "fs_main";
+  fragmentState.constantCount = 0;
+  fragmentState.constants = nullptr;
+  fragmentState.targetCount = 1;
+  fragmentState.targets = &colorTarget;
+  pipelineDesc.fragment = &fragmentState;
+
+  // Drawn over the scene in its pass, neither tested nor written
+  wgpu::DepthStencilState depthStencilState = wgpu::Default;
+  depthStencilState.format = m_settings.depthFormat;
+  depthStencilState.depthCompare = wgpu::CompareFunction::Always;
+  depthStencilState.depthWriteEnabled = false;
+  depthStencilState.stencilReadMask = 0;
+  depthStencilState.stencilWriteMask = 0;
+  pipelineDesc.depthStencil = m_settings.depthFormat != wgpu::TextureFormat::Undefined ? &depthStencilState : nullptr;
+  pipelineDesc.multisample.count = 1;
+  pipelineDesc.multisample.mask = ~0u;
+  pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+  m_pipeline = m_device.createRenderPipeline(pipelineDesc);
+  shaderModule.release();
+  if (!m_pipeline) {
+    LOG_ERROR << "Could not create the HUD pipeline";
+  }
+}
+
+void PerformanceHud::update(const HudFrameInputs& inputs) {
+  if (!isValid()) {
+    return;
+  }
+  const Clock::time_point start = Clock::now();
+  m_frameMs[m_historyNext] = static_cast<float>(inputs.frameMs);
+  m_gpuMs[m_historyNext] = static_cast<float>(std::max(inputs.gpuPassMs, 0.0));
+  m_historyNext = (m_historyNext + 1) % kHistoryFrames;
+  m_historyCount = std::min(m_historyCount + 1, kHistoryFrames);
+
+  layout(inputs);
+  convert();
+  m_updateMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void PerformanceHud::layout(const HudFrameInputs& inputs) {
+  nk_context* ctx = &m_nuklear->context;
+  char text[128];
+  auto label = [&](const char* format, auto... args) {
+    std::snprintf(text, sizeof(text), format, args...);
+    nk_label(ctx, text, NK_TEXT_LEFT);
+  };
+
+  const nk_flags flags = NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR | NK_WINDOW_NO_INPUT;
+  if (nk_begin(ctx, "Performance", nk_rect(8.0f, 8.0f, kWindowWidth, kWindowHeight), flags)) {
+    // Oldest first, so that the graphs scroll left
+    const size_t first = (m_historyNext + kHistoryFrames - m_historyCount) % kHistoryFrames;
+    float maxMs = kMinGraphMs;
+    double sumMs = 0.0;
+    for (size_t i = 0; i < m_historyCount; ++i) {
+      const size_t index = (first + i) % kHistoryFrames;
+      maxMs = std::max({ maxMs, m_frameMs[index], m_gpuMs[index] });
+      sumMs += m_frameMs[index];
+    }
+    const double averageMs = m_historyCount > 0 ? sumMs / static_cast<double>(m_historyCount) : 0.0;
+
+    nk_layout_row_dynamic(ctx, kFontHeight + 4.0f, 1);
+    label("Frame %.2f ms, average %.2f ms (%.0f fps)", inputs.frameMs, averageMs, averageMs > 0.0 ? 1000.0 / averageMs : 0.0);
+    if (inputs.gpuPassMs >= 0.0) {
+      label("GPU render pass %.2f ms", inputs.gpuPassMs);
+    } else {
+      nk_label(ctx, "GPU render pass not timed (no timestamp queries)", NK_TEXT_LEFT);
+    }
+    nk_layout_row_dynamic(ctx, 72.0f, 1);
+    const int points = static_cast<int>(m_historyCount);
+    if (nk_chart_begin_colored(ctx, NK_CHART_LINES, nk_rgb(230, 200, 60), nk_rgb(230, 200, 60), points, 0.0f, maxMs)) {
+      nk_chart_add_slot_colored(ctx, NK_CHART_LINES, nk_rgb(80, 180, 250), nk_rgb(80, 180, 250), points, 0.0f, maxMs);
+      for (size_t i = 0; i < m_historyCount; ++i) {
+        const size_t index = (first + i) % kHistoryFrames;
+        nk_chart_push_slot(ctx, m_frameMs[index], 0);
+        nk_chart_push_slot(ctx, m_gpuMs[index], 1);
+      }
+      nk_chart_end(ctx);
+    }
+    nk_layout_row_dynamic(ctx, kFontHeight + 4.0f, 1);
+    label("Frame (yellow) and GPU (blue), %zu frames, top %.1f ms", m_historyCount, static_cast<double>(maxMs));
+    label("GPU memory %.1f MiB, peak %.1f MiB", toMiB(inputs.gpuBytes), toMiB(inputs.gpuPeakBytes));
+    label("Draws %zu, instances %zu", inputs.draws.draws, inputs.instances);
+    label("Changes: %zu pipeline, %zu bind group, %zu buffer", inputs.draws.pipelineChanges, inputs.draws.bindGroupChanges,
+          inputs.draws.vertexBufferChanges + inputs.draws.indexBufferChanges);
+    label("HUD %.3f ms CPU, %zu draws, %.1f KiB", m_stats.cpuMs, m_stats.draws,
+          static_cast<double>(m_stats.uploadBytes) / 1024.0);
+    label("HUD %zu vertices, %zu indices", m_stats.vertices, m_stats.indices);
+  }
+  nk_end(ctx);
+}
+
+void PerformanceHud::convert() {
+  Nuklear& nk = *m_nuklear;
+  nk_buffer_clear(&nk.commands);
+  nk_buffer_clear(&nk.vertices);
+  nk_buffer_clear(&nk.indices);
+  const nk_flags result = nk_convert(&nk.context, &nk.commands, &nk.vertices, &nk.indices, &nk.config);
+  m_draws.clear();
+  m_drawable = result == NK_CONVERT_SUCCESS;
+  if (!m_drawable) {
+    ++m_stats.overflows;
+    nk_clear(&nk.context);
+    return;
+  }
+
+  // Consecutive commands with the same clip rectangle become one draw, the
+  // texture is always the atlas
+  const struct nk_draw_command* command;
+  uint32_t offset = 0;
+  nk_draw_foreach(command, &nk.context, &nk.commands) {
+    if (command->elem_count == 0) {
+      continue;
+    }
+    const float x0 = std::max(command->clip_rect.x, 0.0f);
+    const float y0 = std::max(command->clip_rect.y, 0.0f);
+    const float x1 = std::min(command->clip_rect.x + command->clip_rect.w, static_cast<float>(m_settings.width));
+    const float y1 = std::min(command->clip_rect.y + command->clip_rect.h, static_cast<float>(m_settings.height));
+    const uint32_t scissor[4] = { static_cast<uint32_t>(x0), static_cast<uint32_t>(y0),
+                                  static_cast<uint32_t>(std::max(x1 - x0, 0.0f)), static_cast<uint32_t>(std::max(y1 - y0, 0.0f)) };
+    if (!m_draws.empty() && std::equal(scissor, scissor + 4, m_draws.back().scissor)) {
+      m_draws.back().indexCount += command->elem_count;
+    } else if (m_draws.size() < m_draws.capacity()) {
+      Draw draw = { offset, command->elem_count, { scissor[0], scissor[1], scissor[2], scissor[3] } };
+      m_draws.push_back(draw);
+    }
+    offset += command->elem_count;
+  }
+  nk_clear(&nk.context);
+
+  m_region = (m_region + 1) % kFramesInFlight;
+  // Bytes written, nk_buffer_total() is the capacity of a fixed buffer
+  const uint64_t vertexBytes = alignTo4(nk.vertices.allocated);
+  const uint64_t indexBytes = alignTo4(nk.indices.allocated);
+  m_queue.writeBuffer(m_vertexBuffer, m_vertexRegionBytes * m_region, nk.vertexMemory.data(), vertexBytes);
+  m_queue.writeBuffer(m_indexBuffer, m_indexRegionBytes * m_region, nk.indexMemory.data(), indexBytes);
+  m_stats.vertices = nk.vertices.allocated / sizeof(HudVertex);
+  m_stats.indices = offset;
+  m_stats.uploadBytes = vertexBytes + indexBytes;
+}
+
+void PerformanceHud::encode(wgpu::RenderPassEncoder renderPass) {
+  if (!isValid()) {
+    return;
+  }
+  const Clock::time_point start = Clock::now();
+  size_t draws = 0;
+  if (m_drawable && !m_draws.empty()) {
+    renderPass.setPipeline(m_pipeline);
+    renderPass.setBindGroup(0, m_bindGroup, 0, nullptr);
+    renderPass.setVertexBuffer(0, m_vertexBuffer, m_vertexRegionBytes * m_region, m_vertexRegionBytes);
+    renderPass.setIndexBuffer(m_indexBuffer, wgpu::IndexFormat::Uint16, m_indexRegionBytes * m_region, m_indexRegionBytes);
+    for (const Draw& draw : m_draws) {
+      if (draw.scissor[2] == 0 || draw.scissor[3] == 0) {
+        continue;
+      }
+      renderPass.setScissorRect(draw.scissor[0], draw.scissor[1], draw.scissor[2], draw.scissor[3]);
+      renderPass.drawIndexed(draw.indexCount, 1, draw.firstIndex, 0, 0);
+      ++draws;
+    }
+    // Later draws of the pass are not clipped
+    renderPass.setScissorRect(0, 0, m_settings.width, m_settings.height);
+  }
+  m_stats.draws = draws;
+
+  // Shown from the next frame on
+  m_costMs[m_costNext] = m_updateMs + std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  m_costNext = (m_costNext + 1) % kCostFrames;
+  m_costCount = std::min(m_costCount + 1, kCostFrames);
+  double sum = 0.0;
+  for (size_t i = 0; i < m_costCount; ++i) {
+    sum += m_costMs[i];
+  }
+  m_stats.cpuMs = sum / static_cast<double>(m_costCount);
+}
@@ -0,0 +1,124 @@
+#ifndef WEBGPU_THINGY_SRC_HUD_H_
+#define WEBGPU_THINGY_SRC_HUD_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+#include "draw_list.h"
+
+class GpuResources;
+
+struct PerformanceHudSettings {
+  uint32_t width = 0;  // Of the render target, in pixels
+  uint32_t height = 0;
+  wgpu::TextureFormat colorFormat = wgpu::TextureFormat::Undefined;
+  wgpu::TextureFormat depthFormat = wgpu::TextureFormat::Undefined;  // Of the pass the HUD is drawn in, if any
+  size_t maxVertices = 16 * 1024;  // Per frame, nuklear's indices are 16-bit
+  size_t maxIndices = 48 * 1024;
+};
+
+// What the HUD shows of a frame, gathered by the render loop
+struct HudFrameInputs {
+  double frameMs = 0.0;      // Since the previous frame started
+  double gpuPassMs = -1.0;   // Of the latest timed render pass, negative when not timed
+  uint64_t gpuBytes = 0;
+  uint64_t gpuPeakBytes = 0;
+  DrawListStats draws;       // Of the scene, without the HUD's own
+  size_t instances = 0;
+};
+
+// The HUD's cost, measured by itself
+struct HudStats {
+  double cpuMs = 0.0;        // Building, converting, uploading and encoding, rolling average
+  size_t draws = 0;          // Of the last frame
+  size_t vertices = 0;
+  size_t indices = 0;
+  uint64_t uploadBytes = 0;  // Of the last frame
+  uint64_t overflows = 0;    // Frames whose geometry did not fit the buffers and were not drawn
+};
+
+// An overlay of frame time and GPU pass time graphs, GPU memory, draw counts
+// and its own cost, laid out with nuklear (vendor/glfw/deps/nuklear.h) and
+// drawn with a pipeline of its own: the geometry is converted into
+// preallocated memory, written to a region of persistent vertex and index
+// buffers that rotates over the frames in flight, and drawn with one indexed
+// draw per clip rectangle, a handful for the whole overlay. The font is baked
+// once into an atlas texture that also holds the white pixel of untextured
+// shapes, so that every draw shares one bind group.
+//
+// All calls come from the rendering thread. A frame neither allocates nor
+// locks.
+class PerformanceHud {
+public:
+  PerformanceHud(wgpu::Device device, wgpu::Queue queue, GpuResources& resources, const PerformanceHudSettings& settings);
+  ~PerformanceHud();
+  PerformanceHud(const PerformanceHud&) = delete;
+  PerformanceHud& operator=(const PerformanceHud&) = delete;
+
+  // Whether the pipeline and buffers were created
+  bool isValid() const { return m_pipeline != nullptr; }
+
+  // Lays out the HUD and writes its geometry to the buffers, before the
+  // frame's commands are submitted
+  void update(const HudFrameInputs& inputs);
+  // Draws the geometry of the last update into a pass of the render target
+  void encode(wgpu::RenderPassEncoder renderPass);
+
+  const HudStats& stats() const { return m_stats; }
+
+private:
+  static constexpr size_t kFramesInFlight = 3;  // Regions of the buffers
+  static constexpr size_t kHistoryFrames = 120;  // Of the graphs
+  static constexpr size_t kCostFrames = 60;      // Of the rolling cost average
+
+  struct Draw {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t scissor[4];  // x, y, width, height
+  };
+
+  struct Nuklear;
+
+  void createPipeline();
+  void createFontAtlas();
+  void layout(const HudFrameInputs& inputs);
+  void convert();
+
+  wgpu::Device m_device;
+  wgpu::Queue m_queue;
+  GpuResources& m_resources;
+  PerformanceHudSettings m_settings;
+  std::unique_ptr<Nuklear> m_nuklear;
+
+  wgpu::RenderPipeline m_pipeline = nullptr;
+  wgpu::PipelineLayout m_pipelineLayout = nullptr;
+  wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
+  wgpu::BindGroup m_bindGroup = nullptr;
+  wgpu::Buffer m_uniformBuffer = nullptr;
+  wgpu::Buffer m_vertexBuffer = nullptr;
+  wgpu::Buffer m_indexBuffer = nullptr;
+  wgpu::Texture m_fontTexture = nullptr;
+  wgpu::TextureView m_fontView = nullptr;
+  wgpu::Sampler m_sampler = nullptr;
+  uint64_t m_vertexRegionBytes = 0;
+  uint64_t m_indexRegionBytes = 0;
+
+  std::vector<Draw> m_draws;  // Of the last update, reserved up front
+  size_t m_region = 0;        // Written by the last update
+  bool m_drawable = false;    // Whether the last update fit the buffers
+
+  std::array<float, kHistoryFrames> m_frameMs = {};
+  std::array<float, kHistoryFrames> m_gpuMs = {};
+  size_t m_historyNext = 0;
+  size_t m_historyCount = 0;
+  std::array<double, kCostFrames> m_costMs = {};
+  size_t m_costNext = 0;
+  size_t m_costCount = 0;
+  double m_updateMs = 0.0;  // Of the frame, added to by encode
+  HudStats m_stats;
+};
+
+#endif //WEBGPU_THINGY_SRC_HUD_H_
@@ -0,0 +1,175 @@
+#include "incremental_buffer.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "gpu_capture.h"
+#include "gpu_resources.h"
+
+namespace {
+
+// Not cryptographic, a changed block going unnoticed needs a 64-bit collision
+uint64_t hashChunk(const uint8_t* data, size_t size) {
+  uint64_t hash = 0x9e3779b97f4a7c15ull ^ size;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+    hash ^= hash >> 32;
+  }
+  for (; i < size; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+} // namespace
+
+IncrementalBuffer::IncrementalBuffer(wgpu::Device device, wgpu::Queue queue, wgpu::BufferUsage usage, size_t blockSize,
+                                     GpuResources* resources, const char* label)
+  : m_device(device)
+  , m_queue(queue)
+  , m_usage(usage)
+  , m_blockSize(std::max<size_t>(1, (blockSize + kBufferChangeResolution - 1) / kBufferChangeResolution) * kBufferChangeResolution)
+  , m_resources(resources)
+  , m_label(label)
+{}
+
+IncrementalBuffer::~IncrementalBuffer() {
+  if (m_resources) {
+    m_resources->destroy(m_buffer);
+  } else if (m_buffer) {
+    m_buffer.destroy();
+    m_buffer.release();
+  }
+}
+
+BufferUploadStats IncrementalBuffer::update(const void* data, size_t size) {
+  BufferUploadStats stats;
+  stats.size = size;
+  if (size % 4 != 0) {
+    std::cerr << "Buffer updates must be a multiple of 4 bytes, got " << size << std::endl;
+    return stats;
+  }
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  std::vector<uint64_t> hashes((size + kBufferChangeResolution - 1) / kBufferChangeResolution);
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    size_t offset = i * kBufferChangeResolution;
+    hashes[i] = hashChunk(bytes + offset, std::min(kBufferChangeResolution, size - offset));
+  }
+
+  // Chunks below this one hold their previous contents on the GPU
+  size_t validChunks = m_hashes.size();
+  if (!m_buffer || size != m_size) {
+    // A partial last chunk was hashed over fewer bytes and compares as changed
+    validChunks = static_cast<size_t>(resize(size, true) / kBufferChangeResolution);
+    stats.reallocated = true;
+  }
+
+  const size_t chunksPerBlock = m_blockSize / kBufferChangeResolution;
+  size_t runStart = 0;
+  size_t runEnd = 0;  // Byte range of the pending write
+  auto flush = [&]() {
+    if (runEnd > runStart) {
+      write(runStart, bytes + runStart, runEnd - runStart);
+      stats.bytesUploaded += runEnd - runStart;
+      ++stats.writes;
+    }
+  };
+  for (size_t block = 0; block * chunksPerBlock < hashes.size(); ++block) {
+    size_t firstChunk = block * chunksPerBlock;
+    size_t lastChunk = std::min(firstChunk + chunksPerBlock, hashes.size());
+    bool changed = false;
+    for (size_t i = firstChunk; i < lastChunk; ++i) {
+      if (i >= validChunks || m_hashes[i] != hashes[i]) {
+        stats.bytesChanged += std::min(kBufferChangeResolution, size - i * kBufferChangeResolution);
+        changed = true;
+      }
+    }
+    if (!changed) {
+      continue;
+    }
+    size_t begin = firstChunk * kBufferChangeResolution;
+    size_t end = std::min(lastChunk * kBufferChangeResolution, size);
+    if (begin != runEnd) {
+      flush();
+      runStart = begin;
+    }
+    runEnd = end;
+    ++stats.blocksUploaded;
+  }
+  flush();
+
+  m_hashes = std::move(hashes);
+  m_size = size;
+  return stats;
+}
+
+BufferUploadStats IncrementalBuffer::replace(const void* data, size_t size) {
+  BufferUploadStats stats;
+  stats.size = size;
+  if (size % 4 != 0) {
+    std::cerr << "Buffer updates must be a multiple of 4 bytes, got " << size << std::endl;
+    return stats;
+  }
+  if (!m_buffer || size != m_size) {
+    resize(size, false);
+    stats.reallocated = true;
+  }
+  if (size > 0) {
+    write(0, data, size);
+    stats.writes = 1;
+  }
+  stats.bytesChanged = stats.bytesUploaded = size;
+  stats.blocksUploaded = static_cast<uint32_t>((size + m_blockSize - 1) / m_blockSize);
+  m_hashes.clear();
+  m_size = size;
+  return stats;
+}
+
+uint64_t IncrementalBuffer::resize(uint64_t size, bool keepContents) {
+  wgpu::BufferDescriptor bufferDesc;
+  bufferDesc.size = std::max<uint64_t>(size, 4);
+  bufferDesc.usage = m_usage | wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::CopySrc;
+  bufferDesc.mappedAtCreation = false;
+  bufferDesc.label = m_label;
+  wgpu::Buffer buffer = m_resources ? m_resources->createBuffer(bufferDesc) : m_device.createBuffer(bufferDesc);
+  uint64_t keptSize = keepContents ? std::min<uint64_t>(m_size, size) : 0;
+  if (m_buffer && keptSize > 0) {
+    // Submitted before the writes that follow, which the queue orders after it
+    wgpu::CommandEncoderDescriptor encoderDesc = wgpu::Default;
+    encoderDesc.label = "Buffer resize";
+    wgpu::CommandEncoder encoder = m_device.createCommandEncoder(encoderDesc);
+    encoder.copyBufferToBuffer(m_buffer, 0, buffer, 0, keptSize);
+    if (GpuCapture* capture = m_resources ? m_resources->capture() : nullptr) {
+      capture->copyBuffer(m_buffer, 0, buffer, 0, keptSize);
+    }
+    wgpu::CommandBufferDescriptor cmdBufferDesc = wgpu::Default;
+    wgpu::CommandBuffer command = encoder.finish(cmdBufferDesc);
+    encoder.release();
+    m_queue.submit(command);
+    command.release();
+  }
+  // Destruction waits for the copy to complete
+  if (m_resources) {
+    m_resources->destroy(m_buffer);
+  } else if (m_buffer) {
+    m_buffer.destroy();
+    m_buffer.release();
+  }
+  m_buffer = buffer;
+  return keptSize;
+}
+
+void IncrementalBuffer::write(uint64_t offset, const void* data, size_t size) {
+  m_queue.writeBuffer(m_buffer, offset, data, size);
+  if (GpuCapture* capture = m_resources ? m_resources->capture() : nullptr) {
+    capture->writeBuffer(m_buffer, offset, data, size);
+  }
+}
+
+void printBufferUploadStats(const char* label, const BufferUploadStats& stats) {
+  std::cout << label << ": " << stats.bytesChanged << " of " << stats.size << " bytes changed, "
+            << stats.bytesUploaded << " uploaded (" << stats.blocksUploaded << " blocks in " << stats.writes << " writes)"
+            << (stats.reallocated ? ", reallocated" : "") << std::endl;
+}
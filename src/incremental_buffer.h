@@ -0,0 +1,64 @@
+#ifndef WEBGPU_THINGY_SRC_INCREMENTAL_BUFFER_H_
+#define WEBGPU_THINGY_SRC_INCREMENTAL_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+class GpuResources;
+
+// Granularity at which changes are detected; upload blocks are a multiple of it
+constexpr size_t kBufferChangeResolution = 1024;
+
+struct BufferUploadStats {
+  uint64_t size = 0;           // Of the new contents
+  uint64_t bytesChanged = 0;   // Rounded to kBufferChangeResolution
+  uint64_t bytesUploaded = 0;  // Whole blocks
+  uint32_t blocksUploaded = 0;
+  uint32_t writes = 0;         // Adjacent blocks share one writeBuffer
+  bool reallocated = false;
+};
+
+// GPU buffer that remembers a hash of what was last uploaded to it, so that
+// updating it with mostly identical contents only writes the blocks that
+// changed. The buffer is only recreated when the size of the contents
+// changes, keeping the common prefix with a GPU-side copy.
+class IncrementalBuffer {
+public:
+  // `blockSize` is rounded up to a multiple of kBufferChangeResolution. With
+  // `resources`, the buffers are created through it under `label`.
+  IncrementalBuffer(wgpu::Device device, wgpu::Queue queue, wgpu::BufferUsage usage, size_t blockSize = 64 * 1024,
+                    GpuResources* resources = nullptr, const char* label = nullptr);
+  ~IncrementalBuffer();
+  IncrementalBuffer(const IncrementalBuffer&) = delete;
+  IncrementalBuffer& operator=(const IncrementalBuffer&) = delete;
+
+  // `size` must be a multiple of 4, as for writeBuffer
+  BufferUploadStats update(const void* data, size_t size);
+  // Uploads everything without hashing, for contents that change entirely
+  // every time. The following update() uploads everything as well.
+  BufferUploadStats replace(const void* data, size_t size);
+
+  wgpu::Buffer buffer() const { return m_buffer; }
+  uint64_t size() const { return m_size; }
+
+private:
+  // Returns how many bytes of the previous buffer were copied to the new one
+  uint64_t resize(uint64_t size, bool keepContents);
+  void write(uint64_t offset, const void* data, size_t size);
+
+  wgpu::Device m_device;
+  wgpu::Queue m_queue;
+  wgpu::BufferUsage m_usage;
+  size_t m_blockSize;
+  GpuResources* m_resources;
+  const char* m_label;
+  wgpu::Buffer m_buffer = nullptr;
+  uint64_t m_size = 0;
+  std::vector<uint64_t> m_hashes;  // Per kBufferChangeResolution bytes of the buffer
+};
+
+void printBufferUploadStats(const char* label, const BufferUploadStats& stats);
+
+#endif //WEBGPU_THINGY_SRC_INCREMENTAL_BUFFER_H_
@@ -0,0 +1,523 @@
+#include "job_system.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include "color_space.h"
+#include "trace.h"
+
+namespace {
+
+// Worker index of the current thread in the JobSystem it belongs to
+thread_local const JobSystem* t_jobSystem = nullptr;
+thread_local int t_workerIndex = -1;
+
+} // namespace
+
+struct JobSystem::Job {
+  JobFunction function;
+  JobCounter* counter = nullptr;
+  Job* next = nullptr;  // In the shared queue or the free list
+  int owner = -1;       // Worker that allocated the job, -1 for other threads
+};
+
+JobFunction& JobFunction::operator=(JobFunction&& other) noexcept {
+  if (this != &other) {
+    reset();
+    if (other.m_invoke) {
+      other.m_relocate(other.m_storage, m_storage);
+      m_invoke = other.m_invoke;
+      m_relocate = other.m_relocate;
+      other.m_invoke = nullptr;
+      other.m_relocate = nullptr;
+    }
+  }
+  return *this;
+}
+
+void JobFunction::reset() {
+  if (m_invoke) {
+    m_relocate(m_storage, nullptr);
+    m_invoke = nullptr;
+    m_relocate = nullptr;
+  }
+}
+
+// Chase-Lev deque ("Dynamic Circular Work-Stealing Deque", with the memory
+// orders of Lê et al., "Correct and Efficient Work-Stealing for Weak Memory
+// Models"), with a fixed capacity. The fences of the paper are folded into
+// sequentially consistent accesses, which ThreadSanitizer understands.
+class JobSystem::Deque {
+public:
+  static constexpr int64_t kCapacity = 4096;
+
+  // Owner only, false when full
+  bool push(Job* job) {
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t top = m_top.load(std::memory_order_acquire);
+    if (bottom - top >= kCapacity) {
+      return false;
+    }
+    m_jobs[bottom & (kCapacity - 1)].store(job, std::memory_order_relaxed);
+    m_bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Owner only, newest job first
+  Job* pop() {
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(bottom, std::memory_order_seq_cst);
+    int64_t top = m_top.load(std::memory_order_seq_cst);
+    if (top > bottom) {
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Job* job = m_jobs[bottom & (kCapacity - 1)].load(std::memory_order_relaxed);
+    if (top == bottom) {
+      // Last job, thieves may be racing for it
+      if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        job = nullptr;
+      }
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+  }
+
+  // Any thread, oldest job first
+  Job* steal(bool& lostRace) {
+    int64_t top = m_top.load(std::memory_order_seq_cst);
+    int64_t bottom = m_bottom.load(std::memory_order_seq_cst);
+    if (top >= bottom) {
+      return nullptr;
+    }
+    Job* job = m_jobs[top & (kCapacity - 1)].load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      lostRace = true;
+      return nullptr;
+    }
+    return job;
+  }
+
+private:
+  // Thieves write the top, the owner the bottom
+  alignas(64) std::atomic<int64_t> m_top{ 0 };
+  alignas(64) std::atomic<int64_t> m_bottom{ 0 };
+  std::atomic<Job*> m_jobs[kCapacity] = {};
+};
+
+struct JobSystem::Worker {
+  Deque deque;
+  std::thread thread;
+  std::atomic<uint64_t> steals{ 0 };
+  std::atomic<uint64_t> failedSteals{ 0 };
+  // threadAllocationCounts() of the worker, published after every job
+  std::atomic<uint64_t> allocations{ 0 };
+  std::atomic<uint64_t> frees{ 0 };
+  std::atomic<uint64_t> allocatedBytes{ 0 };
+  uint32_t random = 0;  // Picks the first victim to steal from
+  // Recycled jobs this worker allocated, the others go back to the shared
+  // free list so that threads outside the pool never run out
+  Job* freeJobs = nullptr;
+  uint32_t freeCount = 0;
+};
+
+namespace {
+
+constexpr uint32_t kWorkerFreeJobs = 64;
+
+} // namespace
+
+unsigned JobSystem::defaultWorkerCount() {
+  unsigned cores = std::thread::hardware_concurrency();
+  return cores > 1 ? cores - 1 : 0;
+}
+
+JobSystem::JobSystem(unsigned workerCount) {
+  for (unsigned i = 0; i < workerCount; ++i) {
+    m_workers.push_back(std::make_unique<Worker>());
+    m_workers.back()->random = 0x9e3779b9u * (i + 1);
+  }
+  // Started once every deque exists, the workers steal from each other
+  for (unsigned i = 0; i < workerCount; ++i) {
+    m_workers[i]->thread = std::thread([this, i]() { workerLoop(i); });
+  }
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_stopping.store(true);
+  }
+  m_wake.notify_all();
+  for (auto& worker : m_workers) {
+    worker->thread.join();
+  }
+  // Jobs nobody waited for are run, they may own resources
+  while (Job* job = findJob(-1)) {
+    execute(job);
+  }
+  auto deleteJobs = [](Job* job) {
+    while (job) {
+      Job* next = job->next;
+      delete job;
+      job = next;
+    }
+  };
+  for (auto& worker : m_workers) {
+    deleteJobs(worker->freeJobs);
+  }
+  deleteJobs(m_freeJobs);
+}
+
+void JobSystem::run(JobFunction function, JobCounter* counter) {
+  Job* job = allocateJob();
+  job->function = std::move(function);
+  job->counter = counter;
+  if (counter) {
+    counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (t_jobSystem == this) {
+    if (!m_workers[t_workerIndex]->deque.push(job)) {
+      m_inlineJobs.fetch_add(1, std::memory_order_relaxed);
+      execute(job);
+      return;
+    }
+  } else {
+    std::lock_guard<std::mutex> lock(m_sharedMutex);
+    job->next = nullptr;
+    (m_sharedTail ? m_sharedTail->next : m_sharedHead) = job;
+    m_sharedTail = job;
+  }
+  m_queued.fetch_add(1);
+  wakeWorker();
+}
+
+void JobSystem::wait(const JobCounter& counter) {
+  int self = t_jobSystem == this ? t_workerIndex : -1;
+  while (!counter.done()) {
+    if (Job* job = findJob(self)) {
+      execute(job);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void JobSystem::parallelFor(size_t begin, size_t end, size_t grain, RangeFunction function, const void* context) {
+  if (end <= begin) {
+    return;
+  }
+  size_t count = end - begin;
+  if (grain == 0) {
+    grain = std::max<size_t>(1, count / (4 * (m_workers.size() + 1)));
+  }
+  if (count <= grain) {
+    function(context, begin, end);
+    return;
+  }
+  JobCounter counter;
+  size_t chunkBegin = begin;
+  for (; end - chunkBegin > grain; chunkBegin += grain) {
+    size_t chunkEnd = chunkBegin + grain;
+    run([function, context, chunkBegin, chunkEnd]() { function(context, chunkBegin, chunkEnd); }, &counter);
+  }
+  // The last chunk is the caller's
+  function(context, chunkBegin, end);
+  wait(counter);
+}
+
+JobSystemStats JobSystem::stats() const {
+  JobSystemStats stats;
+  stats.jobs = m_jobs.load(std::memory_order_relaxed);
+  stats.inlineJobs = m_inlineJobs.load(std::memory_order_relaxed);
+  stats.sleeps = m_sleeps.load(std::memory_order_relaxed);
+  for (const auto& worker : m_workers) {
+    stats.steals += worker->steals.load(std::memory_order_relaxed);
+    stats.failedSteals += worker->failedSteals.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+AllocationCounts JobSystem::allocationCounts() const {
+  AllocationCounts counts;
+  for (const auto& worker : m_workers) {
+    counts.allocations += worker->allocations.load(std::memory_order_relaxed);
+    counts.frees += worker->frees.load(std::memory_order_relaxed);
+    counts.bytes += worker->allocatedBytes.load(std::memory_order_relaxed);
+  }
+  return counts;
+}
+
+void JobSystem::workerLoop(unsigned index) {
+  t_jobSystem = this;
+  t_workerIndex = static_cast<int>(index);
+  setTraceThreadName("Job worker " + std::to_string(index));
+  int idleRounds = 0;
+  while (!m_stopping.load(std::memory_order_relaxed)) {
+    if (Job* job = findJob(static_cast<int>(index))) {
+      execute(job);
+      idleRounds = 0;
+      continue;
+    }
+    // Stay around briefly, jobs often come in bursts
+    if (++idleRounds < 64) {
+      std::this_thread::yield();
+      continue;
+    }
+    // Pairs with wakeWorker(): either the submitter sees this worker
+    // sleeping, or this worker sees the job
+    m_sleeping.fetch_add(1);
+    {
+      std::unique_lock<std::mutex> lock(m_sleepMutex);
+      m_wake.wait(lock, [&]() { return m_queued.load() > 0 || m_stopping.load(); });
+    }
+    m_sleeping.fetch_sub(1);
+    m_sleeps.fetch_add(1, std::memory_order_relaxed);
+    idleRounds = 0;
+  }
+}
+
+JobSystem::Job* JobSystem::findJob(int self) {
+  Job* job = nullptr;
+  if (self >= 0) {
+    job = m_workers[self]->deque.pop();
+  }
+  if (!job && m_queued.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard<std::mutex> lock(m_sharedMutex);
+    if (m_sharedHead) {
+      job = m_sharedHead;
+      m_sharedHead = job->next;
+      if (!m_sharedHead) {
+        m_sharedTail = nullptr;
+      }
+    }
+  }
+  if (!job && !m_workers.empty()) {
+    // Victims in a different order for every thief, to spread the contention
+    uint32_t start = 0;
+    if (self >= 0) {
+      uint32_t& random = m_workers[self]->random;
+      random ^= random << 13;
+      random ^= random >> 17;
+      random ^= random << 5;
+      start = random;
+    }
+    size_t count = m_workers.size();
+    for (size_t i = 0; i < count && !job; ++i) {
+      size_t victim = (start + i) % count;
+      if (static_cast<int>(victim) == self) {
+        continue;
+      }
+      bool lostRace = false;
+      job = m_workers[victim]->deque.steal(lostRace);
+      if (self >= 0 && job) {
+        m_workers[self]->steals.fetch_add(1, std::memory_order_relaxed);
+      } else if (self >= 0 && lostRace) {
+        m_workers[self]->failedSteals.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+  if (job) {
+    m_queued.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+void JobSystem::execute(Job* job) {
+  job->function();
+  JobCounter* counter = job->counter;
+  freeJob(job);
+  m_jobs.fetch_add(1, std::memory_order_relaxed);
+  // Before the counter is released, so that its waiter sees them
+  if (t_jobSystem == this && t_workerIndex >= 0) {
+    Worker& worker = *m_workers[t_workerIndex];
+    const AllocationCounts counts = threadAllocationCounts();
+    worker.allocations.store(counts.allocations, std::memory_order_relaxed);
+    worker.frees.store(counts.frees, std::memory_order_relaxed);
+    worker.allocatedBytes.store(counts.bytes, std::memory_order_relaxed);
+  }
+  // Last, the waiter may destroy the counter right after
+  if (counter) {
+    counter->m_pending.fetch_sub(1, std::memory_order_acq_rel);
+  }
+}
+
+JobSystem::Job* JobSystem::allocateJob() {
+  int self = t_jobSystem == this ? t_workerIndex : -1;
+  Job* job = nullptr;
+  if (self >= 0 && m_workers[self]->freeJobs) {
+    Worker& worker = *m_workers[self];
+    job = worker.freeJobs;
+    worker.freeJobs = job->next;
+    --worker.freeCount;
+  } else {
+    std::lock_guard<std::mutex> lock(m_freeMutex);
+    if (m_freeJobs) {
+      job = m_freeJobs;
+      m_freeJobs = job->next;
+    }
+  }
+  if (!job) {
+    job = new Job;
+  }
+  job->owner = self;
+  return job;
+}
+
+void JobSystem::freeJob(Job* job) {
+  // Captures are released as soon as the job ran
+  job->function.reset();
+  if (t_jobSystem == this && job->owner == t_workerIndex) {
+    Worker& worker = *m_workers[t_workerIndex];
+    if (worker.freeCount < kWorkerFreeJobs) {
+      job->next = worker.freeJobs;
+      worker.freeJobs = job;
+      ++worker.freeCount;
+      return;
+    }
+  }
+  std::lock_guard<std::mutex> lock(m_freeMutex);
+  job->next = m_freeJobs;
+  m_freeJobs = job;
+}
+
+void JobSystem::wakeWorker() {
+  if (m_sleeping.load() > 0) {
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_wake.notify_one();
+  }
+}
+
+TaskGraph::TaskId TaskGraph::add(JobFunction function, std::initializer_list<TaskId> dependencies) {
+  TaskId id = static_cast<TaskId>(m_tasks.size());
+  Task& task = m_tasks.emplace_back();
+  task.function = std::move(function);
+  for (TaskId dependency : dependencies) {
+    if (dependency >= id) {
+      std::cerr << "Task " << id << " depends on task " << dependency << " added after it, ignored" << std::endl;
+      continue;
+    }
+    m_tasks[dependency].dependents.push_back(id);
+    ++task.dependencyCount;
+  }
+  return id;
+}
+
+void TaskGraph::run(JobSystem& jobs) {
+  for (Task& task : m_tasks) {
+    task.remaining.store(task.dependencyCount, std::memory_order_relaxed);
+  }
+  JobCounter counter;
+  for (TaskId id = 0; id < m_tasks.size(); ++id) {
+    if (m_tasks[id].dependencyCount == 0) {
+      start(jobs, id, counter);
+    }
+  }
+  jobs.wait(counter);
+}
+
+void TaskGraph::start(JobSystem& jobs, TaskId id, JobCounter& counter) {
+  jobs.run([this, &jobs, id, &counter]() {
+    Task& task = m_tasks[id];
+    task.function();
+    // Started before this job counts as done, so the counter never drops to
+    // zero while tasks remain
+    for (TaskId dependent : task.dependents) {
+      if (m_tasks[dependent].remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        start(jobs, dependent, counter);
+      }
+    }
+  }, &counter);
+}
+
+void benchmarkJobSystem(unsigned maxWorkers) {
+  using Clock = std::chrono::steady_clock;
+  std::cout << "Job system scaling, " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+  // Parallel for: the exact sRGB conversion of 4M values, 16K per job
+  const size_t valueCount = size_t(1) << 22;
+  std::vector<float> input(valueCount);
+  for (size_t i = 0; i < valueCount; ++i) {
+    input[i] = static_cast<float>(i % 4096) / 4095.0f;
+  }
+  std::vector<float> values;
+  // Task graph: 64 chains of 16 dependent tasks of about 20 µs each
+  auto spin = [](uint32_t seed) {
+    float x = static_cast<float>(seed);
+    for (int i = 0; i < 2000; ++i) {
+      x = std::sqrt(x + 1.0f);
+    }
+    return x;
+  };
+  std::vector<float> chainResults(64 * 16);
+
+  double baseForMs = 0.0;
+  double baseGraphMs = 0.0;
+  std::vector<unsigned> workerCounts;
+  for (unsigned workers = 0; workers < maxWorkers; workers = workers == 0 ? 1 : workers * 2) {
+    workerCounts.push_back(workers);
+  }
+  workerCounts.push_back(maxWorkers);
+  for (unsigned workers : workerCounts) {
+    JobSystem jobs(workers);
+    values = input;
+    auto start = Clock::now();
+    jobs.parallelFor(0, valueCount, 16384, [&](size_t begin, size_t end) {
+      srgbToLinearScalar(values.data() + begin, end - begin);
+    });
+    double forMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    TaskGraph graph;
+    for (uint32_t chain = 0; chain < 64; ++chain) {
+      TaskGraph::TaskId previous = 0;
+      for (uint32_t link = 0; link < 16; ++link) {
+        uint32_t slot = chain * 16 + link;
+        auto task = [&, slot]() { chainResults[slot] = spin(slot); };
+        previous = link == 0 ? graph.add(task) : graph.add(task, { previous });
+      }
+    }
+    start = Clock::now();
+    graph.run(jobs);
+    double graphMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    if (workers == 0) {
+      baseForMs = forMs;
+      baseGraphMs = graphMs;
+    }
+    JobSystemStats stats = jobs.stats();
+    std::cout << std::fixed << std::setprecision(2) << std::setw(3) << workers + 1 << " threads: parallel for "
+              << forMs << " ms (" << baseForMs / forMs << "x), task graph " << graphMs << " ms (" << baseGraphMs / graphMs
+              << "x), " << stats.steals << " steals" << std::defaultfloat << std::endl;
+  }
+
+  // Contention: tiny jobs that each spawn more, all stealing from each other
+  for (unsigned workers : { std::min(maxWorkers, 3u), maxWorkers }) {
+    JobSystem jobs(workers);
+    JobCounter counter;
+    std::atomic<uint64_t> sum{ 0 };
+    const uint32_t roots = 1000;
+    const uint32_t children = 100;
+    auto start = Clock::now();
+    for (uint32_t root = 0; root < roots; ++root) {
+      jobs.run([&, root]() {
+        for (uint32_t child = 0; child < children; ++child) {
+          jobs.run([&, root, child]() { sum.fetch_add(root ^ child, std::memory_order_relaxed); }, &counter);
+        }
+      }, &counter);
+    }
+    jobs.wait(counter);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    JobSystemStats stats = jobs.stats();
+    uint64_t expected = 0;
+    for (uint32_t root = 0; root < roots; ++root) {
+      for (uint32_t child = 0; child < children; ++child) {
+        expected += root ^ child;
+      }
+    }
+    std::cout << std::fixed << std::setprecision(2) << "Contention, " << workers + 1 << " threads: " << stats.jobs << " jobs in "
+              << seconds * 1000.0 << " ms (" << static_cast<double>(stats.jobs) / seconds / 1e6 << " M jobs/s), "
+              << stats.steals << " steals, " << stats.failedSteals << " lost races, " << stats.sleeps << " sleeps, "
+              << (sum.load() == expected ? "results match" : "RESULTS DIFFER") << std::defaultfloat << std::endl;
+  }
+}
@@ -0,0 +1,177 @@
+#ifndef WEBGPU_THINGY_SRC_JOB_SYSTEM_H_
+#define WEBGPU_THINGY_SRC_JOB_SYSTEM_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "alloc_counter.h"
+
+// Work-stealing scheduler. Every worker owns a Chase-Lev deque: it pushes
+// and pops its own jobs at the bottom, idle workers steal from the top of
+// the others'. Jobs submitted from other threads (the main or render
+// thread) go to a shared queue. A thread that waits for jobs runs jobs
+// itself until they are done, so waiting from inside a job cannot deadlock,
+// and a JobSystem without workers runs everything in wait().
+
+// Callable of a job, stored inline: jobs are submitted every frame, so
+// submitting one must not allocate. Captures larger than kCapacity do not
+// compile; capture a pointer to them instead.
+class JobFunction {
+public:
+  static constexpr size_t kCapacity = 48;
+
+  JobFunction() = default;
+  template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, JobFunction>>>
+  JobFunction(F&& function) {
+    using Stored = std::decay_t<F>;
+    static_assert(sizeof(Stored) <= kCapacity && alignof(Stored) <= alignof(std::max_align_t),
+                  "Job captures do not fit in JobFunction");
+    new (m_storage) Stored(std::forward<F>(function));
+    m_invoke = [](void* stored) { (*static_cast<Stored*>(stored))(); };
+    m_relocate = [](void* from, void* to) {
+      if (to) {
+        new (to) Stored(std::move(*static_cast<Stored*>(from)));
+      }
+      static_cast<Stored*>(from)->~Stored();
+    };
+  }
+  JobFunction(JobFunction&& other) noexcept { *this = std::move(other); }
+  JobFunction& operator=(JobFunction&& other) noexcept;
+  ~JobFunction() { reset(); }
+
+  void operator()() { m_invoke(m_storage); }
+  explicit operator bool() const { return m_invoke != nullptr; }
+  void reset();
+
+private:
+  alignas(std::max_align_t) unsigned char m_storage[kCapacity];
+  void (*m_invoke)(void* stored) = nullptr;
+  // Moves the callable to `to` and destroys it, or only destroys it when `to` is null
+  void (*m_relocate)(void* from, void* to) = nullptr;
+};
+
+// Counts unfinished jobs of a group, to wait for them
+class JobCounter {
+public:
+  bool done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+  friend class JobSystem;
+  std::atomic<uint32_t> m_pending{ 0 };
+};
+
+struct JobSystemStats {
+  uint64_t jobs = 0;
+  uint64_t steals = 0;        // Jobs run by another worker than the one that pushed them
+  uint64_t failedSteals = 0;  // Lost a race for the last job of a deque
+  uint64_t inlineJobs = 0;    // Run at submission because the deque was full
+  uint64_t sleeps = 0;
+};
+
+class JobSystem {
+public:
+  // One worker per core besides the submitting thread
+  static unsigned defaultWorkerCount();
+
+  explicit JobSystem(unsigned workerCount = defaultWorkerCount());
+  ~JobSystem();
+  JobSystem(const JobSystem&) = delete;
+  JobSystem& operator=(const JobSystem&) = delete;
+
+  unsigned workerCount() const { return static_cast<unsigned>(m_workers.size()); }
+
+  // Safe to call from any thread, including from jobs
+  void run(JobFunction function, JobCounter* counter = nullptr);
+  // Runs other jobs until every job of `counter` finished
+  void wait(const JobCounter& counter);
+
+  // Calls body(begin, end) on consecutive ranges of at most `grain` items
+  // and returns when all of them are done. A grain of 0 splits the range
+  // into a few chunks per thread.
+  template <typename Body>
+  void parallelFor(size_t begin, size_t end, size_t grain, Body&& body) {
+    using Callable = std::remove_reference_t<Body>;
+    parallelFor(begin, end, grain, [](const void* context, size_t rangeBegin, size_t rangeEnd) {
+      (*static_cast<Callable*>(const_cast<void*>(context)))(rangeBegin, rangeEnd);
+    }, std::addressof(body));
+  }
+
+  JobSystemStats stats() const;
+  // Heap allocations of the worker threads since they started, as of their
+  // last finished job; jobs the caller ran are in its own thread's counts
+  AllocationCounts allocationCounts() const;
+
+private:
+  struct Job;
+  class Deque;
+  struct Worker;
+  using RangeFunction = void (*)(const void* context, size_t begin, size_t end);
+
+  void parallelFor(size_t begin, size_t end, size_t grain, RangeFunction function, const void* context);
+  // Jobs are recycled through a free list rather than the heap
+  Job* allocateJob();
+  void freeJob(Job* job);
+
+  void workerLoop(unsigned index);
+  // Takes a job from this thread's deque, the shared queue or another
+  // worker's deque; `self` is the caller's worker index, or -1
+  Job* findJob(int self);
+  void execute(Job* job);
+  void wakeWorker();
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::atomic<bool> m_stopping{ false };
+  std::atomic<int64_t> m_queued{ 0 };  // Jobs in any queue, for sleeping workers
+  std::atomic<int> m_sleeping{ 0 };
+
+  std::mutex m_sharedMutex;
+  // Jobs submitted from outside the workers, linked through Job::next
+  Job* m_sharedHead = nullptr;
+  Job* m_sharedTail = nullptr;
+  std::mutex m_sleepMutex;
+  std::condition_variable m_wake;
+  std::mutex m_freeMutex;
+  Job* m_freeJobs = nullptr;
+
+  std::atomic<uint64_t> m_jobs{ 0 };
+  std::atomic<uint64_t> m_inlineJobs{ 0 };
+  std::atomic<uint64_t> m_sleeps{ 0 };
+};
+
+// Jobs with dependencies, run once as a whole
+class TaskGraph {
+public:
+  using TaskId = uint32_t;
+
+  // `dependencies` must have been added before
+  TaskId add(JobFunction function, std::initializer_list<TaskId> dependencies = {});
+  // Starts every task as soon as its dependencies are done, returns when all are
+  void run(JobSystem& jobs);
+
+private:
+  struct Task {
+    JobFunction function;
+    std::vector<TaskId> dependents;
+    uint32_t dependencyCount = 0;
+    std::atomic<uint32_t> remaining{ 0 };
+  };
+  void start(JobSystem& jobs, TaskId id, JobCounter& counter);
+
+  std::deque<Task> m_tasks;  // Stable addresses, Task is not movable
+};
+
+// Scaling of parallelFor and task graphs with 1 to `maxWorkers` workers, and
+// a contention test where every job submits more jobs
+void benchmarkJobSystem(unsigned maxWorkers);
+
+#endif //WEBGPU_THINGY_SRC_JOB_SYSTEM_H_
@@ -0,0 +1,367 @@
+#include "log.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct alignas(64) LogRecord {
+  std::atomic<uint64_t> sequence;  // Position + 1 once published, position + kLogCapacity once consumed
+  LogLevel level;
+  uint32_t suppressed;
+  uint32_t length;
+  char text[kLogLineSize];
+};
+static_assert(sizeof(LogRecord) == 256, "Records are four cache lines");
+
+// Bounded multi-producer ring (D. Vyukov's, with a single consumer) drained
+// by a writer thread. Producers never block: when the ring is full the line
+// is dropped and counted.
+class Logger {
+public:
+  Logger()
+    : m_records(new LogRecord[kLogCapacity])
+  {
+    for (size_t i = 0; i < kLogCapacity; ++i) {
+      m_records[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_thread = std::thread([this]() { writerLoop(); });
+  }
+
+  ~Logger() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+  }
+
+  void push(LogLevel level, uint32_t suppressed, const char* text, uint32_t length) {
+    uint64_t position = m_enqueue.load(std::memory_order_relaxed);
+    LogRecord* record;
+    while (true) {
+      record = &m_records[position % kLogCapacity];
+      uint64_t sequence = record->sequence.load(std::memory_order_acquire);
+      int64_t difference = static_cast<int64_t>(sequence - position);
+      if (difference == 0) {
+        if (m_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      } else {
+        position = m_enqueue.load(std::memory_order_relaxed);
+      }
+    }
+    record->level = level;
+    record->suppressed = suppressed;
+    record->length = length;
+    std::memcpy(record->text, text, length);
+    record->sequence.store(position + 1, std::memory_order_release);
+
+    // The writer wakes up on its own every few milliseconds, only errors and
+    // a filling ring are worth a syscall
+    bool urgent = level >= LogLevel::Warning || position - m_dequeue.load(std::memory_order_relaxed) >= kLogCapacity / 2;
+    if (urgent && !m_wakeRequested.exchange(true, std::memory_order_relaxed)) {
+      m_wake.notify_one();
+    }
+  }
+
+  void flush() {
+    uint64_t target = m_enqueue.load(std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_wakeRequested.store(true, std::memory_order_relaxed);
+    m_wake.notify_one();
+    m_flushed.wait(lock, [&]() { return m_dequeue.load(std::memory_order_relaxed) >= target || m_stopping; });
+  }
+
+  void setFile(std::FILE* file) {
+    flush();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file = file;
+  }
+
+  LogStats stats() const {
+    LogStats stats;
+    stats.written = m_written.load(std::memory_order_relaxed);
+    stats.dropped = m_dropped.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+private:
+  void writerLoop() {
+    std::string out;
+    std::string err;
+    uint64_t reportedDrops = 0;
+    // Only flush() and setFile() take the lock, never the producers
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      uint64_t position = m_dequeue.load(std::memory_order_relaxed);
+      uint64_t written = 0;
+      while (true) {
+        LogRecord& record = m_records[position % kLogCapacity];
+        if (record.sequence.load(std::memory_order_acquire) != position + 1) {
+          break;
+        }
+        std::string& stream = record.level >= LogLevel::Warning && !m_file ? err : out;
+        stream.append(record.text, record.length);
+        if (record.suppressed > 0) {
+          stream += " (";
+          stream += std::to_string(record.suppressed);
+          stream += " similar lines suppressed)";
+        }
+        stream += '\n';
+        record.sequence.store(position + kLogCapacity, std::memory_order_release);
+        ++position;
+        ++written;
+      }
+      uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+      if (dropped != reportedDrops) {
+        (m_file ? out : err) += std::to_string(dropped - reportedDrops) + " log lines dropped, the log ring was full\n";
+        reportedDrops = dropped;
+      }
+
+      if (!out.empty()) {
+        std::FILE* file = m_file ? m_file : stdout;
+        std::fwrite(out.data(), 1, out.size(), file);
+        std::fflush(file);
+        out.clear();
+      }
+      if (!err.empty()) {
+        std::fwrite(err.data(), 1, err.size(), stderr);
+        std::fflush(stderr);
+        err.clear();
+      }
+      m_written.fetch_add(written, std::memory_order_relaxed);
+      m_dequeue.store(position, std::memory_order_relaxed);
+      m_flushed.notify_all();
+
+      bool empty = m_records[position % kLogCapacity].sequence.load(std::memory_order_acquire) != position + 1;
+      if (m_stopping && empty) {
+        break;
+      }
+      if (empty) {
+        m_wake.wait_for(lock, std::chrono::milliseconds(10), [&]() {
+          return m_wakeRequested.load(std::memory_order_relaxed) || m_stopping;
+        });
+      }
+      m_wakeRequested.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  std::unique_ptr<LogRecord[]> m_records;
+  std::atomic<uint64_t> m_enqueue{ 0 };
+  std::atomic<uint64_t> m_dequeue{ 0 };  // Written by the writer thread only
+  std::atomic<uint64_t> m_written{ 0 };
+  std::atomic<uint64_t> m_dropped{ 0 };
+  std::atomic<bool> m_wakeRequested{ false };
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_flushed;
+  std::FILE* m_file = nullptr;  // stdout and stderr when null
+  bool m_stopping = false;
+  std::thread m_thread;
+};
+
+Logger& logger() {
+  static Logger instance;
+  return instance;
+}
+
+} // namespace
+
+std::atomic<LogRateLimiter*> LogRateLimiter::s_listed{ nullptr };
+
+bool LogRateLimiter::allow() {
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+  int64_t windowStart = m_windowStart.load(std::memory_order_relaxed);
+  if (now - windowStart >= 1000000000 && m_windowStart.compare_exchange_strong(windowStart, now, std::memory_order_relaxed)) {
+    m_count.store(0, std::memory_order_relaxed);
+  }
+  if (m_count.fetch_add(1, std::memory_order_relaxed) < kLogBurst) {
+    return true;
+  }
+  m_suppressed.fetch_add(1, std::memory_order_relaxed);
+  if (!m_listed.load(std::memory_order_relaxed) && !m_listed.exchange(true, std::memory_order_relaxed)) {
+    m_next = s_listed.load(std::memory_order_relaxed);
+    while (!s_listed.compare_exchange_weak(m_next, this, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+  }
+  return false;
+}
+
+void LogRateLimiter::reportSuppressed() {
+  for (LogRateLimiter* site = s_listed.load(std::memory_order_acquire); site; site = site->m_next) {
+    if (uint32_t suppressed = site->takeSuppressed(); suppressed > 0) {
+      LogLine(site->m_level) << suppressed << " lines suppressed at " << site->m_file << ":" << site->m_line
+                             << " since its last line";
+    }
+  }
+}
+
+LogLine::LogLine(LogLevel level, uint32_t suppressed)
+  : m_level(level)
+  , m_suppressed(suppressed)
+{}
+
+LogLine::~LogLine() {
+  if (m_truncated && m_length >= 3) {
+    std::memcpy(m_text + m_length - 3, "...", 3);
+  }
+  logger().push(m_level, m_suppressed, m_text, m_length);
+}
+
+LogLine& LogLine::operator<<(std::string_view text) {
+  size_t count = std::min(text.size(), kLogLineSize - m_length);
+  std::memcpy(m_text + m_length, text.data(), count);
+  m_length += static_cast<uint32_t>(count);
+  m_truncated |= count < text.size();
+  return *this;
+}
+
+LogLine& LogLine::operator<<(double value) {
+  // Same as std::ostream's default formatting
+  char buffer[32];
+#if defined(__cpp_lib_to_chars)
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::general, 6);
+  return *this << std::string_view(buffer, static_cast<size_t>(result.ptr - buffer));
+#else
+  int length = std::snprintf(buffer, sizeof(buffer), "%g", value);
+  return *this << std::string_view(buffer, static_cast<size_t>(std::max(length, 0)));
+#endif
+}
+
+LogLine& LogLine::operator<<(const void* pointer) {
+  if (!pointer) {
+    return *this << '0';
+  }
+  char buffer[2 + 2 * sizeof(void*)] = { '0', 'x' };
+  auto result = std::to_chars(buffer + 2, buffer + sizeof(buffer), reinterpret_cast<uintptr_t>(pointer), 16);
+  return *this << std::string_view(buffer, static_cast<size_t>(result.ptr - buffer));
+}
+
+LogLine& LogLine::appendSigned(long long value) {
+  char buffer[24];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  return *this << std::string_view(buffer, static_cast<size_t>(result.ptr - buffer));
+}
+
+LogLine& LogLine::appendUnsigned(unsigned long long value) {
+  char buffer[24];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  return *this << std::string_view(buffer, static_cast<size_t>(result.ptr - buffer));
+}
+
+void flushLog() {
+  LogRateLimiter::reportSuppressed();
+  logger().flush();
+}
+
+void setLogFile(std::FILE* file) {
+  logger().setFile(file);
+}
+
+LogStats logStats() {
+  return logger().stats();
+}
+
+void benchmarkLogging(size_t count) {
+  namespace fs = std::filesystem;
+  fs::path path = fs::temp_directory_path() / "webgpu-thingy-log-bench.txt";
+  std::vector<double> callNs(count);
+  if (count == 0) {
+    return;
+  }
+
+  // Every line is timed on its own, the cost of reading the clock is taken out
+  double clockNs = 1e30;
+  for (int i = 0; i < 1000; ++i) {
+    auto start = Clock::now();
+    clockNs = std::min(clockNs, std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+  }
+  auto report = [&](const char* label, double totalMs) {
+    std::vector<double> sorted = callNs;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (double ns : sorted) {
+      sum += ns;
+    }
+    std::cout << std::fixed << std::setprecision(1) << label << ": " << sum / static_cast<double>(count) << " ns per line (median "
+              << sorted[count / 2] << ", p99 " << sorted[count * 99 / 100] << ", max " << sorted.back() << "), "
+              << totalMs << " ms until written" << std::defaultfloat << std::endl;
+  };
+  // A frame time line as the render loop would print it
+  auto timed = [&](size_t i, auto&& logLine) {
+    auto start = Clock::now();
+    logLine(i, 16.6 + static_cast<double>(i % 7) * 0.1);
+    callNs[i] = std::max(std::chrono::duration<double, std::nano>(Clock::now() - start).count() - clockNs, 0.0);
+  };
+
+  std::cout << "Logging " << count << " lines to " << path.string() << std::endl;
+  {
+    std::ofstream file(path);
+    auto start = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+      timed(i, [&](size_t frame, double ms) { file << "Frame " << frame << ": " << ms << " ms" << std::endl; });
+    }
+    report("std::endl", std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+  }
+  {
+    std::ofstream file(path);
+    auto start = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+      timed(i, [&](size_t frame, double ms) { file << "Frame " << frame << ": " << ms << " ms\n"; });
+    }
+    file.flush();
+    report("'\\n', buffered", std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+  }
+
+  std::FILE* file = std::fopen(path.string().c_str(), "w");
+  if (!file) {
+    std::cerr << "Could not open " << path.string() << std::endl;
+    return;
+  }
+  setLogFile(file);
+  LogStats before = logStats();
+  auto start = Clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    // Bypasses the call site rate limit, in bursts the ring can hold
+    timed(i, [&](size_t frame, double ms) { LogLine(LogLevel::Info) << "Frame " << frame << ": " << ms << " ms"; });
+    if ((i + 1) % (kLogCapacity / 2) == 0) {
+      flushLog();
+    }
+  }
+  flushLog();
+  double ringMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  LogStats after = logStats();
+  report("Log ring", ringMs);
+
+  start = Clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    timed(i, [&](size_t frame, double ms) { LOG_INFO << "Frame " << frame << ": " << ms << " ms"; });
+  }
+  flushLog();
+  report("Rate limited call site", std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+  setLogFile(nullptr);
+  std::fclose(file);
+  std::error_code error;
+  fs::remove(path, error);
+
+  std::cout << "Log ring: " << after.written - before.written << " lines written, " << after.dropped - before.dropped
+            << " dropped" << std::endl;
+}
@@ -0,0 +1,148 @@
+#ifndef WEBGPU_THINGY_SRC_LOG_H_
+#define WEBGPU_THINGY_SRC_LOG_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// Asynchronous logging: a log line is formatted on the caller's stack, then
+// copied into a lock-free ring of fixed-size records that a background thread
+// writes out, so that logging from the render loop or a GPU callback costs a
+// copy instead of a flushing write. Usage:
+//
+//   LOG_INFO << "Reloading " << path;
+//
+// Levels below WEBGPU_THINGY_LOG_LEVEL are compiled out, arguments included.
+// Each call site is rate limited to kLogBurst lines per second, the lines it
+// suppressed are counted on its next line, or by the next flushLog() for a
+// site that went quiet. Reports and diagnostics that come in bursts and must
+// be complete, such as a list of leaks, use the LOG_*_ALWAYS variants, which
+// are not limited. Debug and info go to stdout, warnings and errors to
+// stderr. Lines longer than kLogLineSize are cut.
+
+enum class LogLevel : uint8_t {
+  Debug,
+  Info,
+  Warning,
+  Error,
+};
+
+#ifndef WEBGPU_THINGY_LOG_LEVEL
+#define WEBGPU_THINGY_LOG_LEVEL 1
+#endif
+constexpr LogLevel kMinLogLevel = static_cast<LogLevel>(WEBGPU_THINGY_LOG_LEVEL);
+
+constexpr size_t kLogLineSize = 232;     // Record size minus its header
+constexpr uint32_t kLogBurst = 20;       // Lines per second per call site
+constexpr size_t kLogCapacity = 4096;    // Records in the ring
+
+// Per call site state behind the LOG_ macros, constant initialized
+class LogRateLimiter {
+public:
+  constexpr LogRateLimiter(LogLevel level, const char* file, int line) : m_level(level), m_file(file), m_line(line) {}
+
+  bool allow();
+  // Lines dropped since the last call
+  uint32_t takeSuppressed() { return m_suppressed.exchange(0, std::memory_order_relaxed); }
+
+  // Logs the lines dropped by every call site since its last line
+  static void reportSuppressed();
+
+private:
+  LogLevel m_level;
+  const char* m_file;
+  int m_line;
+  std::atomic<int64_t> m_windowStart{ 0 };  // Steady clock nanoseconds
+  std::atomic<uint32_t> m_count{ 0 };
+  std::atomic<uint32_t> m_suppressed{ 0 };
+  // Sites that ever suppressed a line are listed for reportSuppressed()
+  std::atomic<bool> m_listed{ false };
+  LogRateLimiter* m_next = nullptr;
+  static std::atomic<LogRateLimiter*> s_listed;
+};
+
+// One line, queued when destroyed
+class LogLine {
+public:
+  explicit LogLine(LogLevel level, uint32_t suppressed = 0);
+  ~LogLine();
+  LogLine(const LogLine&) = delete;
+  LogLine& operator=(const LogLine&) = delete;
+
+  LogLine& operator<<(const char* text) { return *this << std::string_view(text ? text : "(null)"); }
+  LogLine& operator<<(const std::string& text) { return *this << std::string_view(text); }
+  LogLine& operator<<(std::string_view text);
+  LogLine& operator<<(char c) { return *this << std::string_view(&c, 1); }
+  LogLine& operator<<(bool value) { return *this << (value ? "true" : "false"); }
+  LogLine& operator<<(double value);
+  LogLine& operator<<(const void* pointer);
+  template <typename T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+  LogLine& operator<<(T value) {
+    if constexpr (std::is_signed_v<T>) {
+      return appendSigned(static_cast<long long>(value));
+    } else {
+      return appendUnsigned(static_cast<unsigned long long>(value));
+    }
+  }
+  // WebGPU handles print as the pointer they wrap, like with std::ostream
+  template <typename T, typename = decltype(static_cast<const void*>(std::declval<const T&>())),
+            std::enable_if_t<std::is_class_v<T>, int> = 0>
+  LogLine& operator<<(const T& handle) { return *this << static_cast<const void*>(handle); }
+
+private:
+  LogLine& appendSigned(long long value);
+  LogLine& appendUnsigned(unsigned long long value);
+
+  LogLevel m_level;
+  uint32_t m_suppressed;
+  uint32_t m_length = 0;
+  bool m_truncated = false;
+  char m_text[kLogLineSize];
+};
+
+#define WEBGPU_THINGY_LOG(level)                                                                          \
+  if constexpr ((level) < kMinLogLevel) {                                                                 \
+  } else if (static LogRateLimiter logRateLimiter((level), __FILE__, __LINE__); !logRateLimiter.allow()) { \
+  } else                                                                                                  \
+    LogLine((level), logRateLimiter.takeSuppressed())
+
+#define WEBGPU_THINGY_LOG_ALWAYS(level)   \
+  if constexpr ((level) < kMinLogLevel) { \
+  } else                                  \
+    LogLine((level))
+
+#define LOG_DEBUG WEBGPU_THINGY_LOG(LogLevel::Debug)
+#define LOG_INFO WEBGPU_THINGY_LOG(LogLevel::Info)
+#define LOG_WARNING WEBGPU_THINGY_LOG(LogLevel::Warning)
+#define LOG_ERROR WEBGPU_THINGY_LOG(LogLevel::Error)
+
+// Not rate limited
+#define LOG_INFO_ALWAYS WEBGPU_THINGY_LOG_ALWAYS(LogLevel::Info)
+#define LOG_WARNING_ALWAYS WEBGPU_THINGY_LOG_ALWAYS(LogLevel::Warning)
+#define LOG_ERROR_ALWAYS WEBGPU_THINGY_LOG_ALWAYS(LogLevel::Error)
+
+// Logs the lines call sites suppressed and not reported yet, then blocks
+// until every line queued so far is written. Call before writing to
+// std::cout directly, so that the output stays in order.
+void flushLog();
+
+// Writes every level to `file` instead, nullptr restores stdout and stderr.
+// Flushes first.
+void setLogFile(std::FILE* file);
+
+struct LogStats {
+  uint64_t written = 0;
+  uint64_t dropped = 0;  // The ring was full
+};
+LogStats logStats();
+
+// Times logging `count` lines through std::endl and through the ring, both
+// writing to a temporary file
+void benchmarkLogging(size_t count);
+
+#endif //WEBGPU_THINGY_SRC_LOG_H_
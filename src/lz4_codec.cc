@@ -0,0 +1,153 @@
+#include "lz4_codec.h"
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5;  // The block must end with at least 5 literals
+constexpr size_t kMatchFindLimit = 12;  // No match may start in the last 12 bytes
+constexpr size_t kMaxOffset = 65535;
+constexpr int kHashBits = 16;
+
+uint32_t read32(const uint8_t* p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint32_t hashSequence(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+// Writes 255-byte continuations of a length that did not fit its 4-bit field
+bool writeLength(size_t length, uint8_t*& out, const uint8_t* end) {
+  for (; length >= 255; length -= 255) {
+    if (out >= end) return false;
+    *out++ = 255;
+  }
+  if (out >= end) return false;
+  *out++ = static_cast<uint8_t>(length);
+  return true;
+}
+
+bool writeSequence(const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength, uint8_t*& out, const uint8_t* end) {
+  if (out >= end) return false;
+  uint8_t* token = out++;
+  *token = static_cast<uint8_t>((literalLength >= 15 ? 15 : literalLength) << 4);
+  if (literalLength >= 15 && !writeLength(literalLength - 15, out, end)) return false;
+  if (static_cast<size_t>(end - out) < literalLength) return false;
+  if (literalLength > 0) {
+    std::memcpy(out, literals, literalLength);
+    out += literalLength;
+  }
+  if (matchLength == 0) {
+    return true;  // Last sequence, literals only
+  }
+  if (end - out < 2) return false;
+  *out++ = static_cast<uint8_t>(offset & 0xFF);
+  *out++ = static_cast<uint8_t>(offset >> 8);
+  size_t length = matchLength - kMinMatch;
+  *token |= static_cast<uint8_t>(length >= 15 ? 15 : length);
+  if (length >= 15 && !writeLength(length - 15, out, end)) return false;
+  return true;
+}
+
+} // namespace
+
+size_t lz4CompressBound(size_t size) {
+  return size + size / 255 + 16;
+}
+
+size_t lz4Compress(const uint8_t* source, size_t size, uint8_t* destination, size_t capacity) {
+  uint8_t* out = destination;
+  const uint8_t* end = destination + capacity;
+  size_t anchor = 0;
+
+  if (size > kMatchFindLimit) {
+    // Positions are stored plus one so that 0 means empty
+    std::vector<uint32_t> table(size_t(1) << kHashBits, 0);
+    const size_t matchLimit = size - kLastLiterals;
+    const size_t searchLimit = size - kMatchFindLimit;
+    size_t pos = 0;
+    while (pos < searchLimit) {
+      uint32_t sequence = read32(source + pos);
+      uint32_t& slot = table[hashSequence(sequence)];
+      size_t candidate = slot;
+      slot = static_cast<uint32_t>(pos + 1);
+      if (candidate == 0 || pos - (candidate - 1) > kMaxOffset || read32(source + candidate - 1) != sequence) {
+        // Skip faster through data that does not compress
+        pos += 1 + ((pos - anchor) >> 6);
+        continue;
+      }
+      size_t match = candidate - 1;
+      // Extend backwards over literals, then forwards
+      while (pos > anchor && match > 0 && source[pos - 1] == source[match - 1]) {
+        --pos;
+        --match;
+      }
+      size_t length = kMinMatch;
+      while (pos + length < matchLimit && source[match + length] == source[pos + length]) {
+        ++length;
+      }
+      if (!writeSequence(source + anchor, pos - anchor, pos - match, length, out, end)) return 0;
+      pos += length;
+      anchor = pos;
+      if (pos - 2 < searchLimit) {
+        table[hashSequence(read32(source + pos - 2))] = static_cast<uint32_t>(pos - 2 + 1);
+      }
+    }
+  }
+  if (!writeSequence(source + anchor, size - anchor, 0, 0, out, end)) return 0;
+  return static_cast<size_t>(out - destination);
+}
+
+bool lz4Decompress(const uint8_t* source, size_t size, uint8_t* destination, size_t decompressedSize) {
+  const uint8_t* in = source;
+  const uint8_t* inEnd = source + size;
+  uint8_t* out = destination;
+  uint8_t* outEnd = destination + decompressedSize;
+
+  auto readLength = [&](size_t& length) {
+    uint8_t byte;
+    do {
+      if (in >= inEnd) return false;
+      byte = *in++;
+      length += byte;
+    } while (byte == 255);
+    return true;
+  };
+
+  while (in < inEnd) {
+    uint8_t token = *in++;
+    size_t literalLength = token >> 4;
+    if (literalLength == 15 && !readLength(literalLength)) return false;
+    if (static_cast<size_t>(inEnd - in) < literalLength || static_cast<size_t>(outEnd - out) < literalLength) return false;
+    if (literalLength > 0) {
+      std::memcpy(out, in, literalLength);
+      in += literalLength;
+      out += literalLength;
+    }
+    if (in == inEnd) {
+      break;  // Last sequence
+    }
+
+    if (inEnd - in < 2) return false;
+    size_t offset = in[0] | (size_t(in[1]) << 8);
+    in += 2;
+    if (offset == 0 || offset > static_cast<size_t>(out - destination)) return false;
+    size_t matchLength = token & 15;
+    if (matchLength == 15 && !readLength(matchLength)) return false;
+    matchLength += kMinMatch;
+    if (static_cast<size_t>(outEnd - out) < matchLength) return false;
+    const uint8_t* match = out - offset;
+    if (offset >= matchLength) {
+      std::memcpy(out, match, matchLength);
+      out += matchLength;
+    } else {
+      // Overlapping copy repeats the last `offset` bytes
+      for (size_t i = 0; i < matchLength; ++i) *out++ = match[i];
+    }
+  }
+  return out == outEnd;
+}
@@ -0,0 +1,21 @@
+#ifndef WEBGPU_THINGY_SRC_LZ4_CODEC_H_
+#define WEBGPU_THINGY_SRC_LZ4_CODEC_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// LZ4 block format (no frame header), compatible with LZ4_compress_default
+// and LZ4_decompress_safe of the reference library. The compressor is the
+// greedy single-probe variant, which trades ratio for speed.
+
+// Largest compressed size of `size` input bytes
+size_t lz4CompressBound(size_t size);
+
+// Returns the compressed size, or 0 if `capacity` is too small
+size_t lz4Compress(const uint8_t* source, size_t size, uint8_t* destination, size_t capacity);
+
+// Decodes exactly `decompressedSize` bytes. Returns false on malformed or
+// truncated input, never reading or writing out of bounds.
+bool lz4Decompress(const uint8_t* source, size_t size, uint8_t* destination, size_t decompressedSize);
+
+#endif //WEBGPU_THINGY_SRC_LZ4_CODEC_H_
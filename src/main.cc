@@ -1,41 +1,208 @@
-#include <cassert>
-#include <iostream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #define WEBGPU_CPP_IMPLEMENTATION
 #include <webgpu/webgpu.hpp>
+#ifndef WEBGPU_THINGY_NULL_PLATFORM
 #include <glfw3webgpu.h>
+#endif
 #include <GLFW/glfw3.h>
+#include "alloc_counter.h"
+#include "async_io.h"
+#include "color_space.h"
+#include "draw_list.h"
+#include "frame_arena.h"
+#include "frame_timer.h"
+#include "gpu_capture.h"
+#include "gpu_pass_timer.h"
+#include "gpu_resources.h"
+#include "hitch_detector.h"
+#include "hud.h"
+#include "incremental_buffer.h"
+#include "job_system.h"
+#include "log.h"
+#include "mesh_lod.h"
+#include "mesh_residency.h"
+#include "metrics.h"
+#include "offscreen_target.h"
+#include "options.h"
+#include "overdraw.h"
+#include "pipeline_cache.h"
+#include "resources.h"
+#include "scene.h"
+#include "shm_feed.h"
+#include "spsc_queue.h"
+#include "trace.h"
+#include "triple_buffer.h"
 #include "utils.h"
+#include "vertex.h"
+#include "vertex_layout.h"
 #include "magic_enum.hpp"
 
-int main (int, char**) {
+namespace {
+
+static_assert(sizeof(ShmVertex) == sizeof(Vertex) && offsetof(ShmVertex, color) == offsetof(Vertex, color),
+              "Fed vertices are uploaded as they are");
+
+// Uploads the mesh in the vertex format `Target`, one of the layouts of vertex.h
+template <typename Target>
+BufferUploadStats uploadVertices(IncrementalBuffer& buffer, const std::vector<Vertex>& vertices) {
+  std::vector<Target> packed = packVertices<Target>(vertices);
+  return buffer.update(packed.data(), packed.size() * sizeof(Target));
+}
+
+// Input state sampled by the event thread
+struct FrameInput {
+  std::chrono::steady_clock::time_point sampleTime;
+  double cursorX = 0.0;
+  double cursorY = 0.0;
+};
+
+// Discrete events for the render thread
+enum class RenderCommand {
+  Quit,
+  ToggleLod,
+  WriteTrace,
+  ToggleHud,
+};
+using RenderCommandQueue = SpscQueue<RenderCommand, 64>;
+
+// The event thread samples input this often while the render thread draws
+constexpr double kInputSamplePeriodSeconds = 0.001;
+
+// Set by SIGINT in offscreen runs, whose hidden window cannot be closed
+volatile std::sig_atomic_t g_interrupted = 0;
+
+} // namespace
+
+int main (int argc, char** argv) {
+  using Clock = std::chrono::steady_clock;
+  const Clock::time_point startupStart = Clock::now();
+  AppOptions options;
+  if (!parseOptions(argc, argv, options)) {
+    return 1;
+  }
+  if (options.benchSrgb > 0) {
+    benchmarkSrgbToLinear(options.benchSrgb);
+    return 0;
+  }
+  if (options.benchIo > 0) {
+    benchmarkAsyncIo(options.benchIo);
+    return 0;
+  }
+  if (options.benchLog > 0) {
+    benchmarkLogging(options.benchLog);
+    return 0;
+  }
+  if (options.benchJobs > 0) {
+    benchmarkJobSystem(options.benchJobs);
+    return 0;
+  }
+  if (options.benchMetrics > 0) {
+    benchmarkMetrics(options.benchMetrics);
+    return 0;
+  }
+  if (options.checkAllocations && !allocationCountingEnabled()) {
+    LOG_ERROR << "--check-allocations needs a build with COUNT_ALLOCATIONS";
+    return 1;
+  }
+  // Hitch snapshots need the latest zones of a run of any length
+  const bool detectHitches = options.hitchFactor > 0.0;
+  if (!options.tracePath.empty() || (detectHitches && kTracingBuilt)) {
+    traceStart(detectHitches ? TraceBufferMode::KeepLatest : TraceBufferMode::KeepFirst);
+    setTraceThreadName("Main");
+    if (detectHitches && !options.tracePath.empty()) {
+      LOG_INFO << "Hitch snapshots keep the latest zones of each thread, the trace holds the last "
+               << kTraceEventsPerThread << " zones per thread rather than the first";
+    }
+  }
+
+  // Parses geometry and selects levels of detail, from any thread
+  JobSystem jobs(options.jobWorkers >= 0 ? static_cast<unsigned>(options.jobWorkers) : JobSystem::defaultWorkerCount());
+
+  // A geometry file is read and parsed in the background while the device
+  // and the pipelines are set up. The reader is declared after what its
+  // callbacks write to, so that early returns wait for them first.
+  std::vector<Vertex> vertices;
+  std::vector<uint16_t> indexData;
+  bool geometryLoaded = false;
+  AsyncFileReader fileReader;
+  if (!options.geometryPath.empty()) {
+    fileReader.read(options.geometryPath, [&](bool success, std::string& source) {
+      geometryLoaded = success && parseGeometry(source, vertices, indexData, &jobs);
+    });
+  }
+
+  // Overdraw analysis and the encoding benchmark render offscreen, without a
+  // window or a swap chain
+  const bool headless = options.overdraw || options.benchEncode > 0;
+  // The frame loop renders into a texture instead of the window's swap
+  // chain. The windows of GLFW's null platform have no surface to present to.
+#ifdef WEBGPU_THINGY_NULL_PLATFORM
+  const bool offscreen = !headless;
+#else
+  const bool offscreen = !headless && options.offscreen;
+#endif
+
   // Window
-  glfwInit();
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-  GLFWwindow* window = glfwCreateWindow(640, 480, "Learn WebGPU", nullptr, nullptr);
+  GLFWwindow* window = nullptr;
+  if (!headless) {
+    glfwInit();
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_VISIBLE, offscreen ? GLFW_FALSE : GLFW_TRUE);
+    window = glfwCreateWindow(options.width, options.height, "Learn WebGPU", nullptr, nullptr);
 
-  if (!window) {
-    std::cerr << "Failed to create GLFW window" << std::endl;
-    glfwTerminate();
-    return -1;
+    if (!window) {
+      LOG_ERROR << "Failed to create GLFW window";
+      glfwTerminate();
+      return -1;
+    }
+    // Ctrl+C then ends the run the way closing the window does, reports included
+    if (offscreen) {
+      std::signal(SIGINT, [](int) { g_interrupted = 1; });
+    }
   }
 
   // Instance
+  const int64_t deviceSetupStart = traceEnabled() ? traceNow() : 0;
   wgpu::Instance instance = wgpu::createInstance(wgpu::InstanceDescriptor{});
   if (!instance) {
-    std::cerr << "Could not initialize WebGPU!" << std::endl;
+    LOG_ERROR << "Could not initialize WebGPU!";
     return 1;
   }
-  std::cout << "WGPU instance: " << instance << std::endl;
+  LOG_INFO << "WGPU instance: " << instance;
 
   // Adapter
-  std::cout << "Requesting adapter..." << std::endl;
+  LOG_INFO << "Requesting adapter...";
   wgpu::RequestAdapterOptions adapterOpts = wgpu::Default;
-  wgpu::Surface surface = glfwGetWGPUSurface(instance, window);
+#ifdef WEBGPU_THINGY_NULL_PLATFORM
+  wgpu::Surface surface = nullptr;
+#else
+  wgpu::Surface surface = headless || offscreen ? nullptr : glfwGetWGPUSurface(instance, window);
+#endif
   adapterOpts.compatibleSurface = surface;
+  adapterOpts.forceFallbackAdapter = options.fallbackAdapter;
   wgpu::Adapter adapter = instance.requestAdapter(adapterOpts);
-  assert(adapter);
-  std::cout << "Got adapter: " << adapter << std::endl;
+  if (!adapter) {
+    LOG_ERROR << "Could not get a WebGPU adapter";
+    return 1;
+  }
+  LOG_INFO << "Got adapter: " << adapter;
+
+  // Vertex layouts, both buffers described by compile-time layouts of C++ structs
+  const VertexLayoutView& vertexLayout = options.packedVertices ? VertexLayout<PackedVertex>::view : VertexLayout<Vertex>::view;
+  const std::array<VertexLayoutView, 2> vertexLayouts = { vertexLayout, VertexLayout<InstanceData>::view };
+  const VertexLayoutLimits vertexLimits = vertexLayoutLimits(vertexLayouts);
 
   // Adapter Capabilities
   wgpu::SupportedLimits supportedLimits;
@@ -43,83 +210,179 @@ int main (int, char**) {
 
   // Device Requirements
   wgpu::RequiredLimits requiredLimits = wgpu::Default;
-  requiredLimits.limits.maxVertexAttributes = 2;
-  requiredLimits.limits.maxVertexBuffers = 1;
-  requiredLimits.limits.maxBufferSize = 15 * 5 * sizeof(float);
-  requiredLimits.limits.maxVertexBufferArrayStride = 5 * sizeof(float);
+  requiredLimits.limits.maxVertexAttributes = vertexLimits.maxVertexAttributes;
+  requiredLimits.limits.maxVertexBuffers = vertexLimits.maxVertexBuffers;
+  requiredLimits.limits.maxBufferSize = supportedLimits.limits.maxBufferSize; // Geometry size depends on the file and LOD chain
+  requiredLimits.limits.maxVertexBufferArrayStride = vertexLimits.maxVertexBufferArrayStride;
   requiredLimits.limits.minStorageBufferOffsetAlignment = supportedLimits.limits.minStorageBufferOffsetAlignment; // This must be set even if we do not use storage buffers for now
   requiredLimits.limits.minUniformBufferOffsetAlignment = supportedLimits.limits.minUniformBufferOffsetAlignment; // This must be set even if we do not use uniform buffers for now
-  requiredLimits.limits.maxInterStageShaderComponents = 3;
+  requiredLimits.limits.maxInterStageShaderComponents = 4;
 
   // Device
-  std::cout << "Requesting device..." << std::endl;
+  LOG_INFO << "Requesting device...";
   wgpu::DeviceDescriptor deviceDesc = wgpu::Default;
   deviceDesc.label = "Default device";
   deviceDesc.defaultQueue.label = "Default queue";
   deviceDesc.requiredLimits = &requiredLimits;
+  // Render passes are timed for the trace and the HUD where the adapter can
+  const WGPUFeatureName timestampFeature = WGPUFeatureName_TimestampQuery;
+  if ((traceEnabled() || options.hud) && adapter.hasFeature(wgpu::FeatureName::TimestampQuery)) {
+    deviceDesc.requiredFeaturesCount = 1;
+    deviceDesc.requiredFeatures = &timestampFeature;
+  }
   wgpu::Device device = adapter.requestDevice(deviceDesc);
   device.getLimits(&supportedLimits);
-  std::cout << "device.maxVertexAttributes: " << supportedLimits.limits.maxVertexAttributes << std::endl;
-  device.setUncapturedErrorCallback([](wgpu::ErrorType type, char const* message) {
-    std::cout << "Uncaptured device error: type " << type;
-    if (message) std::cout << " (" << message << ")";
-    std::cout << std::endl;
+  LOG_INFO << "device.maxVertexAttributes: " << supportedLimits.limits.maxVertexAttributes;
+  // Both callbacks live as long as their handle, and may fire every frame
+  auto deviceErrorCallback = device.setUncapturedErrorCallback([](wgpu::ErrorType type, char const* message) {
+    LOG_ERROR << "Uncaptured device error: " << magic_enum::enum_name<WGPUErrorType>(type) << " (" << (message ? message : "no message") << ")";
   });
-  std::cout << "Got device: " << device << std::endl;
+  LOG_INFO << "Got device: " << device;
+  if (traceEnabled()) {
+    traceZone("Device setup", deviceSetupStart, traceNow());
+  }
 
   // Queue
   wgpu::Queue queue = device.getQueue();
-  queue.onSubmittedWorkDone([](wgpu::QueueWorkDoneStatus status) {
-    std::cout << "Queued work finished with status: " << status << std::endl;
+  auto workDoneCallback = queue.onSubmittedWorkDone([](wgpu::QueueWorkDoneStatus status) {
+    LOG_DEBUG << "Queued work finished with status: " << magic_enum::enum_name<WGPUQueueWorkDoneStatus>(status);
   });
 
+  // Recorded before any resource is created, for capture-replay
+  std::unique_ptr<GpuCapture> capture;
+  if (!options.capturePath.empty()) {
+    capture = std::make_unique<GpuCapture>(options.capturePath);
+    if (!capture->isOpen()) {
+      LOG_ERROR << "Could not open capture file " << options.capturePath;
+      capture.reset();
+    }
+  }
+
+  // Buffers, textures and query sets are created through the registry, which
+  // accounts for their memory and reports what is not destroyed at exit
+  GpuResources gpuResources(device, capture.get());
+  gpuResources.setBudget(uint64_t(options.gpuBudgetMiB) << 20, options.gpuBudgetFail ? GpuBudgetMode::Fail : GpuBudgetMode::Warn);
+
+  // Metrics for monitoring, updated by the render loop and exported from a
+  // thread of the exporter
+  MetricsRegistry metricsRegistry;
+  RenderMetrics renderMetrics(metricsRegistry);
+  metricsRegistry.addCollector([&]() { renderMetrics.gpuMemory.set(static_cast<double>(gpuResources.report().total.bytes)); });
+  std::unique_ptr<MetricsExporter> metricsExporter;
+  if (options.metricsPort != 0 || !options.metricsFile.empty()) {
+    MetricsExporterSettings exporterSettings;
+    exporterSettings.httpPort = static_cast<uint16_t>(options.metricsPort);
+    exporterSettings.textfilePath = options.metricsFile;
+    exporterSettings.textfilePeriodSeconds = options.metricsPeriodSeconds;
+    metricsExporter = std::make_unique<MetricsExporter>(metricsRegistry, exporterSettings);
+  }
+
+  // Snapshots of frames that take much longer than the others, with the
+  // reloads and uploads that happened before them
+  std::unique_ptr<HitchDetector> hitchDetector;
+  if (detectHitches) {
+    HitchDetectorSettings hitchSettings;
+    hitchSettings.medianMultiple = options.hitchFactor;
+    hitchSettings.directory = options.hitchDir;
+    hitchSettings.maxSnapshots = options.hitchFiles;
+    hitchDetector = std::make_unique<HitchDetector>(hitchSettings);
+  }
+  auto noteEvent = [&](const char* what, uint64_t bytes) {
+    if (hitchDetector) {
+      hitchDetector->note(what, bytes);
+    }
+  };
+
   // Swapchain
   wgpu::SwapChainDescriptor swapChainDesc = wgpu::Default;
-  swapChainDesc.width = 640;
-  swapChainDesc.height = 480;
+  swapChainDesc.width = options.width;
+  swapChainDesc.height = options.height;
 #ifdef WEBGPU_BACKEND_WGPU
-  wgpu::TextureFormat swapChainFormat = surface.getPreferredFormat(adapter);
+  wgpu::TextureFormat swapChainFormat = headless || offscreen ? wgpu::TextureFormat(wgpu::TextureFormat::RGBA8Unorm) : surface.getPreferredFormat(adapter);
 #else
-  TextureFormat swapChainFormat = TextureFormat::BGRA8Unorm;
+  wgpu::TextureFormat swapChainFormat = wgpu::TextureFormat::BGRA8Unorm;
 #endif
-  swapChainDesc.format = swapChainFormat;
-  swapChainDesc.usage = wgpu::TextureUsage::RenderAttachment;
-  swapChainDesc.presentMode = wgpu::PresentMode::Fifo;
-  wgpu::SwapChain swapChain = device.createSwapChain(surface, swapChainDesc);
-  std::cout << "Swapchain: " << swapChain << std::endl;
-  std::cout << "Swapchain format: " << magic_enum::enum_name<WGPUTextureFormat>(swapChainFormat) << std::endl;
-
-  // Shader module
-  std::cout << "Creating shader module..." << std::endl;
-  wgpu::ShaderModule shaderModule = loadShaderModule(RESOURCE_DIR "/shader.wgsl", device);
-  std::cout << "Shader module: " << shaderModule << std::endl;
+  // The sRGB variant of the preferred 8-bit format lets the hardware encode
+  // linear colors on write. Surfaces that do not offer it keep the UNORM
+  // format, colors are then written encoded.
+  if (const wgpu::TextureFormat srgbFormat = toSrgbFormat(swapChainFormat); srgbFormat != swapChainFormat) {
+    bool offered = headless || offscreen;  // Render targets of our own have both
+    if (!offered) {
+      const std::vector<wgpu::TextureFormat> formats = surfaceFormats(surface, adapter);
+      offered = std::find(formats.begin(), formats.end(), srgbFormat) != formats.end();
+    }
+    if (offered) {
+      swapChainFormat = srgbFormat;
+    } else {
+      LOG_INFO << "The surface offers no " << magic_enum::enum_name<WGPUTextureFormat>(srgbFormat)
+               << ", colors are encoded before they are written";
+    }
+  }
+  wgpu::SwapChain swapChain = nullptr;
+  std::unique_ptr<OffscreenTarget> offscreenTarget;
+  if (offscreen) {
+    OffscreenTargetSettings offscreenSettings;
+    offscreenSettings.width = options.width;
+    offscreenSettings.height = options.height;
+    offscreenSettings.format = swapChainFormat;
+    offscreenTarget = std::make_unique<OffscreenTarget>(device, queue, gpuResources, offscreenSettings);
+    LOG_INFO << "Rendering offscreen, " << offscreenSettings.maxFramesInFlight << " frames in flight";
+    if (options.benchFrames == 0) {
+      LOG_WARNING << "Offscreen frames run until interrupted with Ctrl+C, see --bench-frames";
+    }
+  } else if (!headless) {
+    swapChainDesc.format = swapChainFormat;
+    swapChainDesc.usage = wgpu::TextureUsage::RenderAttachment;
+    swapChainDesc.presentMode = options.presentMode;
+    swapChain = device.createSwapChain(surface, swapChainDesc);
+    LOG_INFO << "Swapchain: " << swapChain;
+  }
+  LOG_INFO << "Swapchain format: " << magic_enum::enum_name<WGPUTextureFormat>(swapChainFormat);
+
+  // Shader variants
+  LOG_INFO << "Creating shader module...";
+  AssetPack assetPack;
+  if (!options.packPath.empty() && !assetPack.open(options.packPath)) {
+    return 1;
+  }
+  ResourceLoader resources(options.diskResources ? RESOURCE_DIR : "", assetPack.isOpen() ? &assetPack : nullptr);
+  std::string shaderSource;
+  if (!resources.load("shader.wgsl", shaderSource)) {
+    LOG_ERROR << "Could not load shader!";
+    return 1;
+  }
+  std::string shaderPrelude = std::string(vertexLayout.wgsl) + VertexLayout<InstanceData>::view.wgsl;
+  auto pipelineCache = std::make_unique<PipelineCache>(device, queue, shaderPrelude + shaderSource);
+  pipelineCache->setCapture(capture.get());
+  pipelineCache->setHitCounter(&renderMetrics.pipelineCacheHits);
+  // Shared by the shader's projection and the layout of the instance grid
+  const float aspectRatio = static_cast<float>(options.width) / static_cast<float>(options.height);
+  ShaderConstants sceneConstants = {
+    { "aspect_ratio", aspectRatio },
+    { "mesh_offset_x", -0.6875 },  // Centers webgpu.txt
+    { "mesh_offset_y", -0.463 },
+    { "fragment_srgb", options.fragmentSrgb ? 1.0 : 0.0 },
+    { "encode_srgb", isSrgbFormat(swapChainFormat) ? 0.0 : 1.0 },
+  };
+  const ShaderVariant& sceneShader = pipelineCache->shaderVariant(sceneConstants);
+  LOG_INFO << "Shader module: " << sceneShader.module;
 
   // Pipeline
   wgpu::RenderPipelineDescriptor pipelineDesc = wgpu::Default;
-  // Vertex Position Attribute
-  std::vector<wgpu::VertexAttribute> vertexAttribs(2);
-  vertexAttribs[0].shaderLocation = 0;
-  vertexAttribs[0].format = wgpu::VertexFormat::Float32x2;
-  vertexAttribs[0].offset = 0;
-  // Vertex Color Attribute
-  vertexAttribs[1].shaderLocation = 1;
-  vertexAttribs[1].format = wgpu::VertexFormat::Float32x3;
-  vertexAttribs[1].offset = 2 * sizeof(float);
-  // Vertex Buffer Layout
-  wgpu::VertexBufferLayout vertexBufferLayout;
-  vertexBufferLayout.attributeCount = static_cast<uint32_t>(vertexAttribs.size());
-  vertexBufferLayout.attributes = vertexAttribs.data();
-  vertexBufferLayout.arrayStride = 5 * sizeof(float);
-  vertexBufferLayout.stepMode = wgpu::VertexStepMode::Vertex;
+  // Vertex and instance buffer layouts
+  std::vector<wgpu::VertexBufferLayout> bufferLayouts;
+  for (const VertexLayoutView& layout : vertexLayouts) {
+    bufferLayouts.push_back(makeVertexBufferLayout(layout));
+  }
 
   // Vertex State
-  pipelineDesc.vertex.bufferCount = 1;
-  pipelineDesc.vertex.buffers = &vertexBufferLayout;
+  pipelineDesc.vertex.bufferCount = static_cast<uint32_t>(bufferLayouts.size());
+  pipelineDesc.vertex.buffers = bufferLayouts.data();
 
-  pipelineDesc.vertex.module = shaderModule;
+  pipelineDesc.vertex.module = sceneShader.module;
   pipelineDesc.vertex.entryPoint = "vs_main";
-  pipelineDesc.vertex.constantCount = 0;
-  pipelineDesc.vertex.constants = nullptr;
+  pipelineDesc.vertex.constantCount = sceneShader.constantCount;
+  pipelineDesc.vertex.constants = sceneShader.constants;
   // Primitive State
   pipelineDesc.primitive.topology = wgpu::PrimitiveTopology::TriangleList; // Each sequence of 3 vertices is considered as a triangle
   pipelineDesc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
@@ -127,10 +390,10 @@ int main (int, char**) {
   pipelineDesc.primitive.cullMode = wgpu::CullMode::None;
   // Fragment Shader
   wgpu::FragmentState fragmentState = wgpu::Default;
-  fragmentState.module = shaderModule;
+  fragmentState.module = sceneShader.module;
   fragmentState.entryPoint = "fs_main";
-  fragmentState.constantCount = 0;
-  fragmentState.constants = nullptr;
+  fragmentState.constantCount = sceneShader.constantCount;
+  fragmentState.constants = sceneShader.constants;
   pipelineDesc.fragment = &fragmentState;
   // Blend State
   wgpu::BlendState blendState;
@@ -147,55 +410,626 @@ int main (int, char**) {
   colorTarget.writeMask = wgpu::ColorWriteMask::All;
   fragmentState.targetCount = 1;
   fragmentState.targets = &colorTarget;
+  // Depth Stencil State
+  const bool useDepth = options.depthFormat != wgpu::TextureFormat::Undefined;
+  wgpu::DepthStencilState depthStencilState = wgpu::Default;
+  depthStencilState.depthCompare = wgpu::CompareFunction::Less;
+  depthStencilState.format = options.depthFormat;
+  depthStencilState.stencilReadMask = 0;
+  depthStencilState.stencilWriteMask = 0;
   pipelineDesc.depthStencil = nullptr;
   pipelineDesc.multisample.count = 1;  // Samples per pixel
   pipelineDesc.multisample.mask = ~0u; // Default value for the mask, meaning "all bits on"
   pipelineDesc.multisample.alphaToCoverageEnabled = false; // Default value as well (irrelevant for count = 1 anyways)
   // Layout
   wgpu::PipelineLayoutDescriptor layoutDesc;
+  layoutDesc.label = "Pipeline layout";
   layoutDesc.bindGroupLayoutCount = 0;
   layoutDesc.bindGroupLayouts = nullptr;
-  wgpu::PipelineLayout layout = device.createPipelineLayout(layoutDesc);
+  wgpu::PipelineLayout layout = gpuResources.createPipelineLayout(layoutDesc);
   pipelineDesc.layout = layout;
 
-  wgpu::RenderPipeline pipeline = device.createRenderPipeline(pipelineDesc);
-  std::cout << "Render pipeline: " << pipeline << std::endl;
+  // Without a depth buffer everything is blended in scene order. With one,
+  // opaque geometry is written without blending and tested early, and only
+  // transparent geometry is blended on top, tested but not written.
+  if (useDepth) {
+    depthStencilState.depthWriteEnabled = false;
+    pipelineDesc.depthStencil = &depthStencilState;
+  }
+  wgpu::DepthStencilState opaqueDepthStencilState = depthStencilState;
+  opaqueDepthStencilState.depthWriteEnabled = true;
+  wgpu::ColorTargetState opaqueColorTarget = colorTarget;
+  opaqueColorTarget.blend = nullptr;
+  wgpu::FragmentState opaqueFragmentState = fragmentState;
+  opaqueFragmentState.targets = &opaqueColorTarget;
+  wgpu::RenderPipelineDescriptor opaquePipelineDesc = pipelineDesc;
+  opaquePipelineDesc.fragment = &opaqueFragmentState;
+  opaquePipelineDesc.depthStencil = &opaqueDepthStencilState;
 
-  std::vector<float> pointData;
-  std::vector<uint16_t> indexData;
+  // Both variants compile in parallel
+  const int64_t pipelinesStart = traceEnabled() ? traceNow() : 0;
+  enum PipelineState : uint32_t { BlendedPipeline, OpaquePipeline };
+  std::vector<PipelineRequest> pipelineRequests = { { BlendedPipeline, sceneConstants, pipelineDesc } };
+  if (useDepth) {
+    pipelineRequests.push_back({ OpaquePipeline, sceneConstants, opaquePipelineDesc });
+  }
+  pipelineCache->prepare(pipelineRequests);
+  wgpu::RenderPipeline pipeline = pipelineCache->find(BlendedPipeline, sceneConstants);
+  LOG_INFO << "Render pipeline: " << pipeline;
+  wgpu::RenderPipeline opaquePipeline = pipeline;
+  if (useDepth) {
+    opaquePipeline = pipelineCache->find(OpaquePipeline, sceneConstants);
+    LOG_INFO << "Opaque render pipeline: " << opaquePipeline;
+  }
+  if (!pipeline || !opaquePipeline) {
+    LOG_ERROR << "Could not create render pipelines!";
+    return 1;
+  }
+  if (traceEnabled()) {
+    traceZone("Create pipelines", pipelinesStart, traceNow());
+  }
+  // Reports write to std::cout, after what is still queued in the log
+  flushLog();
+  printPipelineCacheStats(pipelineCache->stats());
 
-  bool success = loadGeometry(RESOURCE_DIR "/webgpu.txt", pointData, indexData);
-  if (!success) {
-    std::cerr << "Could not load geometry!" << std::endl;
+  {
+    TRACE_ZONE("Wait for geometry");
+    fileReader.waitAll();
+  }
+  std::string geometrySource;
+  if (options.geometryPath.empty()) {
+    geometryLoaded = resources.load("webgpu.txt", geometrySource) && parseGeometry(geometrySource, vertices, indexData, &jobs);
+  }
+  if (!geometryLoaded) {
+    LOG_ERROR << "Could not load geometry!";
     return 1;
   }
+  flushLog();
+  printResourceLoaderStats(resources);
+
+  // Mesh processing, run again when the geometry is reloaded
+  std::vector<MeshLod> lodChain;
+  auto prepareGeometry = [&]() {
+    TRACE_ZONE("Prepare geometry");
+    // Decode the sRGB vertex colors once instead of per fragment. On a non-sRGB
+    // target the encoded colors are already what should be written.
+    if (!options.fragmentSrgb && isSrgbFormat(swapChainFormat)) {
+      convertVertexColorsToLinear(vertices);
+      LOG_INFO << "Converted vertex colors to linear (" << srgbToLinearImplementation() << ")";
+    }
+    if (options.subdivisions > 0 && !subdivideGeometry(vertices, indexData, options.subdivisions)) {
+      LOG_ERROR << "Subdivided geometry does not fit 16-bit indices, using the original mesh";
+    }
+
+    // Level of detail chain, appended to the same index buffer
+    LodChainSettings lodSettings;
+    lodSettings.maxLevels = options.lodLevels;
+    lodChain = buildLodChain(vertices, indexData, lodSettings);
+    flushLog();
+    printLodReport(lodChain);
+    // writeBuffer sizes must be a multiple of 4 bytes
+    if (indexData.size() % 2 != 0) {
+      indexData.push_back(0);
+    }
+  };
+  prepareGeometry();
 
-  // Create vertex buffer
+  // Vertex and index buffers, only the blocks that changed are uploaded again on reload
+  auto vertexUploads = std::make_unique<IncrementalBuffer>(device, queue, wgpu::BufferUsage::Vertex, 64 * 1024, &gpuResources, "Vertices");
+  auto indexUploads = std::make_unique<IncrementalBuffer>(device, queue, wgpu::BufferUsage::Index, 64 * 1024, &gpuResources, "Indices");
+  // Mesh streaming: every level of detail gets an index buffer of its own,
+  // resident within the budget while it is drawn. The coarsest level is
+  // pinned and drawn in place of the others until they are streamed in.
+  std::unique_ptr<MeshResidency> meshResidency;
+  std::vector<MeshId> lodMeshes;
+  if (options.meshBudgetMiB > 0 && !headless) {
+    MeshResidencySettings residencySettings;
+    residencySettings.budgetBytes = uint64_t(options.meshBudgetMiB) << 20;
+    residencySettings.cacheDirectory = options.meshCacheDir;
+    meshResidency = std::make_unique<MeshResidency>(queue, gpuResources, jobs, fileReader, residencySettings);
+  }
+  auto uploadGeometry = [&]() {
+    TRACE_ZONE("Upload geometry");
+    BufferUploadStats vertexStats = options.packedVertices
+      ? uploadVertices<PackedVertex>(*vertexUploads, vertices)
+      : uploadVertices<Vertex>(*vertexUploads, vertices);
+    if (meshResidency) {
+      meshResidency->clear();
+      lodMeshes.clear();
+      renderMetrics.uploadedBytes.add(vertexStats.bytesUploaded);
+      noteEvent("Geometry uploaded", vertexStats.bytesUploaded);
+      for (size_t level = 0; level < lodChain.size(); ++level) {
+        const MeshLod& lod = lodChain[level];
+        std::string label = "LOD " + std::to_string(level);
+        lodMeshes.push_back(meshResidency->add(label.c_str(), indexData.data() + lod.firstIndex, lod.indexCount * sizeof(uint16_t),
+                                               wgpu::BufferUsage::Index, level + 1 == lodChain.size()));
+      }
+      flushLog();
+      printBufferUploadStats("Vertex buffer upload", vertexStats);
+    } else {
+      BufferUploadStats indexStats = indexUploads->update(indexData.data(), indexData.size() * sizeof(uint16_t));
+      renderMetrics.uploadedBytes.add(vertexStats.bytesUploaded + indexStats.bytesUploaded);
+      noteEvent("Geometry uploaded", vertexStats.bytesUploaded + indexStats.bytesUploaded);
+      flushLog();
+      printBufferUploadStats("Vertex buffer upload", vertexStats);
+      printBufferUploadStats("Index buffer upload", indexStats);
+    }
+    // The GPU buffers and the residency cache hold the only copies from here on
+    vertices.clear();
+    vertices.shrink_to_fit();
+    indexData.clear();
+    indexData.shrink_to_fit();
+  };
+  uploadGeometry();
+  LOG_INFO << "Vertex layout: " << vertexLayout.stride << " bytes per vertex, " << vertexUploads->size() << " bytes";
+
+  // Create instance buffer
   wgpu::BufferDescriptor bufferDesc;
-  bufferDesc.size = pointData.size() * sizeof(float);
+  SceneSettings sceneSettings;
+  sceneSettings.gridSize = options.gridSize;
+  sceneSettings.layers = options.layers;
+  sceneSettings.transparentLayers = options.transparentLayers;
+  sceneSettings.aspectRatio = aspectRatio;
+  std::vector<InstanceData> instances = makeScene(sceneSettings);
+  bufferDesc.size = instances.size() * sizeof(InstanceData);
   bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Vertex;
   bufferDesc.mappedAtCreation = false;
-  wgpu::Buffer vertexBuffer = device.createBuffer(bufferDesc);
-  queue.writeBuffer(vertexBuffer, 0, pointData.data(), bufferDesc.size);
+  bufferDesc.label = "Instances";
+  wgpu::Buffer instanceBuffer = gpuResources.createBuffer(bufferDesc);
+  LOG_INFO << "Scene: " << instances.size() << " instances";
 
-  // Index Buffer alignment
-  int indexCount = static_cast<int>(indexData.size());
+  // Instances are uploaded in draw order, grouped into batches that are one instanced draw each
+  std::vector<uint32_t> instanceLods(instances.size(), 0);
+  std::vector<InstanceData> orderedInstances;
+  std::vector<InstanceBatch> instanceBatches;
+  bool instancesDirty = true;
 
-  // Create index buffer
-  // (we reuse the bufferDesc initialized for the vertexBuffer)
-  bufferDesc.size = indexData.size() * sizeof(float);
-  bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Index;
-  bufferDesc.mappedAtCreation = false;
-  wgpu::Buffer indexBuffer = device.createBuffer(bufferDesc);
-  queue.writeBuffer(indexBuffer, 0, indexData.data(), bufferDesc.size);
+  // Depth buffer
+  wgpu::Texture depthTexture = nullptr;
+  wgpu::TextureView depthTextureView = nullptr;
+  if (useDepth) {
+    wgpu::TextureDescriptor depthTextureDesc;
+    depthTextureDesc.label = "Depth buffer";
+    depthTextureDesc.dimension = wgpu::TextureDimension::_2D;
+    depthTextureDesc.format = options.depthFormat;
+    depthTextureDesc.mipLevelCount = 1;
+    depthTextureDesc.sampleCount = 1;
+    depthTextureDesc.size = { options.width, options.height, 1 };
+    depthTextureDesc.usage = wgpu::TextureUsage::RenderAttachment;
+    depthTextureDesc.viewFormatCount = 1;
+    depthTextureDesc.viewFormats = (WGPUTextureFormat*)&options.depthFormat;
+    depthTexture = gpuResources.createTexture(depthTextureDesc);
+
+    wgpu::TextureViewDescriptor depthTextureViewDesc;
+    depthTextureViewDesc.aspect = wgpu::TextureAspect::DepthOnly;
+    depthTextureViewDesc.baseArrayLayer = 0;
+    depthTextureViewDesc.arrayLayerCount = 1;
+    depthTextureViewDesc.baseMipLevel = 0;
+    depthTextureViewDesc.mipLevelCount = 1;
+    depthTextureViewDesc.dimension = wgpu::TextureViewDimension::_2D;
+    depthTextureViewDesc.format = options.depthFormat;
+    depthTextureView = depthTexture.createView(depthTextureViewDesc);
+    if (capture) {
+      capture->createTextureView(depthTextureView, depthTexture, depthTextureViewDesc);
+    }
+    LOG_INFO << "Depth format: " << magic_enum::enum_name<WGPUTextureFormat>(options.depthFormat);
+  }
+
+  // Overdraw measurement: an occlusion query around the whole pass counts
+  // every sample that passes the depth test, i.e. every shaded sample
+  wgpu::QuerySet occlusionQuerySet = nullptr;
+  wgpu::Buffer occlusionResolveBuffer = nullptr;
+  wgpu::Buffer occlusionReadbackBuffer = nullptr;
+  if (options.measureOverdraw) {
+    wgpu::QuerySetDescriptor querySetDesc;
+    querySetDesc.label = "Overdraw occlusion";
+    querySetDesc.type = wgpu::QueryType::Occlusion;
+    querySetDesc.count = 1;
+    querySetDesc.pipelineStatistics = nullptr;
+    querySetDesc.pipelineStatisticsCount = 0;
+    occlusionQuerySet = gpuResources.createQuerySet(querySetDesc);
+    bufferDesc.size = sizeof(uint64_t);
+    bufferDesc.label = "Occlusion resolve";
+    bufferDesc.usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc;
+    occlusionResolveBuffer = gpuResources.createBuffer(bufferDesc);
+    bufferDesc.label = "Occlusion readback";
+    bufferDesc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+    occlusionReadbackBuffer = gpuResources.createBuffer(bufferDesc);
+  }
+
+  // Draw List
+  DrawList drawList;
+  DrawListStats drawListStats;
+  // Transient CPU data of the frame being rendered, such as sort scratch
+  FrameArena frameArena;
+  DrawCommand geometryDraw;
+  geometryDraw.instanceBuffer = instanceBuffer;
+  geometryDraw.instanceBufferSize = instances.size() * sizeof(InstanceData);
+  geometryDraw.indexFormat = wgpu::IndexFormat::Uint16;
+  // Reallocated when a reload changes the size of the geometry
+  auto bindGeometryBuffers = [&]() {
+    geometryDraw.vertexBuffer = vertexUploads->buffer();
+    geometryDraw.vertexBufferSize = vertexUploads->size();
+    geometryDraw.indexBuffer = indexUploads->buffer();
+    geometryDraw.indexBufferSize = indexUploads->size();
+  };
+  bindGeometryBuffers();
+
+  // Live editing: the geometry file is watched and read again in the
+  // background when it changes, then processed and uploaded between frames
+  namespace fs = std::filesystem;
+  fs::path geometryFile = !options.geometryPath.empty() ? fs::path(options.geometryPath)
+                        : options.diskResources ? fs::path(RESOURCE_DIR) / "webgpu.txt" : fs::path();
+  std::error_code watchError;
+  fs::file_time_type geometryWriteTime = geometryFile.empty() ? fs::file_time_type() : fs::last_write_time(geometryFile, watchError);
+  Clock::time_point lastGeometryCheck = Clock::now();
+  std::vector<Vertex> reloadedVertices;
+  std::vector<uint16_t> reloadedIndices;
+  bool reloadSucceeded = false;
+  bool reloadInFlight = false;
+  std::atomic<bool> reloadReady{ false };
+  auto reloadGeometry = [&]() {
+    TRACE_ZONE("Reload geometry");
+    if (reloadReady.load(std::memory_order_acquire)) {
+      reloadReady = false;
+      reloadInFlight = false;
+      if (!reloadSucceeded) {
+        LOG_ERROR << "Could not reload geometry, keeping the previous one";
+        return;
+      }
+      LOG_INFO << "Reloading " << geometryFile.string();
+      noteEvent("Geometry reloaded", 0);
+      vertices = std::move(reloadedVertices);
+      indexData = std::move(reloadedIndices);
+      prepareGeometry();
+      uploadGeometry();
+      bindGeometryBuffers();
+      // The LOD chain may be shorter than before
+      std::fill(instanceLods.begin(), instanceLods.end(), 0);
+      instancesDirty = true;
+      return;
+    }
+    if (geometryFile.empty() || reloadInFlight || Clock::now() - lastGeometryCheck < std::chrono::milliseconds(500)) {
+      return;
+    }
+    lastGeometryCheck = Clock::now();
+    fs::file_time_type writeTime = fs::last_write_time(geometryFile, watchError);
+    if (watchError || writeTime == geometryWriteTime) {
+      return;
+    }
+    geometryWriteTime = writeTime;
+    reloadInFlight = true;
+    noteEvent("Geometry file changed", 0);
+    fileReader.read(geometryFile, [&](bool success, std::string& source) {
+      reloadSucceeded = success && parseGeometry(source, reloadedVertices, reloadedIndices, &jobs);
+      reloadReady.store(true, std::memory_order_release);
+    });
+  };
+
+  // Geometry published by another process, replacing the mesh while one is
+  // attached. Batches are uploaded straight from the shared pages and drawn
+  // as they are, without sRGB conversion, subdivision or LOD chain.
+  ShmFeedConsumer geometryFeed;
+  Clock::time_point lastFeedAttempt = Clock::now() - std::chrono::seconds(1);
+  Clock::time_point feedAttachTime;
+  auto receiveGeometryFeed = [&]() {
+    if (options.shmFeedName.empty()) {
+      return;
+    }
+    if (!geometryFeed.producerAttached()) {
+      // Producers recreate the feed when they start, look for a new one
+      if (Clock::now() - lastFeedAttempt < std::chrono::milliseconds(500)) {
+        return;
+      }
+      lastFeedAttempt = Clock::now();
+      if (geometryFeed.isOpen()) {
+        flushLog();
+        printShmFeedStats(geometryFeed.stats(), std::chrono::duration<double>(Clock::now() - feedAttachTime).count());
+        geometryFeed.close();
+      }
+      if (geometryFeed.open(options.shmFeedName)) {
+        LOG_INFO << "Attached to shared memory feed " << options.shmFeedName;
+        feedAttachTime = Clock::now();
+      }
+      return;
+    }
+    ShmBatch batch;
+    if (!geometryFeed.acquireLatest(batch)) {
+      return;
+    }
+    TRACE_ZONE("Upload fed geometry");
+    uint64_t fedBytes = 0;
+    if (options.packedVertices) {
+      std::vector<Vertex> fedVertices(batch.vertexCount);
+      std::memcpy(fedVertices.data(), batch.vertices, batch.vertexCount * sizeof(ShmVertex));
+      std::vector<PackedVertex> packed = packVertices<PackedVertex>(fedVertices);
+      fedBytes += vertexUploads->replace(packed.data(), packed.size() * sizeof(PackedVertex)).bytesUploaded;
+    } else {
+      fedBytes += vertexUploads->replace(batch.vertices, batch.vertexCount * sizeof(ShmVertex)).bytesUploaded;
+    }
+    // The feed pads odd index counts, as writeBuffer needs
+    const size_t indexBytes = (batch.indexCount + (batch.indexCount & 1)) * sizeof(uint16_t);
+    fedBytes += indexUploads->replace(batch.indices, indexBytes).bytesUploaded;
+    renderMetrics.uploadedBytes.add(fedBytes);
+    noteEvent("Fed geometry uploaded", fedBytes);
+    geometryFeed.release();
+    if (meshResidency) {
+      meshResidency->clear();
+      lodMeshes.clear();
+    }
+    lodChain = { MeshLod{} };
+    lodChain[0].indexCount = batch.indexCount;
+    bindGeometryBuffers();
+    std::fill(instanceLods.begin(), instanceLods.end(), 0);
+    instancesDirty = true;
+  };
+
+  // Level of detail selection by projected size, then reordering and upload of the instances
+  auto updateInstances = [&]() {
+    TRACE_ZONE("Update instances");
+    if (options.lod) {
+      std::atomic<bool> lodsChanged{ false };
+      jobs.parallelFor(0, instances.size(), 1024, [&](size_t begin, size_t end) {
+        bool changed = false;
+        for (size_t i = begin; i < end; ++i) {
+          float pixelsPerUnit = instances[i].scale * 0.5f * static_cast<float>(options.width);
+          uint32_t lod = selectLod(lodChain, pixelsPerUnit, instanceLods[i], options.lodErrorPx);
+          changed |= lod != instanceLods[i];
+          instanceLods[i] = lod;
+        }
+        if (changed) {
+          lodsChanged.store(true, std::memory_order_relaxed);
+        }
+      });
+      instancesDirty |= lodsChanged.load(std::memory_order_relaxed);
+    }
+    if (instancesDirty) {
+      batchInstances(instances, instanceLods, useDepth, orderedInstances, instanceBatches);
+      queue.writeBuffer(instanceBuffer, 0, orderedInstances.data(), orderedInstances.size() * sizeof(InstanceData));
+      renderMetrics.uploadedBytes.add(orderedInstances.size() * sizeof(InstanceData));
+      noteEvent("Instances uploaded", orderedInstances.size() * sizeof(InstanceData));
+      if (capture) {
+        capture->writeBuffer(instanceBuffer, 0, orderedInstances.data(), orderedInstances.size() * sizeof(InstanceData));
+      }
+      instancesDirty = false;
+    }
+  };
+
+  // Sort the frame's draws by key and let the draw list skip redundant state changes:
+  // opaque draws front to back first, then transparent ones back to front
+  auto buildDrawList = [&](wgpu::RenderPipeline blendedPipeline, wgpu::RenderPipeline writingPipeline) {
+    TRACE_ZONE("Build draw list");
+    drawList.clear();
+    for (size_t i = 0; i < instanceBatches.size(); ++i) {
+      const InstanceBatch& batch = instanceBatches[i];
+      DrawCommand draw = geometryDraw;
+      if (!useDepth) {
+        draw.pipeline = blendedPipeline;
+        draw.sortKey = makeSortKey(0, 0, 0, 0, static_cast<uint32_t>(i));
+      } else if (batch.transparent) {
+        draw.pipeline = blendedPipeline;
+        draw.sortKey = makeSortKey(1, 1, 0, 0, quantizeSortDepth(1.0f - batch.depth));
+      } else {
+        draw.pipeline = writingPipeline;
+        draw.sortKey = makeSortKey(0, 0, 0, 0, quantizeSortDepth(batch.depth));
+      }
+      uint32_t lod = batch.lod;
+      if (!lodMeshes.empty()) {
+        // Coarser levels stand in while the level streams in, down to the pinned one
+        draw.indexBuffer = meshResidency->acquire(lodMeshes[lod]);
+        while (!draw.indexBuffer) {
+          draw.indexBuffer = meshResidency->findResident(lodMeshes[++lod]);
+        }
+        draw.indexBufferSize = meshResidency->size(lodMeshes[lod]);
+        draw.firstIndex = 0;
+      } else {
+        draw.firstIndex = lodChain[lod].firstIndex;
+      }
+      draw.indexCount = lodChain[lod].indexCount;
+      draw.firstInstance = batch.firstInstance;
+      draw.instanceCount = batch.instanceCount;
+      drawList.add(draw);
+    }
+    drawList.sort(0, &frameArena);
+  };
+
+  // Overdraw analysis: replay the first frame with counting pipelines that
+  // keep the depth state of the ones they replace
+  if (options.overdraw) {
+    OverdrawSettings overdrawSettings;
+    overdrawSettings.width = options.width;
+    overdrawSettings.height = options.height;
+    OverdrawAnalyzer overdrawAnalyzer(device, queue, overdrawSettings, &gpuResources);
+    wgpu::RenderPipeline countingPipeline = overdrawAnalyzer.createCountingPipeline(pipelineDesc);
+    wgpu::RenderPipeline countingOpaquePipeline = countingPipeline;
+    if (useDepth) {
+      countingOpaquePipeline = overdrawAnalyzer.createCountingPipeline(opaquePipelineDesc);
+    }
+    updateInstances();
+    buildDrawList(countingPipeline, countingOpaquePipeline);
+    overdrawAnalyzer.capture(drawList, depthTextureView);
+    while (!overdrawAnalyzer.ready()) {
+      pollDevice(device, queue);
+    }
+    LOG_INFO_ALWAYS << "Overdraw analysis of " << options.width << "x" << options.height << " (depth " << (useDepth ? "on" : "off") << ")";
+    flushLog();
+    printOverdrawReport(overdrawAnalyzer.report());
+    if (!options.heatmapPath.empty()) {
+      overdrawAnalyzer.writeHeatmap(options.heatmapPath);
+    }
+  }
+
+  // Bundles are recorded for the swap chain and depth formats of the frame's render pass
+  RenderBundleFormat bundleFormat;
+  bundleFormat.colorFormat = swapChainFormat;
+  bundleFormat.depthFormat = options.depthFormat;
+  bundleFormat.sampleCount = pipelineDesc.multisample.count;
+
+  if (options.benchEncode > 0) {
+    DrawCommand benchmarkDraw = geometryDraw;
+    benchmarkDraw.pipeline = opaquePipeline;
+    benchmarkDraw.firstIndex = lodChain[0].firstIndex;
+    benchmarkDraw.indexCount = lodChain[0].indexCount;
+    benchmarkDrawListEncoding(device, benchmarkDraw, static_cast<uint32_t>(instances.size()), bundleFormat, depthTextureView,
+                              options.benchEncode, jobs.workerCount() + 1);
+  }
+
+  // Render pass times on the GPU track of the trace and in the HUD
+  std::unique_ptr<GpuPassTimer> gpuPassTimer;
+  if ((traceEnabled() || options.hud) && !headless) {
+    gpuPassTimer = std::make_unique<GpuPassTimer>(device, queue, gpuResources);
+    if (!gpuPassTimer->available()) {
+      LOG_INFO << "No timestamp queries, render passes are not timed";
+    }
+  }
+
+  // Performance overlay, drawn last in the render pass. Created the first
+  // time it is shown.
+  std::unique_ptr<PerformanceHud> hud;
+  bool hudVisible = options.hud;
+  auto showHud = [&]() {
+    if (!hud) {
+      PerformanceHudSettings hudSettings;
+      hudSettings.width = options.width;
+      hudSettings.height = options.height;
+      hudSettings.colorFormat = swapChainFormat;
+      hudSettings.depthFormat = options.depthFormat;
+      hud = std::make_unique<PerformanceHud>(device, queue, gpuResources, hudSettings);
+    }
+    return hud->isValid();
+  };
+  if (hitchDetector) {
+    hitchDetector->setPendingWorkSampler([&]() {
+      PendingWork pending;
+      pending.gpuReadbacks = gpuPassTimer ? gpuPassTimer->pendingReadbacks() : 0;
+      pending.meshStreamIns = meshResidency ? meshResidency->streaming() : 0;
+      pending.fileReads = fileReader.outstanding();
+      return pending;
+    });
+  }
+
+  FrameTimer frameTimer;
+  // From sampling the input a frame reacts to until that frame is presented
+  FrameTimer inputLatency;
+  int frameIndex = 0;
+  Clock::time_point lastFrameStart;
+  // Frames rendered before benchmark timing starts, to let the pipeline warm up
+  const int benchWarmupFrames = 10;
+  // Steady-state frames must not allocate: the timers are sized up front,
+  // benchmarks keep every frame for the percentiles
+  frameTimer.reserve(options.benchFrames);
+  inputLatency.reserve(options.benchFrames + 1);
+  // Heap allocations of the frames after warm-up, on the rendering thread
+  FrameAllocationStats frameAllocationStats;
+  bool allocationCheckFailed = false;
+
+  // Threading: the main thread owns the window and handles its events, as
+  // GLFW requires. Frames are rendered on a thread of their own, which owns
+  // the device and queue from here on, so that a present blocking on vsync
+  // does not hold up input and the reverse. Discrete events reach the render
+  // thread as commands, the input state as the newest of three snapshots.
+  RenderCommandQueue renderCommands;
+  TripleBuffer<FrameInput> inputSnapshots;
+  auto sampleInput = [&]() {
+    FrameInput input;
+    input.sampleTime = Clock::now();
+    glfwGetCursorPos(window, &input.cursorX, &input.cursorY);
+    return input;
+  };
+  // Returns false once asked to quit
+  auto handleCommands = [&]() {
+    bool quit = false;
+    RenderCommand command;
+    while (renderCommands.pop(command)) {
+      switch (command) {
+      case RenderCommand::Quit:
+        quit = true;
+        break;
+      case RenderCommand::ToggleLod:
+        options.lod = !options.lod;
+        std::fill(instanceLods.begin(), instanceLods.end(), 0);
+        instancesDirty = true;
+        LOG_INFO << "Level of detail " << (options.lod ? "on" : "off");
+        noteEvent("Level of detail toggled", 0);
+        break;
+      case RenderCommand::ToggleHud:
+        hudVisible = !hudVisible;
+        LOG_INFO << "Performance HUD " << (hudVisible ? "on" : "off");
+        break;
+      case RenderCommand::WriteTrace:
+        if (options.tracePath.empty()) {
+          LOG_WARNING << "Not tracing, run with --trace <path>";
+        } else if (writeTrace(options.tracePath, traceFormatForPath(options.tracePath))) {
+          LOG_INFO << "Wrote trace " << options.tracePath;
+          noteEvent("Trace written", 0);
+        }
+        break;
+      }
+    }
+    return !quit;
+  };
+  if (window) {
+    glfwSetWindowUserPointer(window, &renderCommands);
+    glfwSetKeyCallback(window, [](GLFWwindow* window, int key, int, int action, int) {
+      if (action != GLFW_PRESS) {
+        return;
+      }
+      if (key == GLFW_KEY_ESCAPE) {
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+      } else if (key == GLFW_KEY_L) {
+        static_cast<RenderCommandQueue*>(glfwGetWindowUserPointer(window))->push(RenderCommand::ToggleLod);
+      } else if (key == GLFW_KEY_T) {
+        static_cast<RenderCommandQueue*>(glfwGetWindowUserPointer(window))->push(RenderCommand::WriteTrace);
+      } else if (key == GLFW_KEY_H) {
+        static_cast<RenderCommandQueue*>(glfwGetWindowUserPointer(window))->push(RenderCommand::ToggleHud);
+      }
+    });
+  }
+
+  // Returns false when rendering should stop
+  auto renderFrame = [&](const FrameInput& input) {
+    // The job workers' count too, they build and encode parts of the frame
+    auto frameAllocationCounts = [&]() { return threadAllocationCounts() + jobs.allocationCounts(); };
+    const AllocationCounts allocationsAtStart = frameAllocationCounts();
+    TRACE_ZONE("Frame");
+    const Clock::time_point frameStart = Clock::now();
+    const double frameSeconds = frameIndex > 0 ? std::chrono::duration<double>(frameStart - lastFrameStart).count() : 0.0;
+    if (frameIndex > 0) {
+      renderMetrics.frameTime.observe(frameSeconds);
+    }
+    lastFrameStart = frameStart;
+    if (hitchDetector) {
+      hitchDetector->beginFrame(static_cast<uint64_t>(frameIndex));
+    }
+    auto endPhase = [&](FramePhase phase) {
+      if (hitchDetector) {
+        hitchDetector->endPhase(phase);
+      }
+    };
+    reloadGeometry();
+    receiveGeometryFeed();
+    updateInstances();
+    if (meshResidency) {
+      TRACE_ZONE("Mesh residency");
+      meshResidency->update();
+    }
+    endPhase(FramePhase::Update);
+    // Reloads reallocate the geometry buffers
+    if (options.gpuBudgetFail && gpuResources.overBudget()) {
+      return false;
+    }
 
-  while (!glfwWindowShouldClose(window)) {
     // Get the next texture and give it to the render pass
-    wgpu::TextureView nextTexture = swapChain.getCurrentTextureView();
+    const int64_t acquireStart = traceEnabled() ? traceNow() : 0;
+    wgpu::TextureView nextTexture = offscreenTarget ? offscreenTarget->getCurrentTextureView() : swapChain.getCurrentTextureView();
+    if (traceEnabled()) {
+      traceZone("Acquire swap chain image", acquireStart, traceNow());
+    }
     if (!nextTexture) {
-      std::cerr << "Cannot acquire next swap chain texture" << std::endl;
-      break;
+      LOG_ERROR << "Cannot acquire next swap chain texture";
+      return false;
     }
+    endPhase(FramePhase::Acquire);
 
     // Command Buffer
     wgpu::CommandEncoderDescriptor encoderDesc = wgpu::Default;
@@ -214,18 +1048,64 @@ int main (int, char**) {
     renderPassDesc.colorAttachmentCount = 1;
     renderPassDesc.colorAttachments = &renderPassColorAttachment;
 
-    renderPassDesc.depthStencilAttachment = nullptr;
+    wgpu::RenderPassDepthStencilAttachment depthStencilAttachment = wgpu::Default;
+    depthStencilAttachment.view = depthTextureView;
+    depthStencilAttachment.depthClearValue = 1.0f;
+    depthStencilAttachment.depthLoadOp = wgpu::LoadOp::Clear;
+    depthStencilAttachment.depthStoreOp = wgpu::StoreOp::Store;
+    depthStencilAttachment.depthReadOnly = false;
+    depthStencilAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+    depthStencilAttachment.stencilLoadOp = wgpu::LoadOp::Clear;
+    depthStencilAttachment.stencilStoreOp = wgpu::StoreOp::Store;
+#else
+    depthStencilAttachment.stencilLoadOp = wgpu::LoadOp::Undefined;
+    depthStencilAttachment.stencilStoreOp = wgpu::StoreOp::Undefined;
+#endif
+    depthStencilAttachment.stencilReadOnly = true;
+    renderPassDesc.depthStencilAttachment = useDepth ? &depthStencilAttachment : nullptr;
+
+    const bool measureOverdraw = options.measureOverdraw && frameIndex == 0;
+    renderPassDesc.occlusionQuerySet = measureOverdraw ? occlusionQuerySet : nullptr;
     renderPassDesc.timestampWriteCount = 0;
     renderPassDesc.timestampWrites = nullptr;
+    if (gpuPassTimer) {
+      gpuPassTimer->beginPass(renderPassDesc, "Render pass");
+    }
+    const int64_t encodeStart = traceEnabled() ? traceNow() : 0;
     wgpu::RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
-    // Select which render pipeline to use
-    renderPass.setPipeline(pipeline);
-    // Set vertex buffers while encoding the render pass
-    renderPass.setVertexBuffer(0, vertexBuffer, 0, pointData.size() * sizeof(float));
-    renderPass.setIndexBuffer(indexBuffer, wgpu::IndexFormat::Uint16, 0, indexData.size() * sizeof(uint16_t));
-    // Replace `draw()` with `drawIndexed()` and `vertexCount` with `indexCount`
-    // The extra argument is an offset within the index buffer.
-    renderPass.drawIndexed(indexCount, 1, 0, 0, 0);
+    if (measureOverdraw) {
+      renderPass.beginOcclusionQuery(0);
+    }
+    buildDrawList(pipeline, opaquePipeline);
+    const int64_t drawListEncodeStart = traceEnabled() ? traceNow() : 0;
+    const DrawListStats frameDrawStats = options.parallelEncode
+      ? drawList.encodeParallel(renderPass, device, bundleFormat, jobs, &frameArena)
+      : drawList.encode(renderPass);
+    drawListStats += frameDrawStats;
+    renderMetrics.draws.add(frameDrawStats.draws);
+    if (traceEnabled()) {
+      traceZone("Encode draw list", drawListEncodeStart, traceNow());
+    }
+    if (measureOverdraw) {
+      renderPass.endOcclusionQuery();
+    }
+    if (capture) {
+      capture->renderPass(renderPassDesc, swapChainFormat, options.width, options.height, drawList);
+    }
+    if (hudVisible && showHud()) {
+      TRACE_ZONE("HUD");
+      const GpuResourceReport gpuReport = gpuResources.report();
+      HudFrameInputs hudInputs;
+      hudInputs.frameMs = frameSeconds * 1000.0;
+      hudInputs.gpuPassMs = gpuPassTimer ? gpuPassTimer->lastPassMs() : -1.0;
+      hudInputs.gpuBytes = gpuReport.total.bytes;
+      hudInputs.gpuPeakBytes = gpuReport.total.peakBytes;
+      hudInputs.draws = frameDrawStats;
+      hudInputs.instances = instances.size();
+      hud->update(hudInputs);
+      hud->encode(renderPass);
+    }
     renderPass.end();
     renderPass.release();
     nextTexture.release();
@@ -233,41 +1113,230 @@ int main (int, char**) {
     // Done encoding commands, end the command buffer
     wgpu::CommandBufferDescriptor cmdBufferDescriptor = wgpu::Default;
     cmdBufferDescriptor.label = "Command buffer";
+    if (measureOverdraw) {
+      encoder.resolveQuerySet(occlusionQuerySet, 0, 1, occlusionResolveBuffer, 0);
+      encoder.copyBufferToBuffer(occlusionResolveBuffer, 0, occlusionReadbackBuffer, 0, sizeof(uint64_t));
+    }
+    if (gpuPassTimer) {
+      gpuPassTimer->resolve(encoder);
+    }
     wgpu::CommandBuffer command = encoder.finish(cmdBufferDescriptor);
     encoder.release();
+    if (traceEnabled()) {
+      traceZone("Encode", encodeStart, traceNow());
+    }
+    endPhase(FramePhase::Encode);
 
     // Finally submit the command queue and present the swap chain
-    queue.submit(command);
+    {
+      TRACE_ZONE("Submit");
+      queue.submit(command);
+    }
     command.release();
-    swapChain.present();
+    if (gpuPassTimer) {
+      gpuPassTimer->submitted();
+    }
+    if (capture) {
+      capture->endFrame();
+    }
+    if (measureOverdraw) {
+      uint64_t shadedSamples = 0;
+      if (readBufferSync(device, queue, occlusionReadbackBuffer, sizeof(uint64_t), &shadedSamples)) {
+        double pixels = static_cast<double>(options.width) * options.height;
+        LOG_INFO_ALWAYS << "Overdraw (depth " << (useDepth ? "on" : "off") << "): " << shadedSamples
+                        << " shaded samples, " << static_cast<double>(shadedSamples) / pixels << " per pixel";
+      }
+    }
+    endPhase(FramePhase::Submit);
+    {
+      TRACE_ZONE("Present");
+      const Clock::time_point presentStart = Clock::now();
+      if (offscreenTarget) {
+        if (!offscreenTarget->present()) {
+          return false;
+        }
+      } else {
+        swapChain.present();
+      }
+      renderMetrics.presentWait.observe(std::chrono::duration<double>(Clock::now() - presentStart).count());
+    }
+    renderMetrics.frames.add();
+    endPhase(FramePhase::Present);
+    if (hitchDetector && hitchDetector->endFrame(frameAllocationCounts() - allocationsAtStart)) {
+      renderMetrics.hitches.add();
+    }
+    if (frameIndex >= benchWarmupFrames) {
+      inputLatency.record(std::chrono::duration<double, std::milli>(Clock::now() - input.sampleTime).count());
+    }
+    if (frameIndex == 0) {
+      double startupMs = std::chrono::duration<double, std::milli>(Clock::now() - startupStart).count();
+      LOG_INFO << "Startup: first frame presented after " << startupMs << " ms";
+    }
 #ifdef WEBGPU_BACKEND_DAWN
     // Check for pending error callbacks
     device.tick();
 #endif
 
-    // Poll events and check for window close request
-    glfwPollEvents();
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
+    frameArena.reset();
+    if (frameIndex >= benchWarmupFrames) {
+      AllocationCounts frameAllocations = frameAllocationCounts() - allocationsAtStart;
+      frameAllocationStats.record(frameAllocations);
+      if (options.checkAllocations && frameAllocations.allocations > 0) {
+        LOG_ERROR_ALWAYS << "Frame " << frameIndex << " allocated " << frameAllocations.allocations << " times ("
+                         << frameAllocations.bytes << " bytes)";
+        allocationCheckFailed = true;
+      }
+    }
+
+    ++frameIndex;
+    if (options.benchFrames > 0 && frameIndex <= benchWarmupFrames) {
+      return true;
+    }
+    frameTimer.tick();
+    return options.benchFrames == 0 || static_cast<int>(frameTimer.frameCount()) < options.benchFrames;
+  };
+
+  auto windowShouldClose = [&]() {
+    if (g_interrupted) {
       glfwSetWindowShouldClose(window, GLFW_TRUE);
     }
+    return glfwWindowShouldClose(window);
+  };
+  if (!headless && !options.renderThread) {
+    // Events are only handled between frames
+    FrameInput input = sampleInput();
+    while (!windowShouldClose() && handleCommands() && renderFrame(input)) {
+      glfwPollEvents();
+      input = sampleInput();
+    }
+  } else if (!headless) {
+    std::atomic<bool> renderStopped{ false };
+    inputSnapshots.write(sampleInput());
+    std::thread renderThread([&]() {
+      setTraceThreadName("Render");
+      while (handleCommands() && renderFrame(inputSnapshots.read())) {
+      }
+      renderStopped.store(true, std::memory_order_release);
+      glfwPostEmptyEvent();
+    });
+    while (!renderStopped.load(std::memory_order_acquire) && !windowShouldClose()) {
+#ifdef WEBGPU_THINGY_NULL_PLATFORM
+      // The null platform has no events to wait for and returns at once
+      std::this_thread::sleep_for(std::chrono::duration<double>(kInputSamplePeriodSeconds));
+#else
+      glfwWaitEventsTimeout(kInputSamplePeriodSeconds);
+#endif
+      inputSnapshots.write(sampleInput());
+    }
+    // The render thread empties the queue every frame until it stops, after
+    // which a full queue is never emptied again
+    while (!renderStopped.load(std::memory_order_acquire) && !renderCommands.push(RenderCommand::Quit)) {
+      std::this_thread::yield();
+    }
+    renderThread.join();
+  }
+
+  if (!headless) {
+    flushLog();
+    printFrameTimeStats(options.lod ? "Frame time (LOD on)" : "Frame time (LOD off)", frameTimer.stats());
+    printLatencyStats(options.renderThread ? "Input to present (render thread)" : "Input to present (single thread)", inputLatency.stats());
+    printFrameAllocationStats(frameAllocationStats);
+    if (meshResidency) {
+      printMeshResidencyStats(meshResidency->stats());
+    }
+    if (hitchDetector) {
+      printHitchStats(hitchDetector->stats());
+    }
+    if (offscreenTarget) {
+      printOffscreenTargetStats(offscreenTarget->stats());
+    }
+    if (hud && hud->isValid()) {
+      const HudStats& hudStats = hud->stats();
+      LOG_INFO << "HUD: " << hudStats.cpuMs << " ms per frame on the CPU, " << hudStats.draws << " draws, "
+               << hudStats.uploadBytes << " bytes uploaded, " << hudStats.overflows << " frames over its buffers";
+    }
+  }
+  // Writes the snapshot in flight
+  hitchDetector.reset();
+
+  LOG_INFO << "Draw list: " << drawListStats.draws << " draws, "
+           << drawListStats.pipelineChanges << " pipeline / "
+           << drawListStats.bindGroupChanges << " bind group / "
+           << drawListStats.vertexBufferChanges << " vertex buffer / "
+           << drawListStats.indexBufferChanges << " index buffer changes, "
+           << drawListStats.redundantChangesSkipped << " redundant changes skipped";
+
+  if (geometryFeed.isOpen()) {
+    flushLog();
+    printShmFeedStats(geometryFeed.stats(), std::chrono::duration<double>(Clock::now() - feedAttachTime).count());
+    geometryFeed.close();
+  }
+
+  // A reload may still be reading into this scope
+  fileReader.waitAll();
+  // Writes the final values, before the resources it samples are gone
+  metricsExporter.reset();
+
+  if (!options.tracePath.empty()) {
+    // Readbacks still in flight are dropped
+    gpuPassTimer.reset();
+    traceStop();
+    if (writeTrace(options.tracePath, traceFormatForPath(options.tracePath))) {
+      LOG_INFO << "Wrote trace " << options.tracePath;
+      flushLog();
+      printTraceStats(traceStats());
+    }
   }
 
   // Cleanup WebGPU resources
-  vertexBuffer.destroy();
-  indexBuffer.destroy();
-  vertexBuffer.release();
-  indexBuffer.release();
-  pipeline.release();
-  shaderModule.release();
-  swapChain.release();
+  hud.reset();
+  offscreenTarget.reset();
+  meshResidency.reset();
+  vertexUploads.reset();
+  indexUploads.reset();
+  gpuResources.destroy(instanceBuffer);
+  if (depthTexture) {
+    depthTextureView.release();
+    gpuResources.destroy(depthTexture);
+  }
+  gpuResources.destroy(occlusionQuerySet);
+  gpuResources.destroy(occlusionResolveBuffer);
+  gpuResources.destroy(occlusionReadbackBuffer);
+  pipelineCache.reset();
+  gpuResources.release(layout);
+  const size_t leakedGpuResources = gpuResources.reportLeaks();
+  const bool gpuBudgetFailed = options.gpuBudgetFail && gpuResources.overBudget();
+  flushLog();
+  printGpuResourceReport(gpuResources.report());
+  if (capture) {
+    printGpuCaptureStats(capture->stats());
+  }
+  if (swapChain) {
+    swapChain.release();
+  }
   queue.release();
   device.release();
-  surface.release();
+  if (surface) {
+    surface.release();
+  }
   adapter.release();
   instance.release();
 
-  glfwDestroyWindow(window);
-  glfwTerminate();
+  if (window) {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+  }
 
+  if (allocationCheckFailed) {
+    LOG_ERROR << "Allocation check failed: the steady-state frame loop allocated";
+    return 1;
+  }
+  if (gpuBudgetFailed) {
+    LOG_ERROR << "GPU memory budget of " << options.gpuBudgetMiB << " MiB exceeded";
+    return 1;
+  }
+  if (leakedGpuResources > 0) {
+    LOG_WARNING << leakedGpuResources << " GPU resources were not destroyed";
+  }
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,350 @@
+#include "mesh_lod.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+
+namespace {
+
+// Quadrics live in (x, y, r, g, b) space so that color seams are preserved
+// just like geometric features.
+constexpr int kDim = 5;
+using Point = std::array<double, kDim>;
+
+double dot(const Point& a, const Point& b) {
+  double sum = 0.0;
+  for (int i = 0; i < kDim; ++i) sum += a[i] * b[i];
+  return sum;
+}
+
+struct Quadric {
+  double a[kDim][kDim] = {};
+  Point b = {};
+  double c = 0.0;
+
+  Quadric& operator+=(const Quadric& other) {
+    for (int i = 0; i < kDim; ++i) {
+      for (int j = 0; j < kDim; ++j) a[i][j] += other.a[i][j];
+      b[i] += other.b[i];
+    }
+    c += other.c;
+    return *this;
+  }
+
+  void scale(double weight) {
+    for (int i = 0; i < kDim; ++i) {
+      for (int j = 0; j < kDim; ++j) a[i][j] *= weight;
+      b[i] *= weight;
+    }
+    c *= weight;
+  }
+
+  // v^T A v + 2 b^T v + c
+  double evaluate(const Point& v) const {
+    double result = c;
+    for (int i = 0; i < kDim; ++i) {
+      double av = 0.0;
+      for (int j = 0; j < kDim; ++j) av += a[i][j] * v[j];
+      result += v[i] * av + 2.0 * b[i] * v[i];
+    }
+    return result;
+  }
+};
+
+// Squared distance to the plane of the triangle, which in 5D is the affine
+// span of two orthonormal edge directions.
+Quadric triangleQuadric(const Point& p0, const Point& p1, const Point& p2) {
+  Quadric q;
+  Point e1, e2;
+  for (int i = 0; i < kDim; ++i) {
+    e1[i] = p1[i] - p0[i];
+    e2[i] = p2[i] - p0[i];
+  }
+  double length1 = std::sqrt(dot(e1, e1));
+  if (length1 < 1e-12) return q;
+  for (double& x : e1) x /= length1;
+  double projection = dot(e2, e1);
+  for (int i = 0; i < kDim; ++i) e2[i] -= projection * e1[i];
+  double length2 = std::sqrt(dot(e2, e2));
+  if (length2 < 1e-12) return q;
+  for (double& x : e2) x /= length2;
+
+  double p0e1 = dot(p0, e1);
+  double p0e2 = dot(p0, e2);
+  for (int i = 0; i < kDim; ++i) {
+    for (int j = 0; j < kDim; ++j) {
+      q.a[i][j] = (i == j ? 1.0 : 0.0) - e1[i] * e1[j] - e2[i] * e2[j];
+    }
+    q.b[i] = p0e1 * e1[i] + p0e2 * e2[i] - p0[i];
+  }
+  q.c = dot(p0, p0) - p0e1 * p0e1 - p0e2 * p0e2;
+  return q;
+}
+
+// Squared distance to the hyperplane n.v = d, with n of unit length
+Quadric planeQuadric(const Point& n, double d) {
+  Quadric q;
+  for (int i = 0; i < kDim; ++i) {
+    for (int j = 0; j < kDim; ++j) q.a[i][j] = n[i] * n[j];
+    q.b[i] = -d * n[i];
+  }
+  q.c = d * d;
+  return q;
+}
+
+double signedArea(const Point& p0, const Point& p1, const Point& p2) {
+  return 0.5 * ((p1[0] - p0[0]) * (p2[1] - p0[1]) - (p2[0] - p0[0]) * (p1[1] - p0[1]));
+}
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+  return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+class Simplifier {
+public:
+  Simplifier(const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indexData, const LodChainSettings& settings) {
+    size_t vertexCount = vertices.size();
+    m_points.resize(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+      const Vertex& p = vertices[v];
+      m_points[v] = { p.position[0], p.position[1], p.color[0] * settings.colorWeight, p.color[1] * settings.colorWeight, p.color[2] * settings.colorWeight };
+    }
+    m_quadrics.resize(vertexCount);
+    m_vertexTriangles.resize(vertexCount);
+    m_versions.resize(vertexCount, 0);
+    m_collapsed.resize(vertexCount, false);
+    m_merged.resize(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; ++v) m_merged[v].push_back(v);
+
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    for (size_t i = 0; i + 2 < indexData.size(); i += 3) {
+      std::array<uint32_t, 3> triangle = { indexData[i], indexData[i + 1], indexData[i + 2] };
+      uint32_t t = static_cast<uint32_t>(m_triangles.size());
+      m_triangles.push_back(triangle);
+      m_triangleAlive.push_back(true);
+      for (uint32_t v : triangle) m_vertexTriangles[v].push_back(t);
+
+      const Point& p0 = m_points[triangle[0]];
+      const Point& p1 = m_points[triangle[1]];
+      const Point& p2 = m_points[triangle[2]];
+      Quadric q = triangleQuadric(p0, p1, p2);
+      q.scale(std::abs(signedArea(p0, p1, p2)));
+      for (uint32_t v : triangle) m_quadrics[v] += q;
+      for (int k = 0; k < 3; ++k) ++edgeUses[edgeKey(triangle[k], triangle[(k + 1) % 3])];
+    }
+    m_liveTriangles = m_triangles.size();
+
+    // Open borders get a plane perpendicular to the mesh through the edge
+    for (const auto& triangle : m_triangles) {
+      for (int k = 0; k < 3; ++k) {
+        uint32_t a = triangle[k];
+        uint32_t b = triangle[(k + 1) % 3];
+        if (edgeUses[edgeKey(a, b)] != 1) continue;
+        double dx = m_points[b][0] - m_points[a][0];
+        double dy = m_points[b][1] - m_points[a][1];
+        double length = std::sqrt(dx * dx + dy * dy);
+        if (length < 1e-12) continue;
+        Point n = { -dy / length, dx / length, 0.0, 0.0, 0.0 };
+        Quadric q = planeQuadric(n, dot(n, m_points[a]));
+        q.scale(settings.boundaryWeight * length * length);
+        m_quadrics[a] += q;
+        m_quadrics[b] += q;
+      }
+    }
+
+    for (uint32_t v = 0; v < vertexCount; ++v) pushCandidates(v);
+  }
+
+  size_t liveTriangles() const { return m_liveTriangles; }
+
+  // Collapses edges until at most `targetTriangles` remain. Returns the
+  // largest displacement of an input vertex so far, or a negative value if
+  // nothing changed.
+  double simplify(size_t targetTriangles) {
+    size_t before = m_liveTriangles;
+    while (m_liveTriangles > targetTriangles && !m_heap.empty()) {
+      Candidate candidate = m_heap.top();
+      m_heap.pop();
+      if (m_collapsed[candidate.from] || m_collapsed[candidate.to]) continue;
+      if (candidate.fromVersion != m_versions[candidate.from] || candidate.toVersion != m_versions[candidate.to]) continue;
+      if (!collapseIsValid(candidate.from, candidate.to)) continue;
+      collapse(candidate.from, candidate.to);
+    }
+    return m_liveTriangles < before ? m_maxDisplacement : -1.0;
+  }
+
+  void appendIndices(std::vector<uint16_t>& indexData) const {
+    for (size_t t = 0; t < m_triangles.size(); ++t) {
+      if (!m_triangleAlive[t]) continue;
+      for (uint32_t v : m_triangles[t]) indexData.push_back(static_cast<uint16_t>(v));
+    }
+  }
+
+private:
+  struct Candidate {
+    double cost;
+    uint32_t from;
+    uint32_t to;
+    uint32_t fromVersion;
+    uint32_t toVersion;
+    bool operator<(const Candidate& other) const { return cost > other.cost; } // Min-heap
+  };
+
+  void pushCandidates(uint32_t v) {
+    for (uint32_t t : m_vertexTriangles[v]) {
+      if (!m_triangleAlive[t]) continue;
+      for (uint32_t n : m_triangles[t]) {
+        if (n == v) continue;
+        pushCandidate(v, n);
+        pushCandidate(n, v);
+      }
+    }
+  }
+
+  void pushCandidate(uint32_t from, uint32_t to) {
+    double cost = m_quadrics[from].evaluate(m_points[to]) + m_quadrics[to].evaluate(m_points[to]);
+    m_heap.push({ std::max(cost, 0.0), from, to, m_versions[from], m_versions[to] });
+  }
+
+  // Rejects collapses that would fold a surviving triangle over
+  bool collapseIsValid(uint32_t from, uint32_t to) const {
+    for (uint32_t t : m_vertexTriangles[from]) {
+      if (!m_triangleAlive[t]) continue;
+      const auto& triangle = m_triangles[t];
+      if (std::find(triangle.begin(), triangle.end(), to) != triangle.end()) continue;
+      double before = signedArea(m_points[triangle[0]], m_points[triangle[1]], m_points[triangle[2]]);
+      auto moved = [&](int k) -> const Point& { return m_points[triangle[k] == from ? to : triangle[k]]; };
+      double after = signedArea(moved(0), moved(1), moved(2));
+      if (before * after <= 0.0 || std::abs(after) < 1e-3 * std::abs(before)) return false;
+    }
+    return true;
+  }
+
+  void collapse(uint32_t from, uint32_t to) {
+    for (uint32_t t : m_vertexTriangles[from]) {
+      if (!m_triangleAlive[t]) continue;
+      auto& triangle = m_triangles[t];
+      if (std::find(triangle.begin(), triangle.end(), to) != triangle.end()) {
+        m_triangleAlive[t] = false;
+        --m_liveTriangles;
+        continue;
+      }
+      std::replace(triangle.begin(), triangle.end(), from, to);
+      m_vertexTriangles[to].push_back(t);
+    }
+    m_vertexTriangles[from].clear();
+    m_collapsed[from] = true;
+    m_quadrics[to] += m_quadrics[from];
+    // The input vertices merged into `from` now stand at `to`
+    for (uint32_t v : m_merged[from]) {
+      const double dx = m_points[to][0] - m_points[v][0];
+      const double dy = m_points[to][1] - m_points[v][1];
+      m_maxDisplacement = std::max(m_maxDisplacement, std::sqrt(dx * dx + dy * dy));
+    }
+    m_merged[to].insert(m_merged[to].end(), m_merged[from].begin(), m_merged[from].end());
+    m_merged[from].clear();
+
+    auto& toTriangles = m_vertexTriangles[to];
+    toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(), [&](uint32_t t) { return !m_triangleAlive[t]; }), toTriangles.end());
+    ++m_versions[to];
+    pushCandidates(to);
+  }
+
+  std::vector<Point> m_points;
+  std::vector<Quadric> m_quadrics;
+  std::vector<std::array<uint32_t, 3>> m_triangles;
+  std::vector<bool> m_triangleAlive;
+  std::vector<std::vector<uint32_t>> m_vertexTriangles;
+  std::vector<uint32_t> m_versions;
+  std::vector<bool> m_collapsed;
+  std::vector<std::vector<uint32_t>> m_merged;  // Input vertices each vertex stands for
+  std::priority_queue<Candidate> m_heap;
+  size_t m_liveTriangles = 0;
+  double m_maxDisplacement = 0.0;
+};
+
+} // namespace
+
+std::vector<MeshLod> buildLodChain(const std::vector<Vertex>& vertices, std::vector<uint16_t>& indexData, const LodChainSettings& settings) {
+  std::vector<MeshLod> chain;
+  MeshLod full;
+  full.indexCount = static_cast<uint32_t>(indexData.size());
+  chain.push_back(full);
+
+  Simplifier simplifier(vertices, indexData, settings);
+  while (chain.size() < settings.maxLevels) {
+    size_t target = static_cast<size_t>(static_cast<float>(simplifier.liveTriangles()) * settings.triangleRatio);
+    if (target < settings.minTriangles) break;
+    double displacement = simplifier.simplify(target);
+    if (displacement < 0.0) break;
+
+    MeshLod level;
+    level.firstIndex = static_cast<uint32_t>(indexData.size());
+    simplifier.appendIndices(indexData);
+    level.indexCount = static_cast<uint32_t>(indexData.size()) - level.firstIndex;
+    level.error = static_cast<float>(displacement);
+    chain.push_back(level);
+  }
+  return chain;
+}
+
+bool subdivideGeometry(std::vector<Vertex>& vertices, std::vector<uint16_t>& indexData, int levels) {
+  std::vector<Vertex> points = vertices;
+  std::vector<uint16_t> indices = indexData;
+  for (int level = 0; level < levels; ++level) {
+    std::unordered_map<uint64_t, uint32_t> midpoints;
+    std::vector<uint16_t> refined;
+    refined.reserve(indices.size() * 4);
+    auto midpoint = [&](uint32_t a, uint32_t b) {
+      auto it = midpoints.find(edgeKey(a, b));
+      if (it != midpoints.end()) return it->second;
+      uint32_t vertex = static_cast<uint32_t>(points.size());
+      Vertex mid;
+      for (int k = 0; k < 2; ++k) mid.position[k] = 0.5f * (points[a].position[k] + points[b].position[k]);
+      for (int k = 0; k < 3; ++k) mid.color[k] = 0.5f * (points[a].color[k] + points[b].color[k]);
+      points.push_back(mid);
+      midpoints[edgeKey(a, b)] = vertex;
+      return vertex;
+    };
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      uint32_t v0 = indices[i], v1 = indices[i + 1], v2 = indices[i + 2];
+      uint32_t m01 = midpoint(v0, v1), m12 = midpoint(v1, v2), m20 = midpoint(v2, v0);
+      if (points.size() > std::numeric_limits<uint16_t>::max()) {
+        return false;
+      }
+      for (uint32_t v : { v0, m01, m20, m01, v1, m12, m20, m12, v2, m01, m12, m20 }) {
+        refined.push_back(static_cast<uint16_t>(v));
+      }
+    }
+    indices.swap(refined);
+  }
+  vertices.swap(points);
+  indexData.swap(indices);
+  return true;
+}
+
+uint32_t selectLod(const std::vector<MeshLod>& chain, float pixelsPerUnit, uint32_t currentLod, float errorThresholdPx, float hysteresis) {
+  uint32_t selected = 0;
+  for (uint32_t level = 1; level < chain.size(); ++level) {
+    // Staying on a level already in use is easier than switching to a coarser one
+    float threshold = errorThresholdPx * (level <= currentLod ? 1.0f + hysteresis : 1.0f - hysteresis);
+    if (chain[level].error * pixelsPerUnit > threshold) break;
+    selected = level;
+  }
+  return selected;
+}
+
+void printLodReport(const std::vector<MeshLod>& chain) {
+  if (chain.empty()) return;
+  const uint32_t fullTriangles = std::max(chain[0].indexCount / 3, 1u);
+  for (size_t level = 0; level < chain.size(); ++level) {
+    uint32_t triangles = chain[level].indexCount / 3;
+    std::cout << "LOD " << level << ": " << triangles << " triangles ("
+              << std::fixed << std::setprecision(1) << 100.0 * triangles / fullTriangles << "%), error "
+              << std::setprecision(5) << chain[level].error << std::defaultfloat << std::endl;
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef WEBGPU_THINGY_SRC_MESH_LOD_H_
+#define WEBGPU_THINGY_SRC_MESH_LOD_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "vertex.h"
+
+// One level of detail, as a range of the shared index buffer. Every level
+// indexes the same vertices, so the whole chain lives in one vertex buffer
+// and one index buffer.
+struct MeshLod {
+  uint32_t firstIndex = 0;
+  uint32_t indexCount = 0;
+  // Bound on how far (in mesh units, x and y) any input vertex was moved by
+  // the collapses that built this level
+  float error = 0.0f;
+};
+
+struct LodChainSettings {
+  size_t maxLevels = 5;           // Including the full resolution level
+  float triangleRatio = 0.5f;     // Target triangle count of a level relative to the previous one
+  size_t minTriangles = 4;
+  float colorWeight = 0.25f;      // Scale of the color channels relative to positions in the quadrics
+  float boundaryWeight = 10.0f;   // Penalty that keeps open borders from shrinking
+};
+
+// Builds a level of detail chain with quadric error metric half-edge
+// collapses. Level 0 is the input index range; coarser levels are appended
+// to `indexData`. Vertices are never moved or added. The quadrics only order
+// the collapses, a level's error is the geometric displacement they caused.
+std::vector<MeshLod> buildLodChain(const std::vector<Vertex>& vertices, std::vector<uint16_t>& indexData, const LodChainSettings& settings = {});
+
+// Splits every triangle into 4^levels smaller ones, sharing the new edge
+// vertices, to produce dense test geometry. Returns false if the result
+// would not fit 16-bit indices.
+bool subdivideGeometry(std::vector<Vertex>& vertices, std::vector<uint16_t>& indexData, int levels);
+
+// Picks the coarsest level whose error projects below `errorThresholdPx`,
+// given how many pixels one mesh unit covers on screen. `hysteresis` widens
+// the threshold around the current level so objects near a boundary do not flicker.
+uint32_t selectLod(const std::vector<MeshLod>& chain, float pixelsPerUnit, uint32_t currentLod, float errorThresholdPx = 1.0f, float hysteresis = 0.25f);
+
+void printLodReport(const std::vector<MeshLod>& chain);
+
+#endif //WEBGPU_THINGY_SRC_MESH_LOD_H_
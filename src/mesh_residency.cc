@@ -0,0 +1,264 @@
+#include "mesh_residency.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include "async_io.h"
+#include "gpu_capture.h"
+#include "gpu_resources.h"
+#include "log.h"
+#include "lz4_codec.h"
+
+namespace {
+
+bool decode(const uint8_t* compressed, size_t compressedSize, uint64_t size, std::vector<uint8_t>& data) {
+  data.resize(size);
+  return lz4Decompress(compressed, compressedSize, data.data(), data.size());
+}
+
+} // namespace
+
+MeshResidency::MeshResidency(wgpu::Queue queue, GpuResources& resources, JobSystem& jobs, AsyncFileReader& reader,
+                             const MeshResidencySettings& settings)
+  : m_queue(queue)
+  , m_resources(resources)
+  , m_jobs(jobs)
+  , m_reader(reader)
+  , m_settings(settings)
+{
+  if (!m_settings.cacheDirectory.empty()) {
+    std::error_code error;
+    std::filesystem::create_directories(m_settings.cacheDirectory, error);
+    if (error) {
+      LOG_ERROR << "Could not create mesh cache " << m_settings.cacheDirectory.string() << ", caching in memory";
+      m_settings.cacheDirectory.clear();
+    }
+  }
+}
+
+MeshResidency::~MeshResidency() {
+  clear();
+}
+
+MeshId MeshResidency::add(const char* label, const void* data, size_t size, wgpu::BufferUsage usage, bool pinned) {
+  const MeshId id = static_cast<MeshId>(m_meshes.size());
+  m_meshes.emplace_back();
+  Mesh& mesh = m_meshes.back();
+  mesh.label = label;
+  mesh.usage = usage;
+  mesh.size = std::max<uint64_t>((size + 3) & ~size_t(3), 4);
+  mesh.pinned = pinned;
+  m_stats.meshBytes += mesh.size;
+
+  std::vector<uint8_t> padded(mesh.size, 0);
+  std::memcpy(padded.data(), data, size);
+  if (pinned) {
+    // Never streamed again, nothing to cache
+    m_pinnedBytes += mesh.size;
+    if (m_pinnedBytes > m_settings.budgetBytes) {
+      LOG_WARNING << "Pinned meshes alone exceed the mesh budget of " << m_settings.budgetBytes << " bytes";
+    }
+    upload(id, padded.data());
+    return id;
+  }
+
+  std::vector<uint8_t> compressed(lz4CompressBound(padded.size()));
+  compressed.resize(lz4Compress(padded.data(), padded.size(), compressed.data(), compressed.size()));
+  mesh.compressedSize = compressed.size();
+  m_stats.cachedBytes += mesh.compressedSize;
+  if (!m_settings.cacheDirectory.empty()) {
+    mesh.cachePath = m_settings.cacheDirectory / ("mesh-" + std::to_string(id) + ".lz4");
+    std::ofstream file(mesh.cachePath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(compressed.data()), static_cast<std::streamsize>(compressed.size()));
+    if (file) {
+      return id;
+    }
+    LOG_ERROR << "Could not write " << mesh.cachePath.string() << ", caching " << mesh.label << " in memory";
+    mesh.cachePath.clear();
+  }
+  mesh.compressed = std::move(compressed);
+  return id;
+}
+
+void MeshResidency::clear() {
+  waitForStreamIns();
+  m_ready.clear();
+  for (Mesh& mesh : m_meshes) {
+    if (mesh.state == State::Resident) {
+      m_stats.residentBytes -= mesh.size;
+      m_resources.destroy(mesh.buffer);
+    }
+    if (!mesh.cachePath.empty()) {
+      std::error_code error;
+      std::filesystem::remove(mesh.cachePath, error);
+    }
+  }
+  m_meshes.clear();
+  m_pinnedBytes = 0;
+  m_streaming = 0;
+  m_stats.cachedBytes = 0;
+  m_stats.meshBytes = 0;
+}
+
+wgpu::Buffer MeshResidency::acquire(MeshId id) {
+  Mesh& mesh = m_meshes[id];
+  ++m_stats.requests;
+  mesh.lastUsedFrame = m_frame;
+  if (mesh.state == State::Resident) {
+    ++m_stats.hits;
+    return mesh.buffer;
+  }
+  // A mesh that cannot fit next to the pinned ones is never streamed in
+  if (mesh.state == State::Evicted && m_streaming < m_settings.maxStreamIns &&
+      m_pinnedBytes + mesh.size <= m_settings.budgetBytes) {
+    startStreamIn(id);
+  }
+  return nullptr;
+}
+
+wgpu::Buffer MeshResidency::findResident(MeshId id) {
+  Mesh& mesh = m_meshes[id];
+  if (mesh.state != State::Resident) {
+    return nullptr;
+  }
+  mesh.lastUsedFrame = m_frame;
+  return mesh.buffer;
+}
+
+void MeshResidency::update() {
+  // Without workers, jobs only run in wait()
+  if (m_jobs.workerCount() == 0) {
+    m_jobs.wait(m_decodeJobs);
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_readyMutex);
+    std::swap(m_ready, m_uploading);
+  }
+  for (StreamIn& streamIn : m_uploading) {
+    --m_streaming;
+    Mesh& mesh = m_meshes[streamIn.id];
+    if (!streamIn.success) {
+      LOG_ERROR << "Could not stream in mesh " << mesh.label;
+      ++m_stats.streamFailures;
+      mesh.state = State::Evicted;
+      continue;
+    }
+    if (!makeRoom(mesh.size)) {
+      // Meshes pinned since the stream-in started took the room, it is
+      // requested again and refused by acquire()
+      LOG_WARNING << "No room for mesh " << mesh.label << " next to the pinned meshes, dropping it";
+      ++m_stats.overBudget;
+      mesh.state = State::Evicted;
+      continue;
+    }
+    upload(streamIn.id, streamIn.data.data());
+    ++m_stats.streamIns;
+    m_stats.bytesStreamed += mesh.size;
+    m_streamInLatency.record(std::chrono::duration<double, std::milli>(Clock::now() - mesh.requestTime).count());
+  }
+  m_uploading.clear();
+  ++m_frame;
+}
+
+MeshResidencyStats MeshResidency::stats() const {
+  MeshResidencyStats stats = m_stats;
+  stats.streamInLatency = m_streamInLatency.stats();
+  return stats;
+}
+
+void MeshResidency::startStreamIn(MeshId id) {
+  Mesh& mesh = m_meshes[id];
+  mesh.state = State::Streaming;
+  mesh.requestTime = Clock::now();
+  ++m_streaming;
+  if (!mesh.cachePath.empty()) {
+    const uint64_t size = mesh.size;
+    m_reader.read(mesh.cachePath, [this, id, size](bool success, std::string& contents) {
+      std::vector<uint8_t> data;
+      success = success && decode(reinterpret_cast<const uint8_t*>(contents.data()), contents.size(), size, data);
+      finishStreamIn(id, success, std::move(data));
+    });
+    return;
+  }
+  // The compressed copy is left alone until clear(), which waits for this job
+  const uint8_t* compressed = mesh.compressed.data();
+  const size_t compressedSize = mesh.compressed.size();
+  const uint64_t size = mesh.size;
+  m_jobs.run([this, id, compressed, compressedSize, size]() {
+    std::vector<uint8_t> data;
+    bool success = decode(compressed, compressedSize, size, data);
+    finishStreamIn(id, success, std::move(data));
+  }, &m_decodeJobs);
+}
+
+void MeshResidency::finishStreamIn(MeshId id, bool success, std::vector<uint8_t> data) {
+  std::lock_guard<std::mutex> lock(m_readyMutex);
+  m_ready.push_back(StreamIn{ id, success, std::move(data) });
+}
+
+void MeshResidency::upload(MeshId id, const uint8_t* data) {
+  Mesh& mesh = m_meshes[id];
+  wgpu::BufferDescriptor bufferDesc;
+  bufferDesc.label = mesh.label.c_str();
+  bufferDesc.size = mesh.size;
+  bufferDesc.usage = mesh.usage | wgpu::BufferUsage::CopyDst;
+  bufferDesc.mappedAtCreation = false;
+  mesh.buffer = m_resources.createBuffer(bufferDesc);
+  m_queue.writeBuffer(mesh.buffer, 0, data, mesh.size);
+  if (GpuCapture* capture = m_resources.capture()) {
+    capture->writeBuffer(mesh.buffer, 0, data, mesh.size);
+  }
+  mesh.state = State::Resident;
+  m_stats.residentBytes += mesh.size;
+  m_stats.peakResidentBytes = std::max(m_stats.peakResidentBytes, m_stats.residentBytes);
+}
+
+bool MeshResidency::makeRoom(uint64_t bytes) {
+  // Linear scan, there are few meshes
+  while (m_stats.residentBytes + bytes > m_settings.budgetBytes) {
+    Mesh* oldest = nullptr;
+    for (Mesh& mesh : m_meshes) {
+      if (mesh.state == State::Resident && !mesh.pinned && (!oldest || mesh.lastUsedFrame < oldest->lastUsedFrame)) {
+        oldest = &mesh;
+      }
+    }
+    if (!oldest) {
+      return false;
+    }
+    evict(*oldest);
+  }
+  return true;
+}
+
+void MeshResidency::evict(Mesh& mesh) {
+  // Destruction waits for the frames still drawing it
+  m_resources.destroy(mesh.buffer);
+  mesh.state = State::Evicted;
+  m_stats.residentBytes -= mesh.size;
+  ++m_stats.evictions;
+  m_stats.bytesEvicted += mesh.size;
+}
+
+void MeshResidency::waitForStreamIns() {
+  m_jobs.wait(m_decodeJobs);
+  for (const Mesh& mesh : m_meshes) {
+    if (mesh.state == State::Streaming && !mesh.cachePath.empty()) {
+      m_reader.waitAll();
+      break;
+    }
+  }
+}
+
+void printMeshResidencyStats(const MeshResidencyStats& stats) {
+  const double hitRate = stats.requests > 0 ? 100.0 * static_cast<double>(stats.hits) / static_cast<double>(stats.requests) : 0.0;
+  std::cout << std::fixed << std::setprecision(1)
+            << "Mesh residency: " << hitRate << "% of " << stats.requests << " draws resident, " << stats.streamIns
+            << " stream-ins (" << stats.bytesStreamed << " bytes), " << stats.evictions << " evictions ("
+            << stats.bytesEvicted << " bytes), " << stats.streamFailures << " failures, " << stats.overBudget << " over budget" << std::endl
+            << "  resident " << stats.residentBytes << " bytes, peak " << stats.peakResidentBytes << ", cache "
+            << stats.cachedBytes << " of " << stats.meshBytes << " bytes" << std::defaultfloat << std::endl;
+  if (stats.streamInLatency.frames > 0) {
+    printLatencyStats("Mesh stream-in", stats.streamInLatency);
+  }
+}
@@ -0,0 +1,134 @@
+#ifndef WEBGPU_THINGY_SRC_MESH_RESIDENCY_H_
+#define WEBGPU_THINGY_SRC_MESH_RESIDENCY_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+#include "frame_timer.h"
+#include "job_system.h"
+
+class AsyncFileReader;
+class GpuResources;
+
+// Keeps mesh buffers on the GPU within a budget. Once added, a mesh only
+// exists as an LZ4 copy in memory or in a cache directory on disk; the
+// caller frees its own copy. Drawing a mesh that is not resident starts
+// streaming it in, decoded on the job system (or on the file reader's
+// threads from disk) and uploaded by update() on the rendering thread,
+// which first evicts the least recently drawn meshes to make room. Pinned
+// meshes are uploaded when added and never evicted, to stand in for the
+// others while they stream in.
+
+using MeshId = uint32_t;
+
+struct MeshResidencySettings {
+  uint64_t budgetBytes = 256ull << 20;  // Of resident mesh buffers, pinned ones included
+  std::filesystem::path cacheDirectory; // Empty keeps the compressed meshes in memory
+  uint32_t maxStreamIns = 4;            // In flight at once
+};
+
+struct MeshResidencyStats {
+  uint64_t requests = 0;   // acquire() calls
+  uint64_t hits = 0;       // Of them, found resident
+  uint64_t streamIns = 0;  // Completed
+  uint64_t streamFailures = 0;
+  uint64_t overBudget = 0;  // Stream-ins dropped, the pinned meshes left no room
+  uint64_t evictions = 0;
+  uint64_t bytesStreamed = 0;
+  uint64_t bytesEvicted = 0;
+  uint64_t residentBytes = 0;
+  uint64_t peakResidentBytes = 0;
+  uint64_t cachedBytes = 0;  // Compressed, in memory or on disk
+  uint64_t meshBytes = 0;    // Uncompressed, of every mesh
+  FrameTimeStats streamInLatency;  // From the first request to the upload
+};
+
+class MeshResidency {
+public:
+  MeshResidency(wgpu::Queue queue, GpuResources& resources, JobSystem& jobs, AsyncFileReader& reader,
+                const MeshResidencySettings& settings = {});
+  ~MeshResidency();
+  MeshResidency(const MeshResidency&) = delete;
+  MeshResidency& operator=(const MeshResidency&) = delete;
+
+  // Compresses `size` bytes into the cache, zero padded to a multiple of 4
+  // as writeBuffer needs. The buffer is created with `usage` | CopyDst.
+  MeshId add(const char* label, const void* data, size_t size, wgpu::BufferUsage usage, bool pinned = false);
+  // Drops every mesh, after waiting for the stream-ins in flight
+  void clear();
+
+  // The buffer of a resident mesh, marked as drawn this frame. Otherwise
+  // starts streaming it in and returns nullptr. Counted in the hit rate.
+  wgpu::Buffer acquire(MeshId id);
+  // Same without streaming or counting, for the meshes that stand in
+  wgpu::Buffer findResident(MeshId id);
+  // Bytes of the buffer of a mesh, padding included
+  uint64_t size(MeshId id) const { return m_meshes[id].size; }
+
+  // Once per frame, before the acquire() calls: uploads the meshes that
+  // finished decoding, evicting others to fit them in the budget
+  void update();
+
+  MeshResidencyStats stats() const;
+  // Stream-ins started and not uploaded yet
+  uint32_t streaming() const { return m_streaming; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+  enum class State : uint8_t { Evicted, Streaming, Resident };
+
+  struct Mesh {
+    std::string label;
+    wgpu::BufferUsage usage;
+    uint64_t size = 0;
+    std::vector<uint8_t> compressed;  // Empty when cached on disk
+    uint64_t compressedSize = 0;
+    std::filesystem::path cachePath;
+    wgpu::Buffer buffer = nullptr;
+    State state = State::Evicted;
+    bool pinned = false;
+    uint64_t lastUsedFrame = 0;
+    Clock::time_point requestTime;
+  };
+
+  // Decoded on another thread, waiting for update() to upload it
+  struct StreamIn {
+    MeshId id;
+    bool success;
+    std::vector<uint8_t> data;
+  };
+
+  void startStreamIn(MeshId id);
+  void finishStreamIn(MeshId id, bool success, std::vector<uint8_t> data);
+  void upload(MeshId id, const uint8_t* data);
+  // Evicts least recently drawn meshes until `bytes` more fit, false when
+  // only pinned meshes are left and they still do not
+  bool makeRoom(uint64_t bytes);
+  void evict(Mesh& mesh);
+  void waitForStreamIns();
+
+  wgpu::Queue m_queue;
+  GpuResources& m_resources;
+  JobSystem& m_jobs;
+  AsyncFileReader& m_reader;
+  MeshResidencySettings m_settings;
+  std::vector<Mesh> m_meshes;
+  uint64_t m_frame = 1;
+  uint64_t m_pinnedBytes = 0;
+  uint32_t m_streaming = 0;
+  JobCounter m_decodeJobs;
+  std::mutex m_readyMutex;
+  std::vector<StreamIn> m_ready;
+  std::vector<StreamIn> m_uploading;  // Swapped with m_ready, to keep both allocations
+  MeshResidencyStats m_stats;
+  FrameTimer m_streamInLatency;
+};
+
+void printMeshResidencyStats(const MeshResidencyStats& stats);
+
+#endif //WEBGPU_THINGY_SRC_MESH_RESIDENCY_H_
@@ -0,0 +1,348 @@
+#include "metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <utility>
+#include "log.h"
+#ifndef _WIN32
+#include <cerrno>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The exporter thread notices a stop request this often while it listens
+constexpr int kStopPollMs = 100;
+constexpr size_t kMaxRequestBytes = 4096;
+
+void appendNumber(std::string& out, double value) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.9g", value);
+  out += text;
+}
+
+void appendHeader(std::string& out, const std::string& name, const std::string& help, const char* type) {
+  out += "# HELP " + name + " " + help + "\n";
+  out += "# TYPE " + name + " " + type + "\n";
+}
+
+#ifndef _WIN32
+bool sendAll(int socket, const std::string& data) {
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;  // A scraper that hangs up must not kill the app
+#else
+  const int flags = 0;
+#endif
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t written = send(socket, data.data() + sent, data.size() - sent, flags);
+    if (written <= 0) {
+      return false;
+    }
+    sent += static_cast<size_t>(written);
+  }
+  return true;
+}
+#endif
+
+} // namespace
+
+MetricHistogram::MetricHistogram(std::vector<double> bounds)
+  : m_bounds(std::move(bounds)), m_buckets(new std::atomic<uint64_t>[m_bounds.size() + 1]) {
+  std::sort(m_bounds.begin(), m_bounds.end());
+  for (size_t i = 0; i <= m_bounds.size(); ++i) {
+    m_buckets[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void MetricHistogram::observe(double value) {
+  // A handful of bounds, a linear scan beats a binary search
+  size_t bucket = 0;
+  while (bucket < m_bounds.size() && value > m_bounds[bucket]) {
+    ++bucket;
+  }
+  m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  // Uncontended with a single writer, the exchange succeeds the first time
+  double sum = m_sum.load(std::memory_order_relaxed);
+  while (!m_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {
+  }
+}
+
+MetricCounter& MetricsRegistry::counter(const std::string& name, const std::string& help) {
+  auto metric = std::make_unique<Metric>();
+  metric->name = name;
+  metric->help = help;
+  metric->counter = std::make_unique<MetricCounter>();
+  MetricCounter& counter = *metric->counter;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_metrics.push_back(std::move(metric));
+  return counter;
+}
+
+MetricGauge& MetricsRegistry::gauge(const std::string& name, const std::string& help) {
+  auto metric = std::make_unique<Metric>();
+  metric->name = name;
+  metric->help = help;
+  metric->gauge = std::make_unique<MetricGauge>();
+  MetricGauge& gauge = *metric->gauge;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_metrics.push_back(std::move(metric));
+  return gauge;
+}
+
+MetricHistogram& MetricsRegistry::histogram(const std::string& name, const std::string& help, std::vector<double> bounds) {
+  auto metric = std::make_unique<Metric>();
+  metric->name = name;
+  metric->help = help;
+  metric->histogram = std::make_unique<MetricHistogram>(std::move(bounds));
+  MetricHistogram& histogram = *metric->histogram;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_metrics.push_back(std::move(metric));
+  return histogram;
+}
+
+void MetricsRegistry::addCollector(std::function<void()> collector) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_collectors.push_back(std::move(collector));
+}
+
+std::string MetricsRegistry::prometheusText() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const auto& collector : m_collectors) {
+    collector();
+  }
+  std::string out;
+  for (const auto& metric : m_metrics) {
+    const std::string& name = metric->name;
+    if (metric->counter) {
+      appendHeader(out, name, metric->help, "counter");
+      out += name + " " + std::to_string(metric->counter->value()) + "\n";
+    } else if (metric->gauge) {
+      appendHeader(out, name, metric->help, "gauge");
+      out += name + " ";
+      appendNumber(out, metric->gauge->value());
+      out += "\n";
+    } else {
+      const MetricHistogram& histogram = *metric->histogram;
+      appendHeader(out, name, metric->help, "histogram");
+      // The count is the sum of the buckets read here, so that it matches +Inf
+      uint64_t cumulative = 0;
+      for (size_t i = 0; i <= histogram.bounds().size(); ++i) {
+        cumulative += histogram.bucketCount(i);
+        out += name + "_bucket{le=\"";
+        if (i < histogram.bounds().size()) {
+          appendNumber(out, histogram.bounds()[i]);
+        } else {
+          out += "+Inf";
+        }
+        out += "\"} " + std::to_string(cumulative) + "\n";
+      }
+      out += name + "_sum ";
+      appendNumber(out, histogram.sum());
+      out += "\n" + name + "_count " + std::to_string(cumulative) + "\n";
+    }
+  }
+  return out;
+}
+
+RenderMetrics::RenderMetrics(MetricsRegistry& registry)
+  : frames(registry.counter("webgpu_thingy_frames_total", "Frames rendered")),
+    frameTime(registry.histogram("webgpu_thingy_frame_time_seconds", "Time between the starts of consecutive frames",
+                                 { 0.004, 0.008, 0.0125, 0.0167, 0.025, 0.0334, 0.05, 0.1, 0.25, 1.0 })),
+    presentWait(registry.histogram("webgpu_thingy_present_wait_seconds", "Time spent presenting the swap chain",
+                                   { 0.0005, 0.001, 0.002, 0.004, 0.008, 0.0167, 0.0334, 0.1 })),
+    uploadedBytes(registry.counter("webgpu_thingy_uploaded_bytes_total", "Bytes written to GPU buffers")),
+    draws(registry.counter("webgpu_thingy_draws_total", "Draw calls encoded")),
+    pipelineCacheHits(registry.counter("webgpu_thingy_pipeline_cache_hits_total", "Shader and pipeline variants found in the cache")),
+    hitches(registry.counter("webgpu_thingy_hitches_total", "Frames longer than a multiple of the median frame time")),
+    gpuMemory(registry.gauge("webgpu_thingy_gpu_memory_bytes", "Live GPU buffers, textures and query sets")) {}
+
+MetricsExporter::MetricsExporter(MetricsRegistry& registry, const MetricsExporterSettings& settings)
+  : m_registry(registry), m_settings(settings) {
+  if (m_settings.httpPort != 0) {
+#ifndef _WIN32
+    m_listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(m_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(m_settings.httpPort);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // Not exposed beyond this machine
+    if (m_listenSocket < 0 || bind(m_listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(m_listenSocket, 4) != 0) {
+      LOG_ERROR << "Could not serve metrics on port " << m_settings.httpPort << ": " << std::strerror(errno);
+      if (m_listenSocket >= 0) {
+        close(m_listenSocket);
+      }
+      m_listenSocket = -1;
+    } else {
+      LOG_INFO << "Serving metrics on http://127.0.0.1:" << m_settings.httpPort << "/metrics";
+    }
+#else
+    LOG_ERROR << "Serving metrics over HTTP needs POSIX sockets, use a textfile";
+#endif
+  }
+  if (isListening() || !m_settings.textfilePath.empty()) {
+    m_thread = std::thread([this]() { run(); });
+  }
+}
+
+MetricsExporter::~MetricsExporter() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop.store(true, std::memory_order_relaxed);
+  }
+  m_wake.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+#ifndef _WIN32
+  if (m_listenSocket >= 0) {
+    close(m_listenSocket);
+  }
+#endif
+  // The final values, for a collector that reads after the app stopped
+  if (!m_settings.textfilePath.empty()) {
+    writeTextfile();
+  }
+}
+
+void MetricsExporter::run() {
+  const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_settings.textfilePeriodSeconds));
+  Clock::time_point nextWrite = Clock::now();
+  while (!m_stop.load(std::memory_order_relaxed)) {
+    if (!m_settings.textfilePath.empty() && Clock::now() >= nextWrite) {
+      writeTextfile();
+      nextWrite += period;
+    }
+#ifndef _WIN32
+    if (isListening()) {
+      pollfd listener = { m_listenSocket, POLLIN, 0 };
+      if (poll(&listener, 1, kStopPollMs) > 0 && (listener.revents & POLLIN)) {
+        int client = accept(m_listenSocket, nullptr, nullptr);
+        if (client >= 0) {
+          serve(client);
+          close(client);
+        }
+      }
+      continue;
+    }
+#endif
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_wake.wait_until(lock, nextWrite, [&]() { return m_stop.load(std::memory_order_relaxed); });
+  }
+}
+
+void MetricsExporter::serve(int client) {
+#ifndef _WIN32
+  // A client that connects and says nothing must not hold up the exporter
+  timeval timeout = { 1, 0 };
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos && request.size() < kMaxRequestBytes) {
+    ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+      break;
+    }
+    request.append(buffer, static_cast<size_t>(received));
+  }
+  const std::string requestLine = request.substr(0, request.find("\r\n"));
+  std::string status = "200 OK";
+  std::string body;
+  if (requestLine.compare(0, 4, "GET ") != 0) {
+    status = "405 Method Not Allowed";
+  } else if (requestLine.compare(4, 9, "/metrics ") != 0 && requestLine.compare(4, 9, "/metrics?") != 0) {
+    status = "404 Not Found";
+  } else {
+    body = m_registry.prometheusText();
+  }
+  std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: " +
+                         std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+  sendAll(client, response);
+#else
+  static_cast<void>(client);
+#endif
+}
+
+bool MetricsExporter::writeTextfile() {
+  // Written aside and renamed, so that the collector never reads half a file
+  std::filesystem::path temporary = m_settings.textfilePath;
+  temporary += ".tmp";
+  {
+    const std::string text = m_registry.prometheusText();
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(text.data(), static_cast<std::streamsize>(text.size()));
+    if (!file) {
+      LOG_ERROR << "Could not write metrics to " << temporary.string();
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temporary, m_settings.textfilePath, error);
+  if (error) {
+    LOG_ERROR << "Could not replace " << m_settings.textfilePath.string() << ": " << error.message();
+    return false;
+  }
+  return true;
+}
+
+void benchmarkMetrics(size_t frames) {
+  if (frames == 0) {
+    return;
+  }
+  MetricsRegistry registry;
+  RenderMetrics metrics(registry);
+  // What renderFrame() updates, with values that spread over the buckets
+  auto runFrames = [&]() {
+    auto start = Clock::now();
+    for (size_t i = 0; i < frames; ++i) {
+      const double jitter = static_cast<double>(i % 13) * 0.001;
+      metrics.frames.add();
+      metrics.frameTime.observe(0.0167 + jitter);
+      metrics.presentWait.observe(0.002 + jitter);
+      metrics.uploadedBytes.add(64 * 1024);
+      metrics.draws.add(24);
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(frames);
+  };
+  constexpr double kFrameBudgetNs = 1e9 / 60.0;
+  auto report = [&](const char* label, double frameNs) {
+    std::cout << std::fixed << std::setprecision(1) << label << ": " << frameNs << " ns per frame, " << std::setprecision(4)
+              << 100.0 * frameNs / kFrameBudgetNs << "% of a 60 Hz frame" << std::defaultfloat << std::endl;
+  };
+
+  std::cout << "Updating the metrics of " << frames << " frames" << std::endl;
+  report("Alone", runFrames());
+
+  // A scraper reading as fast as it can, far more often than a real one
+  std::atomic<bool> done{ false };
+  size_t scrapes = 0;
+  std::thread scraper([&]() {
+    while (!done.load(std::memory_order_relaxed)) {
+      registry.prometheusText();
+      ++scrapes;
+    }
+  });
+  const double scrapedNs = runFrames();
+  done = true;
+  scraper.join();
+  report("While scraped", scrapedNs);
+
+  auto start = Clock::now();
+  const std::string text = registry.prometheusText();
+  const double exposeUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+  std::cout << std::fixed << std::setprecision(1) << "Exposition: " << text.size() << " bytes in " << exposeUs << " us, "
+            << scrapes << " scrapes during the second run" << std::defaultfloat << std::endl;
+}
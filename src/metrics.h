@@ -0,0 +1,134 @@
+#ifndef WEBGPU_THINGY_SRC_METRICS_H_
+#define WEBGPU_THINGY_SRC_METRICS_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Counters, gauges and histograms for a monitoring system, exposed in the
+// Prometheus text format. Metrics are registered up front; updating one is a
+// few relaxed atomic operations, without locks or allocations, from any
+// thread. Values are in base units: seconds and bytes.
+
+class MetricCounter {
+public:
+  void add(uint64_t amount = 1) { m_value.fetch_add(amount, std::memory_order_relaxed); }
+  uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> m_value{ 0 };
+};
+
+class MetricGauge {
+public:
+  void set(double value) { m_value.store(value, std::memory_order_relaxed); }
+  double value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> m_value{ 0.0 };
+};
+
+// Counts observations into buckets with fixed upper bounds, plus one for
+// what is above the last
+class MetricHistogram {
+public:
+  explicit MetricHistogram(std::vector<double> bounds);
+  void observe(double value);
+
+  const std::vector<double>& bounds() const { return m_bounds; }
+  // Not cumulative, bounds().size() + 1 of them
+  uint64_t bucketCount(size_t bucket) const { return m_buckets[bucket].load(std::memory_order_relaxed); }
+  double sum() const { return m_sum.load(std::memory_order_relaxed); }
+
+private:
+  std::vector<double> m_bounds;
+  std::unique_ptr<std::atomic<uint64_t>[]> m_buckets;
+  std::atomic<double> m_sum{ 0.0 };
+};
+
+class MetricsRegistry {
+public:
+  // References stay valid as long as the registry. Names follow Prometheus
+  // conventions: counters end in _total, units are suffixes.
+  MetricCounter& counter(const std::string& name, const std::string& help);
+  MetricGauge& gauge(const std::string& name, const std::string& help);
+  MetricHistogram& histogram(const std::string& name, const std::string& help, std::vector<double> bounds);
+
+  // Runs before every exposition, from the exporting thread, to sample
+  // values that other modules own
+  void addCollector(std::function<void()> collector);
+
+  std::string prometheusText();
+
+private:
+  struct Metric {
+    std::string name;
+    std::string help;
+    std::unique_ptr<MetricCounter> counter;
+    std::unique_ptr<MetricGauge> gauge;
+    std::unique_ptr<MetricHistogram> histogram;
+  };
+
+  std::mutex m_mutex;
+  std::vector<std::unique_ptr<Metric>> m_metrics;
+  std::vector<std::function<void()>> m_collectors;
+};
+
+// What the render loop reports, registered by the constructor
+struct RenderMetrics {
+  explicit RenderMetrics(MetricsRegistry& registry);
+
+  MetricCounter& frames;
+  MetricHistogram& frameTime;
+  MetricHistogram& presentWait;  // In present(), mostly waiting for vsync
+  MetricCounter& uploadedBytes;
+  MetricCounter& draws;
+  MetricCounter& pipelineCacheHits;
+  MetricCounter& hitches;        // Counted by the hitch detector, when it runs
+  MetricGauge& gpuMemory;        // Sampled by a collector
+};
+
+struct MetricsExporterSettings {
+  uint16_t httpPort = 0;                 // Serves GET /metrics on localhost, 0 for none
+  std::filesystem::path textfilePath;    // Rewritten periodically for a textfile collector, empty for none
+  double textfilePeriodSeconds = 10.0;
+};
+
+// Exposes a registry from a thread of its own: over HTTP, to scrapers on the
+// same machine, and by atomically replacing a file, for node_exporter's
+// textfile collector
+class MetricsExporter {
+public:
+  MetricsExporter(MetricsRegistry& registry, const MetricsExporterSettings& settings);
+  ~MetricsExporter();
+  MetricsExporter(const MetricsExporter&) = delete;
+  MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+  bool isListening() const { return m_listenSocket >= 0; }
+
+private:
+  void run();
+  void serve(int client);
+  bool writeTextfile();
+
+  MetricsRegistry& m_registry;
+  MetricsExporterSettings m_settings;
+  int m_listenSocket = -1;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::atomic<bool> m_stop{ false };
+  std::thread m_thread;
+};
+
+// Cost of the metric updates of one frame, alone and while being scraped
+void benchmarkMetrics(size_t frames);
+
+#endif //WEBGPU_THINGY_SRC_METRICS_H_
@@ -0,0 +1,95 @@
+#include "offscreen_target.h"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include "gpu_resources.h"
+#include "log.h"
+#include "trace.h"
+#include "utils.h"
+
+OffscreenTarget::OffscreenTarget(wgpu::Device device, wgpu::Queue queue, GpuResources& resources,
+                                 const OffscreenTargetSettings& settings)
+  : m_device(device)
+  , m_queue(queue)
+  , m_resources(resources)
+  , m_settings(settings)
+  , m_completion(new Completion())
+{
+  wgpu::TextureDescriptor textureDesc;
+  textureDesc.label = "Offscreen target";
+  textureDesc.dimension = wgpu::TextureDimension::_2D;
+  textureDesc.format = settings.format;
+  textureDesc.mipLevelCount = 1;
+  textureDesc.sampleCount = 1;
+  textureDesc.size = { settings.width, settings.height, 1 };
+  textureDesc.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc;
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  m_texture = m_resources.createTexture(textureDesc);
+}
+
+OffscreenTarget::~OffscreenTarget() {
+  // The callbacks of frames still on the GPU point to the completion state
+  if (!m_lost) {
+    waitForFrames(0);
+  }
+  if (m_completion->completed == m_submitted) {
+    delete m_completion;
+  } else {
+    LOG_ERROR << m_submitted - m_completion->completed << " offscreen frames never finished on the GPU";
+  }
+  m_resources.destroy(m_texture);
+}
+
+wgpu::TextureView OffscreenTarget::getCurrentTextureView() {
+  return m_texture ? m_texture.createView() : nullptr;
+}
+
+bool OffscreenTarget::present() {
+  if (m_lost) {
+    return false;
+  }
+  // Called back once the work submitted so far, this frame's included, is done
+  wgpuQueueOnSubmittedWorkDone(m_queue, &OffscreenTarget::workDone, m_completion);
+  ++m_submitted;
+  ++m_stats.frames;
+  if (m_submitted - m_completion->completed <= m_settings.maxFramesInFlight && !m_completion->failed) {
+    return true;
+  }
+  TRACE_ZONE("Wait for frames in flight");
+  const auto start = std::chrono::steady_clock::now();
+  const bool done = waitForFrames(m_settings.maxFramesInFlight);
+  ++m_stats.waits;
+  m_stats.waitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  return done;
+}
+
+bool OffscreenTarget::waitForFrames(uint64_t maxInFlight) {
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_settings.timeoutMs);
+  while (m_submitted - m_completion->completed > maxInFlight && !m_completion->failed) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      LOG_ERROR << "The GPU did not finish an offscreen frame in " << m_settings.timeoutMs << " ms, giving it up as lost";
+      m_lost = true;
+      return false;
+    }
+    pollDevice(m_device, m_queue);
+  }
+  if (m_completion->failed) {
+    LOG_ERROR << "The GPU failed submitted work, the device is likely lost";
+    m_lost = true;
+    return false;
+  }
+  return true;
+}
+
+void OffscreenTarget::workDone(WGPUQueueWorkDoneStatus status, void* userdata) {
+  // In submission order, an error still ends the frame
+  Completion* completion = static_cast<Completion*>(userdata);
+  ++completion->completed;
+  completion->failed |= status != WGPUQueueWorkDoneStatus_Success;
+}
+
+void printOffscreenTargetStats(const OffscreenTargetStats& stats) {
+  std::cout << std::fixed << std::setprecision(2) << "Offscreen target: " << stats.frames << " frames, " << stats.waits
+            << " waited for the GPU (" << stats.waitMs << " ms in total)" << std::defaultfloat << std::endl;
+}
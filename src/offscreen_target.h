@@ -0,0 +1,73 @@
+#ifndef WEBGPU_THINGY_SRC_OFFSCREEN_TARGET_H_
+#define WEBGPU_THINGY_SRC_OFFSCREEN_TARGET_H_
+
+#include <cstdint>
+#include <webgpu/webgpu.hpp>
+
+class GpuResources;
+
+struct OffscreenTargetSettings {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  wgpu::TextureFormat format = wgpu::TextureFormat::Undefined;
+  uint32_t maxFramesInFlight = 2;  // Submitted frames the GPU may still be working on
+  int timeoutMs = 10000;           // Of a wait for the GPU, before it is given up as lost
+};
+
+struct OffscreenTargetStats {
+  uint64_t frames = 0;
+  uint64_t waits = 0;     // Presents that waited for the GPU
+  double waitMs = 0.0;
+};
+
+// Stands in for the swap chain where frames are rendered without a surface:
+// every frame draws into the same texture, and present() blocks while more
+// than maxFramesInFlight frames are on the GPU instead of waiting for a
+// display. Frame rates are then bounded by the GPU and the frame loop only,
+// for throughput benchmarks on machines without a display, such as GLFW's
+// null platform (NULL_PLATFORM builds) with a software adapter.
+//
+// Used from the rendering thread. Presents neither allocate nor lock. A GPU
+// that reports an error for submitted work, or does not finish a frame
+// within timeoutMs, is given up: present() then fails, and the destructor
+// leaves the completion state of the missing frames to their callbacks.
+class OffscreenTarget {
+public:
+  OffscreenTarget(wgpu::Device device, wgpu::Queue queue, GpuResources& resources, const OffscreenTargetSettings& settings);
+  ~OffscreenTarget();
+  OffscreenTarget(const OffscreenTarget&) = delete;
+  OffscreenTarget& operator=(const OffscreenTarget&) = delete;
+
+  // Same as wgpu::SwapChain's, the caller releases the view
+  wgpu::TextureView getCurrentTextureView();
+  // After the frame's commands were submitted, false once the GPU is given up
+  bool present();
+
+  OffscreenTargetStats stats() const { return m_stats; }
+
+private:
+  // What the callbacks of submitted frames write, on the heap so that it can
+  // outlive a target whose GPU never calls back
+  struct Completion {
+    uint64_t completed = 0;  // Of the presented frames, finished on the GPU
+    bool failed = false;     // A callback reported an error
+  };
+
+  static void workDone(WGPUQueueWorkDoneStatus status, void* userdata);
+  // Polls while more than `maxInFlight` frames are on the GPU, false on an error or timeout
+  bool waitForFrames(uint64_t maxInFlight);
+
+  wgpu::Device m_device;
+  wgpu::Queue m_queue;
+  GpuResources& m_resources;
+  OffscreenTargetSettings m_settings;
+  wgpu::Texture m_texture = nullptr;
+  uint64_t m_submitted = 0;  // Frames presented
+  Completion* m_completion = nullptr;
+  bool m_lost = false;
+  OffscreenTargetStats m_stats;
+};
+
+void printOffscreenTargetStats(const OffscreenTargetStats& stats);
+
+#endif //WEBGPU_THINGY_SRC_OFFSCREEN_TARGET_H_
@@ -0,0 +1,230 @@
+#include "options.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+
+namespace {
+
+void printUsage(const char* program) {
+  std::cout << "Usage: " << program << " [options]\n"
+            << "  --width <px>, --height <px>   Window size (default 640x480)\n"
+            << "  --present-mode <mode>         fifo, mailbox or immediate (default fifo)\n"
+            << "  --offscreen                   Render into a texture instead of the window, without vsync (for benchmarks)\n"
+            << "  --single-thread               Render on the event thread instead of a render thread (for comparison)\n"
+            << "  --jobs <n>                    Job system worker threads (default one per core minus one)\n"
+            << "  --parallel-encode             Record draws into render bundles on the job system threads\n"
+            << "  --disk-resources              Prefer resources on disk to the embedded ones (for development)\n"
+            << "  --pack <path>                 Read resources from an asset pack (see asset-packer)\n"
+            << "  --geometry <path>             Geometry file to load (default: embedded webgpu.txt)\n"
+            << "  --shm-feed <name>             Draw geometry published to a shared memory feed (see shm-producer)\n"
+            << "  --grid <n>                    Draw the mesh n x n times\n"
+            << "  --subdivide <levels>          Refine the mesh, 4x triangles per level\n"
+            << "  --layers <n>                  Stack n overlapping copies of the grid\n"
+            << "  --transparent-layers <n>      Draw the top n layers semi-transparent\n"
+            << "  --depth <format>              none, depth24plus or depth32float (default none)\n"
+            << "  --no-lod                      Always draw the full resolution mesh\n"
+            << "  --lod-levels <n>              Number of levels in the LOD chain (default 5)\n"
+            << "  --lod-error <px>              Screen space error allowed when picking a LOD (default 1)\n"
+            << "  --mesh-budget <MiB>           Stream LOD levels within a GPU budget, evicting the least recently drawn\n"
+            << "  --mesh-cache <dir>            Keep the compressed LOD levels on disk instead of in memory\n"
+            << "  --vertex-layout <layout>      float32 or packed (default float32)\n"
+            << "  --fragment-srgb               Decode vertex colors in the fragment shader (for comparison)\n"
+            << "  --bench-frames <n>            Render n frames, print frame time statistics and exit\n"
+            << "  --bench-srgb <n>              Benchmark the sRGB conversion kernel on n values and exit\n"
+            << "  --bench-io <n>                Benchmark cold and warm loading of n geometry files and exit\n"
+            << "  --bench-log <n>               Benchmark logging n lines through std::endl and the log ring and exit\n"
+            << "  --bench-jobs <n>              Benchmark job system scaling with up to n workers and exit\n"
+            << "  --bench-encode <n>            Time encoding n draws directly and through render bundles and exit\n"
+            << "  --bench-metrics <n>           Time the metric updates of n frames, alone and while scraped, and exit\n"
+            << "  --measure-overdraw            Report shaded samples per pixel of the first frame\n"
+            << "  --check-allocations           Exit with an error if a frame after warm-up allocates (COUNT_ALLOCATIONS builds)\n"
+            << "  --gpu-budget <MiB>            Warn when buffers and textures exceed this much GPU memory\n"
+            << "  --gpu-budget-fail             Exit with an error when over the GPU memory budget\n"
+            << "  --capture <path>              Record the WebGPU calls of every frame for capture-replay\n"
+            << "  --trace <path>                Record a timeline of the frame loop and GPU passes (.json or .pftrace)\n"
+            << "  --hud                         Show the performance overlay (H toggles it)\n"
+            << "  --metrics-port <port>         Serve Prometheus metrics on http://127.0.0.1:<port>/metrics\n"
+            << "  --metrics-file <path>         Rewrite Prometheus metrics into a file for a textfile collector\n"
+            << "  --metrics-period <s>          Seconds between rewrites of the metrics file (default 10)\n"
+            << "  --hitch-factor <x>            Snapshot frames longer than x times the median frame time\n"
+            << "  --hitch-dir <dir>             Directory of the hitch snapshots (default hitches)\n"
+            << "  --hitch-files <n>             Snapshots kept before the oldest is overwritten (default 16)\n"
+            << "  --overdraw                    Analyze per-pixel overdraw of one offscreen frame and exit\n"
+            << "  --heatmap <path>              Write the overdraw heatmap to a PNG file\n"
+            << "  --fallback-adapter            Use the fallback (software) adapter\n"
+            << "  --help                        Show this message" << std::endl;
+}
+
+} // namespace
+
+bool parseOptions(int argc, char** argv, AppOptions& options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    auto is = [&](const char* name) { return std::strcmp(arg, name) == 0; };
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        std::cerr << "Missing value for " << arg << std::endl;
+        return nullptr;
+      }
+      return argv[++i];
+    };
+    auto number = [&](auto& out) {
+      const char* text = value();
+      if (!text) return false;
+      char* end = nullptr;
+      double parsed = std::strtod(text, &end);
+      // Converting a value the target type cannot hold is undefined, integers
+      // hold [0, 2^digits) and the comparisons also turn NaN away
+      using Target = std::decay_t<decltype(out)>;
+      const double limit = std::is_integral_v<Target> ? std::ldexp(1.0, std::numeric_limits<Target>::digits)
+                                                      : static_cast<double>(std::numeric_limits<Target>::max());
+      const bool inRange = std::is_integral_v<Target> ? parsed >= 0 && parsed < limit : parsed >= 0 && parsed <= limit;
+      if (end == text || *end != '\0' || !inRange) {
+        std::cerr << "Invalid value for " << arg << ": " << text << std::endl;
+        return false;
+      }
+      out = static_cast<Target>(parsed);
+      return true;
+    };
+
+    bool ok = true;
+    if (is("--help")) {
+      printUsage(argv[0]);
+      return false;
+    }
+    else if (is("--width")) ok = number(options.width);
+    else if (is("--height")) ok = number(options.height);
+    else if (is("--present-mode")) {
+      const char* mode = value();
+      if (!mode) return false;
+      if (std::strcmp(mode, "fifo") == 0) options.presentMode = wgpu::PresentMode::Fifo;
+      else if (std::strcmp(mode, "mailbox") == 0) options.presentMode = wgpu::PresentMode::Mailbox;
+      else if (std::strcmp(mode, "immediate") == 0) options.presentMode = wgpu::PresentMode::Immediate;
+      else {
+        std::cerr << "Unknown present mode: " << mode << std::endl;
+        return false;
+      }
+    }
+    else if (is("--offscreen")) options.offscreen = true;
+    else if (is("--single-thread")) options.renderThread = false;
+    else if (is("--jobs")) ok = number(options.jobWorkers);
+    else if (is("--parallel-encode")) options.parallelEncode = true;
+    else if (is("--disk-resources")) options.diskResources = true;
+    else if (is("--pack")) {
+      const char* path = value();
+      if (!path) return false;
+      options.packPath = path;
+    }
+    else if (is("--geometry")) {
+      const char* path = value();
+      if (!path) return false;
+      options.geometryPath = path;
+    }
+    else if (is("--shm-feed")) {
+      const char* name = value();
+      if (!name) return false;
+      options.shmFeedName = name;
+    }
+    else if (is("--grid")) ok = number(options.gridSize);
+    else if (is("--subdivide")) ok = number(options.subdivisions);
+    else if (is("--layers")) ok = number(options.layers);
+    else if (is("--transparent-layers")) ok = number(options.transparentLayers);
+    else if (is("--depth")) {
+      const char* format = value();
+      if (!format) return false;
+      if (std::strcmp(format, "none") == 0) options.depthFormat = wgpu::TextureFormat::Undefined;
+      else if (std::strcmp(format, "depth24plus") == 0) options.depthFormat = wgpu::TextureFormat::Depth24Plus;
+      else if (std::strcmp(format, "depth32float") == 0) options.depthFormat = wgpu::TextureFormat::Depth32Float;
+      else {
+        std::cerr << "Unknown depth format: " << format << std::endl;
+        return false;
+      }
+    }
+    else if (is("--no-lod")) options.lod = false;
+    else if (is("--lod-levels")) ok = number(options.lodLevels);
+    else if (is("--lod-error")) ok = number(options.lodErrorPx);
+    else if (is("--mesh-budget")) ok = number(options.meshBudgetMiB);
+    else if (is("--mesh-cache")) {
+      const char* path = value();
+      if (!path) return false;
+      options.meshCacheDir = path;
+    }
+    else if (is("--vertex-layout")) {
+      const char* layout = value();
+      if (!layout) return false;
+      if (std::strcmp(layout, "float32") == 0) options.packedVertices = false;
+      else if (std::strcmp(layout, "packed") == 0) options.packedVertices = true;
+      else {
+        std::cerr << "Unknown vertex layout: " << layout << std::endl;
+        return false;
+      }
+    }
+    else if (is("--fragment-srgb")) options.fragmentSrgb = true;
+    else if (is("--bench-frames")) ok = number(options.benchFrames);
+    else if (is("--bench-srgb")) ok = number(options.benchSrgb);
+    else if (is("--bench-io")) ok = number(options.benchIo);
+    else if (is("--bench-log")) ok = number(options.benchLog);
+    else if (is("--bench-jobs")) ok = number(options.benchJobs);
+    else if (is("--bench-encode")) ok = number(options.benchEncode);
+    else if (is("--bench-metrics")) ok = number(options.benchMetrics);
+    else if (is("--measure-overdraw")) options.measureOverdraw = true;
+    else if (is("--check-allocations")) options.checkAllocations = true;
+    else if (is("--gpu-budget")) ok = number(options.gpuBudgetMiB);
+    else if (is("--gpu-budget-fail")) options.gpuBudgetFail = true;
+    else if (is("--capture")) {
+      const char* path = value();
+      if (!path) return false;
+      options.capturePath = path;
+    }
+    else if (is("--trace")) {
+      const char* path = value();
+      if (!path) return false;
+      options.tracePath = path;
+    }
+    else if (is("--hud")) options.hud = true;
+    else if (is("--metrics-port")) ok = number(options.metricsPort);
+    else if (is("--metrics-file")) {
+      const char* path = value();
+      if (!path) return false;
+      options.metricsFile = path;
+    }
+    else if (is("--metrics-period")) ok = number(options.metricsPeriodSeconds);
+    else if (is("--hitch-factor")) ok = number(options.hitchFactor);
+    else if (is("--hitch-dir")) {
+      const char* path = value();
+      if (!path) return false;
+      options.hitchDir = path;
+    }
+    else if (is("--hitch-files")) ok = number(options.hitchFiles);
+    else if (is("--overdraw")) options.overdraw = true;
+    else if (is("--heatmap")) {
+      const char* path = value();
+      if (!path) return false;
+      options.heatmapPath = path;
+    }
+    else if (is("--fallback-adapter")) options.fallbackAdapter = true;
+    else {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      printUsage(argv[0]);
+      return false;
+    }
+    if (!ok) return false;
+  }
+
+  if (options.width == 0 || options.height == 0 || options.gridSize < 1 || options.layers < 1 || options.lodLevels < 1) {
+    std::cerr << "Window size, grid size, layers and LOD levels must be at least 1" << std::endl;
+    return false;
+  }
+  if (options.hitchFactor != 0.0 && options.hitchFactor <= 1.0) {
+    std::cerr << "The hitch factor must be more than 1" << std::endl;
+    return false;
+  }
+  if (options.metricsPort > 65535 || options.metricsPeriodSeconds <= 0.0) {
+    std::cerr << "The metrics port must be at most 65535 and the metrics period positive" << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,82 @@
+#ifndef WEBGPU_THINGY_SRC_OPTIONS_H_
+#define WEBGPU_THINGY_SRC_OPTIONS_H_
+
+#include <string>
+#include <webgpu/webgpu.hpp>
+
+struct AppOptions {
+  // Window
+  uint32_t width = 640;
+  uint32_t height = 480;
+  wgpu::PresentMode presentMode = wgpu::PresentMode::Fifo;
+  bool renderThread = true;  // Render on a thread of its own, the main thread only handles events
+  int jobWorkers = -1;       // Job system workers, -1 for one per core besides the submitting thread
+  bool parallelEncode = false;  // Record the draw list into render bundles on the job system
+  bool offscreen = false;  // Render into a texture instead of the swap chain, always on in NULL_PLATFORM builds
+
+  // Resources
+  bool diskResources = false;  // Read resources from RESOURCE_DIR before the copies embedded in the binary
+  std::string packPath;        // Asset pack read before the embedded resources
+
+  // Scene
+  std::string geometryPath;  // Empty uses the embedded webgpu.txt
+  std::string shmFeedName;   // Shared memory feed replacing the geometry when a producer publishes to it
+  int gridSize = 1;       // The mesh is instanced on a grid of gridSize x gridSize
+  int subdivisions = 0;   // Refines the loaded mesh to produce a heavier workload
+  int layers = 1;         // Overlapping copies of the grid, for overdraw experiments
+  int transparentLayers = 0;
+
+  // Depth buffer, Undefined disables it and draws everything blended in scene order
+  wgpu::TextureFormat depthFormat = wgpu::TextureFormat::Undefined;
+
+  // Level of detail
+  bool lod = true;
+  size_t lodLevels = 5;
+  float lodErrorPx = 1.0f;
+
+  // Mesh streaming
+  size_t meshBudgetMiB = 0;  // When non-zero, stream LOD levels in and out to stay within this many MiB
+  std::string meshCacheDir;  // Keep the streamed levels compressed on disk instead of in memory
+
+  // Vertex layout
+  bool packedVertices = false;  // Upload 8-bit colors instead of 32-bit floats
+
+  // Color
+  bool fragmentSrgb = false;  // Decode sRGB per fragment instead of once at load time
+
+  // Benchmarking
+  int benchFrames = 0;    // When non-zero, render this many frames, print timings and exit
+  size_t benchSrgb = 0;   // When non-zero, benchmark the sRGB kernel on this many values and exit
+  size_t benchIo = 0;     // When non-zero, benchmark loading this many geometry files and exit
+  size_t benchLog = 0;    // When non-zero, benchmark logging this many lines and exit
+  unsigned benchJobs = 0; // When non-zero, benchmark the job system with up to this many workers and exit
+  size_t benchEncode = 0; // When non-zero, time encoding this many draws with 1 to --jobs + 1 threads and exit
+  size_t benchMetrics = 0; // When non-zero, time the metric updates of this many frames and exit
+  bool measureOverdraw = false;  // Count shaded samples of the first frame with an occlusion query
+  bool checkAllocations = false;  // Fail if a frame after warm-up allocates, needs COUNT_ALLOCATIONS
+  size_t gpuBudgetMiB = 0;        // When non-zero, warn when GPU resources exceed this many MiB
+  bool gpuBudgetFail = false;     // Stop rendering and exit with an error instead of warning
+  std::string capturePath;        // Record the WebGPU calls of every frame for capture-replay
+  std::string tracePath;          // Record a timeline of trace zones and write it here at exit
+  bool hud = false;               // Show the performance overlay from the first frame, H toggles it
+
+  // Metrics for a monitoring system, in the Prometheus text format
+  unsigned metricsPort = 0;       // When non-zero, serve them on http://127.0.0.1:<port>/metrics
+  std::string metricsFile;        // Rewrite them into this file, for node_exporter's textfile collector
+  double metricsPeriodSeconds = 10.0;  // Of the file
+
+  // Hitch detection
+  double hitchFactor = 0.0;              // When non-zero, snapshot frames longer than this many median frames
+  std::string hitchDir = "hitches";      // Ring of snapshot files
+  size_t hitchFiles = 16;
+
+  // Overdraw analysis, renders one frame offscreen without a window and exits
+  bool overdraw = false;
+  std::string heatmapPath;       // Overdraw heatmap PNG, not written when empty
+  bool fallbackAdapter = false;  // Request the software adapter, for machines without a GPU
+};
+
+// Returns false if the command line is invalid or help was requested
+bool parseOptions(int argc, char** argv, AppOptions& options);
+
+#endif //WEBGPU_THINGY_SRC_OPTIONS_H_
@@ -0,0 +1,276 @@
+#include "overdraw.h"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+#include "gpu_resources.h"
+
+namespace {
+
+constexpr size_t kHistogramBuckets = 17; // 0 to 15 fragments, then 16 and more
+
+float halfToFloat(uint16_t half) {
+  uint32_t sign = uint32_t(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1F;
+  uint32_t mantissa = half & 0x3FF;
+  uint32_t bits;
+  if (exponent == 0) {
+    // Zero or subnormal, never produced by counting but handled for completeness
+    float value = static_cast<float>(mantissa) / 16777216.0f;
+    return sign ? -value : value;
+  } else if (exponent == 31) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Black, blue, green, yellow, red as the count goes from 0 to max
+void heatColor(float t, uint8_t* rgb) {
+  static const float stops[5][3] = { { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 } };
+  t = std::min(std::max(t, 0.0f), 1.0f) * 4.0f;
+  int i = std::min(static_cast<int>(t), 3);
+  float f = t - static_cast<float>(i);
+  for (int c = 0; c < 3; ++c) {
+    rgb[c] = static_cast<uint8_t>(255.0f * (stops[i][c] + (stops[i + 1][c] - stops[i][c]) * f));
+  }
+}
+
+} // namespace
+
+OverdrawAnalyzer::OverdrawAnalyzer(wgpu::Device device, wgpu::Queue queue, const OverdrawSettings& settings,
+                                   GpuResources* resources)
+  : m_device(device)
+  , m_queue(queue)
+  , m_settings(settings)
+  , m_resources(resources)
+{
+  wgpu::TextureDescriptor textureDesc;
+  textureDesc.label = "Overdraw counter";
+  textureDesc.dimension = wgpu::TextureDimension::_2D;
+  textureDesc.format = kCounterFormat;
+  textureDesc.mipLevelCount = 1;
+  textureDesc.sampleCount = 1;
+  textureDesc.size = { settings.width, settings.height, 1 };
+  textureDesc.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc;
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  m_counterTexture = resources ? resources->createTexture(textureDesc) : device.createTexture(textureDesc);
+  m_counterView = m_counterTexture.createView();
+
+  // Rows of a texture to buffer copy must be 256-byte aligned
+  m_bytesPerRow = (settings.width * sizeof(uint16_t) + 255) & ~255u;
+  wgpu::BufferDescriptor bufferDesc;
+  bufferDesc.label = "Overdraw readback";
+  bufferDesc.size = uint64_t(m_bytesPerRow) * settings.height;
+  bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+  bufferDesc.mappedAtCreation = false;
+  m_readbackBuffer = resources ? resources->createBuffer(bufferDesc) : device.createBuffer(bufferDesc);
+}
+
+OverdrawAnalyzer::~OverdrawAnalyzer() {
+  for (wgpu::RenderPipeline& pipeline : m_pipelines) {
+    pipeline.release();
+  }
+  m_counterView.release();
+  if (m_resources) {
+    m_resources->destroy(m_readbackBuffer);
+    m_resources->destroy(m_counterTexture);
+    return;
+  }
+  m_readbackBuffer.destroy();
+  m_readbackBuffer.release();
+  m_counterTexture.destroy();
+  m_counterTexture.release();
+}
+
+wgpu::RenderPipeline OverdrawAnalyzer::createCountingPipeline(const wgpu::RenderPipelineDescriptor& pipelineDesc) {
+  wgpu::RenderPipelineDescriptor countingDesc = pipelineDesc;
+  wgpu::FragmentState fragmentState = *pipelineDesc.fragment;
+  fragmentState.entryPoint = "fs_overdraw";
+  fragmentState.constantCount = 0;
+  fragmentState.constants = nullptr;
+
+  wgpu::BlendState blendState;
+  blendState.color.srcFactor = wgpu::BlendFactor::One;
+  blendState.color.dstFactor = wgpu::BlendFactor::One;
+  blendState.color.operation = wgpu::BlendOperation::Add;
+  blendState.alpha = blendState.color;
+  wgpu::ColorTargetState colorTarget;
+  colorTarget.format = kCounterFormat;
+  colorTarget.blend = &blendState;
+  colorTarget.writeMask = wgpu::ColorWriteMask::All;
+  fragmentState.targetCount = 1;
+  fragmentState.targets = &colorTarget;
+  countingDesc.fragment = &fragmentState;
+  countingDesc.label = "Overdraw counting pipeline";
+
+  wgpu::RenderPipeline pipeline = m_device.createRenderPipeline(countingDesc);
+  m_pipelines.push_back(pipeline);
+  return pipeline;
+}
+
+void OverdrawAnalyzer::capture(const DrawList& drawList, wgpu::TextureView depthView) {
+  m_ready = false;
+  wgpu::CommandEncoderDescriptor encoderDesc = wgpu::Default;
+  encoderDesc.label = "Overdraw encoder";
+  wgpu::CommandEncoder encoder = m_device.createCommandEncoder(encoderDesc);
+
+  wgpu::RenderPassColorAttachment colorAttachment = wgpu::Default;
+  colorAttachment.view = m_counterView;
+  colorAttachment.resolveTarget = nullptr;
+  colorAttachment.loadOp = wgpu::LoadOp::Clear;
+  colorAttachment.storeOp = wgpu::StoreOp::Store;
+  colorAttachment.clearValue = wgpu::Color{ 0.0, 0.0, 0.0, 0.0 };
+
+  wgpu::RenderPassDepthStencilAttachment depthStencilAttachment = wgpu::Default;
+  depthStencilAttachment.view = depthView;
+  depthStencilAttachment.depthClearValue = 1.0f;
+  depthStencilAttachment.depthLoadOp = wgpu::LoadOp::Clear;
+  depthStencilAttachment.depthStoreOp = wgpu::StoreOp::Store;
+  depthStencilAttachment.depthReadOnly = false;
+  depthStencilAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+  depthStencilAttachment.stencilLoadOp = wgpu::LoadOp::Clear;
+  depthStencilAttachment.stencilStoreOp = wgpu::StoreOp::Store;
+#else
+  depthStencilAttachment.stencilLoadOp = wgpu::LoadOp::Undefined;
+  depthStencilAttachment.stencilStoreOp = wgpu::StoreOp::Undefined;
+#endif
+  depthStencilAttachment.stencilReadOnly = true;
+
+  wgpu::RenderPassDescriptor renderPassDesc = wgpu::Default;
+  renderPassDesc.colorAttachmentCount = 1;
+  renderPassDesc.colorAttachments = &colorAttachment;
+  renderPassDesc.depthStencilAttachment = depthView ? &depthStencilAttachment : nullptr;
+  renderPassDesc.timestampWriteCount = 0;
+  renderPassDesc.timestampWrites = nullptr;
+  wgpu::RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+  drawList.encode(renderPass);
+  renderPass.end();
+  renderPass.release();
+
+  wgpu::ImageCopyTexture source = wgpu::Default;
+  source.texture = m_counterTexture;
+  wgpu::ImageCopyBuffer destination = wgpu::Default;
+  destination.buffer = m_readbackBuffer;
+  destination.layout.offset = 0;
+  destination.layout.bytesPerRow = m_bytesPerRow;
+  destination.layout.rowsPerImage = m_settings.height;
+  encoder.copyTextureToBuffer(source, destination, { m_settings.width, m_settings.height, 1 });
+
+  wgpu::CommandBufferDescriptor commandDesc = wgpu::Default;
+  commandDesc.label = "Overdraw commands";
+  wgpu::CommandBuffer command = encoder.finish(commandDesc);
+  encoder.release();
+  m_queue.submit(command);
+  command.release();
+
+  const uint64_t readbackSize = uint64_t(m_bytesPerRow) * m_settings.height;
+  m_mapCallback = m_readbackBuffer.mapAsync(wgpu::MapMode::Read, 0, readbackSize, [this, readbackSize](wgpu::BufferMapAsyncStatus status) {
+    m_counts.assign(size_t(m_settings.width) * m_settings.height, 0);
+    if (status == wgpu::BufferMapAsyncStatus::Success) {
+      const uint8_t* data = static_cast<const uint8_t*>(m_readbackBuffer.getConstMappedRange(0, readbackSize));
+      for (uint32_t y = 0; y < m_settings.height; ++y) {
+        const uint16_t* row = reinterpret_cast<const uint16_t*>(data + size_t(y) * m_bytesPerRow);
+        for (uint32_t x = 0; x < m_settings.width; ++x) {
+          m_counts[size_t(y) * m_settings.width + x] = static_cast<uint32_t>(halfToFloat(row[x]) + 0.5f);
+        }
+      }
+      m_readbackBuffer.unmap();
+    } else {
+      std::cerr << "Could not map the overdraw readback buffer" << std::endl;
+    }
+    m_ready = true;
+  });
+}
+
+OverdrawReport OverdrawAnalyzer::report() const {
+  OverdrawReport report;
+  report.histogram.assign(kHistogramBuckets, 0);
+  if (m_counts.empty()) {
+    return report;
+  }
+
+  const uint32_t width = m_settings.width;
+  const uint32_t height = m_settings.height;
+  const uint32_t tileSize = std::max(m_settings.tileSize, 1u);
+  const uint32_t tilesX = (width + tileSize - 1) / tileSize;
+  const uint32_t tilesY = (height + tileSize - 1) / tileSize;
+  std::vector<uint64_t> tileSums(size_t(tilesX) * tilesY, 0);
+
+  uint64_t total = 0;
+  uint64_t covered = 0;
+  for (uint32_t y = 0; y < height; ++y) {
+    for (uint32_t x = 0; x < width; ++x) {
+      uint32_t count = m_counts[size_t(y) * width + x];
+      total += count;
+      covered += count > 0 ? 1 : 0;
+      report.max = std::max(report.max, count);
+      ++report.histogram[std::min<size_t>(count, kHistogramBuckets - 1)];
+      tileSums[size_t(y / tileSize) * tilesX + x / tileSize] += count;
+    }
+  }
+  report.average = static_cast<double>(total) / (static_cast<double>(width) * height);
+  report.averageCovered = covered > 0 ? static_cast<double>(total) / static_cast<double>(covered) : 0.0;
+
+  std::vector<OverdrawTile> tiles;
+  for (uint32_t ty = 0; ty < tilesY; ++ty) {
+    for (uint32_t tx = 0; tx < tilesX; ++tx) {
+      uint32_t tileWidth = std::min(tileSize, width - tx * tileSize);
+      uint32_t tileHeight = std::min(tileSize, height - ty * tileSize);
+      OverdrawTile tile;
+      tile.x = tx;
+      tile.y = ty;
+      tile.average = static_cast<double>(tileSums[size_t(ty) * tilesX + tx]) / (static_cast<double>(tileWidth) * tileHeight);
+      tiles.push_back(tile);
+    }
+  }
+  size_t hottest = std::min(m_settings.hottestTileCount, tiles.size());
+  std::partial_sort(tiles.begin(), tiles.begin() + hottest, tiles.end(), [](const OverdrawTile& a, const OverdrawTile& b) {
+    return a.average > b.average;
+  });
+  report.hottestTiles.assign(tiles.begin(), tiles.begin() + hottest);
+  return report;
+}
+
+bool OverdrawAnalyzer::writeHeatmap(const std::string& path) {
+  if (m_counts.empty()) {
+    std::cerr << "No overdraw counts to write a heatmap of" << std::endl;
+    return false;
+  }
+  const uint32_t width = m_settings.width;
+  const uint32_t height = m_settings.height;
+  const uint32_t max = *std::max_element(m_counts.begin(), m_counts.end());
+  std::vector<uint8_t> pixels(size_t(width) * height * 3);
+  for (size_t i = 0; i < m_counts.size(); ++i) {
+    heatColor(max > 0 ? static_cast<float>(m_counts[i]) / static_cast<float>(max) : 0.0f, &pixels[i * 3]);
+  }
+  if (!stbi_write_png(path.c_str(), static_cast<int>(width), static_cast<int>(height), 3, pixels.data(), static_cast<int>(width * 3))) {
+    std::cerr << "Could not write overdraw heatmap to " << path << std::endl;
+    return false;
+  }
+  std::cout << "Overdraw heatmap written to " << path << std::endl;
+  return true;
+}
+
+void printOverdrawReport(const OverdrawReport& report) {
+  std::cout << std::fixed << std::setprecision(3)
+            << "Overdraw: average " << report.average << " per pixel, "
+            << report.averageCovered << " per covered pixel, max " << report.max << std::endl;
+  std::cout << "Overdraw histogram (fragments: pixels):";
+  for (size_t bucket = 0; bucket < report.histogram.size(); ++bucket) {
+    if (report.histogram[bucket] == 0) continue;
+    std::cout << " " << bucket << (bucket + 1 == report.histogram.size() ? "+" : "") << ": " << report.histogram[bucket];
+  }
+  std::cout << std::endl;
+  for (const OverdrawTile& tile : report.hottestTiles) {
+    std::cout << "Hot tile (" << tile.x << ", " << tile.y << "): average " << tile.average << std::endl;
+  }
+  std::cout << std::defaultfloat;
+}
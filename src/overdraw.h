@@ -0,0 +1,78 @@
+#ifndef WEBGPU_THINGY_SRC_OVERDRAW_H_
+#define WEBGPU_THINGY_SRC_OVERDRAW_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+#include "draw_list.h"
+
+class GpuResources;
+
+struct OverdrawSettings {
+  uint32_t width = 640;
+  uint32_t height = 480;
+  uint32_t tileSize = 32;
+  size_t hottestTileCount = 5;
+};
+
+struct OverdrawTile {
+  uint32_t x = 0;  // In tiles
+  uint32_t y = 0;
+  double average = 0.0;
+};
+
+struct OverdrawReport {
+  double average = 0.0;         // Shaded fragments per pixel over the whole target
+  double averageCovered = 0.0;  // Same, over pixels shaded at least once
+  uint32_t max = 0;
+  // histogram[n] pixels were shaded n times, the last bucket counts everything above
+  std::vector<uint64_t> histogram;
+  std::vector<OverdrawTile> hottestTiles;
+};
+
+// Counts how many fragments land on every pixel by replaying a frame's draw
+// list with pipelines that add 1 to a float render target. R32Float is not
+// blendable without an optional feature, so the counter is R16Float, which
+// is exact up to 2048 layers.
+class OverdrawAnalyzer {
+public:
+  static constexpr WGPUTextureFormat kCounterFormat = WGPUTextureFormat_R16Float;
+
+  // With `resources`, the counter and readback are created through it
+  OverdrawAnalyzer(wgpu::Device device, wgpu::Queue queue, const OverdrawSettings& settings, GpuResources* resources = nullptr);
+  ~OverdrawAnalyzer();
+
+  // Builds the counting variant of a pipeline: same vertex, primitive and
+  // depth state, with fs_overdraw writing to the counter target
+  wgpu::RenderPipeline createCountingPipeline(const wgpu::RenderPipelineDescriptor& pipelineDesc);
+
+  // Encodes the draw list into the counter target, which must match the
+  // draw list's depth attachment, and starts an asynchronous readback
+  void capture(const DrawList& drawList, wgpu::TextureView depthView);
+  // True once the readback of the last capture has completed
+  bool ready() const { return m_ready; }
+  // Valid once ready()
+  OverdrawReport report() const;
+  // Writes the counts as a PNG heatmap scaled to the maximum, once ready()
+  bool writeHeatmap(const std::string& path);
+
+private:
+  wgpu::Device m_device;
+  wgpu::Queue m_queue;
+  OverdrawSettings m_settings;
+  GpuResources* m_resources;
+  uint32_t m_bytesPerRow = 0;
+  wgpu::Texture m_counterTexture = nullptr;
+  wgpu::TextureView m_counterView = nullptr;
+  wgpu::Buffer m_readbackBuffer = nullptr;
+  std::unique_ptr<wgpu::BufferMapCallback> m_mapCallback;
+  bool m_ready = false;
+  std::vector<uint32_t> m_counts;
+  std::vector<wgpu::RenderPipeline> m_pipelines;
+};
+
+void printOverdrawReport(const OverdrawReport& report);
+
+#endif //WEBGPU_THINGY_SRC_OVERDRAW_H_
@@ -0,0 +1,275 @@
+#include "pipeline_cache.h"
+#include "gpu_capture.h"
+#include "metrics.h"
+#include "trace.h"
+#include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+ShaderConstants sortedConstants(const ShaderConstants& constants) {
+  ShaderConstants sorted = constants;
+  std::sort(sorted.begin(), sorted.end(), [](const ShaderConstant& a, const ShaderConstant& b) {
+    return a.name < b.name;
+  });
+  return sorted;
+}
+
+std::string constantsKey(const ShaderConstants& constants) {
+  std::string key;
+  char value[32];
+  for (const ShaderConstant& constant : sortedConstants(constants)) {
+    std::snprintf(value, sizeof(value), "%.17g", constant.value);
+    key += constant.name + "=" + value + ";";
+  }
+  return key;
+}
+
+std::string pipelineKey(uint32_t stateKey, const ShaderConstants& constants) {
+  return std::to_string(stateKey) + "|" + constantsKey(constants);
+}
+
+#ifdef WEBGPU_BACKEND_WGPU
+bool isIdentifierChar(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+std::string formatConstant(double value, const std::string& type) {
+  char text[32];
+  if (type == "bool") return value != 0.0 ? "true" : "false";
+  if (type == "i32") return std::to_string(static_cast<long long>(value));
+  if (type == "u32") return std::to_string(static_cast<unsigned long long>(value)) + "u";
+  std::snprintf(text, sizeof(text), "%.9g", value);
+  std::string literal = text;
+  if (type == "f32" && literal.find_first_of(".en") == std::string::npos) {
+    literal += ".0";
+  }
+  return literal;
+}
+
+// Rewrites every `override name: type = default;` into a `const` declaration
+// holding the requested value, or the default when none is requested.
+// `@id` attributes are not supported.
+bool specializeOverrides(const std::string& source, const ShaderConstants& constants, std::string& specialized) {
+  const std::string keyword = "override";
+  specialized.clear();
+  size_t pos = 0;
+  while (true) {
+    size_t found = source.find(keyword, pos);
+    if (found == std::string::npos) break;
+    size_t lineStart = source.rfind('\n', found);
+    lineStart = lineStart == std::string::npos ? 0 : lineStart + 1;
+    bool inComment = source.find("//", lineStart) < found;
+    bool isWord = (found == 0 || !isIdentifierChar(source[found - 1]))
+               && (found + keyword.size() >= source.size() || !isIdentifierChar(source[found + keyword.size()]));
+    if (inComment || !isWord) {
+      specialized.append(source, pos, found + keyword.size() - pos);
+      pos = found + keyword.size();
+      continue;
+    }
+    size_t end = source.find(';', found);
+    if (end == std::string::npos) {
+      std::cerr << "Unterminated override declaration in shader" << std::endl;
+      return false;
+    }
+    specialized.append(source, pos, found - pos);
+
+    std::string declaration = source.substr(found + keyword.size(), end - found - keyword.size());
+    size_t equal = declaration.find('=');
+    std::string head = declaration.substr(0, equal);
+    std::string defaultValue = equal == std::string::npos ? "" : declaration.substr(equal + 1);
+    size_t colon = head.find(':');
+    auto trim = [](std::string text) {
+      size_t first = text.find_first_not_of(" \t\r\n");
+      size_t last = text.find_last_not_of(" \t\r\n");
+      return first == std::string::npos ? std::string() : text.substr(first, last - first + 1);
+    };
+    std::string name = trim(head.substr(0, colon));
+    std::string type = colon == std::string::npos ? "" : trim(head.substr(colon + 1));
+
+    std::string value = trim(defaultValue);
+    for (const ShaderConstant& constant : constants) {
+      if (constant.name == name) value = formatConstant(constant.value, type);
+    }
+    if (value.empty()) {
+      std::cerr << "Shader override '" << name << "' has no default and no requested value" << std::endl;
+      return false;
+    }
+    specialized += "const " + name + (type.empty() ? "" : ": " + type) + " = " + value + ";";
+    pos = end + 1;
+  }
+  specialized.append(source, pos, std::string::npos);
+  return true;
+}
+#endif
+
+} // namespace
+
+PipelineCache::PipelineCache(wgpu::Device device, wgpu::Queue queue, std::string shaderSource)
+  : m_device(device)
+  , m_queue(queue)
+  , m_shaderSource(std::move(shaderSource))
+{}
+
+PipelineCache::~PipelineCache() {
+  for (auto& [key, pipeline] : m_pipelines) {
+    if (pipeline) pipeline.release();
+  }
+  for (auto& [key, variant] : m_shaderVariants) {
+#ifndef WEBGPU_BACKEND_WGPU
+    // Variants share the module of the unspecialized shader
+    if (!key.empty()) continue;
+#endif
+    if (variant->module) variant->module.release();
+  }
+}
+
+void PipelineCache::countHit() {
+  ++m_stats.hits;
+  if (m_hitCounter) {
+    m_hitCounter->add();
+  }
+}
+
+const ShaderVariant& PipelineCache::shaderVariant(const ShaderConstants& constants) {
+  std::string key = constantsKey(constants);
+  auto it = m_shaderVariants.find(key);
+  if (it != m_shaderVariants.end()) {
+    countHit();
+    return *it->second;
+  }
+
+  auto start = Clock::now();
+  auto variant = std::make_unique<ShaderVariant>();
+#ifdef WEBGPU_BACKEND_WGPU
+  std::string specialized;
+  if (specializeOverrides(m_shaderSource, constants, specialized)) {
+    variant->module = createShaderModule(m_device, specialized);
+    if (m_capture && variant->module) {
+      m_capture->createShaderModule(variant->module, specialized);
+    }
+  }
+#else
+  // One module shared by all variants, specialized when pipelines are created
+  if (key.empty()) {
+    variant->module = createShaderModule(m_device, m_shaderSource);
+    if (m_capture && variant->module) {
+      m_capture->createShaderModule(variant->module, m_shaderSource);
+    }
+  } else {
+    variant->module = shaderVariant({}).module;
+  }
+  for (const ShaderConstant& constant : constants) {
+    variant->keys.push_back(constant.name);
+  }
+  for (size_t i = 0; i < constants.size(); ++i) {
+    WGPUConstantEntry entry = {};
+    entry.key = variant->keys[i].c_str();
+    entry.value = constants[i].value;
+    variant->entries.push_back(entry);
+  }
+  variant->constants = variant->entries.data();
+  variant->constantCount = variant->entries.size();
+#endif
+  m_stats.shaderCompileMs += elapsedMs(start);
+  ++m_stats.shaderVariants;
+  return *m_shaderVariants.emplace(key, std::move(variant)).first->second;
+}
+
+void PipelineCache::prepare(const std::vector<PipelineRequest>& requests) {
+  std::vector<const PipelineRequest*> pending;
+  std::vector<std::string> pendingKeys;
+  for (const PipelineRequest& request : requests) {
+    std::string key = pipelineKey(request.stateKey, request.constants);
+    if (m_pipelines.count(key) > 0 || std::find(pendingKeys.begin(), pendingKeys.end(), key) != pendingKeys.end()) {
+      countHit();
+      continue;
+    }
+    pending.push_back(&request);
+    pendingKeys.push_back(key);
+  }
+  if (pending.empty()) {
+    return;
+  }
+
+  auto start = Clock::now();
+  std::vector<WGPURenderPipeline> pipelines(pending.size(), nullptr);
+  std::vector<double> compileMs(pending.size(), 0.0);
+#ifdef WEBGPU_BACKEND_WGPU
+  // wgpu-native devices can be used from any thread
+  std::atomic<size_t> next{ 0 };
+  auto worker = [&]() {
+    for (size_t i = next++; i < pending.size(); i = next++) {
+      TRACE_ZONE("Compile pipeline");
+      auto compileStart = Clock::now();
+      pipelines[i] = m_device.createRenderPipeline(pending[i]->descriptor);
+      compileMs[i] = elapsedMs(compileStart);
+    }
+  };
+  size_t workerCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), pending.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < workerCount; ++i) {
+    workers.emplace_back([&]() {
+      setTraceThreadName("Pipeline compiler");
+      worker();
+    });
+  }
+  worker();
+  for (std::thread& thread : workers) {
+    thread.join();
+  }
+#else
+  size_t done = 0;
+  std::vector<std::unique_ptr<wgpu::CreateRenderPipelineAsyncCallback>> callbacks;
+  for (size_t i = 0; i < pending.size(); ++i) {
+    auto compileStart = Clock::now();
+    callbacks.push_back(m_device.createRenderPipelineAsync(pending[i]->descriptor, [&, i, compileStart](wgpu::CreatePipelineAsyncStatus status, wgpu::RenderPipeline pipeline, char const* message) {
+      if (status == wgpu::CreatePipelineAsyncStatus::Success) {
+        pipelines[i] = pipeline;
+      } else {
+        std::cerr << "Could not create pipeline variant " << pendingKeys[i] << (message ? ": " : "") << (message ? message : "") << std::endl;
+      }
+      compileMs[i] = elapsedMs(compileStart);
+      ++done;
+    }));
+  }
+  while (done < pending.size()) {
+    pollDevice(m_device, m_queue);
+  }
+#endif
+  m_stats.pipelineWallMs += elapsedMs(start);
+  for (size_t i = 0; i < pending.size(); ++i) {
+    m_pipelines.emplace(pendingKeys[i], wgpu::RenderPipeline(pipelines[i]));
+    if (m_capture && pipelines[i]) {
+      m_capture->createRenderPipeline(pipelines[i], pending[i]->descriptor);
+    }
+    m_stats.pipelineCompileMs += compileMs[i];
+    ++m_stats.pipelineVariants;
+  }
+}
+
+wgpu::RenderPipeline PipelineCache::find(uint32_t stateKey, const ShaderConstants& constants) const {
+  auto it = m_pipelines.find(pipelineKey(stateKey, constants));
+  return it != m_pipelines.end() ? it->second : nullptr;
+}
+
+void printPipelineCacheStats(const PipelineCacheStats& stats) {
+  std::cout << std::fixed << std::setprecision(2)
+            << "Pipeline cache: " << stats.shaderVariants << " shader variants in " << stats.shaderCompileMs << " ms, "
+            << stats.pipelineVariants << " pipeline variants in " << stats.pipelineWallMs << " ms ("
+            << stats.pipelineCompileMs << " ms of compilation), " << stats.hits << " cache hits" << std::endl;
+  std::cout << std::defaultfloat;
+}
@@ -0,0 +1,95 @@
+#ifndef WEBGPU_THINGY_SRC_PIPELINE_CACHE_H_
+#define WEBGPU_THINGY_SRC_PIPELINE_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+
+class GpuCapture;
+class MetricCounter;
+
+// Value of a WGSL `override` declaration. Booleans are 0 or 1.
+struct ShaderConstant {
+  std::string name;
+  double value = 0.0;
+};
+using ShaderConstants = std::vector<ShaderConstant>;
+
+// One specialization of the shader, to plug into the stages of a pipeline descriptor
+struct ShaderVariant {
+  wgpu::ShaderModule module = nullptr;
+  const WGPUConstantEntry* constants = nullptr;
+  size_t constantCount = 0;
+
+  // Storage behind `constants`
+  std::vector<std::string> keys;
+  std::vector<WGPUConstantEntry> entries;
+};
+
+// A pipeline to compile: `stateKey` tells apart descriptors that differ in
+// anything but their constants, and the stages of `descriptor` must already
+// use the ShaderVariant of `constants`
+struct PipelineRequest {
+  uint32_t stateKey = 0;
+  ShaderConstants constants;
+  wgpu::RenderPipelineDescriptor descriptor;
+};
+
+struct PipelineCacheStats {
+  size_t shaderVariants = 0;
+  size_t pipelineVariants = 0;
+  double shaderCompileMs = 0.0;
+  double pipelineCompileMs = 0.0;  // Summed over workers
+  double pipelineWallMs = 0.0;     // Time spent waiting in prepare()
+  size_t hits = 0;                 // Variants requested again, found cached
+};
+
+// Specializes one WGSL source by its override constants and caches the
+// resulting pipelines by state key and constant values.
+//
+// wgpu-native does not parse `override` declarations yet, so there the cache
+// rewrites them to `const` declarations with the requested values and
+// compiles one module per set of constants. Dawn gets a single module and
+// the values as pipeline constants.
+class PipelineCache {
+public:
+  PipelineCache(wgpu::Device device, wgpu::Queue queue, std::string shaderSource);
+  ~PipelineCache();
+
+  // Shader specialized for `constants`; overrides that are not listed keep their default
+  const ShaderVariant& shaderVariant(const ShaderConstants& constants);
+
+  // Compiles the requests that are not cached yet in parallel and waits for
+  // them: asynchronous pipeline creation with Dawn, worker threads with
+  // wgpu-native, which does not implement createRenderPipelineAsync.
+  void prepare(const std::vector<PipelineRequest>& requests);
+  // Cached pipeline, or nullptr if the request was never prepared or failed
+  wgpu::RenderPipeline find(uint32_t stateKey, const ShaderConstants& constants) const;
+
+  // Records the modules and pipelines created from now on
+  void setCapture(GpuCapture* capture) { m_capture = capture; }
+  // Also counts every hit from now on into `counter`, as it happens
+  void setHitCounter(MetricCounter* counter) { m_hitCounter = counter; }
+
+  const PipelineCacheStats& stats() const { return m_stats; }
+
+private:
+  // A lookup answered from the cache, in the stats and the hit counter
+  void countHit();
+
+  wgpu::Device m_device;
+  wgpu::Queue m_queue;
+  std::string m_shaderSource;
+  GpuCapture* m_capture = nullptr;
+  MetricCounter* m_hitCounter = nullptr;
+  std::unordered_map<std::string, std::unique_ptr<ShaderVariant>> m_shaderVariants;
+  std::unordered_map<std::string, wgpu::RenderPipeline> m_pipelines;
+  PipelineCacheStats m_stats;
+};
+
+void printPipelineCacheStats(const PipelineCacheStats& stats);
+
+#endif //WEBGPU_THINGY_SRC_PIPELINE_CACHE_H_
@@ -0,0 +1,67 @@
+#include "resources.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+const EmbeddedResource* findEmbeddedResource(const std::string& name) {
+  size_t count = 0;
+  const EmbeddedResource* resources = embeddedResources(count);
+  for (size_t i = 0; i < count; ++i) {
+    if (name == resources[i].name) return &resources[i];
+  }
+  return nullptr;
+}
+
+ResourceLoader::ResourceLoader(std::filesystem::path diskDirectory, AssetPack* pack)
+  : m_diskDirectory(std::move(diskDirectory))
+  , m_pack(pack)
+{}
+
+bool ResourceLoader::load(const std::string& name, std::string& contents) {
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  const EmbeddedResource* embedded = findEmbeddedResource(name);
+  bool loaded = false;
+
+  if (!m_diskDirectory.empty()) {
+    std::ifstream file(m_diskDirectory / name, std::ios::binary);
+    if (file.is_open()) {
+      std::ostringstream buffer;
+      buffer << file.rdbuf();
+      contents = buffer.str();
+      loaded = true;
+      ++m_diskLoads;
+      const unsigned char* bytes = reinterpret_cast<const unsigned char*>(contents.data());
+      if (embedded && fnv1a64(bytes, contents.size()) != embedded->hash) {
+        std::cout << "Resource " << name << " differs from the embedded copy, using " << (m_diskDirectory / name).string() << std::endl;
+      }
+    } else {
+      std::cerr << "Could not open " << (m_diskDirectory / name).string() << std::endl;
+    }
+  }
+  std::string_view packed;
+  if (!loaded && m_pack && m_pack->read(name, packed)) {
+    contents.assign(packed);
+    loaded = true;
+    ++m_packLoads;
+  }
+  if (!loaded && embedded) {
+    contents.assign(reinterpret_cast<const char*>(embedded->data), embedded->size);
+    loaded = true;
+    ++m_embeddedLoads;
+  }
+  if (!loaded) {
+    std::cerr << "Unknown resource: " << name << std::endl;
+  }
+  m_loadMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  return loaded;
+}
+
+void printResourceLoaderStats(const ResourceLoader& loader) {
+  std::cout << std::fixed << std::setprecision(3)
+            << "Resources: " << loader.embeddedLoads() << " embedded, " << loader.packLoads() << " from the pack, "
+            << loader.diskLoads() << " from disk, loaded in " << loader.loadMs() << " ms" << std::endl;
+  std::cout << std::defaultfloat;
+}
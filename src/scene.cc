@@ -0,0 +1,84 @@
+#include "scene.h"
+#include "draw_list.h"
+#include <cstring>
+
+std::vector<InstanceData> makeScene(const SceneSettings& settings) {
+  const int gridSize = settings.gridSize;
+  const float ratio = settings.aspectRatio;
+  const float cell = 2.0f / static_cast<float>(gridSize);
+  std::vector<InstanceData> instances;
+  for (int layer = 0; layer < settings.layers; ++layer) {
+    // Later layers are closer and slightly shifted so that they overlap the ones below
+    float depth = 1.0f - static_cast<float>(layer + 1) / static_cast<float>(settings.layers + 1);
+    float shift = 0.05f * static_cast<float>(layer);
+    bool transparent = layer >= settings.layers - settings.transparentLayers;
+    for (int j = 0; j < gridSize; ++j) {
+      for (int i = 0; i < gridSize; ++i) {
+        InstanceData instance;
+        if (gridSize == 1) {
+          instance.offset[0] = 0.0f;
+          instance.offset[1] = 0.0f;
+          instance.scale = 1.0f;
+        } else {
+          float variation = 0.25f + 0.75f * static_cast<float>((i * 7 + j * 13) % 10) / 9.0f;
+          instance.offset[0] = -1.0f + cell * (static_cast<float>(i) + 0.5f);
+          instance.offset[1] = (-1.0f + cell * (static_cast<float>(j) + 0.5f)) / ratio;
+          instance.scale = cell / 1.5f * variation;
+        }
+        instance.offset[0] += shift * instance.scale;
+        instance.offset[1] += shift * instance.scale;
+        instance.depth = depth;
+        instance.alpha = transparent ? 0.5f : 1.0f;
+        instances.push_back(instance);
+      }
+    }
+  }
+  return instances;
+}
+
+void batchInstances(const std::vector<InstanceData>& instances, const std::vector<uint32_t>& lods, bool depthOrdered, std::vector<InstanceData>& ordered, std::vector<InstanceBatch>& batches) {
+  // Non-negative floats order like their bit patterns
+  auto depthBits = [](float depth) {
+    uint32_t bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    return bits;
+  };
+
+  std::vector<uint64_t> keys(instances.size());
+  std::vector<uint32_t> order(instances.size());
+  for (uint32_t i = 0; i < instances.size(); ++i) {
+    const InstanceData& instance = instances[i];
+    bool transparent = depthOrdered && instance.alpha < 1.0f;
+    if (transparent) {
+      keys[i] = (uint64_t(1) << 63) | ~depthBits(instance.depth);
+    } else if (depthOrdered) {
+      keys[i] = (uint64_t(lods[i]) << 32) | depthBits(instance.depth);
+    } else {
+      // Blended without a depth buffer, LOD batches must not reorder overlaps
+      keys[i] = (uint64_t(~depthBits(instance.depth)) << 32) | lods[i];
+    }
+    order[i] = i;
+  }
+  // The sort is stable, so equal keys keep list order
+  radixSortKeys(keys, order);
+
+  ordered.resize(instances.size());
+  batches.clear();
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    const InstanceData& instance = instances[order[i]];
+    ordered[i] = instance;
+    uint32_t lod = lods[order[i]];
+    bool transparent = depthOrdered && instance.alpha < 1.0f;
+    if (!transparent && !batches.empty() && !batches.back().transparent && batches.back().lod == lod) {
+      ++batches.back().instanceCount;
+      continue;
+    }
+    InstanceBatch batch;
+    batch.lod = lod;
+    batch.transparent = transparent;
+    batch.depth = instance.depth;
+    batch.firstInstance = i;
+    batch.instanceCount = 1;
+    batches.push_back(batch);
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef WEBGPU_THINGY_SRC_SCENE_H_
+#define WEBGPU_THINGY_SRC_SCENE_H_
+
+#include <cstdint>
+#include <vector>
+#include "vertex_layout.h"
+
+// Per-instance vertex data, declared to the shader as `InstanceInput`
+struct InstanceData {
+  float offset[2];
+  float scale;
+  float depth;  // In [0, 1), smaller is closer to the viewer
+  float alpha;  // 1 for opaque instances
+};
+
+template <> struct VertexLayoutTraits<InstanceData> {
+  static constexpr const char* wgslName = "InstanceInput";
+  static constexpr WGPUVertexStepMode stepMode = WGPUVertexStepMode_Instance;
+  static constexpr std::array<VertexAttributeInfo, 4> attributes = {{
+    VERTEX_ATTRIBUTE(InstanceData, offset, 2),
+    VERTEX_ATTRIBUTE(InstanceData, scale, 3),
+    VERTEX_ATTRIBUTE(InstanceData, depth, 4),
+    VERTEX_ATTRIBUTE(InstanceData, alpha, 5),
+  }};
+};
+
+struct SceneSettings {
+  int gridSize = 1;           // Instances on a gridSize x gridSize grid, with varying sizes
+  int layers = 1;             // Overlapping copies stacked on each grid cell
+  int transparentLayers = 0;  // How many of the top layers are drawn semi-transparent
+  float aspectRatio = 640.0f / 480.0f;  // Of the viewport, as the shader's aspect_ratio override
+};
+
+// A 1x1 grid with one layer is the plain mesh. Layers are listed back to
+// front, so drawing in list order matches what depth testing produces.
+std::vector<InstanceData> makeScene(const SceneSettings& settings);
+
+// A range of the ordered instance buffer drawn with one instanced draw
+struct InstanceBatch {
+  uint32_t lod = 0;
+  bool transparent = false;
+  float depth = 0.0f;  // Nearest instance for opaque batches
+  uint32_t firstInstance = 0;
+  uint32_t instanceCount = 0;
+};
+
+// Orders instances for upload and splits them into draws. Without depth
+// ordering, every instance is blended: all of them are sorted back to front,
+// across LODs, and instances at the same depth are grouped per LOD in list
+// order. With it, opaque instances are grouped per LOD and sorted front to
+// back for early depth rejection, and each transparent instance gets its own
+// draw, back to front.
+void batchInstances(const std::vector<InstanceData>& instances, const std::vector<uint32_t>& lods, bool depthOrdered, std::vector<InstanceData>& ordered, std::vector<InstanceBatch>& batches);
+
+#endif //WEBGPU_THINGY_SRC_SCENE_H_
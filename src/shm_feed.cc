@@ -0,0 +1,316 @@
+#include "shm_feed.h"
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <thread>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+uint32_t paddedIndexCount(uint32_t indexCount) {
+  return indexCount + (indexCount & 1);
+}
+
+} // namespace
+
+size_t shmBatchSize(uint32_t vertexCount, uint32_t indexCount) {
+  return sizeof(ShmBatchHeader) + size_t(vertexCount) * sizeof(ShmVertex) + size_t(paddedIndexCount(indexCount)) * sizeof(uint16_t);
+}
+
+ShmFeedRegion::~ShmFeedRegion() {
+  close();
+}
+
+void ShmFeedRegion::close() {
+#ifndef _WIN32
+  if (m_header && m_owner) {
+    m_header->producerAttached.store(0, std::memory_order_release);
+    wake(m_header->writeIndex);
+    shm_unlink(m_name.c_str());
+  }
+  if (m_header) {
+    munmap(m_header, m_size);
+  }
+#endif
+  m_header = nullptr;
+  m_size = 0;
+  m_slotCount = 0;
+  m_slotSize = 0;
+  m_owner = false;
+}
+
+uint8_t* ShmFeedRegion::slot(uint32_t index) const {
+  return reinterpret_cast<uint8_t*>(m_header) + kShmFeedAlignment + size_t(index % m_slotCount) * m_slotSize;
+}
+
+bool ShmFeedRegion::map(const std::string& name, bool create, uint32_t slotCount, uint32_t slotSize) {
+  close();
+#ifndef _WIN32
+  int fd = -1;
+  size_t size = 0;
+  if (create) {
+    slotSize = static_cast<uint32_t>((slotSize + kShmFeedAlignment - 1) / kShmFeedAlignment * kShmFeedAlignment);
+    size = kShmFeedAlignment + size_t(slotCount) * slotSize;
+    shm_unlink(name.c_str());
+    fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      ::close(fd);
+      shm_unlink(name.c_str());
+      fd = -1;
+    }
+  } else {
+    fd = shm_open(name.c_str(), O_RDWR, 0);
+    struct stat info;
+    if (fd >= 0 && fstat(fd, &info) == 0) {
+      size = static_cast<size_t>(info.st_size);
+    }
+  }
+  if (fd < 0 && !create && errno == ENOENT) {
+    return false;  // No producer yet, left to the caller to report
+  }
+  if (fd < 0 || size < kShmFeedAlignment) {
+    if (fd >= 0) ::close(fd);
+    std::cerr << "Could not " << (create ? "create" : "open") << " shared memory feed " << name << std::endl;
+    return false;
+  }
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cerr << "Could not map shared memory feed " << name << std::endl;
+    if (create) shm_unlink(name.c_str());
+    return false;
+  }
+
+  ShmFeedHeader* header = static_cast<ShmFeedHeader*>(mapping);
+  if (create) {
+    header = new (mapping) ShmFeedHeader();
+    header->version = kShmFeedVersion;
+    header->slotCount = slotCount;
+    header->slotSize = slotSize;
+    header->producerAttached.store(1, std::memory_order_relaxed);
+    // The magic goes last, a consumer opening early rejects the feed
+    header->magic.store(kShmFeedMagic, std::memory_order_release);
+  } else {
+    bool valid = header->magic.load(std::memory_order_acquire) == kShmFeedMagic;
+    slotCount = valid ? header->slotCount : 0;
+    slotSize = valid ? header->slotSize : 0;
+    valid = valid && header->version == kShmFeedVersion && slotCount > 0 && slotSize % kShmFeedAlignment == 0
+         && slotSize >= sizeof(ShmBatchHeader) && kShmFeedAlignment + size_t(slotCount) * slotSize <= size;
+    if (!valid) {
+      std::cerr << "Invalid shared memory feed " << name << std::endl;
+      munmap(mapping, size);
+      return false;
+    }
+  }
+  m_header = header;
+  m_size = size;
+  m_slotCount = slotCount;
+  m_slotSize = slotSize;
+  m_name = name;
+  m_owner = create;
+  return true;
+#else
+  (void)name;
+  (void)create;
+  (void)slotCount;
+  (void)slotSize;
+  std::cerr << "Shared memory feeds are not supported on this platform" << std::endl;
+  return false;
+#endif
+}
+
+void ShmFeedRegion::wait(std::atomic<uint32_t>& word, uint32_t expected, int timeoutMs) {
+#ifdef __linux__
+  // Not FUTEX_PRIVATE_FLAG, the other side is another process
+  timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+#else
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  while (word.load(std::memory_order_acquire) == expected && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+#endif
+}
+
+void ShmFeedRegion::wake(std::atomic<uint32_t>& word) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+bool ShmFeedProducer::create(const std::string& name, uint32_t slotCount, uint32_t slotSize) {
+  m_reserved = false;
+  return map(name, true, slotCount, slotSize);
+}
+
+bool ShmFeedProducer::reserve(uint32_t vertexCount, uint32_t indexCount, int timeoutMs, ShmBatch& batch) {
+  if (!isOpen() || m_reserved) {
+    return false;
+  }
+  ShmFeedHeader& feed = header();
+  size_t size = shmBatchSize(vertexCount, indexCount);
+  if (size > m_slotSize) {
+    std::cerr << "Batch of " << size << " bytes does not fit a " << m_slotSize << " byte slot" << std::endl;
+    return false;
+  }
+
+  // Backpressure: wait for the consumer to free a slot
+  uint32_t write = feed.writeIndex.load(std::memory_order_relaxed);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  while (true) {
+    uint32_t read = feed.readIndex.load(std::memory_order_acquire);
+    if (write - read < m_slotCount) {
+      break;
+    }
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+      feed.producerDropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    wait(feed.readIndex, read, static_cast<int>(remaining));
+  }
+
+  uint8_t* data = slot(write);
+  ShmBatchHeader batchHeader = { write, vertexCount, indexCount, 0 };
+  std::memcpy(data, &batchHeader, sizeof(batchHeader));
+  batch.sequence = write;
+  batch.vertices = reinterpret_cast<ShmVertex*>(data + sizeof(ShmBatchHeader));
+  batch.vertexCount = vertexCount;
+  batch.indices = reinterpret_cast<uint16_t*>(batch.vertices + vertexCount);
+  batch.indexCount = indexCount;
+  if (indexCount & 1) {
+    batch.indices[indexCount] = 0;  // Padding
+  }
+  m_reserved = true;
+  return true;
+}
+
+void ShmFeedProducer::commit() {
+  if (!m_reserved) {
+    return;
+  }
+  m_reserved = false;
+  header().writeIndex.fetch_add(1, std::memory_order_release);
+  wake(header().writeIndex);
+}
+
+bool ShmFeedConsumer::open(const std::string& name) {
+  m_acquired = false;
+  return map(name, false, 0, 0);
+}
+
+bool ShmFeedConsumer::acquire(uint32_t index, ShmBatch& batch) {
+  ShmFeedHeader& feed = header();
+  uint8_t* data = slot(index);
+  ShmBatchHeader batchHeader;
+  std::memcpy(&batchHeader, data, sizeof(batchHeader));
+  // The producer is not trusted with the sizes
+  size_t size = shmBatchSize(batchHeader.vertexCount, batchHeader.indexCount);
+  if (batchHeader.vertexCount > m_slotSize || batchHeader.indexCount > m_slotSize || size > m_slotSize) {
+    std::cerr << "Ignoring invalid shared memory batch " << batchHeader.sequence << std::endl;
+    feed.readIndex.store(index + 1, std::memory_order_release);
+    wake(feed.readIndex);
+    return false;
+  }
+  batch.sequence = batchHeader.sequence;
+  batch.vertices = reinterpret_cast<ShmVertex*>(data + sizeof(ShmBatchHeader));
+  batch.vertexCount = batchHeader.vertexCount;
+  batch.indices = reinterpret_cast<uint16_t*>(batch.vertices + batchHeader.vertexCount);
+  batch.indexCount = batchHeader.indexCount;
+  m_acquired = true;
+  ++m_batches;
+  m_bytes += size;
+  return true;
+}
+
+bool ShmFeedConsumer::acquireLatest(ShmBatch& batch) {
+  if (!isOpen() || m_acquired) {
+    return false;
+  }
+  ShmFeedHeader& feed = header();
+  uint32_t write = feed.writeIndex.load(std::memory_order_acquire);
+  uint32_t read = feed.readIndex.load(std::memory_order_relaxed);
+  if (write == read) {
+    return false;
+  }
+  if (write - read > 1) {
+    // Only the newest batch is drawn, the older ones are freed right away
+    feed.consumerSkipped.fetch_add(write - read - 1, std::memory_order_relaxed);
+    read = write - 1;
+    feed.readIndex.store(read, std::memory_order_release);
+    wake(feed.readIndex);
+  }
+  return acquire(read, batch);
+}
+
+bool ShmFeedConsumer::acquireNext(ShmBatch& batch) {
+  if (!isOpen() || m_acquired) {
+    return false;
+  }
+  ShmFeedHeader& feed = header();
+  uint32_t read = feed.readIndex.load(std::memory_order_relaxed);
+  if (feed.writeIndex.load(std::memory_order_acquire) == read) {
+    return false;
+  }
+  return acquire(read, batch);
+}
+
+void ShmFeedConsumer::release() {
+  if (!m_acquired) {
+    return;
+  }
+  m_acquired = false;
+  ShmFeedHeader& feed = header();
+  feed.readIndex.store(feed.readIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  wake(feed.readIndex);
+}
+
+void ShmFeedConsumer::waitForBatch(int timeoutMs) {
+  if (!isOpen()) {
+    return;
+  }
+  ShmFeedHeader& feed = header();
+  uint32_t write = feed.writeIndex.load(std::memory_order_acquire);
+  if (write == feed.readIndex.load(std::memory_order_relaxed) && producerAttached()) {
+    wait(feed.writeIndex, write, timeoutMs);
+  }
+}
+
+bool ShmFeedConsumer::producerAttached() const {
+  return isOpen() && header().producerAttached.load(std::memory_order_acquire) != 0;
+}
+
+ShmFeedStats ShmFeedConsumer::stats() const {
+  ShmFeedStats stats;
+  stats.batches = m_batches;
+  stats.bytes = m_bytes;
+  if (isOpen()) {
+    stats.skipped = header().consumerSkipped.load(std::memory_order_relaxed);
+    stats.dropped = header().producerDropped.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+void printShmFeedStats(const ShmFeedStats& stats, double seconds) {
+  seconds = seconds > 0.0 ? seconds : 1.0;
+  std::cout << std::fixed << std::setprecision(1)
+            << "Shared memory feed: " << stats.batches << " batches (" << static_cast<double>(stats.batches) / seconds << " per second), "
+            << static_cast<double>(stats.bytes) / (1024.0 * 1024.0) / seconds << " MB/s, "
+            << stats.skipped << " skipped, " << stats.dropped << " dropped by the producer" << std::endl;
+  std::cout << std::defaultfloat;
+}
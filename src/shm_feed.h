@@ -0,0 +1,154 @@
+#ifndef WEBGPU_THINGY_SRC_SHM_FEED_H_
+#define WEBGPU_THINGY_SRC_SHM_FEED_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Geometry fed by another process through a POSIX shared memory ring:
+//
+//   ShmFeedHeader, padded to kShmFeedAlignment
+//   slotCount slots of slotSize bytes, each one batch:
+//     ShmBatchHeader
+//     ShmVertex[vertexCount]
+//     uint16_t[indexCount], plus one 0 when indexCount is odd so that the
+//       indices can be uploaded as they are (writeBuffer sizes are multiples of 4)
+//
+// The producer fills the slot at writeIndex in place and publishes it by
+// incrementing writeIndex; the consumer reads the slot at readIndex in place
+// and frees it by incrementing readIndex. Both counters run freely and wrap,
+// the ring is full when they are slotCount apart. On Linux they double as
+// futex words, so either side can sleep until the other one moves.
+//
+// Colors are linear; the renderer does not convert fed batches.
+
+constexpr uint32_t kShmFeedMagic = 0x46535457;  // "WTSF" in little-endian memory
+constexpr uint32_t kShmFeedVersion = 1;
+constexpr size_t kShmFeedAlignment = 64;
+
+struct ShmVertex {
+  float position[2];
+  float color[3];
+};
+
+struct ShmFeedHeader {
+  // Stored last by the producer, with release; the fields below are only
+  // read after it was loaded with acquire
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint32_t slotCount;
+  uint32_t slotSize;
+  std::atomic<uint32_t> writeIndex;
+  std::atomic<uint32_t> readIndex;
+  std::atomic<uint32_t> producerAttached;  // Cleared when the producer exits
+  uint32_t reserved;
+  std::atomic<uint64_t> producerDropped;  // Batches not written because the ring stayed full
+  std::atomic<uint64_t> consumerSkipped;  // Batches replaced by a newer one before being read
+};
+
+struct ShmBatchHeader {
+  uint32_t sequence;  // writeIndex when it was published
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t reserved;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "Atomics shared between processes must be lock free");
+static_assert(sizeof(ShmFeedHeader) <= kShmFeedAlignment, "ShmFeedHeader fits before the first slot");
+static_assert(sizeof(ShmBatchHeader) % alignof(ShmVertex) == 0, "Vertices follow the batch header");
+
+// Bytes a slot needs for a batch
+size_t shmBatchSize(uint32_t vertexCount, uint32_t indexCount);
+
+struct ShmBatch {
+  uint32_t sequence = 0;
+  ShmVertex* vertices = nullptr;
+  uint32_t vertexCount = 0;
+  uint16_t* indices = nullptr;
+  uint32_t indexCount = 0;
+};
+
+// Mapping of a feed, shared by both ends
+class ShmFeedRegion {
+public:
+  ShmFeedRegion() = default;
+  ~ShmFeedRegion();
+  ShmFeedRegion(const ShmFeedRegion&) = delete;
+  ShmFeedRegion& operator=(const ShmFeedRegion&) = delete;
+
+  bool isOpen() const { return m_header != nullptr; }
+  // The producer also detaches and removes the name
+  void close();
+  ShmFeedHeader& header() const { return *m_header; }
+  uint8_t* slot(uint32_t index) const;
+
+protected:
+  bool map(const std::string& name, bool create, uint32_t slotCount, uint32_t slotSize);
+  // Sleeps while `word` holds `expected`, at most `timeoutMs`
+  static void wait(std::atomic<uint32_t>& word, uint32_t expected, int timeoutMs);
+  static void wake(std::atomic<uint32_t>& word);
+
+  ShmFeedHeader* m_header = nullptr;
+  size_t m_size = 0;
+  uint32_t m_slotCount = 0;  // Copied at mapping time, the other process could change the header
+  uint32_t m_slotSize = 0;
+  std::string m_name;
+  bool m_owner = false;  // The producer unlinks the name when done
+};
+
+class ShmFeedProducer : public ShmFeedRegion {
+public:
+  // Creates the feed, replacing one left behind by a previous producer.
+  // `name` is a shm_open name such as "/webgpu-thingy-feed".
+  bool create(const std::string& name, uint32_t slotCount, uint32_t slotSize);
+
+  // Space for a batch in the next free slot, written in place. Waits up to
+  // `timeoutMs` for the consumer to free a slot (0 never waits) and counts
+  // the batch as dropped if none is. Returns false as well if the batch is
+  // larger than a slot.
+  bool reserve(uint32_t vertexCount, uint32_t indexCount, int timeoutMs, ShmBatch& batch);
+  // Publishes the reserved batch
+  void commit();
+
+private:
+  bool m_reserved = false;
+};
+
+struct ShmFeedStats {
+  uint64_t batches = 0;  // Read by this consumer
+  uint64_t bytes = 0;
+  uint64_t skipped = 0;  // Replaced by a newer batch first
+  uint64_t dropped = 0;  // Never written, the ring was full
+};
+
+class ShmFeedConsumer : public ShmFeedRegion {
+public:
+  // Maps an existing feed. Only reports errors other than a missing feed.
+  bool open(const std::string& name);
+
+  // Most recent published batch, skipping older unread ones, or false if
+  // none was published since the last one. The batch is read in place and
+  // stays valid until release().
+  bool acquireLatest(ShmBatch& batch);
+  // Oldest unread batch, for consumers that must not skip any
+  bool acquireNext(ShmBatch& batch);
+  void release();
+  // Sleeps until a batch is published, at most `timeoutMs`
+  void waitForBatch(int timeoutMs);
+  bool producerAttached() const;
+
+  ShmFeedStats stats() const;
+
+private:
+  bool acquire(uint32_t index, ShmBatch& batch);
+
+  bool m_acquired = false;
+  uint64_t m_batches = 0;
+  uint64_t m_bytes = 0;
+};
+
+void printShmFeedStats(const ShmFeedStats& stats, double seconds);
+
+#endif //WEBGPU_THINGY_SRC_SHM_FEED_H_
@@ -0,0 +1,45 @@
+#ifndef WEBGPU_THINGY_SRC_SPSC_QUEUE_H_
+#define WEBGPU_THINGY_SRC_SPSC_QUEUE_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue between exactly one producer thread and one
+// consumer thread. Neither side ever blocks: push() fails when the queue is
+// full and pop() when it is empty.
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  // Producer side
+  bool push(const T& value) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    m_items[tail & (Capacity - 1)] = value;
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T& value) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = m_items[head & (Capacity - 1)];
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  // On separate cache lines, each is written by one side only
+  alignas(64) std::atomic<size_t> m_head{ 0 };
+  alignas(64) std::atomic<size_t> m_tail{ 0 };
+  std::array<T, Capacity> m_items{};
+};
+
+#endif //WEBGPU_THINGY_SRC_SPSC_QUEUE_H_
@@ -0,0 +1,408 @@
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const Clock::time_point processStart = Clock::now();
+
+std::atomic<bool> g_keepLatest{ false };
+
+// A zone behind a sequence stamp, 2 * i + 1 while zone i is written into the
+// slot and 2 * i + 2 once it is complete. Readers keep a copy only if the
+// stamp was the complete one before and after, so that a zone the owner
+// overwrites meanwhile is dropped rather than torn.
+struct TraceSlot {
+  std::atomic<uint64_t> sequence{ 0 };
+  std::atomic<const char*> name{ nullptr };
+  std::atomic<int64_t> beginNs{ 0 };
+  std::atomic<int64_t> endNs{ 0 };
+};
+
+// Zones of one thread, or of the GPU. Only the owner appends; readers see
+// the events below the count they load. Zone i is at i % kTraceEventsPerThread.
+struct TraceBuffer {
+  TraceBuffer() : slots(new TraceSlot[kTraceEventsPerThread]) {}
+
+  void record(const char* name, int64_t beginNs, int64_t endNs) {
+    const uint64_t index = count.load(std::memory_order_relaxed);
+    if (index >= kTraceEventsPerThread && !g_keepLatest.load(std::memory_order_relaxed)) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    TraceSlot& slot = slots[index % kTraceEventsPerThread];
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.beginNs.store(beginNs, std::memory_order_relaxed);
+    slot.endNs.store(endNs, std::memory_order_relaxed);
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+    count.store(index + 1, std::memory_order_release);
+  }
+
+  // Copies zone `index`, false if it was being overwritten
+  bool read(uint64_t index, TraceEvent& event) const {
+    const TraceSlot& slot = slots[index % kTraceEventsPerThread];
+    const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+    event.name = slot.name.load(std::memory_order_relaxed);
+    event.beginNs = slot.beginNs.load(std::memory_order_relaxed);
+    event.endNs = slot.endNs.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return sequence == 2 * index + 2 && slot.sequence.load(std::memory_order_relaxed) == sequence;
+  }
+
+  // The first zone still in the buffer, of those below `end`
+  static uint64_t first(uint64_t end, uint64_t margin) {
+    return end > kTraceEventsPerThread ? end - kTraceEventsPerThread + margin : 0;
+  }
+
+  std::unique_ptr<TraceSlot[]> slots;
+  std::atomic<uint64_t> count{ 0 };  // Recorded, overwritten ones included
+  std::atomic<uint64_t> dropped{ 0 };
+  uint32_t threadId = 0;
+  std::string name;  // Guarded by Tracer::mutex
+};
+
+// Every buffer lives until exit, so that the zones of threads that are gone
+// are still exported
+struct Tracer {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> threads;
+  TraceBuffer gpu;
+};
+
+Tracer& tracer() {
+  static Tracer instance;
+  return instance;
+}
+
+thread_local TraceBuffer* t_buffer = nullptr;
+thread_local std::string t_threadName;
+
+TraceBuffer& threadBuffer() {
+  if (!t_buffer) {
+    Tracer& state = tracer();
+    auto buffer = std::make_unique<TraceBuffer>();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    buffer->threadId = static_cast<uint32_t>(state.threads.size() + 1);
+    buffer->name = t_threadName.empty() ? "Thread " + std::to_string(buffer->threadId) : t_threadName;
+    t_buffer = buffer.get();
+    state.threads.push_back(std::move(buffer));
+  }
+  return *t_buffer;
+}
+
+// What a writer needs of a buffer, copied under the mutex
+struct TrackSnapshot {
+  uint64_t uuid;
+  uint32_t threadId;
+  std::string name;
+  std::vector<TraceEvent> events;
+};
+
+std::vector<TrackSnapshot> snapshotTracks() {
+  Tracer& state = tracer();
+  std::vector<TrackSnapshot> tracks;
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto add = [&](const TraceBuffer& buffer, uint64_t uuid, const std::string& name) {
+    const uint64_t end = buffer.count.load(std::memory_order_acquire);
+    TrackSnapshot track{ uuid, buffer.threadId, name, {} };
+    TraceEvent event;
+    for (uint64_t i = TraceBuffer::first(end, kTraceOverwriteMargin); i < end; ++i) {
+      if (buffer.read(i, event)) {
+        track.events.push_back(event);
+      }
+    }
+    tracks.push_back(std::move(track));
+  };
+  for (const auto& buffer : state.threads) {
+    add(*buffer, 100 + buffer->threadId, buffer->name);
+  }
+  add(state.gpu, 2, "GPU");
+  return tracks;
+}
+
+void appendJsonString(std::string& out, const std::string& text) {
+  out += '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+void appendMicroseconds(std::string& out, int64_t ns) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.3f", static_cast<double>(ns) / 1000.0);
+  out += text;
+}
+
+// Trace Event Format: complete ("X") events, one thread per track, the GPU
+// on a thread id of its own
+std::string chromeJson(const std::vector<TrackSnapshot>& tracks) {
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  auto separate = [&]() {
+    if (!first) {
+      out += ",\n";
+    }
+    first = false;
+  };
+  separate();
+  out += R"({"name":"process_name","ph":"M","pid":1,"args":{"name":"webgpu-thingy"}})";
+  for (const TrackSnapshot& track : tracks) {
+    const std::string tid = std::to_string(track.uuid);
+    separate();
+    out += R"({"name":"thread_name","ph":"M","pid":1,"tid":)" + tid + R"(,"args":{"name":)";
+    appendJsonString(out, track.name);
+    out += "}}";
+    for (const TraceEvent& event : track.events) {
+      separate();
+      out += R"({"name":)";
+      appendJsonString(out, event.name);
+      out += R"(,"ph":"X","pid":1,"tid":)" + tid + R"(,"ts":)";
+      appendMicroseconds(out, event.beginNs);
+      out += R"(,"dur":)";
+      appendMicroseconds(out, event.endNs - event.beginNs);
+      out += "}";
+    }
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+// Just enough of the protobuf wire format for Perfetto's trace packets
+class ProtoWriter {
+public:
+  void varint(uint32_t field, uint64_t value) {
+    key(field, 0);
+    raw(value);
+  }
+  void bytes(uint32_t field, const std::string& value) {
+    key(field, 2);
+    raw(value.size());
+    m_data += value;
+  }
+  void message(uint32_t field, const ProtoWriter& nested) { bytes(field, nested.m_data); }
+  const std::string& data() const { return m_data; }
+
+private:
+  void key(uint32_t field, uint32_t wireType) { raw((uint64_t(field) << 3) | wireType); }
+  void raw(uint64_t value) {
+    while (value >= 0x80) {
+      m_data += static_cast<char>((value & 0x7F) | 0x80);
+      value >>= 7;
+    }
+    m_data += static_cast<char>(value);
+  }
+
+  std::string m_data;
+};
+
+// Field numbers of perfetto/trace/trace_packet.proto and its track_event/
+constexpr uint32_t kTracePacket = 1;
+constexpr uint32_t kPacketTimestamp = 8;
+constexpr uint32_t kPacketSequenceId = 10;
+constexpr uint32_t kPacketTrackEvent = 11;
+constexpr uint32_t kPacketTrackDescriptor = 60;
+constexpr uint32_t kTrackUuid = 1;
+constexpr uint32_t kTrackName = 2;
+constexpr uint32_t kTrackProcess = 3;
+constexpr uint32_t kTrackThread = 4;
+constexpr uint32_t kTrackParentUuid = 5;
+constexpr uint32_t kProcessPid = 1;
+constexpr uint32_t kProcessName = 6;
+constexpr uint32_t kThreadPid = 1;
+constexpr uint32_t kThreadTid = 2;
+constexpr uint32_t kThreadName = 5;
+constexpr uint32_t kEventType = 9;
+constexpr uint32_t kEventTrackUuid = 11;
+constexpr uint32_t kEventName = 23;
+constexpr uint64_t kSliceBegin = 1;
+constexpr uint64_t kSliceEnd = 2;
+constexpr uint64_t kProcessUuid = 1;
+
+// Slices nest per track, so each track's zones are sorted by start, outer
+// zones first, and ends are emitted before the next zone that starts after them
+std::string perfettoProto(std::vector<TrackSnapshot>& tracks) {
+  ProtoWriter trace;
+  auto packet = [&](const ProtoWriter& content) { trace.message(kTracePacket, content); };
+  {
+    ProtoWriter process;
+    process.varint(kProcessPid, 1);
+    process.bytes(kProcessName, "webgpu-thingy");
+    ProtoWriter descriptor;
+    descriptor.varint(kTrackUuid, kProcessUuid);
+    descriptor.message(kTrackProcess, process);
+    ProtoWriter content;
+    content.message(kPacketTrackDescriptor, descriptor);
+    packet(content);
+  }
+  for (TrackSnapshot& track : tracks) {
+    ProtoWriter descriptor;
+    descriptor.varint(kTrackUuid, track.uuid);
+    descriptor.varint(kTrackParentUuid, kProcessUuid);
+    if (track.threadId != 0) {
+      ProtoWriter thread;
+      thread.varint(kThreadPid, 1);
+      thread.varint(kThreadTid, track.threadId);
+      thread.bytes(kThreadName, track.name);
+      descriptor.message(kTrackThread, thread);
+    } else {
+      descriptor.bytes(kTrackName, track.name);
+    }
+    ProtoWriter content;
+    content.message(kPacketTrackDescriptor, descriptor);
+    packet(content);
+
+    auto slice = [&](uint64_t type, int64_t timestamp, const char* name) {
+      ProtoWriter event;
+      event.varint(kEventType, type);
+      event.varint(kEventTrackUuid, track.uuid);
+      if (name) {
+        event.bytes(kEventName, name);
+      }
+      ProtoWriter content;
+      content.varint(kPacketTimestamp, static_cast<uint64_t>(timestamp));
+      content.varint(kPacketSequenceId, 1);
+      content.message(kPacketTrackEvent, event);
+      packet(content);
+    };
+    std::sort(track.events.begin(), track.events.end(), [](const TraceEvent& a, const TraceEvent& b) {
+      return a.beginNs != b.beginNs ? a.beginNs < b.beginNs : a.endNs > b.endNs;
+    });
+    std::vector<int64_t> open;  // Ends of the enclosing zones, innermost last
+    for (const TraceEvent& event : track.events) {
+      while (!open.empty() && open.back() <= event.beginNs) {
+        slice(kSliceEnd, open.back(), nullptr);
+        open.pop_back();
+      }
+      slice(kSliceBegin, event.beginNs, event.name);
+      // A zone that outlives its parent, as GPU zones may, is cut at the parent's end
+      open.push_back(open.empty() ? event.endNs : std::min(event.endNs, open.back()));
+    }
+    while (!open.empty()) {
+      slice(kSliceEnd, open.back(), nullptr);
+      open.pop_back();
+    }
+  }
+  return trace.data();
+}
+
+} // namespace
+
+int64_t traceNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - processStart).count();
+}
+
+void traceZone(const char* name, int64_t beginNs, int64_t endNs) {
+  threadBuffer().record(name, beginNs, endNs);
+}
+
+void traceGpuZone(const char* name, int64_t beginNs, int64_t endNs) {
+  if (traceEnabled()) {
+    tracer().gpu.record(name, beginNs, endNs);
+  }
+}
+
+void setTraceThreadName(const std::string& name) {
+  t_threadName = name;
+  if (t_buffer) {
+    std::lock_guard<std::mutex> lock(tracer().mutex);
+    t_buffer->name = name;
+  }
+}
+
+void traceStart(TraceBufferMode mode) {
+  if (!kTracingBuilt) {
+    std::cerr << "Tracing was not built in, configure with -DTRACING=ON" << std::endl;
+    return;
+  }
+  g_keepLatest.store(mode == TraceBufferMode::KeepLatest, std::memory_order_relaxed);
+  g_traceEnabled.store(true, std::memory_order_relaxed);
+}
+
+void traceStop() {
+  g_traceEnabled.store(false, std::memory_order_relaxed);
+}
+
+size_t recentTraceZones(int64_t sinceNs, TraceEvent* out, size_t capacity) {
+  if (!t_buffer) {
+    return 0;
+  }
+  // Zones are recorded as they end, so the latest ones are the last ones
+  const uint64_t end = t_buffer->count.load(std::memory_order_relaxed);
+  const uint64_t oldest = TraceBuffer::first(end, 0);
+  // Only this thread writes its buffer, so every read succeeds
+  uint64_t begin = end;
+  TraceEvent event;
+  while (begin > oldest && end - begin < capacity && t_buffer->read(begin - 1, event) && event.endNs >= sinceNs) {
+    --begin;
+  }
+  for (uint64_t i = begin; i < end; ++i) {
+    t_buffer->read(i, out[i - begin]);
+  }
+  return static_cast<size_t>(end - begin);
+}
+
+TraceStats traceStats() {
+  Tracer& state = tracer();
+  TraceStats stats;
+  std::lock_guard<std::mutex> lock(state.mutex);
+  stats.threads = state.threads.size();
+  // Zones that were overwritten count as dropped
+  auto add = [&](const TraceBuffer& buffer, uint64_t& events) {
+    const uint64_t count = buffer.count.load(std::memory_order_acquire);
+    events += count - TraceBuffer::first(count, 0);
+    stats.dropped += TraceBuffer::first(count, 0) + buffer.dropped.load(std::memory_order_relaxed);
+  };
+  for (const auto& buffer : state.threads) {
+    add(*buffer, stats.events);
+  }
+  add(state.gpu, stats.gpuEvents);
+  return stats;
+}
+
+TraceFormat traceFormatForPath(const std::filesystem::path& path) {
+  const std::filesystem::path extension = path.extension();
+  if (extension == ".pftrace" || extension == ".perfetto-trace") {
+    return TraceFormat::PerfettoProto;
+  }
+  return TraceFormat::ChromeJson;
+}
+
+bool writeTrace(const std::filesystem::path& path, TraceFormat format) {
+  std::vector<TrackSnapshot> tracks = snapshotTracks();
+  const std::string contents = format == TraceFormat::PerfettoProto ? perfettoProto(tracks) : chromeJson(tracks);
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+  if (!file) {
+    std::cerr << "Could not write trace " << path.string() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void printTraceStats(const TraceStats& stats) {
+  std::cout << "Trace: " << stats.events << " zones on " << stats.threads << " threads, " << stats.gpuEvents << " GPU zones";
+  if (stats.dropped > 0) {
+    std::cout << ", " << stats.dropped << " dropped or overwritten (beyond " << kTraceEventsPerThread << " per thread)";
+  }
+  std::cout << std::endl;
+}
@@ -0,0 +1,117 @@
+#ifndef WEBGPU_THINGY_SRC_TRACE_H_
+#define WEBGPU_THINGY_SRC_TRACE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// Timeline of what each thread is doing, for chrome://tracing, Perfetto or
+// speedscope. Scopes are marked with zones named by string literals:
+//
+//   TRACE_ZONE("Build draw list");
+//
+// A zone is recorded when it ends, into a buffer of its thread that only
+// that thread writes, so that recording costs two clock reads and a store.
+// Each thread keeps its first kTraceEventsPerThread zones and counts the
+// others as dropped, or as a flight recorder its latest ones. Zones are only
+// recorded between traceStart() and traceStop(), and are compiled out of
+// builds without WEBGPU_THINGY_TRACING (the TRACING CMake option).
+
+#ifdef WEBGPU_THINGY_TRACING
+constexpr bool kTracingBuilt = true;
+#else
+constexpr bool kTracingBuilt = false;
+#endif
+
+constexpr size_t kTraceEventsPerThread = 64 * 1024;
+constexpr size_t kTraceOverwriteMargin = 1024;
+
+// Set by traceStart() and traceStop()
+inline std::atomic<bool> g_traceEnabled{ false };
+
+inline bool traceEnabled() {
+  return kTracingBuilt && g_traceEnabled.load(std::memory_order_relaxed);
+}
+
+// Nanoseconds since the process started, on the steady clock
+int64_t traceNow();
+
+struct TraceEvent {
+  const char* name;
+  int64_t beginNs;
+  int64_t endNs;
+};
+
+// Records a zone of the calling thread
+void traceZone(const char* name, int64_t beginNs, int64_t endNs);
+// Records a zone on the GPU track, from the thread reading GPU timestamps back
+void traceGpuZone(const char* name, int64_t beginNs, int64_t endNs);
+
+// Names the calling thread in exported traces
+void setTraceThreadName(const std::string& name);
+
+class TraceZone {
+public:
+  explicit TraceZone(const char* name) : m_name(traceEnabled() ? name : nullptr), m_begin(m_name ? traceNow() : 0) {}
+  ~TraceZone() {
+    if (m_name) {
+      traceZone(m_name, m_begin, traceNow());
+    }
+  }
+  TraceZone(const TraceZone&) = delete;
+  TraceZone& operator=(const TraceZone&) = delete;
+
+private:
+  const char* m_name;
+  int64_t m_begin;
+};
+
+#define WEBGPU_THINGY_TRACE_CONCAT_(a, b) a##b
+#define WEBGPU_THINGY_TRACE_CONCAT(a, b) WEBGPU_THINGY_TRACE_CONCAT_(a, b)
+#ifdef WEBGPU_THINGY_TRACING
+// The "" only lets string literals through, zones keep the pointer
+#define TRACE_ZONE(name) TraceZone WEBGPU_THINGY_TRACE_CONCAT(traceZone, __LINE__)("" name)
+#else
+#define TRACE_ZONE(name) static_cast<void>(0)
+#endif
+
+enum class TraceBufferMode {
+  KeepFirst,   // For a trace of the start of a run
+  KeepLatest,  // Overwrites the oldest zones, for a run of any length
+};
+
+void traceStart(TraceBufferMode mode = TraceBufferMode::KeepFirst);
+void traceStop();
+
+// Copies up to `capacity` of the latest zones of the calling thread that
+// ended at or after `sinceNs`, oldest first, without allocating
+size_t recentTraceZones(int64_t sinceNs, TraceEvent* out, size_t capacity);
+
+struct TraceStats {
+  size_t threads = 0;
+  uint64_t events = 0;
+  uint64_t dropped = 0;  // The buffer of their thread was full, or overwritten
+  uint64_t gpuEvents = 0;
+};
+TraceStats traceStats();
+void printTraceStats(const TraceStats& stats);
+
+enum class TraceFormat {
+  ChromeJson,      // Trace Event Format, "X" events
+  PerfettoProto,   // Perfetto TracePacket protobuf, track events
+};
+
+// By extension: .pftrace and .perfetto-trace are Perfetto, anything else JSON
+TraceFormat traceFormatForPath(const std::filesystem::path& path);
+
+// Writes every zone recorded so far, including those of threads that have
+// exited. Other threads keep recording meanwhile; their zones that end
+// after the call started may or may not be included. With KeepLatest, the
+// oldest kTraceOverwriteMargin zones of a full buffer are left out, as the
+// thread may be overwriting them, and so is any zone that was overwritten
+// while it was copied.
+bool writeTrace(const std::filesystem::path& path, TraceFormat format);
+
+#endif //WEBGPU_THINGY_SRC_TRACE_H_
@@ -0,0 +1,42 @@
+#ifndef WEBGPU_THINGY_SRC_TRIPLE_BUFFER_H_
+#define WEBGPU_THINGY_SRC_TRIPLE_BUFFER_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Latest value handed from one writer thread to one reader thread without
+// locks or waiting. The writer fills its own copy and swaps it with the
+// middle one, the reader swaps its copy with the middle one when it holds a
+// newer value. Values the reader did not get to in time are overwritten.
+template <typename T>
+class TripleBuffer {
+public:
+  // Writer side
+  void write(const T& value) {
+    m_buffers[m_writeIndex] = value;
+    uint8_t previous = m_middle.exchange(m_writeIndex | kFresh, std::memory_order_acq_rel);
+    m_writeIndex = previous & kIndexMask;
+  }
+
+  // Reader side: the newest value, or the same one as last time if nothing
+  // was written since. Valid until the next read().
+  const T& read() {
+    if (m_middle.load(std::memory_order_relaxed) & kFresh) {
+      uint8_t previous = m_middle.exchange(m_readIndex, std::memory_order_acq_rel);
+      m_readIndex = previous & kIndexMask;
+    }
+    return m_buffers[m_readIndex];
+  }
+
+private:
+  static constexpr uint8_t kIndexMask = 0x3;
+  static constexpr uint8_t kFresh = 0x4;  // The middle copy was not read yet
+
+  std::array<T, 3> m_buffers{};
+  uint8_t m_writeIndex = 0;
+  alignas(64) std::atomic<uint8_t> m_middle{ 1 };
+  alignas(64) uint8_t m_readIndex = 2;
+};
+
+#endif //WEBGPU_THINGY_SRC_TRIPLE_BUFFER_H_
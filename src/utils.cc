@@ -1,25 +1,39 @@
 #include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include "job_system.h"
+#include "trace.h"
+#ifdef WEBGPU_BACKEND_WGPU
+#include <webgpu/wgpu.h>
+#endif
 
 namespace fs = std::filesystem;
 
-wgpu::ShaderModule loadShaderModule(const fs::path& path, wgpu::Device device) {
+bool loadShaderSource(const fs::path& path, std::string& source) {
+  TRACE_ZONE("Read file");
   std::ifstream file(path);
   if (!file.is_open()) {
-    return nullptr;
+    return false;
   }
   file.seekg(0, std::ios::end);
   std::streamsize size = file.tellg();
-  std::string shaderSource(size, ' ');
+  source.assign(size, ' ');
   file.seekg(0);
-  file.read(shaderSource.data(), size);
+  file.read(source.data(), size);
+  return true;
+}
 
+wgpu::ShaderModule createShaderModule(wgpu::Device device, const std::string& source) {
+  TRACE_ZONE("Create shader module");
   wgpu::ShaderModuleWGSLDescriptor shaderCodeDesc{};
   shaderCodeDesc.chain.next = nullptr;
   shaderCodeDesc.chain.sType = wgpu::SType::ShaderModuleWGSLDescriptor;
-  shaderCodeDesc.code = shaderSource.c_str();
+  shaderCodeDesc.code = source.c_str();
   wgpu::ShaderModuleDescriptor shaderDesc{};
   shaderDesc.hintCount = 0;
   shaderDesc.hints = nullptr;
@@ -27,15 +41,51 @@ wgpu::ShaderModule loadShaderModule(const fs::path& path, wgpu::Device device) {
   return device.createShaderModule(shaderDesc);
 }
 
-bool loadGeometry(const fs::path& path, std::vector<float>& pointData, std::vector<uint16_t>& indexData) {
-  std::ifstream file(path);
-  if (!file.is_open()) {
-    return false;
+wgpu::ShaderModule loadShaderModule(const fs::path& path, wgpu::Device device, const std::string& prelude) {
+  std::string shaderSource;
+  if (!loadShaderSource(path, shaderSource)) {
+    return nullptr;
+  }
+  return createShaderModule(device, prelude + shaderSource);
+}
+
+namespace {
+
+// Geometry lines per job
+constexpr size_t kGeometryGrain = 4096;
+
+Vertex parseVertex(const std::string& line) {
+  std::istringstream iss(line);
+  // Get x, y, r, g, b
+  Vertex vertex;
+  iss >> vertex.position[0] >> vertex.position[1] >> vertex.color[0] >> vertex.color[1] >> vertex.color[2];
+  return vertex;
+}
+
+// False when the line does not hold three corners below `vertexCount`
+bool parseTriangle(const std::string& line, size_t vertexCount, uint16_t* corners) {
+  std::istringstream iss(line);
+  // Get corners #0 #1 and #2
+  for (int i = 0; i < 3; ++i) {
+    if (!(iss >> corners[i]) || corners[i] >= vertexCount) {
+      return false;
+    }
   }
+  return true;
+}
 
-  pointData.clear();
-  indexData.clear();
+} // namespace
 
+bool loadGeometry(const fs::path& path, std::vector<Vertex>& vertices, std::vector<uint16_t>& indexData, JobSystem* jobs) {
+  std::string source;
+  if (!loadShaderSource(path, source)) {
+    return false;
+  }
+  return parseGeometry(source, vertices, indexData, jobs);
+}
+
+bool parseGeometry(const std::string& source, std::vector<Vertex>& vertices, std::vector<uint16_t>& indexData, JobSystem* jobs) {
+  TRACE_ZONE("Parse geometry");
   enum class Section {
     None,
     Points,
@@ -43,42 +93,125 @@ bool loadGeometry(const fs::path& path, std::vector<float>& pointData, std::vect
   };
   Section currentSection = Section::None;
 
-  float value;
-  uint16_t index;
-  std::string line;
-  while (!file.eof()) {
-    getline(file, line);
+  // Sorting the lines into sections is sequential, parsing them is not
+  std::vector<std::string_view> pointLines;
+  std::vector<std::string_view> indexLines;
+  std::string_view text(source);
+  size_t lineStart = 0;
+  while (lineStart <= text.size()) {
+    size_t lineEnd = std::min(text.find('\n', lineStart), text.size());
+    std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+    lineStart = lineEnd + 1;
 
     // overcome the `CRLF` problem
     if (!line.empty() && line.back() == '\r') {
-      line.pop_back();
+      line.remove_suffix(1);
     }
 
     if (line == "[points]") {
       currentSection = Section::Points;
     }
+    else if (line.empty() || line[0] == '#') {
+      // Do nothing, this is a comment
+    }
     else if (line == "[indices]") {
       currentSection = Section::Indices;
     }
-    else if (line[0] == '#' || line.empty()) {
-      // Do nothing, this is a comment
-    }
     else if (currentSection == Section::Points) {
-      std::istringstream iss(line);
-      // Get x, y, r, g, b
-      for (int i = 0; i < 5; ++i) {
-        iss >> value;
-        pointData.push_back(value);
-      }
+      pointLines.push_back(line);
     }
     else if (currentSection == Section::Indices) {
-      std::istringstream iss(line);
-      // Get corners #0 #1 and #2
-      for (int i = 0; i < 3; ++i) {
-        iss >> index;
-        indexData.push_back(index);
+      indexLines.push_back(line);
+    }
+  }
+
+  vertices.resize(pointLines.size());
+  indexData.resize(3 * indexLines.size());
+  auto parseVertices = [&](size_t begin, size_t end) {
+    TRACE_ZONE("Parse vertices");
+    std::string line;
+    for (size_t i = begin; i < end; ++i) {
+      line.assign(pointLines[i]);
+      vertices[i] = parseVertex(line);
+    }
+  };
+  // A half-saved or mistyped file would index past the vertices
+  std::atomic<bool> indicesValid{ true };
+  auto parseIndices = [&](size_t begin, size_t end) {
+    TRACE_ZONE("Parse indices");
+    std::string line;
+    for (size_t i = begin; i < end; ++i) {
+      line.assign(indexLines[i]);
+      if (!parseTriangle(line, vertices.size(), &indexData[3 * i])) {
+        indicesValid.store(false, std::memory_order_relaxed);
+        return;
       }
     }
+  };
+  if (jobs) {
+    jobs->parallelFor(0, pointLines.size(), kGeometryGrain, parseVertices);
+    jobs->parallelFor(0, indexLines.size(), kGeometryGrain, parseIndices);
+  } else {
+    parseVertices(0, pointLines.size());
+    parseIndices(0, indexLines.size());
   }
-  return true;
-}
\ No newline at end of file
+  return indicesValid.load(std::memory_order_relaxed);
+}
+
+void pollDevice(wgpu::Device device, wgpu::Queue queue) {
+#ifdef WEBGPU_BACKEND_WGPU
+  // wgpu-native processes callbacks when something is submitted
+  (void)device;
+  queue.submit(0, nullptr);
+#else
+  (void)queue;
+  device.tick();
+#endif
+}
+
+bool readBufferSync(wgpu::Device device, wgpu::Queue queue, wgpu::Buffer buffer, size_t size, void* data) {
+  TRACE_ZONE("Read buffer back");
+  bool done = false;
+  bool success = false;
+  auto handle = buffer.mapAsync(wgpu::MapMode::Read, 0, size, [&](wgpu::BufferMapAsyncStatus status) {
+    done = true;
+    success = status == wgpu::BufferMapAsyncStatus::Success;
+  });
+  while (!done) {
+    pollDevice(device, queue);
+  }
+  if (success) {
+    std::memcpy(data, buffer.getConstMappedRange(0, size), size);
+    buffer.unmap();
+  }
+  return success;
+}
+
+bool isSrgbFormat(wgpu::TextureFormat format) {
+  return format == wgpu::TextureFormat::BGRA8UnormSrgb || format == wgpu::TextureFormat::RGBA8UnormSrgb;
+}
+
+wgpu::TextureFormat toSrgbFormat(wgpu::TextureFormat format) {
+  if (format == wgpu::TextureFormat::BGRA8Unorm) return wgpu::TextureFormat::BGRA8UnormSrgb;
+  if (format == wgpu::TextureFormat::RGBA8Unorm) return wgpu::TextureFormat::RGBA8UnormSrgb;
+  return format;
+}
+
+std::vector<wgpu::TextureFormat> surfaceFormats(wgpu::Surface surface, wgpu::Adapter adapter) {
+  std::vector<wgpu::TextureFormat> formats;
+#ifdef WEBGPU_BACKEND_WGPU
+  // wgpu-native's extension, which fills the counts, then the arrays given to it
+  WGPUSurfaceCapabilities capabilities = {};
+  wgpuSurfaceGetCapabilities(surface, adapter, &capabilities);
+  std::vector<WGPUTextureFormat> supported(capabilities.formatCount);
+  capabilities = {};
+  capabilities.formatCount = supported.size();
+  capabilities.formats = supported.data();
+  wgpuSurfaceGetCapabilities(surface, adapter, &capabilities);
+  formats.assign(supported.begin(), supported.begin() + std::min(capabilities.formatCount, supported.size()));
+#else
+  (void)surface;
+  (void)adapter;
+#endif
+  return formats;
+}
@@ -3,10 +3,32 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <string>
 #include <vector>
 #include <webgpu/webgpu.hpp>
+#include "vertex.h"
 
-wgpu::ShaderModule loadShaderModule(const std::filesystem::path& path, wgpu::Device device);
-bool loadGeometry(const std::filesystem::path& path, std::vector<float>& pointData, std::vector<uint16_t>& indexData);
+class JobSystem;
+
+bool loadShaderSource(const std::filesystem::path& path, std::string& source);
+wgpu::ShaderModule createShaderModule(wgpu::Device device, const std::string& source);
+// `prelude` is prepended to the file, e.g. the WGSL structs of the vertex layouts
+wgpu::ShaderModule loadShaderModule(const std::filesystem::path& path, wgpu::Device device, const std::string& prelude = {});
+// With `jobs`, the lines are parsed in parallel
+bool loadGeometry(const std::filesystem::path& path, std::vector<Vertex>& vertices, std::vector<uint16_t>& indexData,
+                  JobSystem* jobs = nullptr);
+// Same as loadGeometry, from the contents of a geometry file. False when a
+// triangle is malformed or indexes past the points.
+bool parseGeometry(const std::string& source, std::vector<Vertex>& vertices, std::vector<uint16_t>& indexData,
+                   JobSystem* jobs = nullptr);
+// Lets the backend process pending callbacks such as mapAsync completions
+void pollDevice(wgpu::Device device, wgpu::Queue queue);
+// Copies `size` bytes of a MapRead buffer to `data`, waiting for the mapping
+bool readBufferSync(wgpu::Device device, wgpu::Queue queue, wgpu::Buffer buffer, size_t size, void* data);
+bool isSrgbFormat(wgpu::TextureFormat format);
+// Returns the sRGB counterpart of a UNORM color format, or the format itself
+wgpu::TextureFormat toSrgbFormat(wgpu::TextureFormat format);
+// Formats a swap chain of the surface can have, empty when the backend cannot tell
+std::vector<wgpu::TextureFormat> surfaceFormats(wgpu::Surface surface, wgpu::Adapter adapter);
 
 #endif //WEBGPU_THINGY_SRC_UTILS_H_
@@ -0,0 +1,66 @@
+#ifndef WEBGPU_THINGY_SRC_VERTEX_H_
+#define WEBGPU_THINGY_SRC_VERTEX_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "vertex_layout.h"
+
+// Mesh vertex as loaded and processed on the CPU, uploaded as is by default
+struct Vertex {
+  float position[2];
+  float color[3];
+};
+
+template <> struct VertexLayoutTraits<Vertex> {
+  static constexpr const char* wgslName = "VertexInput";
+  static constexpr WGPUVertexStepMode stepMode = WGPUVertexStepMode_Vertex;
+  static constexpr std::array<VertexAttributeInfo, 2> attributes = {{
+    VERTEX_ATTRIBUTE(Vertex, position, 0),
+    VERTEX_ATTRIBUTE(Vertex, color, 1),
+  }};
+};
+
+// Compact upload format, 12 bytes instead of 20. Colors are quantized to
+// 8 bits per channel, which bands in dark linear colors.
+struct PackedVertex {
+  float position[2];
+  Unorm8x4 color;
+};
+
+template <> struct VertexLayoutTraits<PackedVertex> {
+  static constexpr const char* wgslName = "VertexInput";
+  static constexpr WGPUVertexStepMode stepMode = WGPUVertexStepMode_Vertex;
+  static constexpr std::array<VertexAttributeInfo, 2> attributes = {{
+    VERTEX_ATTRIBUTE(PackedVertex, position, 0),
+    VERTEX_ATTRIBUTE(PackedVertex, color, 1),
+  }};
+};
+
+static_assert(VertexLayout<Vertex>::stride == 5 * sizeof(float), "Vertex is tightly packed");
+static_assert(VertexLayout<PackedVertex>::stride == 3 * sizeof(float), "PackedVertex is tightly packed");
+
+inline void packVertex(const Vertex& in, Vertex& out) {
+  out = in;
+}
+
+inline void packVertex(const Vertex& in, PackedVertex& out) {
+  out.position[0] = in.position[0];
+  out.position[1] = in.position[1];
+  for (int c = 0; c < 3; ++c) {
+    out.color.value[c] = static_cast<uint8_t>(std::lround(std::clamp(in.color[c], 0.0f, 1.0f) * 255.0f));
+  }
+  out.color.value[3] = 255;
+}
+
+// Converts mesh vertices to the upload format `Target`
+template <typename Target>
+std::vector<Target> packVertices(const std::vector<Vertex>& vertices) {
+  std::vector<Target> packed(vertices.size());
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    packVertex(vertices[i], packed[i]);
+  }
+  return packed;
+}
+
+#endif //WEBGPU_THINGY_SRC_VERTEX_H_
@@ -0,0 +1,221 @@
+#ifndef WEBGPU_THINGY_SRC_VERTEX_LAYOUT_H_
+#define WEBGPU_THINGY_SRC_VERTEX_LAYOUT_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <webgpu/webgpu.hpp>
+
+// Compile-time vertex layouts. A vertex struct lists its attributes in a
+// VertexLayoutTraits specialization:
+//
+//   template <> struct VertexLayoutTraits<MyVertex> {
+//     static constexpr const char* wgslName = "VertexInput";
+//     static constexpr WGPUVertexStepMode stepMode = WGPUVertexStepMode_Vertex;
+//     static constexpr std::array<VertexAttributeInfo, 2> attributes = {{
+//       VERTEX_ATTRIBUTE(MyVertex, position, 0),
+//       VERTEX_ATTRIBUTE(MyVertex, color, 1),
+//     }};
+//   };
+//
+// and VertexLayout<MyVertex> derives the WebGPU attributes, the stride, the
+// limits it needs and the WGSL input struct from it.
+
+// Attribute tags for packed formats. Plain float, float[2], float[3] and
+// float[4] members map to the Float32 formats.
+struct Unorm8x4 { uint8_t value[4]; };     // vec4f in [0, 1]
+struct Snorm16x2 { int16_t value[2]; };    // vec2f in [-1, 1]
+struct Float16x2 { uint16_t value[2]; };   // vec2f, IEEE half floats
+
+template <typename T> struct VertexAttributeType;
+template <> struct VertexAttributeType<float> {
+  static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float32;
+  static constexpr const char* wgslType = "f32";
+};
+template <> struct VertexAttributeType<float[2]> {
+  static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float32x2;
+  static constexpr const char* wgslType = "vec2f";
+};
+template <> struct VertexAttributeType<float[3]> {
+  static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float32x3;
+  static constexpr const char* wgslType = "vec3f";
+};
+template <> struct VertexAttributeType<float[4]> {
+  static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float32x4;
+  static constexpr const char* wgslType = "vec4f";
+};
+template <> struct VertexAttributeType<Unorm8x4> {
+  static constexpr WGPUVertexFormat format = WGPUVertexFormat_Unorm8x4;
+  static constexpr const char* wgslType = "vec4f";
+};
+template <> struct VertexAttributeType<Snorm16x2> {
+  static constexpr WGPUVertexFormat format = WGPUVertexFormat_Snorm16x2;
+  static constexpr const char* wgslType = "vec2f";
+};
+template <> struct VertexAttributeType<Float16x2> {
+  static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float16x2;
+  static constexpr const char* wgslType = "vec2f";
+};
+
+struct VertexAttributeInfo {
+  const char* name;  // Member name, also used in the WGSL struct
+  WGPUVertexFormat format;
+  uint64_t offset;
+  uint64_t size;
+  uint32_t shaderLocation;
+  const char* wgslType;
+};
+
+template <typename Member>
+constexpr VertexAttributeInfo vertexAttribute(const char* name, uint64_t offset, uint32_t shaderLocation) {
+  return { name, VertexAttributeType<Member>::format, offset, sizeof(Member), shaderLocation, VertexAttributeType<Member>::wgslType };
+}
+
+#define VERTEX_ATTRIBUTE(Struct, member, location) \
+  vertexAttribute<decltype(Struct::member)>(#member, offsetof(Struct, member), location)
+
+template <typename Vertex> struct VertexLayoutTraits;
+
+// Type-erased view of a VertexLayout, to pick a layout at run time
+struct VertexLayoutView {
+  const WGPUVertexAttribute* attributes;
+  size_t attributeCount;
+  uint64_t stride;
+  WGPUVertexStepMode stepMode;
+  const char* wgsl;
+};
+
+struct VertexLayoutLimits {
+  uint32_t maxVertexAttributes = 0;
+  uint32_t maxVertexBuffers = 0;
+  uint32_t maxVertexBufferArrayStride = 0;
+};
+
+namespace vertex_layout_detail {
+
+constexpr size_t length(const char* text) {
+  size_t n = 0;
+  while (text[n] != '\0') ++n;
+  return n;
+}
+
+constexpr size_t digitCount(uint32_t value) {
+  size_t n = 1;
+  while (value >= 10) {
+    value /= 10;
+    ++n;
+  }
+  return n;
+}
+
+template <typename Traits>
+constexpr size_t wgslStructLength() {
+  size_t n = length("struct ") + length(Traits::wgslName) + length(" {\n") + length("};\n");
+  for (const VertexAttributeInfo& attribute : Traits::attributes) {
+    n += length("    @location(") + digitCount(attribute.shaderLocation) + length(") ")
+       + length(attribute.name) + length(": ") + length(attribute.wgslType) + length(",\n");
+  }
+  return n;
+}
+
+template <typename Traits, size_t Length>
+constexpr std::array<char, Length + 1> wgslStruct() {
+  std::array<char, Length + 1> text{};
+  size_t pos = 0;
+  auto append = [&](const char* part) {
+    while (*part != '\0') text[pos++] = *part++;
+  };
+  append("struct ");
+  append(Traits::wgslName);
+  append(" {\n");
+  for (const VertexAttributeInfo& attribute : Traits::attributes) {
+    append("    @location(");
+    size_t digits = digitCount(attribute.shaderLocation);
+    for (size_t i = 0, value = attribute.shaderLocation; i < digits; ++i, value /= 10) {
+      text[pos + digits - 1 - i] = static_cast<char>('0' + value % 10);
+    }
+    pos += digits;
+    append(") ");
+    append(attribute.name);
+    append(": ");
+    append(attribute.wgslType);
+    append(",\n");
+  }
+  append("};\n");
+  text[pos] = '\0';
+  return text;
+}
+
+template <typename Traits, size_t Count>
+constexpr std::array<WGPUVertexAttribute, Count> wgpuAttributes() {
+  std::array<WGPUVertexAttribute, Count> attributes{};
+  for (size_t i = 0; i < Count; ++i) {
+    attributes[i].format = Traits::attributes[i].format;
+    attributes[i].offset = Traits::attributes[i].offset;
+    attributes[i].shaderLocation = Traits::attributes[i].shaderLocation;
+  }
+  return attributes;
+}
+
+template <typename Vertex, typename Traits>
+constexpr bool attributesFit() {
+  for (const VertexAttributeInfo& attribute : Traits::attributes) {
+    // WebGPU requires offsets aligned to min(4, format size)
+    uint64_t alignment = attribute.size < 4 ? attribute.size : 4;
+    if (attribute.offset % alignment != 0 || attribute.offset + attribute.size > sizeof(Vertex)) return false;
+  }
+  return sizeof(Vertex) % 4 == 0;
+}
+
+template <typename Traits>
+constexpr bool locationsUnique() {
+  for (size_t i = 0; i < Traits::attributes.size(); ++i) {
+    for (size_t j = i + 1; j < Traits::attributes.size(); ++j) {
+      if (Traits::attributes[i].shaderLocation == Traits::attributes[j].shaderLocation) return false;
+    }
+  }
+  return true;
+}
+
+} // namespace vertex_layout_detail
+
+template <typename Vertex>
+struct VertexLayout {
+  using Traits = VertexLayoutTraits<Vertex>;
+  static_assert(vertex_layout_detail::attributesFit<Vertex, Traits>(), "Vertex attributes must be aligned and fit the vertex struct");
+  static_assert(vertex_layout_detail::locationsUnique<Traits>(), "Vertex attributes must use distinct shader locations");
+
+  static constexpr size_t attributeCount = Traits::attributes.size();
+  static constexpr uint64_t stride = sizeof(Vertex);
+  static constexpr std::array<WGPUVertexAttribute, attributeCount> attributes = vertex_layout_detail::wgpuAttributes<Traits, attributeCount>();
+  // WGSL declaration of the matching input struct, e.g. "struct VertexInput { @location(0) position: vec2f, ... };"
+  static constexpr std::array<char, vertex_layout_detail::wgslStructLength<Traits>() + 1> wgsl = vertex_layout_detail::wgslStruct<Traits, vertex_layout_detail::wgslStructLength<Traits>()>();
+  static constexpr VertexLayoutView view = { attributes.data(), attributeCount, stride, Traits::stepMode, wgsl.data() };
+};
+
+inline wgpu::VertexBufferLayout makeVertexBufferLayout(const VertexLayoutView& layout) {
+  wgpu::VertexBufferLayout bufferLayout;
+  bufferLayout.attributeCount = layout.attributeCount;
+  bufferLayout.attributes = layout.attributes;
+  bufferLayout.arrayStride = layout.stride;
+  bufferLayout.stepMode = layout.stepMode;
+  return bufferLayout;
+}
+
+// Device limits needed to use all the given layouts in one pipeline, one vertex buffer each
+template <size_t Count>
+constexpr VertexLayoutLimits vertexLayoutLimits(const std::array<VertexLayoutView, Count>& layouts) {
+  VertexLayoutLimits limits;
+  limits.maxVertexBuffers = static_cast<uint32_t>(Count);
+  for (const VertexLayoutView& layout : layouts) {
+    for (size_t i = 0; i < layout.attributeCount; ++i) {
+      uint32_t location = layout.attributes[i].shaderLocation + 1;
+      limits.maxVertexAttributes = location > limits.maxVertexAttributes ? location : limits.maxVertexAttributes;
+    }
+    uint32_t stride = static_cast<uint32_t>(layout.stride);
+    limits.maxVertexBufferArrayStride = stride > limits.maxVertexBufferArrayStride ? stride : limits.maxVertexBufferArrayStride;
+  }
+  return limits;
+}
+
+#endif //WEBGPU_THINGY_SRC_VERTEX_LAYOUT_H_
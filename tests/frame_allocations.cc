@@ -0,0 +1,118 @@
+// Runs the CPU side of the frame loop without a GPU and fails if a
+// steady-state frame allocates: level of detail selection with
+// JobSystem::parallelFor, the draw list build and sort with its scratch in a
+// FrameArena, the arena itself, and the frame timers, ticked and recorded
+// into past their default window. Built with COUNT_ALLOCATIONS, see
+// src/alloc_counter.h. Counts the calling thread and the job workers.
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "alloc_counter.h"
+#include "draw_list.h"
+#include "frame_arena.h"
+#include "frame_timer.h"
+#include "job_system.h"
+#include "mesh_lod.h"
+#include "scene.h"
+
+namespace {
+
+constexpr int kWarmupFrames = 10;
+constexpr int kFrames = 200;
+// Small, so that the timers wrap around within the test
+constexpr size_t kTimerWindow = 64;
+
+} // namespace
+
+int main() {
+  if (!allocationCountingEnabled()) {
+    std::cerr << "Built without COUNT_ALLOCATIONS" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  SceneSettings sceneSettings;
+  sceneSettings.gridSize = 64;
+  sceneSettings.layers = 3;
+  sceneSettings.transparentLayers = 1;
+  const std::vector<InstanceData> instances = makeScene(sceneSettings);
+  const std::vector<MeshLod> lodChain = {
+    { 0, 3072, 0.0f }, { 3072, 1536, 0.002f }, { 4608, 768, 0.008f }, { 5376, 384, 0.03f },
+  };
+  std::vector<uint32_t> instanceLods(instances.size(), 0);
+  std::vector<InstanceData> orderedInstances;
+  std::vector<InstanceBatch> instanceBatches;
+
+  JobSystem jobs(3);
+  FrameArena frameArena;
+  DrawList drawList;
+  const float viewportWidth = 1280.0f;
+  FrameTimer frameTimer(kTimerWindow);
+  FrameTimer inputLatency(kTimerWindow);
+
+  int failedFrames = 0;
+  for (int frame = 0; frame < kWarmupFrames + kFrames; ++frame) {
+    const AllocationCounts atStart = threadAllocationCounts() + jobs.allocationCounts();
+
+    // Same as updateInstances() of the frame loop, a slow zoom keeps some
+    // instances moving between levels
+    const float zoom = 1.0f + 0.002f * static_cast<float>(frame % 50);
+    std::atomic<bool> lodsChanged{ false };
+    jobs.parallelFor(0, instances.size(), 1024, [&](size_t begin, size_t end) {
+      bool changed = false;
+      for (size_t i = begin; i < end; ++i) {
+        float pixelsPerUnit = instances[i].scale * 0.5f * viewportWidth * zoom;
+        uint32_t lod = selectLod(lodChain, pixelsPerUnit, instanceLods[i]);
+        changed |= lod != instanceLods[i];
+        instanceLods[i] = lod;
+      }
+      if (changed) {
+        lodsChanged.store(true, std::memory_order_relaxed);
+      }
+    });
+    // Allocates, as in the frame loop it only runs when levels change,
+    // which steady-state frames of this scene do not
+    if (frame == 0 || (frame < kWarmupFrames && lodsChanged.load(std::memory_order_relaxed))) {
+      batchInstances(instances, instanceLods, true, orderedInstances, instanceBatches);
+    }
+
+    // Same as buildDrawList() of the frame loop
+    drawList.clear();
+    for (size_t i = 0; i < instanceBatches.size(); ++i) {
+      const InstanceBatch& batch = instanceBatches[i];
+      DrawCommand draw;
+      draw.sortKey = batch.transparent ? makeSortKey(1, 1, 0, 0, quantizeSortDepth(1.0f - batch.depth))
+                                       : makeSortKey(0, 0, 0, 0, quantizeSortDepth(batch.depth));
+      draw.indexCount = lodChain[batch.lod].indexCount;
+      draw.firstIndex = lodChain[batch.lod].firstIndex;
+      draw.firstInstance = batch.firstInstance;
+      draw.instanceCount = batch.instanceCount;
+      drawList.add(draw);
+    }
+    drawList.sort(jobs.workerCount() + 1, &frameArena);
+
+    // Other transient data of the frame
+    float* scratch = frameArena.allocate<float>(instances.size());
+    jobs.parallelFor(0, instances.size(), 0, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        scratch[i] = instances[i].depth;
+      }
+    });
+    frameArena.reset();
+
+    // As at the end of the frame loop
+    inputLatency.record(0.5);
+    frameTimer.tick();
+
+    const AllocationCounts frameAllocations = threadAllocationCounts() + jobs.allocationCounts() - atStart;
+    if (frame >= kWarmupFrames && frameAllocations.allocations > 0) {
+      std::cerr << "Frame " << frame << " allocated " << frameAllocations.allocations << " times ("
+                << frameAllocations.bytes << " bytes)" << std::endl;
+      ++failedFrames;
+    }
+  }
+
+  std::cout << kFrames << " frames of " << drawList.size() << " draws, " << failedFrames << " allocating, arena overflows "
+            << frameArena.overflows() << ", " << frameTimer.frameCount() << " frames timed" << std::endl;
+  return failedFrames == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
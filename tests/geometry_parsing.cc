@@ -0,0 +1,61 @@
+// Geometry files that parseGeometry must turn away rather than hand out
+// indices past the points: an index out of range, as a typo makes it, and a
+// triangle cut short, as a file read while it is being saved has it. Parsed
+// with and without the job system.
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "job_system.h"
+#include "utils.h"
+
+namespace {
+
+const char* kValid =
+  "[points]\n"
+  "-0.5 -0.5 1.0 0.0 0.0\n"
+  "+0.5 -0.5 0.0 1.0 0.0\n"
+  "+0.0 +0.5 0.0 0.0 1.0\n"
+  "[indices]\n"
+  "0 1 2\n";
+
+const char* kIndexOutOfRange =
+  "[points]\n"
+  "-0.5 -0.5 1.0 0.0 0.0\n"
+  "+0.5 -0.5 0.0 1.0 0.0\n"
+  "+0.0 +0.5 0.0 0.0 1.0\n"
+  "[indices]\n"
+  "0 1 3\n";
+
+const char* kTruncatedTriangle =
+  "[points]\n"
+  "-0.5 -0.5 1.0 0.0 0.0\n"
+  "+0.5 -0.5 0.0 1.0 0.0\n"
+  "+0.0 +0.5 0.0 0.0 1.0\n"
+  "[indices]\n"
+  "0 1 2\n"
+  "2 1\n";
+
+int failures = 0;
+
+void expect(const char* name, const char* source, bool expected, JobSystem* jobs) {
+  std::vector<Vertex> vertices;
+  std::vector<uint16_t> indexData;
+  const bool parsed = parseGeometry(source, vertices, indexData, jobs);
+  if (parsed != expected) {
+    std::cerr << name << (jobs ? " (jobs)" : "") << ": parseGeometry returned " << parsed << std::endl;
+    ++failures;
+  }
+}
+
+} // namespace
+
+int main() {
+  JobSystem jobs(2);
+  for (JobSystem* parseJobs : { static_cast<JobSystem*>(nullptr), &jobs }) {
+    expect("Valid", kValid, true, parseJobs);
+    expect("Index out of range", kIndexOutOfRange, false, parseJobs);
+    expect("Truncated triangle", kTruncatedTriangle, false, parseJobs);
+  }
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,81 @@
+// Builds an asset pack (see src/asset_pack.h) from a list of files
+#include "asset_pack.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+void printUsage(const char* program) {
+  std::cout << "Usage: " << program << " [options] <output.pack> <file>...\n"
+            << "  --root <dir>   Entries are named by their path relative to <dir> (default: file name)\n"
+            << "  --store        Do not compress\n"
+            << "  --help         Show this message" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  fs::path root;
+  bool compress = true;
+  std::vector<fs::path> paths;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--help") == 0) {
+      printUsage(argv[0]);
+      return 0;
+    } else if (std::strcmp(argv[i], "--root") == 0 && i + 1 < argc) {
+      root = argv[++i];
+    } else if (std::strcmp(argv[i], "--store") == 0) {
+      compress = false;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.size() < 2) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  const fs::path output = paths.front();
+  std::vector<AssetPackInput> inputs;
+  for (size_t i = 1; i < paths.size(); ++i) {
+    std::ifstream file(paths[i], std::ios::binary);
+    if (!file.is_open()) {
+      std::cerr << "Could not open " << paths[i].string() << std::endl;
+      return 1;
+    }
+    AssetPackInput input;
+    input.name = root.empty() ? paths[i].filename().generic_string() : fs::relative(paths[i], root).generic_string();
+    input.contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    inputs.push_back(std::move(input));
+  }
+  if (!writeAssetPack(output, inputs, compress)) {
+    return 1;
+  }
+
+  // Read the pack back, which also checks that every entry decodes
+  AssetPack pack;
+  if (!pack.open(output)) {
+    return 1;
+  }
+  uint64_t totalSize = 0;
+  uint64_t totalStored = 0;
+  for (size_t i = 0; i < pack.entryCount(); ++i) {
+    const AssetPackEntry& entry = pack.entry(i);
+    std::string name(pack.entryName(i));
+    std::string_view contents;
+    if (!pack.read(name, contents)) {
+      return 1;
+    }
+    std::cout << name << ": " << entry.size << " -> " << entry.storedSize << " bytes ("
+              << (entry.codec == static_cast<uint32_t>(AssetCodec::Lz4) ? "lz4" : "stored") << ")" << std::endl;
+    totalSize += entry.size;
+    totalStored += entry.storedSize;
+  }
+  std::cout << "Wrote " << output.string() << ": " << pack.entryCount() << " entries, "
+            << totalSize << " -> " << totalStored << " bytes" << std::endl;
+  return 0;
+}
@@ -0,0 +1,625 @@
+// Replays a capture recorded with --capture (see src/gpu_capture.h) without
+// a window, as fast as the device allows, and prints the CPU and GPU time
+// of every frame
+#include "gpu_capture.h"
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <webgpu/webgpu.hpp>
+#include "draw_list.h"
+#include "frame_timer.h"
+#include "utils.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+void printUsage(const char* program) {
+  std::cout << "Usage: " << program << " [options] <capture>\n"
+            << "  --fallback-adapter   Use the fallback (software) adapter\n"
+            << "  --quiet              Only print the summary, not every frame\n"
+            << "  --help               Show this message" << std::endl;
+}
+
+double elapsedMs(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Objects by capture id, each kind in its own table. Ids come from
+// CaptureParser::getId(), which bounds them.
+template <typename T>
+T& slot(std::vector<T>& objects, uint32_t id) {
+  if (id >= objects.size()) {
+    objects.resize(id + 1, nullptr);
+  }
+  return objects[id];
+}
+
+// Re-creates the captured objects and re-records the captured frames
+class Replayer {
+public:
+  Replayer(wgpu::Device device, wgpu::Queue queue) : m_device(device), m_queue(queue) {}
+  ~Replayer();
+
+  // Returns false on a malformed record
+  bool execute(CaptureCommand command, CaptureParser& payload);
+  // Submits the commands recorded since the last call and waits for them.
+  // Returns the GPU time in ms, from the submit to the end of the work.
+  double submitFrame();
+
+  DrawListStats drawStats() const { return m_drawStats; }
+
+private:
+  void createBuffer(CaptureParser& payload);
+  void writeBuffer(CaptureParser& payload);
+  void copyBuffer(CaptureParser& payload);
+  void createTexture(CaptureParser& payload);
+  void createTextureView(CaptureParser& payload);
+  void createRenderPipeline(CaptureParser& payload);
+  void renderPass(CaptureParser& payload);
+  // The swap chain image of the capture, of the last format and size asked for
+  wgpu::TextureView colorTarget(wgpu::TextureFormat format, uint32_t width, uint32_t height);
+  wgpu::CommandEncoder& encoder();
+
+  wgpu::Device m_device;
+  wgpu::Queue m_queue;
+  std::vector<wgpu::Buffer> m_buffers;
+  std::vector<wgpu::Texture> m_textures;
+  std::vector<wgpu::TextureView> m_views;
+  std::vector<wgpu::ShaderModule> m_modules;
+  std::vector<wgpu::PipelineLayout> m_layouts;
+  std::vector<wgpu::RenderPipeline> m_pipelines;
+  wgpu::Texture m_colorTexture = nullptr;
+  wgpu::TextureView m_colorView = nullptr;
+  wgpu::TextureFormat m_colorFormat = wgpu::TextureFormat::Undefined;
+  uint32_t m_colorWidth = 0;
+  uint32_t m_colorHeight = 0;
+  wgpu::CommandEncoder m_encoder = nullptr;
+  DrawList m_drawList;
+  DrawListStats m_drawStats;
+};
+
+Replayer::~Replayer() {
+  if (m_encoder) m_encoder.release();
+  for (wgpu::RenderPipeline& pipeline : m_pipelines) {
+    if (pipeline) pipeline.release();
+  }
+  for (wgpu::PipelineLayout& layout : m_layouts) {
+    if (layout) layout.release();
+  }
+  for (wgpu::ShaderModule& module : m_modules) {
+    if (module) module.release();
+  }
+  for (wgpu::TextureView& view : m_views) {
+    if (view) view.release();
+  }
+  for (wgpu::Texture& texture : m_textures) {
+    if (texture) {
+      texture.destroy();
+      texture.release();
+    }
+  }
+  for (wgpu::Buffer& buffer : m_buffers) {
+    if (buffer) {
+      buffer.destroy();
+      buffer.release();
+    }
+  }
+  if (m_colorView) m_colorView.release();
+  if (m_colorTexture) {
+    m_colorTexture.destroy();
+    m_colorTexture.release();
+  }
+}
+
+bool Replayer::execute(CaptureCommand command, CaptureParser& payload) {
+  switch (command) {
+  case CaptureCommand::CreateBuffer:
+    createBuffer(payload);
+    break;
+  case CaptureCommand::DestroyBuffer: {
+    wgpu::Buffer& buffer = slot(m_buffers, payload.getId());
+    if (buffer) {
+      buffer.destroy();
+      buffer.release();
+      buffer = nullptr;
+    }
+    break;
+  }
+  case CaptureCommand::WriteBuffer:
+    writeBuffer(payload);
+    break;
+  case CaptureCommand::CopyBuffer:
+    copyBuffer(payload);
+    break;
+  case CaptureCommand::CreateTexture:
+    createTexture(payload);
+    break;
+  case CaptureCommand::DestroyTexture: {
+    wgpu::Texture& texture = slot(m_textures, payload.getId());
+    if (texture) {
+      texture.destroy();
+      texture.release();
+      texture = nullptr;
+    }
+    break;
+  }
+  case CaptureCommand::CreateTextureView:
+    createTextureView(payload);
+    break;
+  case CaptureCommand::CreateShaderModule: {
+    const uint32_t id = payload.getId();
+    const std::string source(payload.getString());
+    if (payload.ok()) {
+      slot(m_modules, id) = createShaderModule(m_device, source);
+    }
+    break;
+  }
+  case CaptureCommand::CreatePipelineLayout: {
+    // The app binds no groups
+    wgpu::PipelineLayoutDescriptor layoutDesc = wgpu::Default;
+    layoutDesc.bindGroupLayoutCount = 0;
+    layoutDesc.bindGroupLayouts = nullptr;
+    slot(m_layouts, payload.getId()) = m_device.createPipelineLayout(layoutDesc);
+    break;
+  }
+  case CaptureCommand::CreateRenderPipeline:
+    createRenderPipeline(payload);
+    break;
+  case CaptureCommand::RenderPass:
+    renderPass(payload);
+    break;
+  case CaptureCommand::EndFrame:
+    // Handled by the caller, which times the frames
+    break;
+  default:
+    std::cerr << "Unknown capture command " << static_cast<int>(command) << std::endl;
+    return false;
+  }
+  return payload.ok();
+}
+
+double Replayer::submitFrame() {
+  wgpu::CommandBufferDescriptor cmdBufferDesc = wgpu::Default;
+  cmdBufferDesc.label = "Replayed frame";
+  wgpu::CommandBuffer command = encoder().finish(cmdBufferDesc);
+  m_encoder.release();
+  m_encoder = nullptr;
+
+  bool done = false;
+  const Clock::time_point start = Clock::now();
+  m_queue.submit(command);
+  command.release();
+  auto workDoneCallback = m_queue.onSubmittedWorkDone([&done](wgpu::QueueWorkDoneStatus) { done = true; });
+  while (!done) {
+    pollDevice(m_device, m_queue);
+  }
+  return elapsedMs(start, Clock::now());
+}
+
+void Replayer::createBuffer(CaptureParser& payload) {
+  const uint32_t id = payload.getId();
+  wgpu::BufferDescriptor bufferDesc;
+  bufferDesc.usage = payload.get<uint32_t>();
+  bufferDesc.size = payload.get<uint64_t>();
+  const std::string label(payload.getString());
+  bufferDesc.label = label.c_str();
+  bufferDesc.mappedAtCreation = false;
+  if (payload.ok()) {
+    slot(m_buffers, id) = m_device.createBuffer(bufferDesc);
+  }
+}
+
+void Replayer::writeBuffer(CaptureParser& payload) {
+  wgpu::Buffer buffer = slot(m_buffers, payload.getId());
+  const uint64_t offset = payload.get<uint64_t>();
+  uint64_t size = 0;
+  const uint8_t* data = payload.getBytes(size);
+  if (payload.ok() && buffer) {
+    m_queue.writeBuffer(buffer, offset, data, size);
+  }
+}
+
+void Replayer::copyBuffer(CaptureParser& payload) {
+  wgpu::Buffer source = slot(m_buffers, payload.getId());
+  const uint64_t sourceOffset = payload.get<uint64_t>();
+  wgpu::Buffer destination = slot(m_buffers, payload.getId());
+  const uint64_t destinationOffset = payload.get<uint64_t>();
+  const uint64_t size = payload.get<uint64_t>();
+  if (!payload.ok() || !source || !destination) {
+    return;
+  }
+  // Submitted at once like the app does, ahead of the frame being recorded
+  wgpu::CommandEncoderDescriptor encoderDesc = wgpu::Default;
+  encoderDesc.label = "Replayed copy";
+  wgpu::CommandEncoder copyEncoder = m_device.createCommandEncoder(encoderDesc);
+  copyEncoder.copyBufferToBuffer(source, sourceOffset, destination, destinationOffset, size);
+  wgpu::CommandBufferDescriptor cmdBufferDesc = wgpu::Default;
+  wgpu::CommandBuffer command = copyEncoder.finish(cmdBufferDesc);
+  copyEncoder.release();
+  m_queue.submit(command);
+  command.release();
+}
+
+void Replayer::createTexture(CaptureParser& payload) {
+  const uint32_t id = payload.getId();
+  wgpu::TextureDescriptor textureDesc;
+  textureDesc.usage = payload.get<uint32_t>();
+  textureDesc.dimension = static_cast<WGPUTextureDimension>(payload.get<uint32_t>());
+  textureDesc.size.width = payload.get<uint32_t>();
+  textureDesc.size.height = payload.get<uint32_t>();
+  textureDesc.size.depthOrArrayLayers = payload.get<uint32_t>();
+  textureDesc.format = static_cast<WGPUTextureFormat>(payload.get<uint32_t>());
+  textureDesc.mipLevelCount = payload.get<uint32_t>();
+  textureDesc.sampleCount = payload.get<uint32_t>();
+  const std::string label(payload.getString());
+  textureDesc.label = label.c_str();
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  if (payload.ok()) {
+    slot(m_textures, id) = m_device.createTexture(textureDesc);
+  }
+}
+
+void Replayer::createTextureView(CaptureParser& payload) {
+  const uint32_t id = payload.getId();
+  wgpu::Texture texture = slot(m_textures, payload.getId());
+  wgpu::TextureViewDescriptor viewDesc;
+  viewDesc.format = static_cast<WGPUTextureFormat>(payload.get<uint32_t>());
+  viewDesc.dimension = static_cast<WGPUTextureViewDimension>(payload.get<uint32_t>());
+  viewDesc.aspect = static_cast<WGPUTextureAspect>(payload.get<uint32_t>());
+  viewDesc.baseMipLevel = payload.get<uint32_t>();
+  viewDesc.mipLevelCount = payload.get<uint32_t>();
+  viewDesc.baseArrayLayer = payload.get<uint32_t>();
+  viewDesc.arrayLayerCount = payload.get<uint32_t>();
+  if (payload.ok() && texture) {
+    slot(m_views, id) = texture.createView(viewDesc);
+  }
+}
+
+void Replayer::createRenderPipeline(CaptureParser& payload) {
+  // Storage behind the pointers of the descriptor
+  struct Constants {
+    std::vector<std::string> keys;
+    std::vector<WGPUConstantEntry> entries;
+  };
+  auto getConstants = [&payload](Constants& constants) {
+    const uint32_t count = payload.get<uint32_t>();
+    for (uint32_t i = 0; i < count && payload.ok(); ++i) {
+      constants.keys.emplace_back(payload.getString());
+      WGPUConstantEntry entry = {};
+      entry.value = payload.get<double>();
+      constants.entries.push_back(entry);
+    }
+    for (size_t i = 0; i < constants.entries.size(); ++i) {
+      constants.entries[i].key = constants.keys[i].c_str();
+    }
+  };
+  auto getBlend = [&payload](wgpu::BlendComponent& component) {
+    component.operation = static_cast<WGPUBlendOperation>(payload.get<uint32_t>());
+    component.srcFactor = static_cast<WGPUBlendFactor>(payload.get<uint32_t>());
+    component.dstFactor = static_cast<WGPUBlendFactor>(payload.get<uint32_t>());
+  };
+  auto getStencilFace = [&payload](wgpu::StencilFaceState& face) {
+    face.compare = static_cast<WGPUCompareFunction>(payload.get<uint32_t>());
+    face.failOp = static_cast<WGPUStencilOperation>(payload.get<uint32_t>());
+    face.depthFailOp = static_cast<WGPUStencilOperation>(payload.get<uint32_t>());
+    face.passOp = static_cast<WGPUStencilOperation>(payload.get<uint32_t>());
+  };
+
+  const uint32_t id = payload.getId();
+  wgpu::RenderPipelineDescriptor pipelineDesc;
+  pipelineDesc.layout = slot(m_layouts, payload.getId());
+
+  pipelineDesc.vertex.module = slot(m_modules, payload.getId());
+  const std::string vertexEntryPoint(payload.getString());
+  pipelineDesc.vertex.entryPoint = vertexEntryPoint.c_str();
+  Constants vertexConstants;
+  getConstants(vertexConstants);
+  pipelineDesc.vertex.constantCount = vertexConstants.entries.size();
+  pipelineDesc.vertex.constants = vertexConstants.entries.data();
+  // Stride, step mode and attribute count
+  std::vector<wgpu::VertexBufferLayout> vertexBuffers(payload.getCount(16));
+  std::vector<std::vector<wgpu::VertexAttribute>> attributes(vertexBuffers.size());
+  for (size_t i = 0; i < vertexBuffers.size() && payload.ok(); ++i) {
+    vertexBuffers[i].arrayStride = payload.get<uint64_t>();
+    vertexBuffers[i].stepMode = static_cast<WGPUVertexStepMode>(payload.get<uint32_t>());
+    // Format, offset and shader location
+    attributes[i].resize(payload.getCount(16));
+    for (wgpu::VertexAttribute& attribute : attributes[i]) {
+      attribute.format = static_cast<WGPUVertexFormat>(payload.get<uint32_t>());
+      attribute.offset = payload.get<uint64_t>();
+      attribute.shaderLocation = payload.get<uint32_t>();
+    }
+    vertexBuffers[i].attributeCount = attributes[i].size();
+    vertexBuffers[i].attributes = attributes[i].data();
+  }
+  pipelineDesc.vertex.bufferCount = vertexBuffers.size();
+  pipelineDesc.vertex.buffers = vertexBuffers.data();
+
+  pipelineDesc.primitive.topology = static_cast<WGPUPrimitiveTopology>(payload.get<uint32_t>());
+  pipelineDesc.primitive.stripIndexFormat = static_cast<WGPUIndexFormat>(payload.get<uint32_t>());
+  pipelineDesc.primitive.frontFace = static_cast<WGPUFrontFace>(payload.get<uint32_t>());
+  pipelineDesc.primitive.cullMode = static_cast<WGPUCullMode>(payload.get<uint32_t>());
+
+  wgpu::DepthStencilState depthStencilState = wgpu::Default;
+  pipelineDesc.depthStencil = nullptr;
+  if (payload.get<uint8_t>()) {
+    depthStencilState.format = static_cast<WGPUTextureFormat>(payload.get<uint32_t>());
+    depthStencilState.depthWriteEnabled = payload.get<uint8_t>() != 0;
+    depthStencilState.depthCompare = static_cast<WGPUCompareFunction>(payload.get<uint32_t>());
+    getStencilFace(depthStencilState.stencilFront);
+    getStencilFace(depthStencilState.stencilBack);
+    depthStencilState.stencilReadMask = payload.get<uint32_t>();
+    depthStencilState.stencilWriteMask = payload.get<uint32_t>();
+    depthStencilState.depthBias = payload.get<int32_t>();
+    depthStencilState.depthBiasSlopeScale = payload.get<float>();
+    depthStencilState.depthBiasClamp = payload.get<float>();
+    pipelineDesc.depthStencil = &depthStencilState;
+  }
+
+  pipelineDesc.multisample.count = payload.get<uint32_t>();
+  pipelineDesc.multisample.mask = payload.get<uint32_t>();
+  pipelineDesc.multisample.alphaToCoverageEnabled = payload.get<uint8_t>() != 0;
+
+  wgpu::FragmentState fragmentState;
+  std::string fragmentEntryPoint;
+  Constants fragmentConstants;
+  std::vector<wgpu::ColorTargetState> targets;
+  std::vector<wgpu::BlendState> blends;
+  pipelineDesc.fragment = nullptr;
+  if (payload.get<uint8_t>()) {
+    fragmentState.module = slot(m_modules, payload.getId());
+    fragmentEntryPoint = payload.getString();
+    fragmentState.entryPoint = fragmentEntryPoint.c_str();
+    getConstants(fragmentConstants);
+    fragmentState.constantCount = fragmentConstants.entries.size();
+    fragmentState.constants = fragmentConstants.entries.data();
+    // Format, blend flag and write mask
+    targets.resize(payload.getCount(9));
+    // Sized up front, targets point into it
+    blends.resize(targets.size());
+    for (size_t i = 0; i < targets.size() && payload.ok(); ++i) {
+      targets[i].format = static_cast<WGPUTextureFormat>(payload.get<uint32_t>());
+      targets[i].blend = nullptr;
+      if (payload.get<uint8_t>()) {
+        getBlend(blends[i].color);
+        getBlend(blends[i].alpha);
+        targets[i].blend = &blends[i];
+      }
+      targets[i].writeMask = payload.get<uint32_t>();
+    }
+    fragmentState.targetCount = targets.size();
+    fragmentState.targets = targets.data();
+    pipelineDesc.fragment = &fragmentState;
+  }
+
+  if (payload.ok()) {
+    slot(m_pipelines, id) = m_device.createRenderPipeline(pipelineDesc);
+  }
+}
+
+void Replayer::renderPass(CaptureParser& payload) {
+  const wgpu::TextureFormat colorFormat = static_cast<WGPUTextureFormat>(payload.get<uint32_t>());
+  const uint32_t width = payload.get<uint32_t>();
+  const uint32_t height = payload.get<uint32_t>();
+  wgpu::RenderPassColorAttachment colorAttachment = wgpu::Default;
+  colorAttachment.resolveTarget = nullptr;
+  colorAttachment.loadOp = static_cast<WGPULoadOp>(payload.get<uint32_t>());
+  colorAttachment.storeOp = static_cast<WGPUStoreOp>(payload.get<uint32_t>());
+  colorAttachment.clearValue.r = payload.get<double>();
+  colorAttachment.clearValue.g = payload.get<double>();
+  colorAttachment.clearValue.b = payload.get<double>();
+  colorAttachment.clearValue.a = payload.get<double>();
+
+  wgpu::RenderPassDepthStencilAttachment depthStencilAttachment = wgpu::Default;
+  const uint32_t depthViewId = payload.getId();
+  if (depthViewId != 0) {
+    depthStencilAttachment.view = slot(m_views, depthViewId);
+    depthStencilAttachment.depthLoadOp = static_cast<WGPULoadOp>(payload.get<uint32_t>());
+    depthStencilAttachment.depthStoreOp = static_cast<WGPUStoreOp>(payload.get<uint32_t>());
+    depthStencilAttachment.depthClearValue = payload.get<float>();
+    depthStencilAttachment.depthReadOnly = payload.get<uint8_t>() != 0;
+    depthStencilAttachment.stencilLoadOp = static_cast<WGPULoadOp>(payload.get<uint32_t>());
+    depthStencilAttachment.stencilStoreOp = static_cast<WGPUStoreOp>(payload.get<uint32_t>());
+    depthStencilAttachment.stencilClearValue = payload.get<uint32_t>();
+    depthStencilAttachment.stencilReadOnly = payload.get<uint8_t>() != 0;
+  }
+
+  // Keys in capture order, which is already the sorted order
+  m_drawList.clear();
+  const uint32_t drawCount = payload.get<uint32_t>();
+  for (uint32_t i = 0; i < drawCount && payload.ok(); ++i) {
+    DrawCommand draw;
+    draw.sortKey = i;
+    draw.pipeline = slot(m_pipelines, payload.getId());
+    draw.vertexBuffer = slot(m_buffers, payload.getId());
+    draw.vertexBufferSize = payload.get<uint64_t>();
+    draw.instanceBuffer = slot(m_buffers, payload.getId());
+    draw.instanceBufferSize = payload.get<uint64_t>();
+    draw.indexBuffer = slot(m_buffers, payload.getId());
+    draw.indexBufferSize = payload.get<uint64_t>();
+    draw.indexFormat = static_cast<WGPUIndexFormat>(payload.get<uint32_t>());
+    draw.indexCount = payload.get<uint32_t>();
+    draw.firstIndex = payload.get<uint32_t>();
+    draw.baseVertex = payload.get<int32_t>();
+    draw.instanceCount = payload.get<uint32_t>();
+    draw.firstInstance = payload.get<uint32_t>();
+    // Draws of objects that failed to replay are dropped rather than failing the pass
+    if (draw.pipeline && draw.vertexBuffer && draw.indexBuffer) {
+      m_drawList.add(draw);
+    }
+  }
+  if (!payload.ok()) {
+    return;
+  }
+  m_drawList.sort();
+
+  colorAttachment.view = colorTarget(colorFormat, width, height);
+  wgpu::RenderPassDescriptor renderPassDesc = wgpu::Default;
+  renderPassDesc.colorAttachmentCount = 1;
+  renderPassDesc.colorAttachments = &colorAttachment;
+  renderPassDesc.depthStencilAttachment = depthStencilAttachment.view ? &depthStencilAttachment : nullptr;
+  renderPassDesc.timestampWriteCount = 0;
+  renderPassDesc.timestampWrites = nullptr;
+  wgpu::RenderPassEncoder pass = encoder().beginRenderPass(renderPassDesc);
+  m_drawStats += m_drawList.encode(pass);
+  pass.end();
+  pass.release();
+}
+
+wgpu::TextureView Replayer::colorTarget(wgpu::TextureFormat format, uint32_t width, uint32_t height) {
+  if (m_colorView && format == m_colorFormat && width == m_colorWidth && height == m_colorHeight) {
+    return m_colorView;
+  }
+  if (m_colorView) {
+    m_colorView.release();
+    m_colorTexture.destroy();
+    m_colorTexture.release();
+  }
+  wgpu::TextureDescriptor textureDesc;
+  textureDesc.label = "Replayed swap chain image";
+  textureDesc.dimension = wgpu::TextureDimension::_2D;
+  textureDesc.format = format;
+  textureDesc.size = { width, height, 1 };
+  textureDesc.mipLevelCount = 1;
+  textureDesc.sampleCount = 1;
+  textureDesc.usage = wgpu::TextureUsage::RenderAttachment;
+  textureDesc.viewFormatCount = 0;
+  textureDesc.viewFormats = nullptr;
+  m_colorTexture = m_device.createTexture(textureDesc);
+  m_colorView = m_colorTexture.createView();
+  m_colorFormat = format;
+  m_colorWidth = width;
+  m_colorHeight = height;
+  return m_colorView;
+}
+
+wgpu::CommandEncoder& Replayer::encoder() {
+  if (!m_encoder) {
+    wgpu::CommandEncoderDescriptor encoderDesc = wgpu::Default;
+    encoderDesc.label = "Replay encoder";
+    m_encoder = m_device.createCommandEncoder(encoderDesc);
+  }
+  return m_encoder;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bool fallbackAdapter = false;
+  bool quiet = false;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--help") == 0) {
+      printUsage(argv[0]);
+      return 0;
+    } else if (std::strcmp(argv[i], "--fallback-adapter") == 0) {
+      fallbackAdapter = true;
+    } else if (std::strcmp(argv[i], "--quiet") == 0) {
+      quiet = true;
+    } else if (!path) {
+      path = argv[i];
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (!path) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  CaptureReader reader;
+  if (!reader.open(path)) {
+    return 1;
+  }
+
+  // No surface, the swap chain image is replaced with a texture
+  wgpu::Instance instance = wgpu::createInstance(wgpu::InstanceDescriptor{});
+  if (!instance) {
+    std::cerr << "Could not initialize WebGPU!" << std::endl;
+    return 1;
+  }
+  wgpu::RequestAdapterOptions adapterOpts = wgpu::Default;
+  adapterOpts.compatibleSurface = nullptr;
+  adapterOpts.forceFallbackAdapter = fallbackAdapter;
+  wgpu::Adapter adapter = instance.requestAdapter(adapterOpts);
+  if (!adapter) {
+    std::cerr << "Could not get a WebGPU adapter" << std::endl;
+    return 1;
+  }
+  // Whatever the captured app asked for is within what the adapter supports
+  wgpu::SupportedLimits supportedLimits;
+  adapter.getLimits(&supportedLimits);
+  wgpu::RequiredLimits requiredLimits = wgpu::Default;
+  requiredLimits.limits = supportedLimits.limits;
+  wgpu::DeviceDescriptor deviceDesc = wgpu::Default;
+  deviceDesc.label = "Replay device";
+  deviceDesc.defaultQueue.label = "Replay queue";
+  deviceDesc.requiredLimits = &requiredLimits;
+  wgpu::Device device = adapter.requestDevice(deviceDesc);
+  if (!device) {
+    std::cerr << "Could not get a WebGPU device" << std::endl;
+    return 1;
+  }
+  auto deviceErrorCallback = device.setUncapturedErrorCallback([](wgpu::ErrorType, char const* message) {
+    std::cerr << "Replay device error: " << (message ? message : "no message") << std::endl;
+  });
+  wgpu::Queue queue = device.getQueue();
+
+  FrameTimer cpuTimes;
+  FrameTimer gpuTimes;
+  FrameTimer capturedTimes;
+  bool malformed = false;
+  {
+    Replayer replayer(device, queue);
+    CaptureCommand command;
+    CaptureParser payload;
+    Clock::time_point frameStart = Clock::now();
+    while (reader.next(command, payload)) {
+      if (command != CaptureCommand::EndFrame) {
+        if (!replayer.execute(command, payload)) {
+          malformed = true;
+          break;
+        }
+        continue;
+      }
+      const uint64_t frame = payload.get<uint64_t>();
+      const double capturedMs = payload.get<double>();
+      // CPU time covers re-creating objects, uploads and encoding, up to the submit
+      const double cpuMs = elapsedMs(frameStart, Clock::now());
+      const double gpuMs = replayer.submitFrame();
+      cpuTimes.record(cpuMs);
+      gpuTimes.record(gpuMs);
+      capturedTimes.record(capturedMs);
+      if (!quiet) {
+        std::cout << std::fixed << std::setprecision(3) << "Frame " << frame << ": CPU " << cpuMs << " ms, GPU "
+                  << gpuMs << " ms (captured " << capturedMs << " ms)" << std::defaultfloat << std::endl;
+      }
+      frameStart = Clock::now();
+    }
+
+    const DrawListStats drawStats = replayer.drawStats();
+    std::cout << "Replayed " << cpuTimes.frameCount() << " frames, " << drawStats.draws << " draws, "
+              << drawStats.redundantChangesSkipped << " redundant changes skipped" << std::endl;
+  }
+  if (reader.failed() || malformed) {
+    std::cerr << "Capture is truncated or malformed, stopped after " << cpuTimes.frameCount() << " frames" << std::endl;
+  }
+  if (cpuTimes.frameCount() > 0) {
+    printLatencyStats("Replay CPU", cpuTimes.stats());
+    printLatencyStats("Replay GPU", gpuTimes.stats());
+    printFrameTimeStats("Captured frame time", capturedTimes.stats());
+  }
+
+  queue.release();
+  device.release();
+  adapter.release();
+  instance.release();
+  return reader.failed() || malformed ? 1 : 0;
+}
@@ -0,0 +1,199 @@
+// Test producer for the shared memory geometry feed (see src/shm_feed.h):
+// publishes an animated grid, or measures the throughput of the ring
+#include "shm_feed.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+volatile std::sig_atomic_t g_interrupted = 0;
+
+void printUsage(const char* program) {
+  std::cout << "Usage: " << program << " [options]\n"
+            << "  --name <name>      Feed name (default /webgpu-thingy-feed)\n"
+            << "  --vertices <n>     Vertices per batch, at most 65536 (default 16384)\n"
+            << "  --rate <hz>        Batches per second, 0 for as fast as possible (default 60)\n"
+            << "  --seconds <s>      Run time, 0 until interrupted (default 0, 5 with --bench)\n"
+            << "  --slots <n>        Slots in the ring (default 4)\n"
+            << "  --timeout <ms>     Wait for a free slot before dropping a batch (default 0, 100 with --rate 0)\n"
+            << "  --bench            Feed a consumer process as fast as possible and report throughput\n"
+            << "  --help             Show this message" << std::endl;
+}
+
+// Grid of the size of webgpu.txt, which the renderer centers, with a
+// traveling wave and a color cycle
+void writeGrid(uint32_t side, double time, ShmBatch& batch) {
+  const float width = 1.375f;
+  const float height = 0.926f;
+  for (uint32_t y = 0; y < side; ++y) {
+    for (uint32_t x = 0; x < side; ++x) {
+      float u = static_cast<float>(x) / static_cast<float>(side - 1);
+      float v = static_cast<float>(y) / static_cast<float>(side - 1);
+      ShmVertex& vertex = batch.vertices[y * side + x];
+      vertex.position[0] = u * width;
+      vertex.position[1] = v * height + 0.05f * std::sin(6.0f * u + 3.0f * static_cast<float>(time));
+      vertex.color[0] = 0.5f + 0.5f * std::sin(static_cast<float>(time) + 4.0f * u);
+      vertex.color[1] = 0.5f + 0.5f * std::sin(static_cast<float>(time) + 4.0f * v + 2.0f);
+      vertex.color[2] = 0.5f + 0.5f * std::sin(static_cast<float>(time) + 4.0f);
+    }
+  }
+  uint16_t* index = batch.indices;
+  for (uint32_t y = 0; y + 1 < side; ++y) {
+    for (uint32_t x = 0; x + 1 < side; ++x) {
+      uint16_t corner = static_cast<uint16_t>(y * side + x);
+      uint16_t right = static_cast<uint16_t>(corner + 1);
+      uint16_t up = static_cast<uint16_t>(corner + side);
+      uint16_t diagonal = static_cast<uint16_t>(up + 1);
+      *index++ = corner;
+      *index++ = right;
+      *index++ = diagonal;
+      *index++ = corner;
+      *index++ = diagonal;
+      *index++ = up;
+    }
+  }
+}
+
+// Reads every batch in place, as the renderer's upload would
+int runConsumer(const std::string& name) {
+  ShmFeedConsumer consumer;
+  if (!consumer.open(name)) {
+    return 1;
+  }
+  auto start = Clock::now();
+  double checksum = 0.0;
+  while (true) {
+    ShmBatch batch;
+    if (consumer.acquireNext(batch)) {
+      const float* values = &batch.vertices[0].position[0];
+      for (size_t i = 0; i < batch.vertexCount * sizeof(ShmVertex) / sizeof(float); ++i) {
+        checksum += values[i];
+      }
+      for (uint32_t i = 0; i < batch.indexCount; ++i) {
+        checksum += batch.indices[i];
+      }
+      consumer.release();
+    } else if (!consumer.producerAttached()) {
+      break;
+    } else {
+      consumer.waitForBatch(100);
+    }
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  std::cout << "Consumer (checksum " << checksum << "): ";
+  printShmFeedStats(consumer.stats(), seconds);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  std::string name = "/webgpu-thingy-feed";
+  uint32_t vertexCount = 16384;
+  double rate = 60.0;
+  double seconds = -1.0;
+  uint32_t slotCount = 4;
+  int timeoutMs = -1;
+  bool bench = false;
+  for (int i = 1; i < argc; ++i) {
+    auto is = [&](const char* option) { return std::strcmp(argv[i], option) == 0; };
+    bool hasValue = i + 1 < argc;
+    if (is("--help")) {
+      printUsage(argv[0]);
+      return 0;
+    } else if (is("--name") && hasValue) {
+      name = argv[++i];
+    } else if (is("--vertices") && hasValue) {
+      vertexCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (is("--rate") && hasValue) {
+      rate = std::strtod(argv[++i], nullptr);
+    } else if (is("--seconds") && hasValue) {
+      seconds = std::strtod(argv[++i], nullptr);
+    } else if (is("--slots") && hasValue) {
+      slotCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (is("--timeout") && hasValue) {
+      timeoutMs = std::atoi(argv[++i]);
+    } else if (is("--bench")) {
+      bench = true;
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  uint32_t side = static_cast<uint32_t>(std::sqrt(static_cast<double>(std::min<uint32_t>(vertexCount, 65536))));
+  if (side < 2 || slotCount == 0) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  vertexCount = side * side;
+  uint32_t indexCount = 6 * (side - 1) * (side - 1);
+  if (bench) {
+    rate = 0.0;
+    timeoutMs = 1000;  // Every batch reaches the consumer
+    seconds = seconds < 0.0 ? 5.0 : seconds;
+  }
+  seconds = std::max(seconds, 0.0);
+  if (timeoutMs < 0) {
+    // Unpaced, a full ring would otherwise count a drop per spin
+    timeoutMs = rate > 0.0 ? 0 : 100;
+  }
+
+  ShmFeedProducer producer;
+  if (!producer.create(name, slotCount, static_cast<uint32_t>(shmBatchSize(vertexCount, indexCount)))) {
+    return 1;
+  }
+  std::cout << "Feeding " << name << ": " << vertexCount << " vertices and " << indexCount << " indices per batch ("
+            << shmBatchSize(vertexCount, indexCount) << " bytes), " << slotCount << " slots" << std::endl;
+
+  pid_t consumer = -1;
+  if (bench) {
+    std::cout.flush();
+    consumer = fork();
+    if (consumer == 0) {
+      std::_Exit(runConsumer(name));
+    }
+  }
+  std::signal(SIGINT, [](int) { g_interrupted = 1; });
+
+  auto start = Clock::now();
+  auto nextBatch = start;
+  uint64_t published = 0;
+  while (!g_interrupted) {
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    if (seconds > 0.0 && elapsed >= seconds) {
+      break;
+    }
+    ShmBatch batch;
+    if (producer.reserve(vertexCount, indexCount, timeoutMs, batch)) {
+      writeGrid(side, elapsed, batch);
+      producer.commit();
+      ++published;
+    }
+    if (rate > 0.0) {
+      nextBatch += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+      std::this_thread::sleep_until(nextBatch);
+    }
+  }
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  uint64_t dropped = producer.header().producerDropped.load();
+  double megabytes = static_cast<double>(published * shmBatchSize(vertexCount, indexCount)) / (1024.0 * 1024.0);
+  std::cout << "Producer: " << published << " batches in " << elapsed << " s (" << static_cast<double>(published) / elapsed
+            << " per second, " << megabytes / elapsed << " MB/s), " << dropped << " dropped" << std::endl;
+  producer.close();
+
+  if (consumer > 0) {
+    int status = 0;
+    waitpid(consumer, &status, 0);
+  }
+  return 0;
+}